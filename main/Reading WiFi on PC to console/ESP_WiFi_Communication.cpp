@@ -6,6 +6,10 @@
  */
 
 #include <Arduino.h>
+#include <stdarg.h>
+#include "sample_batch.h"
+#include "outage_buffer.h"
+#include "at_matcher.h"
 
 // Configuration structure for better organization
 struct NetworkConfig {
@@ -41,12 +45,107 @@ enum TimeoutValues {
 
 // Buffer sizes with safety margins
 enum BufferSizes {
-  MAX_RESPONSE_LENGTH = 512,
   MAX_CMD_LENGTH = 128,
   MAX_PAYLOAD_LENGTH = 384,
-  SAFETY_MARGIN = 32
+  MAX_HEADER_LENGTH = 192,              // HTTP request line and headers of a batch upload
+  BATCH_BUFFER_LENGTH = MAX_PAYLOAD_LENGTH, // Batch body; may be raised up to 2048 (AT+CIPSEND limit)
+  AT_QUEUE_LENGTH = 4,                  // AT commands waiting: an upload queues up to four
+  AT_POLL_BYTES = 16                    // Module output handled per loop(), well above the UART's 11.5 bytes/ms
 };
 
+// Upload format: UPLOAD_SINGLE sends every sample as its own GET request;
+// UPLOAD_CSV and UPLOAD_BINARY collect samples in a batch (see sample_batch.h)
+// and POST it to /log once BATCH_SAMPLES are waiting or the oldest is
+// BATCH_MAX_AGE old, whichever comes first (batch_receiver decodes both)
+#define UPLOAD_SINGLE 0
+#define UPLOAD_CSV 1
+#define UPLOAD_BINARY 2
+#define UPLOAD_FORMAT UPLOAD_BINARY
+
+// Session mode: 1 opens the TCP connection once and sends every sample over it
+// with HTTP keep-alive, reconnecting only when the module reports the link
+// closed (tens of ms per sample); 0 connects, sends and closes for every sample
+// (seconds per sample).
+#define HTTP_KEEP_ALIVE 1
+
+// Debug echo: 1 copies the commands sent and the module's output to the serial
+// monitor (like every message, only as far as it fits, see logText())
+#define AT_ECHO 0
+
+// Outage storage for the batch formats: 1 moves samples to EEPROM when the
+// RAM buffer fills up during an outage (see OUTAGE_BUFFER_SAMPLES), and
+// before the board restarts because the link cannot be recovered. With 0 the
+// samples are only in RAM, so the board does not restart while any are
+// waiting; it keeps retrying the WiFi setup instead.
+#define OUTAGE_EEPROM 0
+
+#if UPLOAD_FORMAT != UPLOAD_SINGLE
+const unsigned long SAMPLE_INTERVAL = 250;  // Sampling is independent of the uploads
+const unsigned long BATCH_MAX_AGE = 10000;  // Send a partial batch once its oldest sample is 10 s old
+#if UPLOAD_FORMAT == UPLOAD_CSV
+const uint8_t BATCH_SAMPLES = 12;           // Worst-case CSV lines are 27 bytes
+typedef SampleBatch<BATCH_SAMPLES> UploadBatch;
+static_assert(UploadBatch::CSV_SIZE <= BATCH_BUFFER_LENGTH, "Raise BATCH_BUFFER_LENGTH or lower BATCH_SAMPLES");
+#else
+const uint8_t BATCH_SAMPLES = 32;           // 8 bytes each
+typedef SampleBatch<BATCH_SAMPLES> UploadBatch;
+static_assert(UploadBatch::BINARY_SIZE <= BATCH_BUFFER_LENGTH, "Raise BATCH_BUFFER_LENGTH or lower BATCH_SAMPLES");
+#endif
+UploadBatch batch;
+
+// Store and forward: samples stay in RAM until the server has taken them, so
+// an outage of up to OUTAGE_BUFFER_SAMPLES * SAMPLE_INTERVAL (48 s) loses
+// nothing; the backlog then goes out in full batches while sampling goes on.
+// With OUTAGE_EEPROM set, the oldest samples move to EEPROM once RAM is full,
+// adding OUTAGE_EEPROM_SLOTS more (50 s) that also survive the restart when
+// the link cannot be recovered. EEPROM is only written during such outages.
+// Without it an outage longer than the RAM buffer overwrites the oldest
+// samples, but none are lost to a restart: the board does not restart while
+// samples are waiting.
+const uint16_t OUTAGE_BUFFER_SAMPLES = 192; // 14 bytes each
+SampleRing<OUTAGE_BUFFER_SAMPLES> sampleBuffer;
+uint32_t nextSeq = 0;                       // Number of the next sample, from 0 after a reset
+
+#if OUTAGE_EEPROM
+#include <EEPROM.h>
+
+const uint16_t OUTAGE_EEPROM_SLOTS = 200;   // 20 bytes each
+const size_t OUTAGE_EEPROM_BASE = 0;        // First EEPROM address used
+
+// The board's EEPROM for SampleLog
+struct EepromStorage {
+  uint8_t read(size_t address) {
+    return EEPROM.read(address);
+  }
+  void write(size_t address, uint8_t value) {
+    EEPROM.update(address, value); // Skips bytes that do not change
+  }
+  bool ready() {
+#ifdef __AVR__
+    return eeprom_is_ready(); // A write would otherwise wait for the previous one
+#else
+    return true;
+#endif
+  }
+};
+
+typedef SampleLog<OUTAGE_EEPROM_SLOTS, EepromStorage> OutageLog;
+#ifdef E2END
+static_assert(OUTAGE_EEPROM_BASE + OutageLog::SIZE <= E2END + 1, "Lower OUTAGE_EEPROM_SLOTS");
+#endif
+EepromStorage eepromStorage;
+OutageLog sampleLog(eepromStorage, OUTAGE_EEPROM_BASE);
+#endif
+#elif HTTP_KEEP_ALIVE
+const unsigned long SAMPLE_INTERVAL = 1000; // 1 second
+#else
+const unsigned long SAMPLE_INTERVAL = 5000; // 5 seconds
+#endif
+
+// Whether the module holds an open TCP connection to the server; cleared when
+// it reports "CLOSED" or refuses a send
+bool tcpConnected = false;
+
 // Connection status enum
 enum ConnectionStatus {
   STATUS_IDLE = 0,
@@ -55,261 +154,904 @@ enum ConnectionStatus {
   STATUS_DISCONNECTED = 5
 };
 
+// ---------------------------------------------------------------------------
+// Messages on the serial monitor
+//
+// Serial.print() waits while the transmit buffer (64 bytes on AVR) is full,
+// for as long as the monitor takes to drain it, so a burst of messages would
+// stall loop(). Messages are only written as far as the buffer takes them; the
+// rest is dropped.
+// ---------------------------------------------------------------------------
+
+/**
+ * Write text to the serial monitor without waiting
+ * @param text Text to write; what does not fit in the transmit buffer is dropped
+ */
+void logText(const char* text) {
+  size_t length = strlen(text);
+  size_t room = Serial.availableForWrite();
+  Serial.write(reinterpret_cast<const uint8_t*>(text), length < room ? length : room);
+}
+
+/**
+ * Write a line to the serial monitor without waiting; the line break is kept
+ * when the text is cut short
+ * @param text Line without its line break
+ */
+void logLine(const char* text) {
+  size_t room = Serial.availableForWrite();
+  if (room < 2) {
+    return;
+  }
+  size_t length = strlen(text);
+  Serial.write(reinterpret_cast<const uint8_t*>(text), length < room - 2 ? length : room - 2);
+  Serial.write(reinterpret_cast<const uint8_t*>("\r\n"), 2);
+}
+
+/**
+ * Format a line (printf style) and write it as logLine() does
+ */
+void logLinef(const char* format, ...) {
+  char line[64]; // No more fits in the transmit buffer
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  logLine(line);
+}
+
+// Every response the sketch looks for, matched in one pass as module output
+// arrives (see at_matcher.h); patterns are added by atBegin() and atSend()
+ATMatcher atMatcher;
+uint16_t closedMask = 0;       // "CLOSED": the TCP connection ended
+uint16_t errorMask = 0;        // Responses that fail the command in progress
+uint16_t statusMask = 0;       // HTTP_STATUS_LINE: the server's answer, its status code follows
+
+// Start of the status line the server answers with (in an "+IPD" from the
+// module); a command expecting a status (or class of them) fails on any other
+const char HTTP_STATUS_LINE[] = "HTTP/1.1 ";
+const char HTTP_SUCCESS[] = "HTTP/1.1 2"; // Any 2xx: the server has taken the request
+
 /**
- * Send AT command and wait for expected response
- * @param cmd AT command to send
+ * Register the responses watched regardless of the command in progress
+ */
+void atBegin() {
+  closedMask = atMatcher.add("CLOSED");
+  errorMask = atMatcher.add("ERROR") | atMatcher.add("FAIL") | atMatcher.add("busy");
+  statusMask = atMatcher.add(HTTP_STATUS_LINE);
+}
+
+/**
+ * Feed one byte of module output to the matcher and watch for the unsolicited
+ * "CLOSED" that ends the TCP connection
+ * @param c Next character received from the module
+ * @return Patterns ending at this byte
+ */
+uint16_t watchLink(char c) {
+  uint16_t matches = atMatcher.feed(c);
+  if (matches & closedMask) {
+    if (tcpConnected) {
+      logLine("[TCP] Server closed the connection");
+    }
+    tcpConnected = false;
+  }
+  return matches;
+}
+
+// ---------------------------------------------------------------------------
+// Asynchronous AT engine
+//
+// Commands wait in a small queue and are written to the module a piece at a
+// time, only as much as the UART transmit buffer takes; atPoll() (called from
+// every loop()) reads what the module answered so far, completes the command
+// at the head once its expected response arrives, an error arrives or its
+// deadline passes, and starts the next one. Nothing here waits, so loop()
+// keeps sampling while the module takes seconds to join a network.
+// ---------------------------------------------------------------------------
+
+/**
+ * Completion callback of an AT command
+ * @param ok true if the expected response arrived in time
+ */
+typedef void (*ATCallback)(bool ok);
+
+struct ATCommand {
+  char text[MAX_CMD_LENGTH];   // Command line, sent with "\r\n"
+  const uint8_t* data;         // Raw bytes sent instead of text (after a ">" prompt), nullptr for a command
+  int dataLength;
+  const char* expected;        // Response that completes the command; nullptr: complete once written
+  uint16_t expectedMask;       // Its bit in atMatcher
+  uint8_t statusDigits;        // Status code digits in expected, an HTTP status line: any other status fails
+                               // the command; 0 for other responses
+  unsigned long timeout;       // Deadline, counted from when the first byte is written
+  ATCallback done;             // Called once with the outcome, may be nullptr
+};
+
+enum ATState {
+  AT_IDLE,      // Nothing in progress; module output is only watched for "CLOSED"
+  AT_WRITING,   // Writing the head command
+  AT_WAITING    // Head command written, waiting for its response
+};
+
+ATCommand atQueue[AT_QUEUE_LENGTH];
+uint8_t atHead = 0;
+uint8_t atCount = 0;
+ATState atState = AT_IDLE;
+int atWritten = 0;             // Bytes of the head command written so far
+unsigned long atStarted = 0;   // millis() when its first byte was written
+uint8_t atStatusLeft = 0;      // Digits of a status code still to come after HTTP_STATUS_LINE
+
+/**
+ * @return true while a command is queued or in progress
+ */
+bool atBusy() {
+  return atCount > 0;
+}
+
+/**
+ * Copy AT traffic to the serial monitor when AT_ECHO is set (see logText())
+ * @param text Text to write
+ */
+void atEcho(const char* text) {
+#if AT_ECHO
+  logText(text);
+#else
+  (void)text;
+#endif
+}
+
+/**
+ * @return Digits of the status code in response if it is a server status line
+ *         (HTTP_STATUS_LINE and all or the start of a code), otherwise 0
+ */
+uint8_t statusDigits(const char* response) {
+  const size_t lineLength = sizeof(HTTP_STATUS_LINE) - 1;
+  if (response == nullptr || strncmp(response, HTTP_STATUS_LINE, lineLength) != 0) {
+    return 0;
+  }
+  return strlen(response) - lineLength;
+}
+
+/**
+ * Queue an AT command
+ * @param cmd AT command to send (copied)
  * @param expectedResponse Expected response string
  * @param timeout Timeout in milliseconds
- * @return true if expected response received, false otherwise
+ * @param done Completion callback, may be nullptr
+ * @return false if the queue is full or the command invalid; done is not called then
  */
-bool sendATCommand(const char* cmd, const char* expectedResponse = "OK", 
-                  unsigned long timeout = AT_TIMEOUT) {
+bool atSend(const char* cmd, const char* expectedResponse, unsigned long timeout, ATCallback done) {
   // Validate input parameters
-  if (cmd == nullptr || strlen(cmd) == 0) {
-    Serial.println("[AT] Error: Invalid command");
+  if (cmd == nullptr || strlen(cmd) == 0 || strlen(cmd) >= MAX_CMD_LENGTH) {
+    logLine("[AT] Error: Invalid command");
+    return false;
+  }
+  if (atCount == AT_QUEUE_LENGTH) {
+    logLine("[AT] Error: Command queue full");
+    return false;
+  }
+  uint16_t expectedMask = expectedResponse != nullptr ? atMatcher.add(expectedResponse) : 0;
+  if (expectedResponse != nullptr && expectedMask == 0) {
+    logLine("[AT] Error: Too many expected responses");
     return false;
   }
-
-  Serial.print("[AT] Sending: ");
-  Serial.println(cmd);
   
-  // Clear serial buffer safely
-  Serial1.flush();
-  while (Serial1.available() > 0) {
-    Serial1.read();
+  ATCommand& command = atQueue[(atHead + atCount) % AT_QUEUE_LENGTH];
+  strcpy(command.text, cmd);
+  command.data = nullptr;
+  command.dataLength = 0;
+  command.expected = expectedResponse;
+  command.expectedMask = expectedMask;
+  command.statusDigits = statusDigits(expectedResponse);
+  command.timeout = timeout;
+  command.done = done;
+  atCount++;
+  return true;
+}
+
+/**
+ * Queue raw bytes for the module to pass on (the data of AT+CIPSEND)
+ * @param data Bytes to send; must stay valid until the command completes
+ * @param dataLength Length of data
+ * @param expectedResponse Expected response string, nullptr to complete once written
+ * @param timeout Timeout in milliseconds
+ * @param done Completion callback, may be nullptr
+ * @return false if the queue is full; done is not called then
+ */
+bool atSendData(const uint8_t* data, int dataLength, const char* expectedResponse, unsigned long timeout,
+                ATCallback done) {
+  if (atCount == AT_QUEUE_LENGTH) {
+    logLine("[AT] Error: Command queue full");
+    return false;
+  }
+  uint16_t expectedMask = expectedResponse != nullptr ? atMatcher.add(expectedResponse) : 0;
+  if (expectedResponse != nullptr && expectedMask == 0) {
+    logLine("[AT] Error: Too many expected responses");
+    return false;
   }
   
-  // Send command
-  Serial1.println(cmd);
+  ATCommand& command = atQueue[(atHead + atCount) % AT_QUEUE_LENGTH];
+  command.text[0] = '\0';
+  command.data = data;
+  command.dataLength = dataLength;
+  command.expected = expectedResponse;
+  command.expectedMask = expectedMask;
+  command.statusDigits = statusDigits(expectedResponse);
+  command.timeout = timeout;
+  command.done = done;
+  atCount++;
+  return true;
+}
+
+/**
+ * Complete the head command. A failed command also fails every command queued
+ * behind it (the data of a refused AT+CIPSEND must not be sent); their
+ * callbacks run after its own.
+ * @param ok Outcome
+ */
+void atFinish(bool ok) {
+  ATCallback callbacks[AT_QUEUE_LENGTH];
+  uint8_t finished = ok ? 1 : atCount;
+  for (uint8_t i = 0; i < finished; i++) {
+    callbacks[i] = atQueue[atHead].done;
+    atHead = (atHead + 1) % AT_QUEUE_LENGTH;
+    atCount--;
+  }
+  atState = AT_IDLE;
   
-  unsigned long startTime = millis();
-  String response;
-  response.reserve(MAX_RESPONSE_LENGTH); // Pre-allocate memory
-  bool responseComplete = false;
-  bool errorDetected = false;
+  // Callbacks may queue the next commands
+  for (uint8_t i = 0; i < finished; i++) {
+    if (callbacks[i] != nullptr) {
+      callbacks[i](ok);
+    }
+  }
+}
+
+/**
+ * Write as much of the head command as the UART takes without waiting
+ */
+void atWrite() {
+  const ATCommand& command = atQueue[atHead];
+  int length = command.data != nullptr ? command.dataLength : (int)strlen(command.text) + 2;
+  int room = Serial1.availableForWrite();
   
-  while (millis() - startTime < timeout && !responseComplete && !errorDetected) {
-    while (Serial1.available() > 0) {
-      char c = Serial1.read();
-      response += c;
-      
-      // Echo to serial monitor for debugging
-      if (c != '\r' && c != '\n') {
-        Serial.write(c);
-      }
-      
-      // Prevent buffer overflow with safety margin
-      if (response.length() > (MAX_RESPONSE_LENGTH - SAFETY_MARGIN)) {
-        response.remove(0, response.length() - (MAX_RESPONSE_LENGTH - SAFETY_MARGIN));
-        Serial.println("[AT] Warning: Response buffer truncated");
-      }
-      
-      // Check for expected response
-      if (expectedResponse != nullptr && response.indexOf(expectedResponse) != -1) {
-        responseComplete = true;
-        break;
-      }
-      
-      // Check for error responses
-      if (response.indexOf("ERROR") != -1 || 
-          response.indexOf("FAIL") != -1 ||
-          response.indexOf("busy") != -1) {
-        errorDetected = true;
-        break;
+  while (room > 0 && atWritten < length) {
+    int chunk = min(room, length - atWritten);
+    if (command.data != nullptr) {
+      Serial1.write(command.data + atWritten, chunk);
+    } else {
+      int textLength = length - 2;
+      for (int i = 0; i < chunk; i++) {
+        int at = atWritten + i;
+        Serial1.write(at < textLength ? command.text[at] : (at == textLength ? '\r' : '\n'));
       }
     }
-    
-    // Small delay to prevent busy waiting
-    delay(10);
+    atWritten += chunk;
+    room -= chunk;
   }
   
-  if (errorDetected) {
-    Serial.println("[AT] Command failed");
-    return false;
+  if (atWritten == length) {
+    if (command.expected == nullptr) {
+      atFinish(true);
+    } else {
+      atState = AT_WAITING;
+    }
   }
+}
+
+/**
+ * Check one byte of module output against the head command
+ * @param c Byte received
+ * @param matches Patterns ending at it, from watchLink()
+ * @return true if it completed the command
+ */
+bool atReceive(char c, uint16_t matches) {
+  const ATCommand& command = atQueue[atHead];
   
-  if (!responseComplete) {
-    Serial.print("[AT] Timeout waiting for: ");
-    Serial.println(expectedResponse ? expectedResponse : "any response");
-    Serial.print("Partial response: ");
-    Serial.println(response);
-    return false;
+  // Echo to serial monitor for debugging
+  if (c != '\r' && c != '\n') {
+    char echo[2] = {c, '\0'};
+    atEcho(echo);
   }
   
-  return true;
+  // Check for expected response
+  if (matches & command.expectedMask) {
+    atEcho("\r\n");
+    atFinish(true);
+    return true;
+  }
+  
+  // Check for error responses
+  if (matches & errorMask) {
+    atEcho("\r\n");
+    logLine("[AT] Command failed");
+    atFinish(false);
+    return true;
+  }
+  
+  // Check for a status other than the expected one: the digits the expected
+  // response covers are complete without it having matched
+  if (command.statusDigits > 0) {
+    if (atStatusLeft > 0 && --atStatusLeft == 0) {
+      atEcho("\r\n");
+      logLine("[AT] Server refused the request");
+      atFinish(false);
+      return true;
+    }
+    if (matches & statusMask) {
+      atStatusLeft = command.statusDigits;
+    }
+  }
+  return false;
 }
 
 /**
- * Connect to WiFi network with retry mechanism
- * @param maxRetries Maximum number of connection attempts
- * @return true if connected successfully, false otherwise
+ * Advance the AT engine; returns without waiting for anything
  */
-bool setupWiFi(int maxRetries = 3) {
-  Serial.println("Initializing ESP module...");
-  
-  // Reset module with retries
-  for (int attempt = 1; attempt <= maxRetries; attempt++) {
-    Serial.print("Attempt ");
-    Serial.print(attempt);
-    Serial.println(" to initialize module...");
-    
-    if (sendATCommand("AT+RST", "ready", AT_TIMEOUT)) {
-      break;
+void atPoll() {
+  // Start the next command
+  if (atState == AT_IDLE && atCount > 0) {
+    const ATCommand& command = atQueue[atHead];
+    if (command.data == nullptr) {
+      atEcho("[AT] Sending: ");
+      atEcho(command.text);
+      atEcho("\r\n");
     }
     
-    if (attempt == maxRetries) {
-      Serial.println("Failed to reset module");
-      return false;
+    // Clear serial buffer safely: the rest of the previous response (e.g. the
+    // "OK" after "+CWMODE:1") must not complete this command
+    while (Serial1.available() > 0) {
+      watchLink(Serial1.read());
     }
-    
-    delay(1000 * attempt); // Exponential backoff
+    atMatcher.reset();
+    atWritten = 0;
+    atStatusLeft = 0;
+    atStarted = millis();
+    atState = AT_WRITING;
   }
   
-  // Check module responsiveness
-  if (!sendATCommand("AT", "OK", 2000)) {
-    Serial.println("Module not responding to AT commands");
-    return false;
+  if (atState == AT_WRITING) {
+    atWrite();
   }
   
-  // Set WiFi mode to station (client)
-  if (!sendATCommand("AT+CWMODE=1") || 
-      !sendATCommand("AT+CWMODE?", "+CWMODE:1")) {
-    Serial.println("Failed to set WiFi mode");
-    return false;
+  // Read a bounded amount of module output per call (the module may answer while
+  // a command is still being written, e.g. its echo)
+  for (int i = 0; i < AT_POLL_BYTES && Serial1.available() > 0; i++) {
+    char c = Serial1.read();
+    uint16_t matches = watchLink(c);
+    if (atState != AT_IDLE && atReceive(c, matches)) {
+      return; // The next command starts on the next call
+    }
   }
   
-  // Build connect command safely
-  char connectCmd[MAX_CMD_LENGTH];
-  int cmdLen = snprintf(connectCmd, sizeof(connectCmd), 
-                       "AT+CWJAP=\"%s\",\"%s\"", 
-                       NET_CONFIG.ssid, 
-                       NET_CONFIG.password);
+  if (atState != AT_IDLE && millis() - atStarted >= atQueue[atHead].timeout) {
+    const ATCommand& command = atQueue[atHead];
+    atEcho("\r\n");
+    logLinef("[AT] Timeout waiting for: %s", command.expected ? command.expected : "the module to take the data");
+    char tail[ATMatcher::TAIL_LENGTH + 1];
+    atMatcher.tail(tail);
+    atEcho("Partial response: ");
+    if (!atMatcher.tail_complete()) {
+      atEcho("...");
+    }
+    atEcho(tail);
+    atEcho("\r\n");
+    atFinish(false);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Link management on top of the AT engine
+// ---------------------------------------------------------------------------
+
+enum LinkState {
+  LINK_SETUP,       // Resetting the module and joining the network
+  LINK_UP,          // Joined: uploads may run
+  LINK_RESTARTING   // Setup failed for good, the board restarts when the timer fires
+};
+
+LinkState linkState = LINK_SETUP;
+
+// One pending action (a retry after a backoff, the restart), run by linkPoll()
+void (*linkTimerAction)() = nullptr;
+unsigned long linkTimerStart = 0;
+unsigned long linkTimerDelay = 0;
+
+/**
+ * Run action once delayMs have passed, replacing any pending action
+ */
+void linkSchedule(void (*action)(), unsigned long delayMs) {
+  linkTimerAction = action;
+  linkTimerStart = millis();
+  linkTimerDelay = delayMs;
+}
+
+/**
+ * Fire the pending action when it is due
+ */
+void linkPoll() {
+  if (linkTimerAction != nullptr && millis() - linkTimerStart >= linkTimerDelay) {
+    void (*action)() = linkTimerAction;
+    linkTimerAction = nullptr;
+    action();
+  }
+}
+
+char joinCommand[MAX_CMD_LENGTH];  // AT+CWJAP with the credentials, built in setup()
+char tcpCommand[MAX_CMD_LENGTH];   // AT+CIPSTART to the server, built in setup()
+
+// One step of setupWiFi()
+struct SetupStep {
+  const char* command;
+  const char* expected;
+  unsigned long timeout;
+  uint8_t attempts;        // Tries before the setup attempt fails
+  unsigned long backoff;   // Wait backoff * attempt before the next try
+  bool required;           // Otherwise a failure is only reported
+  const char* failure;     // Message when the step fails
+};
+
+const SetupStep SETUP_STEPS[] = {
+  {"AT+RST", "ready", AT_TIMEOUT, 3, 1000, true, "Failed to reset module"},
+  {"AT", "OK", 2000, 1, 0, true, "Module not responding to AT commands"},
+  {"AT+CWMODE=1", "OK", AT_TIMEOUT, 1, 0, true, "Failed to set WiFi mode"},
+  {"AT+CWMODE?", "+CWMODE:1", AT_TIMEOUT, 1, 0, true, "Failed to set WiFi mode"},
+  {joinCommand, "OK", WIFI_CONNECT_TIMEOUT, 3, 5000, true, "Failed to connect to WiFi"},
+  {"AT+CIPSTATUS", "STATUS:3", 3000, 1, 0, true, "WiFi connected but no IP address"},
+  {"AT+CIFSR", "OK", AT_TIMEOUT, 1, 0, false, "Failed to get IP address"}
+};
+const uint8_t SETUP_STEP_COUNT = sizeof(SETUP_STEPS) / sizeof(SETUP_STEPS[0]);
+
+const unsigned long SETUP_MAX_BACKOFF = 60000; // Longest wait between setup attempts
+
+uint8_t setupStep = 0;
+uint8_t setupStepAttempt = 1;
+uint8_t setupAttempt = 1;
+uint8_t setupAttempts = 1;
+unsigned long setupRestartDelay = 0;
+
+void onSetupStep(bool ok);
+
+void runSetupStep() {
+  const SetupStep& step = SETUP_STEPS[setupStep];
+  if (!atSend(step.command, step.expected, step.timeout, onSetupStep)) {
+    onSetupStep(false);
+  }
+}
+
+void runSetup() {
+  logLinef("Initializing ESP module, attempt %d", setupAttempt);
+  tcpConnected = false; // The reset drops any connection
+  setupStep = 0;
+  setupStepAttempt = 1;
+  runSetupStep();
+}
+
+/**
+ * @return true if a restart would lose samples not yet sent: they are only in RAM
+ */
+bool samplesOnlyInRam() {
+#if UPLOAD_FORMAT != UPLOAD_SINGLE && !OUTAGE_EEPROM
+  return !sampleBuffer.empty();
+#else
+  return false;
+#endif
+}
+
+void restartBoard() {
+#if UPLOAD_FORMAT != UPLOAD_SINGLE && OUTAGE_EEPROM
+  // The reset clears RAM: move the samples not yet sent to EEPROM first
+  while (!sampleBuffer.empty() && !sampleLog.full()) {
+    if (sampleLog.append(sampleBuffer.at(0))) {
+      sampleBuffer.pop(1);
+    } else {
+      sampleLog.poll();
+    }
+  }
+  sampleLog.flush();
+#endif
+  ESP.restart(); // Soft reset instead of hanging
+}
+
+void onSetupStep(bool ok) {
+  const SetupStep& step = SETUP_STEPS[setupStep];
   
-  if (cmdLen >= sizeof(connectCmd)) {
-    Serial.println("WiFi connect command too long");
-    return false;
+  if (!ok && step.required && setupStepAttempt < step.attempts) {
+    linkSchedule(runSetupStep, step.backoff * setupStepAttempt); // Exponential backoff
+    setupStepAttempt++;
+    return;
   }
   
-  // Connect to WiFi with retries
-  for (int attempt = 1; attempt <= maxRetries; attempt++) {
-    Serial.print("WiFi connection attempt ");
-    Serial.println(attempt);
-    
-    if (sendATCommand(connectCmd, "OK", WIFI_CONNECT_TIMEOUT)) {
-      break;
-    }
-    
-    if (attempt == maxRetries) {
-      Serial.println("Failed to connect to WiFi");
-      return false;
+  if (!ok) {
+    logLine(step.failure);
+    if (step.required) {
+      // Without EEPROM a restart would throw the buffered samples away: keep
+      // retrying instead (the setup resets the module anyway)
+      if (setupAttempt < setupAttempts || samplesOnlyInRam()) {
+        unsigned long backoff = min(5000UL * setupAttempt, SETUP_MAX_BACKOFF); // Exponential backoff, capped
+        if (setupAttempt >= setupAttempts) {
+          logLinef("WiFi down, samples kept: retrying in %lu s", backoff / 1000);
+        }
+        linkSchedule(runSetup, backoff);
+        if (setupAttempt < 255) {
+          setupAttempt++;
+        }
+        return;
+      }
+      logLine("Critical: Failed to initialize WiFi");
+      logLinef("Restarting in %lu seconds", setupRestartDelay / 1000);
+      linkState = LINK_RESTARTING;
+      linkSchedule(restartBoard, setupRestartDelay);
+      return;
     }
-    
-    delay(5000 * attempt); // Exponential backoff
   }
   
-  // Verify connection status
-  if (!sendATCommand("AT+CIPSTATUS", "STATUS:3", 3000)) {
-    Serial.println("WiFi connected but no IP address");
-    return false;
+  if (++setupStep < SETUP_STEP_COUNT) {
+    setupStepAttempt = 1;
+    runSetupStep();
+    return;
   }
   
-  // Get and display IP address
-  if (!sendATCommand("AT+CIFSR")) {
-    Serial.println("Failed to get IP address");
+  logLine("WiFi ready");
+  linkState = LINK_UP;
+}
+
+/**
+ * Start connecting to the WiFi network; loop() keeps running meanwhile
+ * The module is reset and every step retried as listed in SETUP_STEPS.
+ * @param maxRetries Maximum number of setup attempts; more while samples are
+ *                   waiting that only RAM holds (see samplesOnlyInRam())
+ * @param restartDelay Wait this long after the last failed attempt, then restart the board
+ */
+void setupWiFi(int maxRetries, unsigned long restartDelay) {
+  linkState = LINK_SETUP;
+  linkTimerAction = nullptr;
+  setupAttempt = 1;
+  setupAttempts = maxRetries;
+  setupRestartDelay = restartDelay;
+  runSetup();
+}
+
+// ---------------------------------------------------------------------------
+// Uploads: one HTTP request per upload, over the connection kept open with
+// HTTP_KEEP_ALIVE (opened on demand, reopened after the module reported it
+// closed or refused a send). An upload succeeds only once the server has
+// answered with a 2xx status: "SEND OK" just means the module passed the bytes on.
+// ---------------------------------------------------------------------------
+
+const uint8_t UPLOAD_ATTEMPTS = 2;
+
+bool uploadActive = false;
+const char* uploadHead;            // Request line and headers
+int uploadHeadLength;
+const uint8_t* uploadBody;         // Body, nullptr for none
+int uploadBodyLength;
+uint8_t uploadAttempt;
+ATCallback uploadDone;
+char sendCommand[MAX_CMD_LENGTH];  // AT+CIPSEND of the upload
+
+void runUploadAttempt();
+
+void finishUpload(bool ok) {
+  uploadActive = false;
+  uploadDone(ok);
+}
+
+void onConnectionOpened(bool ok) {
+  if (ok) {
+    tcpConnected = true;
+  }
+}
+
+void onConnectionClosed(bool ok) {
+  if (!ok && tcpConnected) {
+    logLine("Warning: Failed to close TCP connection");
+  }
+  tcpConnected = false;
+  finishUpload(true);
+}
+
+void onRequestSent(bool ok) {
+  if (!ok) {
+    // "link is not valid", another status or a timeout: assume the connection is gone and reopen it
+    tcpConnected = false;
+    if (uploadAttempt < UPLOAD_ATTEMPTS) {
+      linkSchedule(runUploadAttempt, 1000UL * uploadAttempt); // Exponential backoff
+      uploadAttempt++;
+      return;
+    }
+    logLine("Failed to send data");
+    finishUpload(false);
+    return;
   }
   
-  return true;
+#if !HTTP_KEEP_ALIVE
+  // Close the connection after every request, unless the server already has
+  if (tcpConnected && atSend("AT+CIPCLOSE", "OK", AT_TIMEOUT, onConnectionClosed)) {
+    return;
+  }
+  tcpConnected = false;
+#endif
+  finishUpload(true);
+}
+
+void runUploadAttempt() {
+  logLinef("Data send attempt %d", uploadAttempt);
+  
+  // "CONNECT" (or "ALREADY CONNECTED") confirms the link; the send, the request
+  // and the server's answer follow without waiting for another turn of loop()
+  bool queued = (tcpConnected || atSend(tcpCommand, "CONNECT", TCP_CONNECT_TIMEOUT, onConnectionOpened)) &&
+                atSend(sendCommand, ">", 2000, nullptr) &&
+                atSendData(reinterpret_cast<const uint8_t*>(uploadHead), uploadHeadLength,
+                           uploadBodyLength > 0 ? nullptr : HTTP_SUCCESS, DATA_SEND_TIMEOUT,
+                           uploadBodyLength > 0 ? nullptr : onRequestSent) &&
+                (uploadBodyLength == 0 ||
+                 atSendData(uploadBody, uploadBodyLength, HTTP_SUCCESS, DATA_SEND_TIMEOUT, onRequestSent));
+  if (!queued) {
+    atCount = 0; // Nothing else uses the queue during an upload: drop the part that was queued
+    onRequestSent(false);
+  }
 }
 
 /**
- * Send sensor data to server with proper connection management
- * @param data SensorData structure containing readings
- * @param maxRetries Maximum number of send attempts
- * @return true if data sent successfully, false otherwise
+ * Start sending one HTTP request to the server
+ * @param head Request line and headers; must stay valid until done is called
+ * @param headLength Length of head
+ * @param body Request body, nullptr for none; must stay valid until done is called
+ * @param bodyLength Length of body
+ * @param done Called once with the outcome
+ * @return false if the link is not up or another upload is in progress; done is not called then
  */
-bool sendDataToServer(const SensorData &data, int maxRetries = 2) {
-  // Build TCP connection command safely
-  char tcpCmd[MAX_CMD_LENGTH];
-  int cmdLen = snprintf(tcpCmd, sizeof(tcpCmd),
-                       "AT+CIPSTART=\"TCP\",\"%s\",%d",
-                       NET_CONFIG.server,
-                       NET_CONFIG.port);
-  
-  if (cmdLen >= sizeof(tcpCmd)) {
-    Serial.println("TCP connection command too long");
+bool startUpload(const char* head, int headLength, const uint8_t* body, int bodyLength, ATCallback done) {
+  if (linkState != LINK_UP || uploadActive || atBusy()) {
     return false;
   }
   
-  // Establish TCP connection with retries
-  for (int attempt = 1; attempt <= maxRetries; attempt++) {
-    Serial.print("TCP connection attempt ");
-    Serial.println(attempt);
-    
-    if (sendATCommand(tcpCmd, "OK", TCP_CONNECT_TIMEOUT) &&
-        sendATCommand("AT+CIPSTATUS", "STATUS:4", 3000)) {
-      break;
-    }
-    
-    if (attempt == maxRetries) {
-      Serial.println("Failed to establish TCP connection");
-      return false;
-    }
-    
-    delay(2000 * attempt); // Exponential backoff
+  int cmdLength = snprintf(sendCommand, sizeof(sendCommand), "AT+CIPSEND=%d", headLength + bodyLength);
+  if (cmdLength >= sizeof(sendCommand)) {
+    logLine("Send command too long");
+    return false;
   }
   
-  // Build HTTP request safely
-  char payload[MAX_PAYLOAD_LENGTH];
+  uploadActive = true;
+  uploadHead = head;
+  uploadHeadLength = headLength;
+  uploadBody = body;
+  uploadBodyLength = bodyLength;
+  uploadDone = done;
+  uploadAttempt = 1;
+  runUploadAttempt();
+  return true;
+}
+
+unsigned long uploadStart = 0;   // millis() when the current upload started
+int uploadSamples = 0;           // Samples it carries
+
+/**
+ * Report an upload, recovering the WiFi connection after a failure
+ * @param sent Whether the upload succeeded
+ */
+void onUploadDone(bool sent) {
+  if (sent) {
+    logLinef("%d %s sent in %lu ms", uploadSamples, uploadSamples == 1 ? "sample" : "samples",
+             millis() - uploadStart);
+    return;
+  }
+  
+  logLine("Warning: Data transmission failed - attempting WiFi recovery");
+  setupWiFi(1, 1000); // One attempt, then restart the board unless that would lose samples
+}
+
+/**
+ * Start sending sensor data to the server as one GET request
+ * @param data SensorData structure containing readings
+ * @return false if the request could not be started (link down, upload in progress)
+ */
+bool sendDataToServer(const SensorData &data) {
+  // Build HTTP request safely; it is sent from this buffer after we return
+  static char payload[MAX_PAYLOAD_LENGTH];
   int payloadLen = snprintf(payload, sizeof(payload),
                            "GET /log?gas=%d&temp=%d&s3=%d HTTP/1.1\r\n"
                            "Host: %s\r\n"
-                           "Connection: close\r\n\r\n",
+                           "Connection: %s\r\n\r\n",
                            data.gas, data.temp, data.sensor3,
-                           NET_CONFIG.server);
+                           NET_CONFIG.server,
+                           HTTP_KEEP_ALIVE ? "keep-alive" : "close");
   
   if (payloadLen >= sizeof(payload)) {
-    Serial.println("HTTP payload too large");
-    sendATCommand("AT+CIPCLOSE");
+    logLine("HTTP payload too large");
     return false;
   }
   
-  // Send data with proper error handling
-  bool sendSuccess = false;
-  char sendCmd[MAX_CMD_LENGTH];
-  cmdLen = snprintf(sendCmd, sizeof(sendCmd), "AT+CIPSEND=%d", payloadLen);
-  
-  if (cmdLen >= sizeof(sendCmd)) {
-    Serial.println("Send command too long");
-    sendATCommand("AT+CIPCLOSE");
+  if (!startUpload(payload, payloadLen, nullptr, 0, onUploadDone)) {
     return false;
   }
-  
-  for (int attempt = 1; attempt <= maxRetries; attempt++) {
-    Serial.print("Data send attempt ");
-    Serial.println(attempt);
-    
-    if (sendATCommand(sendCmd, ">", 2000)) {
-      Serial1.print(payload);
-      
-      if (sendATCommand("", "SEND OK", DATA_SEND_TIMEOUT)) {
-        sendSuccess = true;
+  uploadStart = millis();
+  uploadSamples = 1;
+  return true;
+}
+
+#if UPLOAD_FORMAT != UPLOAD_SINGLE
+// The batch being uploaded, encoded; its samples stay stored until the server
+// has answered it with a 2xx status (batch_receiver: 204), and a batch that
+// fails is built again and sent once more (the receiver drops the samples it
+// already has)
+uint8_t batchBody[BATCH_BUFFER_LENGTH];
+char batchHead[MAX_HEADER_LENGTH];
+uint32_t batchNextSeq = 0;       // Number the next sample in the batch must have
+uint32_t batchEnd = 0;           // Ring index (log position) after its last sample
+bool batchFromLog = false;
+bool batchRestored = false;      // Its samples are from EEPROM, taken before the last restart
+bool overflowReported = false;   // The buffer overflowed since the last upload
+
+void onBatchSent(bool ok) {
+  if (ok) {
+#if OUTAGE_EEPROM
+    if (batchFromLog) {
+      sampleLog.ack(batchEnd);
+    } else {
+      sampleBuffer.pop_until(batchEnd);
+    }
+#else
+    sampleBuffer.pop_until(batchEnd);
+#endif
+    overflowReported = false;
+  }
+  onUploadDone(ok);
+}
+
+/**
+ * Add a stored sample to the batch if it follows on from the ones in it
+ * @return false if it does not: the batch is full, or the sample starts a new
+ *         run (samples before it were lost, or it was taken after a reset)
+ */
+bool addToBatch(const BatchSample& sample) {
+  if (batch.empty()) {
+    batch.start(sample.seq);
+  } else if (sample.seq != batchNextSeq || batch.full()) {
+    return false;
+  }
+  if (!batch.add(sample.time_ms, sample.value[0], sample.value[1], sample.value[2])) {
+    return false;
+  }
+  batchNextSeq = sample.seq + 1;
+  return true;
+}
+
+/**
+ * Fill the batch with the oldest samples waiting, those in EEPROM first
+ */
+void fillBatch() {
+  batch.start(0);
+  batchRestored = false;
+#if OUTAGE_EEPROM
+  batchFromLog = !sampleLog.empty();
+  if (batchFromLog) {
+    BatchSample sample;
+    uint32_t pos = sampleLog.first();
+    while (sampleLog.read(pos, sample)) {
+      // Samples from before the restart are timed by another run of millis(): a batch of their own
+      bool restored = sampleLog.restored(pos - 1);
+      if (!batch.empty() && restored != batchRestored) {
         break;
       }
+      if (!addToBatch(sample)) {
+        break;
+      }
+      batchRestored = restored;
+      batchEnd = pos;
     }
-    
-    if (attempt == maxRetries) {
-      Serial.println("Failed to send data");
+    if (batch.empty()) {
+      sampleLog.ack(pos); // Records that do not read back: skip them
     }
-    
-    delay(1000 * attempt); // Exponential backoff
+    return;
+  }
+#endif
+  uint16_t count = 0;
+  while (count < sampleBuffer.size() && addToBatch(sampleBuffer.at(count))) {
+    count++;
+  }
+  batchEnd = sampleBuffer.first_index() + count;
+}
+
+/**
+ * @return true once a batch should go out: samples wait in EEPROM, a batch is
+ *         full, or the oldest sample is BATCH_MAX_AGE old
+ */
+bool batchDue() {
+#if OUTAGE_EEPROM
+  if (sampleLog.busy()) {
+    return false; // The sample being written goes out before the newer ones in RAM
+  }
+  if (!sampleLog.empty()) {
+    return true;
+  }
+#endif
+  return sampleBuffer.size() >= BATCH_SAMPLES ||
+         (!sampleBuffer.empty() && millis() - sampleBuffer.at(0).time_ms >= BATCH_MAX_AGE);
+}
+
+/**
+ * Start POSTing a batch of the oldest samples waiting
+ * @return false if the upload could not be started
+ */
+bool sendBatch() {
+  if (linkState != LINK_UP || uploadActive || atBusy()) {
+    return false;
   }
   
-  // Always close connection
-  if (!sendATCommand("AT+CIPCLOSE")) {
-    Serial.println("Warning: Failed to close TCP connection");
+  fillBatch();
+  if (batch.empty()) {
+    return false;
+  }
+#if UPLOAD_FORMAT == UPLOAD_CSV
+  int bodyLength = batch.encode_csv(reinterpret_cast<char*>(batchBody));
+  const char* contentType = "text/csv";
+#else
+  int bodyLength = batch.encode_binary(batchBody);
+  const char* contentType = "application/octet-stream";
+#endif
+  
+  // now: millis() at this point, from which the receiver tells how long ago the
+  // samples were taken; for samples from before the restart, on their millis(),
+  // counting from the newest of them (as if the restart took no time)
+  unsigned long now = millis();
+#if OUTAGE_EEPROM
+  if (batchRestored) {
+    now += sampleLog.restored_ms();
   }
+#endif
+  char target[24];
+  snprintf(target, sizeof(target), "/log?now=%lu", now);
+  int headLength = snprintf(batchHead, sizeof(batchHead),
+                            "POST %s HTTP/1.1\r\n"
+                            "Host: %s\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %d\r\n"
+                            "Connection: %s\r\n\r\n",
+                            target,
+                            NET_CONFIG.server,
+                            contentType,
+                            bodyLength,
+                            HTTP_KEEP_ALIVE ? "keep-alive" : "close");
   
-  return sendSuccess;
+  if (headLength >= sizeof(batchHead)) {
+    logLine("HTTP headers too large");
+    return false;
+  }
+  
+  if (!startUpload(batchHead, headLength, batchBody, bodyLength, onBatchSent)) {
+    return false;
+  }
+  uploadStart = millis();
+  uploadSamples = batch.size();
+  return true;
+}
+#endif
+
+/**
+ * Build the WiFi and TCP connect commands safely
+ * @return false if one does not fit
+ */
+bool buildCommands() {
+  int cmdLen = snprintf(joinCommand, sizeof(joinCommand),
+                       "AT+CWJAP=\"%s\",\"%s\"",
+                       NET_CONFIG.ssid,
+                       NET_CONFIG.password);
+  if (cmdLen >= sizeof(joinCommand)) {
+    logLine("WiFi connect command too long");
+    return false;
+  }
+  
+  cmdLen = snprintf(tcpCommand, sizeof(tcpCommand),
+                   "AT+CIPSTART=\"TCP\",\"%s\",%d",
+                   NET_CONFIG.server,
+                   NET_CONFIG.port);
+  if (cmdLen >= sizeof(tcpCommand)) {
+    logLine("TCP connection command too long");
+    return false;
+  }
+  return true;
 }
 
 void setup() {
@@ -320,30 +1062,39 @@ void setup() {
   // Wait for serial ports to initialize
   delay(SERIAL_INIT_DELAY);
   
-  Serial.println("Starting WiFi communication...");
+  logLine("Starting WiFi communication...");
+  atBegin();
   
-  // Initialize WiFi with recovery attempts
-  for (int attempt = 1; attempt <= 3; attempt++) {
-    if (setupWiFi()) {
-      break;
-    }
-    
-    if (attempt == 3) {
-      Serial.println("Critical: Failed to initialize WiFi after multiple attempts");
-      Serial.println("Entering recovery mode - will retry in 60 seconds");
-      delay(60000);
-      ESP.restart(); // Soft reset instead of hanging
-    }
-    
-    delay(5000 * attempt); // Exponential backoff
+#if UPLOAD_FORMAT != UPLOAD_SINGLE && OUTAGE_EEPROM
+  uint32_t stored = sampleLog.begin();
+  if (stored > 0) {
+    logLinef("%lu samples from before the restart waiting in EEPROM", static_cast<unsigned long>(stored));
+  }
+#endif
+  
+  if (!buildCommands()) {
+    linkState = LINK_RESTARTING; // A configuration error: nothing to retry
+    return;
   }
+  
+  // Initialize WiFi with recovery attempts; after the last one fails the
+  // board restarts in 60 seconds
+  setupWiFi(3, 60000);
 }
 
 void loop() {
-  static unsigned long lastSendTime = 0;
-  const unsigned long sendInterval = 5000; // 5 seconds
+  static unsigned long lastSampleTime = 0;
   
-  if (millis() - lastSendTime >= sendInterval) {
+  // Networking only ever does what it can without waiting
+  atPoll();
+  linkPoll();
+#if UPLOAD_FORMAT != UPLOAD_SINGLE && OUTAGE_EEPROM
+  sampleLog.poll();
+#endif
+  
+  if (millis() - lastSampleTime >= SAMPLE_INTERVAL) {
+    lastSampleTime = millis();
+    
     // Read sensor data
     SensorData data = {
       analogRead(A0),
@@ -351,20 +1102,36 @@ void loop() {
       analogRead(A2)
     };
     
-    // Send data with automatic recovery
+#if UPLOAD_FORMAT == UPLOAD_SINGLE
     if (!sendDataToServer(data)) {
-      Serial.println("Warning: Data transmission failed - attempting WiFi recovery");
-      
-      if (!setupWiFi()) {
-        Serial.println("Error: WiFi recovery failed - restarting");
-        delay(1000);
-        ESP.restart();
-      }
+      logLine("Warning: Link busy or down - sample not sent");
     }
-    
-    lastSendTime = millis();
+#else
+    BatchSample sample;
+    sample.time_ms = lastSampleTime;
+    sample.seq = nextSeq++;
+    sample.value[0] = data.gas;
+    sample.value[1] = data.temp;
+    sample.value[2] = data.sensor3;
+#if OUTAGE_EEPROM
+    // Make room by moving the oldest sample to EEPROM (unless the previous one is still being written)
+    if (sampleBuffer.full() && sampleLog.append(sampleBuffer.at(0))) {
+      sampleBuffer.pop(1);
+    }
+#endif
+    // The receiver counts overwritten samples as lost from the gap in their numbers
+    if (!sampleBuffer.push(sample) && !overflowReported) {
+      logLine("Warning: Sample buffer full - overwriting the oldest samples");
+      overflowReported = true;
+    }
+#endif
   }
   
-  // Small delay to prevent busy waiting
-  delay(100);
-}
\ No newline at end of file
+#if UPLOAD_FORMAT != UPLOAD_SINGLE
+  // Send a batch once one is full or the oldest sample is due; a backlog goes
+  // out batch after batch, one per upload
+  if (batchDue()) {
+    sendBatch();
+  }
+#endif
+}
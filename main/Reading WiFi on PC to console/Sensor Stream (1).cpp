@@ -15,6 +15,9 @@ bool tempSensorEnabled = true;
 bool humiditySensorEnabled = true;
 bool lightSensorEnabled = true;
 
+// --- Sample number, counting from 0 at reset, so the PC reader can count lost samples ---
+unsigned long sampleSeq = 0;
+
 // --- Struct to hold sensor data ---
 struct SensorData {
   float temperature;
@@ -23,6 +26,7 @@ struct SensorData {
   bool hasTemperature;
   bool hasHumidity;
   bool hasLight;
+  unsigned long sampledAt;  // millis() of the readings
 };
 
 // --- Simulated temperature reading ---
@@ -43,6 +47,7 @@ int readLightLevel() {
 // --- Read enabled sensors ---
 SensorData readSensors(bool readTemp, bool readHum, bool readLight) {
   SensorData data;
+  data.sampledAt = millis();
   data.hasTemperature = false;
   data.hasHumidity = false;
   data.hasLight = false;
@@ -89,8 +94,14 @@ void sendToWiFi(const SensorData& data) {
     if (!first) Serial.print(", ");
     Serial.print("\"light\":");
     Serial.print(data.light);
+    first = false;
   }
 
+  if (!first) Serial.print(", ");
+  Serial.print("\"seq\":");
+  Serial.print(sampleSeq++);
+  Serial.print(", \"ms\":");
+  Serial.print(data.sampledAt);
   Serial.println("}");
 }
 
@@ -1,7 +1,17 @@
+#include "telemetry_frame.h"
+
 #define GAS_SENSOR A0
 #define TEMP_SENSOR A1
 #define SENSOR_3 A2
 
+// Serial output: 0 prints the text lines below; 1 sends each sample as a
+// 15-byte binary telemetry frame (telemetry_frame.h) instead of ~70 bytes of
+// text. Read frames with the PC reader's --protocol=binary.
+#define TELEMETRY_BINARY 0
+const uint8_t SENSOR_ID = 1;          // Tells boards sharing one PC link apart (0..63)
+uint32_t sampleSeq = 0;               // Text lines end with "Seq: N" so the PC reader can count lost samples,
+                                      // then "Time: N ms" so it can time them by the board's clock
+
 const int NUM_SAMPLES = 20; // Increased samples for better noise reduction
 
 // --- Calibration and Validation Constants ---
@@ -40,6 +50,7 @@ struct SensorData {
     bool gasConnected; // Indicates if gas sensor is likely connected and working
     bool tempConnected; // Indicates if temp sensor is likely connected and working
     bool sensor3Connected; // Indicates if sensor3 is likely connected and working
+    unsigned long sampledAt; // millis() when the readings were started
 };
 
 // Function to read and average multiple analog readings with value validation
@@ -73,6 +84,7 @@ float calculateRs(int rawADC) {
 // Function to read all sensors with enhanced validation and calibration
 SensorData readSensors() {
     SensorData data;
+    data.sampledAt = millis();
 
     // --- Read and validate Gas Sensor ---
     int gasRaw = averageAnalogRead(GAS_SENSOR);
@@ -134,6 +146,19 @@ SensorData readSensors() {
     return data;
 }
 
+#if TELEMETRY_BINARY
+TelemetryEncoder telemetry(TELEMETRY_HANDLER, SENSOR_ID);
+
+// Sends one sample as a frame: gas PPM, temperature, soil moisture
+void sendFrame(const SensorData& readings) {
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    if (readings.gasConnected) telemetry.set(0, readings.gasPPM); else telemetry.set_disconnected(0);
+    if (readings.tempConnected) telemetry.set(1, readings.tempC); else telemetry.set_disconnected(1);
+    if (readings.sensor3Connected) telemetry.set(2, readings.soilMoisturePercent); else telemetry.set_disconnected(2);
+    Serial.write(frame, telemetry.finish(readings.sampledAt, frame));
+}
+#endif
+
 // Arduino setup
 void setup() {
     Serial.begin(9600);
@@ -143,6 +168,9 @@ void setup() {
 void loop() {
     SensorData readings = readSensors();
 
+#if TELEMETRY_BINARY
+    sendFrame(readings);
+#else
     // Print Gas sensor values
     if (readings.gasConnected)
         Serial.print("Gas: "), Serial.print(readings.gasPPM, 2), Serial.print(" PPM");
@@ -161,9 +189,17 @@ void loop() {
 
     // Print Sensor3 (Soil Moisture) values
     if (readings.sensor3Connected)
-        Serial.print("Soil Moisture: "), Serial.print(readings.soilMoisturePercent, 2), Serial.println("%");
+        Serial.print("Soil Moisture: "), Serial.print(readings.soilMoisturePercent, 2), Serial.print("%");
     else
-        Serial.println("Soil Moisture: NOT CONNECTED / ERROR");
+        Serial.print("Soil Moisture: NOT CONNECTED / ERROR");
+
+    // Sample number, counting from 0 at reset, and when it was taken (frames carry their own)
+    Serial.print(" | Seq: ");
+    Serial.print(sampleSeq++);
+    Serial.print(" | Time: ");
+    Serial.print(readings.sampledAt);
+    Serial.println(" ms");
+#endif
 
     delay(2000); // Delay between readings (increased for clarity)
 }
@@ -1,14 +1,39 @@
 #include <libserialport.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <memory>
 #include <chrono>
 #include <thread>
 #include <ctime>
 #include <csignal>
-#include <iomanip>
 #include <stdexcept>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include "console_sink.h"
+#include "device_clock.h"
+#include "hotplug.h"
+#include "line_framer.h"
+#include "log_sink.h"
+#include "metrics.h"
+#include "parser_stage.h"
+#include "sensor_parser.h"
+#include "sequence_tracker.h"
+#include "series_store.h"
+#include "spsc_ring.h"
+#include "telemetry_frame.h"
+#include "timestamp.h"
 
 /**
  * RAII wrapper for sp_port to ensure proper cleanup.
@@ -35,6 +60,29 @@ struct ConfigDeleter {
 };
 using UniqueConfig = std::unique_ptr<sp_port_config, ConfigDeleter>;
 
+/**
+ * RAII wrapper for sp_event_set to ensure proper cleanup.
+ */
+struct EventSetDeleter {
+    void operator()(sp_event_set* events) const {
+        if (events) {
+            sp_free_event_set(events);
+        }
+    }
+};
+using UniqueEventSet = std::unique_ptr<sp_event_set, EventSetDeleter>;
+
+/**
+ * How the main loop waits for serial data.
+ * EVENT blocks on all open ports at once (PortWaiter) until bytes arrive and then
+ * drains them; POLL is the original fixed-interval blocking read plus sleep
+ * (nonblocking reads of each port when there are several).
+ */
+enum class ReadMode {
+    EVENT,
+    POLL
+};
+
 /**
  * Checks for libserialport errors and throws exception with message.
  * @param result The return code from a libserialport function.
@@ -53,25 +101,19 @@ void check_error(enum sp_return result, const std::string& context) {
     }
 }
 
-/**
- * Gets current timestamp as string for logging.
- * @return Formatted timestamp (e.g., "2025-06-04 13:00:00") or "Invalid time" on failure.
- */
-std::string getTimestamp() {
-    std::time_t now = std::time(nullptr);
-    char buf[20] = "Invalid time";
-    if (std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now)) == 0) {
-        return "Invalid time";
-    }
-    return buf;
-}
-
 /**
  * Checks if a port exists in the system.
+ * A device path (including pseudo-terminals such as the arduino_simulator link,
+ * which libserialport does not enumerate) is checked with a single stat();
+ * only other names are looked up in the port list, whose enumeration is slow
+ * on hosts with many ttys.
  * @param port_name Name of the port to check (e.g., "COM3").
  * @return true if port exists, false otherwise.
  */
 bool port_exists(const std::string& port_name) {
+    if (is_device_path(port_name)) {
+        return device_node_exists(port_name);
+    }
     sp_port** ports = nullptr;
     enum sp_return result = sp_list_ports(&ports);
     if (result != SP_OK || !ports) {
@@ -109,6 +151,552 @@ std::string list_ports() {
     return port_list;
 }
 
+/**
+ * Extracts the value of a "--name=value" argument.
+ * @param arg Command-line argument.
+ * @param name Option name including the leading dashes.
+ * @param value Receives the text after '='.
+ * @return true if arg is this option.
+ */
+bool option_value(const std::string& arg, const std::string& name, std::string& value) {
+    if (arg.size() > name.size() && arg.compare(0, name.size(), name) == 0 && arg[name.size()] == '=') {
+        value = arg.substr(name.size() + 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * One serial port of the reader and its counters. Only the read thread touches
+ * the port; the counters are written by the read thread only.
+ */
+struct SerialDevice {
+    using Clock = std::chrono::steady_clock;
+
+    std::string name;
+    uint16_t id = 0;                // Index in the device list; tags its samples
+    size_t parser = 0;              // ParserStage that handles its bytes
+    UniquePort port{nullptr};
+    bool open = false;
+    bool ever_open = false;         // False until the first open (the node may appear after startup)
+    bool parser_behind = false;     // Whether dropped reads were already reported
+    Clock::time_point lost_at;      // When the port was closed
+    Clock::time_point next_check;   // Next node check or reopen attempt while closed
+    Clock::time_point next_report;  // Reopen failures are reported at most once per interval
+    bool node_appeared = false;     // Hotplug event for its node since the last check
+    bool node_seen = false;         // Its node is back (device paths only) ...
+    Clock::time_point node_seen_at; // ... since then
+    Counter bytes;                  // Bytes read from the port
+    Counter dropped_bytes;          // Bytes read while its parser's queue was full
+    Counter reconnects;             // Successful reopens
+    Counter reconnect_failures;
+    Histogram outage_ns;            // Closed until reopened
+    Histogram recovery_ns;          // Node back until reopened (device paths only)
+    std::atomic<bool> port_open{false};
+};
+
+using DeviceList = std::vector<std::unique_ptr<SerialDevice>>;
+
+/**
+ * Waits for data on all open ports at once, the reader's single event loop.
+ * On POSIX the port handles are polled directly so that a hang-up is pinned to
+ * its port, and while a port is closed the HotplugWatcher descriptor is polled
+ * too so that its node reappearing ends the wait; elsewhere sp_wait() on an
+ * event set is used and a lost port shows up as a read error.
+ */
+class PortWaiter {
+public:
+    /**
+     * Rebuilds the wait list. Call after any port is opened or closed.
+     * @param watch_fd HotplugWatcher::fd(), polled while a port is closed (POSIX only).
+     */
+    void rebuild(const DeviceList& devices, int watch_fd = -1) {
+#ifdef _WIN32
+        (void)watch_fd;
+        events_.reset();
+        for (const auto& device : devices) {
+            if (device->open) {
+                if (!events_) {
+                    sp_event_set* raw_events = nullptr;
+                    check_error(sp_new_event_set(&raw_events), "Creating event set");
+                    events_.reset(raw_events);
+                }
+                check_error(sp_add_port_events(events_.get(), device->port.get(), SP_EVENT_RX_READY),
+                            "Adding port events");
+            }
+        }
+#else
+        fds_.clear();
+        owners_.clear();
+        bool any_closed = false;
+        for (const auto& device : devices) {
+            int fd = -1;
+            if (device->open && sp_get_port_handle(device->port.get(), &fd) == SP_OK) {
+                fds_.push_back({fd, POLLIN, 0});
+                owners_.push_back(device.get());
+            }
+            any_closed |= !device->open;
+        }
+        if (any_closed && watch_fd >= 0) {
+            fds_.push_back({watch_fd, POLLIN, 0});
+            owners_.push_back(nullptr);
+        }
+#endif
+    }
+
+    /**
+     * Sleeps until a port has data, a watched node changes, the timeout passes or a signal arrives.
+     * @param hung_up Receives the ports that reported a hang-up (POSIX only).
+     */
+    void wait(unsigned int timeout_ms, std::vector<SerialDevice*>& hung_up) {
+        hung_up.clear();
+#ifdef _WIN32
+        if (!events_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            return;
+        }
+        check_error(sp_wait(events_.get(), timeout_ms), "Waiting for data");
+#else
+        if (poll(fds_.data(), fds_.size(), static_cast<int>(timeout_ms)) < 0) {
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("Waiting for data: ") + std::strerror(errno));
+            }
+            return;
+        }
+        for (size_t i = 0; i < fds_.size(); ++i) {
+            if (owners_[i] && (fds_[i].revents & (POLLHUP | POLLERR | POLLNVAL))) {
+                hung_up.push_back(owners_[i]);
+            }
+        }
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    UniqueEventSet events_{nullptr};
+#else
+    std::vector<pollfd> fds_;
+    std::vector<SerialDevice*> owners_; // nullptr for the hotplug watch
+#endif
+};
+
+/**
+ * Quotes a Prometheus label value ("\" and "\\" escaped).
+ */
+std::string label(const char* name, const std::string& value) {
+    std::string text = std::string(name) + "=\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            text += '\\';
+        }
+        text += c;
+    }
+    return text + "\"";
+}
+
+/**
+ * Renders the reader, queue and log writer metrics in Prometheus text format.
+ * @param started When the reader started, for the uptime gauge.
+ */
+std::string render_metrics(const DeviceList& devices, const ParserList& parsers, const ConsoleSink& console,
+                           const LogSink& log_sink, const SeriesStore* history,
+                           std::chrono::steady_clock::time_point started) {
+    static const char* const FORMAT_LABELS[ParserMetrics::FORMAT_COUNT] = {
+        "format=\"legacy\"", "format=\"json\"", "format=\"handler\"", "format=\"dht\"",
+        "format=\"response\"", "format=\"data\"", "format=\"malformed\""};
+    std::string out;
+    PrometheusText text(out);
+    auto parser_sum = [&](uint64_t (*field)(const ParserMetrics&)) {
+        uint64_t total = 0;
+        for (const auto& parser : parsers) {
+            total += field(parser->metrics());
+        }
+        return total;
+    };
+    auto device_samples = [&](const char* name, const char* type, const char* help, double (*field)(const SerialDevice&)) {
+        text.header(name, type, help);
+        for (const auto& device : devices) {
+            text.sample(name, label("device", device->name).c_str(), field(*device));
+        }
+    };
+
+    text.header("ecm_reader_lines_total", "counter", "Non-empty lines received, by format.");
+    for (int f = 0; f < ParserMetrics::FORMAT_COUNT; ++f) {
+        uint64_t total = 0;
+        for (const auto& parser : parsers) {
+            total += parser->metrics().lines[f].value();
+        }
+        text.sample("ecm_reader_lines_total", FORMAT_LABELS[f], static_cast<double>(total));
+    }
+    device_samples("ecm_reader_bytes_total", "counter", "Bytes read from the serial port.",
+                   [](const SerialDevice& d) { return static_cast<double>(d.bytes.value()); });
+    device_samples("ecm_reader_dropped_bytes_total", "counter", "Bytes discarded because the parser queue was full.",
+                   [](const SerialDevice& d) { return static_cast<double>(d.dropped_bytes.value()); });
+    text.counter("ecm_reader_invalid_samples_total", "Sensor samples outside 0..1023, not logged.",
+                 parser_sum([](const ParserMetrics& m) { return m.invalid_samples.value(); }));
+    text.counter("ecm_reader_buffer_overflows_total", "Unterminated lines cleared for exceeding the line limit.",
+                 parser_sum([](const ParserMetrics& m) { return m.buffer_overflows.value(); }));
+    text.counter("ecm_reader_incomplete_line_timeouts_total", "Partial lines cleared after the incomplete-line timeout.",
+                 parser_sum([](const ParserMetrics& m) { return m.incomplete_timeouts.value(); }));
+    text.counter("ecm_reader_corrupt_frames_total", "Binary telemetry frames rejected by the COBS, CRC or length check.",
+                 parser_sum([](const ParserMetrics& m) { return m.corrupt_frames.value(); }));
+    auto sequence_samples = [&](const char* name, const char* type, const char* help,
+                                double (*field)(const SequenceStats&)) {
+        text.header(name, type, help);
+        for (const auto& device : devices) {
+            text.sample(name, label("device", device->name).c_str(),
+                        field(parsers[device->parser]->sequence(device->id)));
+        }
+    };
+    sequence_samples("ecm_reader_seq_received_total", "counter", "Distinct numbered samples received.",
+                     [](const SequenceStats& s) { return static_cast<double>(s.received); });
+    sequence_samples("ecm_reader_seq_lost_total", "counter",
+                     "Numbered samples skipped by sequence gaps and not received late.",
+                     [](const SequenceStats& s) { return static_cast<double>(s.lost); });
+    sequence_samples("ecm_reader_seq_late_total", "counter", "Samples received after a later-numbered one.",
+                     [](const SequenceStats& s) { return static_cast<double>(s.late); });
+    sequence_samples("ecm_reader_seq_duplicates_total", "counter", "Samples whose number was already seen, dropped.",
+                     [](const SequenceStats& s) { return static_cast<double>(s.duplicates); });
+    sequence_samples("ecm_reader_seq_restarts_total", "counter", "Times a sketch's numbering started over.",
+                     [](const SequenceStats& s) { return static_cast<double>(s.restarts); });
+    sequence_samples("ecm_reader_seq_loss_ratio", "gauge", "Lost samples as a fraction of the samples sent.",
+                     [](const SequenceStats& s) { return s.loss_ratio(); });
+    text.header("ecm_reader_clock_drift_ppm", "gauge",
+                "Fitted drift of each board's millis() against the host clock (positive: board is slow).");
+    for (const auto& device : devices) {
+        const DeviceClock* clock = parsers[device->parser]->clock(device->id);
+        text.sample("ecm_reader_clock_drift_ppm", label("device", device->name).c_str(),
+                    clock ? clock->drift_ppm() : 0.0);
+    }
+    text.header("ecm_reader_clock_resets_total", "counter",
+                "Times a device clock model started over (board reset, host clock step).");
+    for (const auto& device : devices) {
+        const DeviceClock* clock = parsers[device->parser]->clock(device->id);
+        text.sample("ecm_reader_clock_resets_total", label("device", device->name).c_str(),
+                    clock ? static_cast<double>(clock->resets()) : 0.0);
+    }
+    text.header("ecm_reader_sample_delay_seconds", "histogram",
+                "Time from a sample being taken (device clock) to its last byte arriving, less its time on the wire.");
+    for (const auto& device : devices) {
+        if (const DeviceClock* clock = parsers[device->parser]->clock(device->id)) {
+            text.histogram_seconds("ecm_reader_sample_delay_seconds", nullptr, clock->delay(),
+                                   label("device", device->name).c_str());
+        }
+    }
+    device_samples("ecm_reader_reconnects_total", "counter", "Successful port reopens.",
+                   [](const SerialDevice& d) { return static_cast<double>(d.reconnects.value()); });
+    device_samples("ecm_reader_reconnect_failures_total", "counter", "Failed port reopen attempts.",
+                   [](const SerialDevice& d) { return static_cast<double>(d.reconnect_failures.value()); });
+    device_samples("ecm_reader_port_open", "gauge", "1 while the serial port is open.",
+                   [](const SerialDevice& d) { return d.port_open.load() ? 1.0 : 0.0; });
+    text.header("ecm_reader_outage_seconds", "histogram", "Time from losing a serial port to reopening it.");
+    for (const auto& device : devices) {
+        text.histogram_seconds("ecm_reader_outage_seconds", nullptr, device->outage_ns,
+                               label("device", device->name).c_str());
+    }
+    text.header("ecm_reader_replug_recovery_seconds", "histogram",
+                "Time from a port's device node reappearing to the port being reopened.");
+    for (const auto& device : devices) {
+        text.histogram_seconds("ecm_reader_replug_recovery_seconds", nullptr, device->recovery_ns,
+                               label("device", device->name).c_str());
+    }
+    text.gauge("ecm_reader_uptime_seconds", "Seconds since the reader started.",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    text.header("ecm_reader_process_seconds", "histogram",
+                "Parser time for the lines of one serial read (1 in 16 reads sampled).");
+    for (size_t i = 0; i < parsers.size(); ++i) {
+        text.histogram_seconds("ecm_reader_process_seconds", nullptr, parsers[i]->metrics().process_ns,
+                               label("parser", std::to_string(i)).c_str());
+    }
+    text.header("ecm_queue_depth", "gauge", "Elements waiting between pipeline stages.");
+    for (size_t i = 0; i < parsers.size(); ++i) {
+        text.sample("ecm_queue_depth", ("queue=\"parser\"," + label("parser", std::to_string(i))).c_str(),
+                    static_cast<double>(parsers[i]->queued()));
+    }
+    text.sample("ecm_queue_depth", "queue=\"console\"", static_cast<double>(console.queued()));
+    text.sample("ecm_queue_depth", "queue=\"log\"", static_cast<double>(log_sink.queued()));
+    text.counter("ecm_console_dropped_total", "Console messages dropped by the console overflow policy.",
+                 console.dropped());
+    text.counter("ecm_log_rows_written_total", "Rows committed to the sample log.", log_sink.rows_written());
+    text.counter("ecm_log_rows_dropped_total", "Rows dropped by the log overflow policy.", log_sink.dropped());
+    text.counter("ecm_log_write_errors_total", "Failed log commits.", log_sink.write_errors());
+    text.header("ecm_log_rollup_late_samples_total", "counter",
+                "Samples left out of a rollup tier because their bucket was already written.");
+    static const char* const TIER_LABELS[ROLLUP_TIERS] = {"tier=\"1s\"", "tier=\"1m\"", "tier=\"1h\""};
+    for (int t = 0; t < ROLLUP_TIERS; ++t) {
+        text.sample("ecm_log_rollup_late_samples_total", TIER_LABELS[t], static_cast<double>(log_sink.rollup_late(t)));
+    }
+    text.counter("ecm_log_rotations_total", "Log segments closed by rotation.", log_sink.rotations());
+    text.counter("ecm_log_segments_compressed_total", "Closed log segments gzipped.", log_sink.segments_compressed());
+    text.histogram_seconds("ecm_log_commit_seconds", "Time per log batch commit, including the durability step.",
+                           log_sink.commit_latency());
+    if (history) {
+        text.gauge("ecm_history_bytes", "Memory taken by the in-memory sample history.",
+                   static_cast<double>(history->memory_bytes()));
+        text.counter("ecm_history_evicted_chunks_total", "History chunks recycled for the memory budget or retention.",
+                     history->evicted_chunks());
+        text.header("ecm_history_samples_total", "counter", "Samples added to the in-memory history.");
+        for (const auto& device : devices) {
+            uint64_t samples = 0;
+            for (int stream = 0; stream < SAMPLE_STREAMS; ++stream) {
+                for (int f = 0; f < FIELD_COUNT; ++f) {
+                    samples += history->samples(history_series(device->id, stream, f));
+                }
+            }
+            text.sample("ecm_history_samples_total", label("device", device->name).c_str(),
+                        static_cast<double>(samples));
+        }
+    }
+    return out;
+}
+
+/**
+ * Extracts a parameter from the query string of a request path ("%XX" and '+' decoded).
+ * @return true if the parameter is present.
+ */
+bool query_value(const std::string& path, const char* name, std::string& value) {
+    size_t start = path.find('?');
+    const size_t name_length = std::strlen(name);
+    while (start != std::string::npos) {
+        ++start;
+        size_t end = path.find('&', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        if (end - start > name_length && path.compare(start, name_length, name) == 0 &&
+            path[start + name_length] == '=') {
+            value.clear();
+            for (size_t i = start + name_length + 1; i < end; ++i) {
+                if (path[i] == '+') {
+                    value += ' ';
+                } else if (path[i] == '%' && i + 2 < end && std::isxdigit(static_cast<unsigned char>(path[i + 1])) &&
+                           std::isxdigit(static_cast<unsigned char>(path[i + 2]))) {
+                    value += static_cast<char>(std::stoi(path.substr(i + 1, 2), nullptr, 16));
+                    i += 2;
+                } else {
+                    value += path[i];
+                }
+            }
+            return true;
+        }
+        start = path.find('&', start);
+    }
+    return false;
+}
+
+/**
+ * Answers GET /history from the in-memory sample history: without parameters
+ * a "Device,Stream,Sensor,Samples" list of the series, else the samples of one
+ * series as "Timestamp,Value" CSV.
+ *   device  port name or index (default: the first port)
+ *   stream  sample stream as listed, e.g. handler/2 (default: the first one with samples of the sensor)
+ *   sensor  field name as on the console, e.g. Temp (case-insensitive)
+ *   from, to  range in ms since the epoch (default: everything kept)
+ *   last    ... or the last N seconds
+ * @return false for an unknown device, stream or sensor.
+ */
+bool render_history(const std::string& path, const DeviceList& devices, const SeriesStore& history, std::string& body) {
+    char name[16];
+    std::string sensor_name;
+    if (!query_value(path, "sensor", sensor_name)) {
+        body = "Device,Stream,Sensor,Samples\n";
+        for (const auto& device : devices) {
+            for (int stream = 0; stream < SAMPLE_STREAMS; ++stream) {
+                for (int f = 0; f < FIELD_COUNT; ++f) {
+                    uint64_t samples = history.samples(history_series(device->id, stream, f));
+                    if (samples > 0) {
+                        stream_name(stream, name, sizeof(name));
+                        body += device->name + "," + name + "," + field_name(static_cast<SensorField>(f)) + "," +
+                                std::to_string(samples) + "\n";
+                    }
+                }
+            }
+        }
+        return true;
+    }
+    std::string device_name;
+    const SerialDevice* device = devices.front().get();
+    if (query_value(path, "device", device_name)) {
+        device = nullptr;
+        for (const auto& candidate : devices) {
+            if (candidate->name == device_name || std::to_string(candidate->id) == device_name) {
+                device = candidate.get();
+            }
+        }
+    }
+    int field = 0;
+    auto same_name = [&](const char* name) {
+        return sensor_name.size() == std::strlen(name) &&
+               std::equal(sensor_name.begin(), sensor_name.end(), name, [](char a, char b) {
+                   return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+               });
+    };
+    while (field < FIELD_COUNT && !same_name(field_name(static_cast<SensorField>(field)))) {
+        ++field;
+    }
+    int stream = 0;
+    std::string wanted_stream;
+    if (device && field < FIELD_COUNT) {
+        if (query_value(path, "stream", wanted_stream)) {
+            for (; stream < SAMPLE_STREAMS; ++stream) {
+                stream_name(stream, name, sizeof(name));
+                if (wanted_stream == name) {
+                    break;
+                }
+            }
+        } else {
+            while (stream < SAMPLE_STREAMS - 1 && history.samples(history_series(device->id, stream, field)) == 0) {
+                ++stream;
+            }
+        }
+    }
+    if (!device || field == FIELD_COUNT || stream == SAMPLE_STREAMS) {
+        body = "Unknown device, stream or sensor\n";
+        return false;
+    }
+    std::string value;
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;
+    if (query_value(path, "last", value)) {
+        from_ms = wall_clock_ms() - static_cast<int64_t>(std::atof(value.c_str()) * 1000);
+    }
+    if (query_value(path, "from", value)) {
+        from_ms = std::atoll(value.c_str());
+    }
+    if (query_value(path, "to", value)) {
+        to_ms = std::atoll(value.c_str());
+    }
+    std::vector<SeriesPoint> points;
+    history.read(history_series(device->id, stream, field), from_ms, to_ms, points);
+    body = "Timestamp,Value\n";
+    body.reserve(body.size() + points.size() * 36);
+    TimestampClock clock;
+    char line[TimestampClock::BUFFER_SIZE + 32];
+    for (const SeriesPoint& p : points) {
+        clock.format(p.time_ms, line);
+        size_t length = std::strlen(line);
+        length += static_cast<size_t>(std::snprintf(line + length, sizeof(line) - length, ",%.10g\n", p.value));
+        body.append(line, length);
+    }
+    return true;
+}
+
+/**
+ * Formats the one-line summary for --stats-interval.
+ * @param recovery Replug recovery times of all ports.
+ * @param elapsed_s Seconds since the previous summary.
+ * @param previous_lines Line total at the previous summary; updated.
+ */
+std::string format_stats(const DeviceList& devices, const ParserList& parsers, const ConsoleSink& console,
+                         const LogSink& log_sink, const Histogram& recovery, double elapsed_s,
+                         uint64_t& previous_lines) {
+    uint64_t lines = 0, invalid = 0, malformed = 0, overflows = 0, timeouts = 0, corrupt = 0;
+    for (const auto& parser : parsers) {
+        const ParserMetrics& m = parser->metrics();
+        lines += m.total_lines();
+        invalid += m.invalid_samples.value();
+        malformed += m.lines[static_cast<int>(LineFormat::MALFORMED)].value();
+        overflows += m.buffer_overflows.value();
+        timeouts += m.incomplete_timeouts.value();
+        corrupt += m.corrupt_frames.value();
+    }
+    uint64_t reconnects = 0, dropped_bytes = 0;
+    SequenceStats sequence;
+    size_t open = 0;
+    for (const auto& device : devices) {
+        reconnects += device->reconnects.value();
+        dropped_bytes += device->dropped_bytes.value();
+        open += device->port_open.load() ? 1 : 0;
+        sequence.add(parsers[device->parser]->sequence(device->id));
+    }
+    const Histogram& commit = log_sink.commit_latency();
+    char summary[560];
+    std::snprintf(summary, sizeof(summary),
+                  "Stats | ports open %zu/%zu | lines %llu (%.1f/s), invalid %llu, malformed %llu, corrupt frames %llu, "
+                  "overflows %llu, timeouts %llu, reconnects %llu (recovery p50 %.1f ms), dropped bytes %llu | "
+                  "seq lost %llu (%.3f%%), late %llu, duplicates %llu | "
+                  "console dropped %llu | "
+                  "log rows %llu, dropped %llu, commit p50 %.2f ms p99 %.2f ms max %.2f ms",
+                  open, devices.size(), static_cast<unsigned long long>(lines),
+                  elapsed_s > 0 ? (lines - previous_lines) / elapsed_s : 0.0,
+                  static_cast<unsigned long long>(invalid), static_cast<unsigned long long>(malformed),
+                  static_cast<unsigned long long>(corrupt), static_cast<unsigned long long>(overflows),
+                  static_cast<unsigned long long>(timeouts), static_cast<unsigned long long>(reconnects),
+                  recovery.quantile(0.5) / 1e6,
+                  static_cast<unsigned long long>(dropped_bytes), static_cast<unsigned long long>(sequence.lost),
+                  100.0 * sequence.loss_ratio(), static_cast<unsigned long long>(sequence.late),
+                  static_cast<unsigned long long>(sequence.duplicates), static_cast<unsigned long long>(console.dropped()),
+                  static_cast<unsigned long long>(log_sink.rows_written()),
+                  static_cast<unsigned long long>(log_sink.dropped()),
+                  commit.quantile(0.5) / 1e6, commit.quantile(0.99) / 1e6, commit.max() / 1e6);
+    previous_lines = lines;
+    return summary;
+}
+
+/**
+ * @return Log of a sample format next to the main log, e.g. "sensor_data.handler.csv" for "sensor_data.csv".
+ */
+std::string format_log_name(const std::string& log_filename, LineFormat format) {
+    char name[16];
+    stream_name(static_cast<int>(format) * SENSOR_IDS, name, sizeof(name));
+    std::filesystem::path path(log_filename);
+    path.replace_filename(path.stem().string() + "." + name + ".csv");
+    return path.string();
+}
+
+/**
+ * Splits a comma-separated port list.
+ * @return The non-empty names in order.
+ */
+std::vector<std::string> split_ports(const std::string& list) {
+    std::vector<std::string> names;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > start) {
+            names.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return names;
+}
+
+/**
+ * Opens a device's port for reading and applies the serial settings.
+ * @throws std::runtime_error naming the failed step.
+ */
+void open_device(SerialDevice& device, sp_port_config* config) {
+    if (!device.port) {
+        sp_port* raw_port = nullptr;
+        check_error(sp_get_port_by_name(device.name.c_str(), &raw_port), "Finding port");
+        device.port.reset(raw_port);
+    }
+    check_error(sp_open(device.port.get(), SP_MODE_READ), "Opening port");
+    enum sp_return result = sp_set_config(device.port.get(), config);
+    if (result < 0) {
+        sp_close(device.port.get());
+        check_error(result, "Applying config");
+    }
+    device.open = true;
+    device.ever_open = true;
+    device.port_open = true;
+}
+
+/**
+ * Closes a device's port after a read error; the read loop reopens it once it is back.
+ */
+void close_device(SerialDevice& device) {
+    sp_close(device.port.get());
+    device.open = false;
+    device.port_open = false;
+    device.lost_at = SerialDevice::Clock::now();
+    device.next_check = device.lost_at;
+    device.node_seen = false;
+}
+
 // Signal handler for graceful exit
 volatile sig_atomic_t running = 1;
 void signal_handler(int sig) {
@@ -116,10 +704,28 @@ void signal_handler(int sig) {
 }
 
 /**
- * Main function to read serial data from Arduino, parse sensor values, and log to CSV.
- * Expects data format: "Sensor values: gas=%d, temp=%d, s3=%d" or AT/HTTP responses.
+ * Main function to read serial data from Arduinos, parse sensor values, and log to CSV.
+ * One read thread services every port from a single event loop and hands each
+ * read to one of a small pool of ParserStage threads (each owning a share of the
+ * ports), which frame and parse the bytes and feed the shared ConsoleSink and
+ * LogSink threads through bounded queues. With several ports every sample is
+ * tagged with its port name. A lost port given as a device path is reopened as
+ * soon as its node reappears (HotplugWatcher, or a stat() every 250 ms); a
+ * missing device path at startup is waited for the same way.
+ * Recognises every sketch format handled by parse_sensor_line(), or with
+ * --protocol=binary the same samples as telemetry frames. The
+ * "Sensor values: gas=%d, temp=%d, s3=%d" ADC samples are logged to the log
+ * file, along with gap markers for the numbered samples of every format; the
+ * samples of each other format go to a CSV log of their own next to it
+ * (format_log_name()), created with its first sample, with a Device column
+ * that names the port and, for sensors other than 0, the sensor id ("COM3/2").
+ * All logs get the same rotation and rollups.
  * @param argc Number of command-line arguments.
- * @param argv Array of command-line arguments: [1] port, [2] CSV file, [3] baud rate.
+ * @param argv Array of command-line arguments: [1] port or comma-separated ports, [2] CSV file,
+ *             [3] baud rate, plus optional flags (--read-mode, --protocol, --timestamps, --format, --batch-rows, --batch-ms,
+ *             --durability, --rollups, --metrics-port, --stats-interval, --console-overflow,
+ *             --log-overflow, --console, --refresh-hz, --quiet, --rotate, --rotate-size, --compress,
+ *             --history, --history-hours, --parsers).
  * @return 0 on success, 1 on failure.
  */
 int main(int argc, char* argv[]) {
@@ -128,45 +734,241 @@ int main(int argc, char* argv[]) {
     signal(SIGTERM, signal_handler);
 
     try {
+        // Split command-line arguments into positional values and --flags
+        std::vector<std::string> positional;
+        ReadMode read_mode = ReadMode::EVENT;
+        ParserStage::Options parser_options;
+        LogSink::Options log_options;
+        ConsoleSink::Options console_options;
+        int metrics_port = 0;        // 0: no metrics endpoint
+        SeriesStore::Options history_options;
+        double stats_interval = 0;   // Seconds between stats lines on stderr, 0: off
+        int parser_count = 0;        // 0: one per port, up to one per spare core
+        bool bad_args = false;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            std::string value;
+            if (arg == "--read-mode=event") {
+                read_mode = ReadMode::EVENT;
+            } else if (arg == "--read-mode=poll") {
+                read_mode = ReadMode::POLL;
+            } else if (arg == "--protocol=text") {
+                parser_options.protocol = SerialProtocol::TEXT;
+            } else if (arg == "--protocol=binary") {
+                parser_options.protocol = SerialProtocol::BINARY;
+            } else if (arg == "--timestamps=device") {
+                parser_options.device_time = true;
+            } else if (arg == "--timestamps=arrival") {
+                parser_options.device_time = false;
+            } else if (arg == "--format=csv") {
+                log_options.format = LogFormat::CSV;
+            } else if (arg == "--format=bin") {
+                log_options.format = LogFormat::BINARY;
+            } else if (option_value(arg, "--batch-rows", value)) {
+                int rows = std::atoi(value.c_str());
+                bad_args |= rows <= 0;
+                log_options.batch_rows = rows > 0 ? rows : 1;
+            } else if (option_value(arg, "--batch-ms", value)) {
+                int ms = std::atoi(value.c_str());
+                bad_args |= ms <= 0;
+                log_options.batch_interval = std::chrono::milliseconds(ms > 0 ? ms : 1);
+            } else if (arg == "--durability=none") {
+                log_options.durability = Durability::NONE;
+            } else if (arg == "--durability=flush") {
+                log_options.durability = Durability::FLUSH;
+            } else if (arg == "--durability=fsync") {
+                log_options.durability = Durability::FSYNC;
+            } else if (arg == "--rollups=on") {
+                log_options.rollups = true;
+            } else if (arg == "--rollups=off") {
+                log_options.rollups = false;
+            } else if (option_value(arg, "--console-overflow", value)) {
+                bad_args |= !parse_overflow_policy(value, console_options.overflow);
+            } else if (option_value(arg, "--log-overflow", value)) {
+                bad_args |= !parse_overflow_policy(value, log_options.overflow);
+            } else if (option_value(arg, "--metrics-port", value)) {
+                metrics_port = std::atoi(value.c_str());
+                bad_args |= metrics_port <= 0 || metrics_port > 65535;
+            } else if (option_value(arg, "--stats-interval", value)) {
+                stats_interval = std::atof(value.c_str());
+                bad_args |= stats_interval <= 0;
+            } else if (arg == "--console=lines") {
+                console_options.mode = ConsoleMode::LINES;
+            } else if (arg == "--console=dashboard") {
+                console_options.mode = ConsoleMode::DASHBOARD;
+            } else if (arg == "--quiet") {
+                console_options.mode = ConsoleMode::QUIET;
+            } else if (option_value(arg, "--refresh-hz", value)) {
+                console_options.refresh_hz = std::atof(value.c_str());
+                bad_args |= console_options.refresh_hz <= 0 || console_options.refresh_hz > 100;
+            } else if (option_value(arg, "--rotate-size", value)) {
+                bad_args |= !parse_byte_size(value, log_options.rotate_bytes);
+            } else if (option_value(arg, "--rotate", value)) {
+                bad_args |= !parse_rotate_interval(value, log_options.rotate_every);
+            } else if (arg == "--compress=on") {
+                log_options.compress = true;
+            } else if (arg == "--compress=off") {
+                log_options.compress = false;
+            } else if (arg == "--history=off") {
+                history_options.memory_bytes = 0;
+            } else if (option_value(arg, "--history", value)) {
+                uint64_t bytes = 0;
+                bad_args |= !parse_byte_size(value, bytes);
+                history_options.memory_bytes = static_cast<size_t>(bytes);
+            } else if (option_value(arg, "--history-hours", value)) {
+                history_options.retention_ms = static_cast<int64_t>(std::atof(value.c_str()) * 3600 * 1000);
+                bad_args |= history_options.retention_ms <= 0;
+            } else if (option_value(arg, "--parsers", value)) {
+                parser_count = std::atoi(value.c_str());
+                bad_args |= parser_count <= 0;
+            } else if (arg.compare(0, 2, "--") == 0) {
+                bad_args = true;
+            } else {
+                positional.push_back(arg);
+            }
+        }
+
         // Parse command-line arguments
-        const std::string port_name = (argc > 1) ? argv[1] : "COM3";
-        const std::string csv_filename = (argc > 2) ? argv[2] : "sensor_data.csv";
-        int baud_rate = (argc > 3) ? std::atoi(argv[3]) : 9600;
+        const std::vector<std::string> port_names = split_ports((positional.size() > 0) ? positional[0] : "COM3");
+        const bool binary_log = log_options.format == LogFormat::BINARY;
+        const std::string log_filename = (positional.size() > 1) ? positional[1]
+                                         : binary_log ? "sensor_data.bin" : "sensor_data.csv";
+        int baud_rate = (positional.size() > 2) ? std::atoi(positional[2].c_str()) : 9600;
 
         // Validate arguments
-        if (argc > 4 || (argc > 3 && baud_rate <= 0)) {
-            std::cerr << "Usage: " << argv[0] << " [port] [csv_file] [baud_rate]\n"
+        if (bad_args || positional.size() > 3 || (positional.size() > 2 && baud_rate <= 0) || port_names.empty() ||
+            port_names.size() >= UINT16_MAX) {
+            std::cerr << "Usage: " << argv[0] << " [port[,port...]] [csv_file] [baud_rate] [options]\n"
+                      << "Options:\n"
+                      << "  --read-mode=event|poll          Wait for data events or poll every 100 ms\n"
+                      << "  --protocol=text|binary          Sketches print text lines or send telemetry frames\n"
+                      << "  --timestamps=device|arrival     Stamp samples with when the sketch took them (from its\n"
+                      << "                                  millis(), default) or with when they arrived\n"
+                      << "  --format=csv|bin                Log as CSV text or binary columnar blocks\n"
+                      << "  --batch-rows=N                  Commit CSV rows in batches of N (default 64)\n"
+                      << "  --batch-ms=T                    ... or every T milliseconds (default 200)\n"
+                      << "  --durability=none|flush|fsync   Per-batch durability (default flush)\n"
+                      << "  --rollups=on|off                Keep 1s/1m/1h min/max/sum/count files next to the log (default on)\n"
+                      << "  --metrics-port=N                Serve Prometheus metrics on http://127.0.0.1:N/metrics\n"
+                      << "                                  and recent samples on .../history\n"
+                      << "  --history=N[K|M|G]|off          Memory for the recent samples of every sensor (default 64M)\n"
+                      << "  --history-hours=H               ... kept for up to H hours (default 24)\n"
+                      << "  --stats-interval=S              Print a stats line to stderr every S seconds\n"
+                      << "  --console=lines|dashboard       Print every line, or redraw a per-sensor summary\n"
+                      << "  --refresh-hz=N                  Dashboard redraws per second (default 10)\n"
+                      << "  --quiet                         No console output except warnings and errors\n"
+                      << "  --console-overflow=POLICY       When the terminal falls behind: block, drop-oldest\n"
+                      << "                                  or sample (default sample)\n"
+                      << "  --log-overflow=POLICY           When the log writer falls behind (default block)\n"
+                      << "  --rotate=hourly|daily|none      Start a new CSV segment at each local hour or day\n"
+                      << "  --rotate-size=N[K|M|G]          ... or when the live CSV log reaches N bytes\n"
+                      << "  --compress=on|off               Gzip closed segments in the background (default on)\n"
+                      << "  --parsers=N                     Parser threads shared by the ports (default: one per\n"
+                      << "                                  port, at most one per spare core)\n"
                       << "Example: " << argv[0] << " COM3 sensor_data.csv 9600\n"
-                      << "Defaults: port=COM3, csv_file=sensor_data.csv, baud_rate=9600\n";
+                      << "         " << argv[0] << " /dev/ttyUSB0,/dev/ttyUSB1 sensor_data.csv 9600\n"
+                      << "Defaults: port=COM3, csv_file=sensor_data.csv (.bin with --format=bin), baud_rate=9600, read-mode=event\n";
             return 1;
         }
-
-        // Check if port exists
-        if (!port_exists(port_name)) {
-            std::cerr << "Port " << port_name << " not found. " << list_ports() << std::endl;
+        if (binary_log && port_names.size() > 1) {
+            std::cerr << "--format=bin logs a single device; use CSV with several ports" << std::endl;
+            return 1;
+        }
+        if (binary_log && (log_options.rotate_bytes > 0 || log_options.rotate_every != RotateInterval::NONE)) {
+            std::cerr << "--rotate and --rotate-size apply to CSV logs only" << std::endl;
             return 1;
         }
 
-        // Open CSV file
-        std::ofstream csv_file(csv_filename, std::ios::app);
-        if (!csv_file.is_open()) {
-            std::cerr << "Failed to open CSV file: " << csv_filename << std::endl;
+        // Check if the ports exist; a device path that is missing is waited for instead
+        for (const std::string& name : port_names) {
+            if (!is_device_path(name) && !port_exists(name)) {
+                std::cerr << "Port " << name << " not found. " << list_ports() << std::endl;
+                return 1;
+            }
+        }
+
+        // Spread the ports over the parser threads
+        if (parser_count <= 0) {
+            unsigned cores = std::thread::hardware_concurrency();
+            parser_count = static_cast<int>(cores > 1 ? cores - 1 : 1);
+        }
+        const size_t parsers_used = std::min(static_cast<size_t>(parser_count), port_names.size());
+        log_options.producers = parsers_used;
+        if (port_names.size() > 1) {
+            log_options.devices = port_names;
+        }
+
+        // Open the log file and start its writer thread
+        LogSink log_sink(log_filename, log_options);
+        if (!log_sink.start()) {
+            std::cerr << "Failed to open " << (binary_log ? "log" : "CSV") << " file: " << log_filename << std::endl;
             return 1;
         }
-        csv_file.seekp(0, std::ios::end);
-        if (csv_file.tellp() == 0) {
-            csv_file << "Timestamp,Gas,Temp,S3\n";
+
+        // The other formats' logs are CSV whatever the main log's format, and one device per sensor id
+        std::unique_ptr<LogSink> format_logs[SAMPLE_FORMATS];
+        for (int f = static_cast<int>(LineFormat::LEGACY) + 1; f < SAMPLE_FORMATS; ++f) {
+            LogSink::Options options = log_options;
+            options.format = LogFormat::CSV;
+            options.columns = format_log_columns(static_cast<LineFormat>(f));
+            options.open_on_first_row = true;
+            options.devices.clear();
+            for (const std::string& port : port_names) {
+                for (int id = 0; id < SENSOR_IDS; ++id) {
+                    options.devices.push_back(id == 0 ? port : port + "/" + std::to_string(id));
+                }
+            }
+            format_logs[f].reset(new LogSink(format_log_name(log_filename, static_cast<LineFormat>(f)), options));
+            format_logs[f]->start();
+            parser_options.format_logs[f] = format_logs[f].get();
         }
 
-        // Initialize serial port
-        UniquePort port(nullptr);
-        {
-            sp_port* raw_port = nullptr;
-            check_error(sp_get_port_by_name(port_name.c_str(), &raw_port), "Finding port");
-            port.reset(raw_port);
+        // Pipeline stages and devices; the metrics server is declared after
+        // everything its handler reads, so it stops first
+        const auto started = std::chrono::steady_clock::now();
+        console_options.producers = parsers_used;
+        console_options.devices = port_names;
+        ConsoleSink console(std::cout, std::cerr, console_options);
+        parser_options.baud_rate = baud_rate;
+        // The history is only read through the metrics server
+        std::unique_ptr<SeriesStore> history;
+        if (metrics_port > 0 && history_options.memory_bytes > 0) {
+            history.reset(new SeriesStore(port_names.size() * SAMPLE_STREAMS * FIELD_COUNT, history_options));
+            parser_options.history = history.get();
+        }
+        ParserList parsers;
+        for (size_t i = 0; i < parsers_used; ++i) {
+            parsers.emplace_back(new ParserStage(i, port_names.size(), parser_options, console, log_sink));
+        }
+        DeviceList devices;
+        for (size_t i = 0; i < port_names.size(); ++i) {
+            devices.emplace_back(new SerialDevice());
+            SerialDevice& device = *devices.back();
+            device.name = port_names[i];
+            device.id = static_cast<uint16_t>(i);
+            device.parser = i % parsers_used;
+            parsers[device.parser]->add_device(device.id);
+        }
+        MetricsServer metrics_server;
+        if (metrics_port > 0 &&
+            !metrics_server.start(static_cast<uint16_t>(metrics_port),
+                                  [&](const std::string& path, std::string& body, std::string& content_type) {
+                                      if (history && (path == "/history" || path.compare(0, 9, "/history?") == 0)) {
+                                          content_type = "text/csv; charset=utf-8";
+                                          return render_history(path, devices, *history, body);
+                                      }
+                                      if (path != "/metrics" && path != "/") {
+                                          return false;
+                                      }
+                                      body = render_metrics(devices, parsers, console, log_sink, history.get(), started);
+                                      content_type = "text/plain; version=0.0.4";
+                                      return true;
+                                  })) {
+            std::cerr << "Failed to listen on metrics port " << metrics_port << std::endl;
+            return 1;
         }
-        check_error(sp_open(port.get(), SP_MODE_READ), "Opening port");
 
+        // Initialize serial ports
         UniqueConfig config(nullptr);
         {
             sp_port_config* raw_config = nullptr;
@@ -177,145 +979,341 @@ int main(int argc, char* argv[]) {
         check_error(sp_set_config_bits(config.get(), 8), "Setting data bits");
         check_error(sp_set_config_parity(config.get(), SP_PARITY_NONE), "Setting parity");
         check_error(sp_set_config_stopbits(config.get(), 1), "Setting stop bits");
-        check_error(sp_set_config(port.get(), config.get()), "Applying config");
-
-        // Print startup message
-        std::cout << "----------------------------------------\n"
-                  << "Serial Reader started\n"
-                  << "Port: " << port_name << "\n"
-                  << "Baud rate: " << baud_rate << "\n"
-                  << "Logging to: " << csv_filename << "\n"
-                  << "Press Ctrl+C to exit\n"
-                  << "----------------------------------------\n";
+        std::vector<std::string> missing;
+        for (auto& device : devices) {
+            if (is_device_path(device->name) && !device_node_exists(device->name)) {
+                device->lost_at = SerialDevice::Clock::now();
+                missing.push_back(device->name);
+                continue;
+            }
+            try {
+                open_device(*device, config.get());
+            } catch (const std::exception& e) {
+                throw std::runtime_error(device->name + ": " + e.what());
+            }
+        }
 
-        // Serial reading variables
-        char buffer[256];
-        std::string accumulated_data;
-        const unsigned long RECONNECT_INTERVAL = 5000; // Retry every 5s
-        unsigned long lastReconnectAttempt = 0;
-        const size_t MAX_ACCUMULATED_SIZE = 4096; // Max accumulated data size
-        bool port_open = true;
-        auto last_data_time = std::chrono::steady_clock::now();
-        const auto INCOMPLETE_LINE_TIMEOUT = std::chrono::seconds(10);
+        // Watch for lost ports coming back
+        HotplugWatcher hotplug;
+        hotplug.start(port_names);
+        PortWaiter waiter;
+        if (read_mode == ReadMode::EVENT) {
+            waiter.rebuild(devices, hotplug.fd());
+        }
 
-        while (running) {
-            // Check CSV file status
-            if (!csv_file.good()) {
-                std::cerr << getTimestamp() << " CSV file error, attempting to reopen...\n";
-                csv_file.close();
-                csv_file.open(csv_filename, std::ios::app);
-                if (!csv_file.is_open()) {
-                    std::cerr << getTimestamp() << " Failed to reopen CSV file!\n";
-                } else if (csv_file.tellp() == 0) {
-                    csv_file << "Timestamp,Gas,Temp,S3\n";
+        // Print startup message (the dashboard draws over it; quiet mode prints nothing)
+        if (console_options.mode == ConsoleMode::LINES) {
+            std::cout << "----------------------------------------\n"
+                      << "Serial Reader started\n";
+            if (devices.size() == 1) {
+                std::cout << "Port: " << port_names[0] << "\n";
+            } else {
+                std::cout << "Ports:";
+                for (const std::string& name : port_names) {
+                    std::cout << " " << name;
                 }
+                std::cout << " (" << parsers_used << " parser thread" << (parsers_used > 1 ? "s" : "") << ")\n";
             }
-
-            // Read data from serial port if open
-            int bytes_read = 0;
-            if (port_open) {
-                try {
-                    bytes_read = sp_blocking_read(port.get(), buffer, sizeof(buffer) - 1, 1000);
-                } catch (const std::exception& e) {
-                    std::cerr << getTimestamp() << " Serial read exception: " << e.what() << "\n";
-                    bytes_read = -1; // Trigger reconnect
+            std::cout << "Baud rate: " << baud_rate << "\n"
+                      << "Read mode: " << (read_mode == ReadMode::EVENT ? "event" : "poll") << "\n"
+                      << "Protocol: " << (parser_options.protocol == SerialProtocol::BINARY ? "binary frames" : "text")
+                      << "\n"
+                      << "Timestamps: "
+                      << (parser_options.device_time ? "device clock where the sketch sends millis()" : "arrival")
+                      << "\n"
+                      << "Logging to: " << log_filename << (binary_log ? " (binary)" : "") << "\n"
+                      << "Other formats to: " << format_log_name(log_filename, LineFormat::JSON) << ", "
+                      << format_log_name(log_filename, LineFormat::HANDLER) << ", "
+                      << format_log_name(log_filename, LineFormat::DHT) << " (once they have a sample)\n";
+            if (log_options.rotate_bytes > 0 || log_options.rotate_every != RotateInterval::NONE) {
+                std::cout << "Rotation:";
+                if (log_options.rotate_every != RotateInterval::NONE) {
+                    std::cout << (log_options.rotate_every == RotateInterval::HOURLY ? " hourly" : " daily");
+                }
+                if (log_options.rotate_bytes > 0) {
+                    std::cout << " every " << (log_options.rotate_bytes >> 10) << " KiB";
+                }
+                std::cout << (log_options.compress ? ", gzip closed segments" : "") << "\n";
+            }
+            if (metrics_port > 0) {
+                std::cout << "Metrics: http://127.0.0.1:" << metrics_port << "/metrics\n";
+                if (history) {
+                    std::cout << "History: http://127.0.0.1:" << metrics_port << "/history (up to "
+                              << (history_options.memory_bytes >> 20) << " MiB, "
+                              << history_options.retention_ms / 3600000.0 << " h)\n";
                 }
             }
+            std::cout << "Press Ctrl+C to exit\n"
+                      << "----------------------------------------\n";
+        }
 
-            if (bytes_read > 0) {
-                buffer[bytes_read] = '\0';
+        // Serial reading variables
+        const auto RECONNECT_INTERVAL = std::chrono::milliseconds(5000); // Retry ports we cannot stat every 5s
+        const auto NODE_CHECK_INTERVAL = std::chrono::milliseconds(250);  // stat() a lost device path this often
+        const unsigned int EVENT_WAIT_TIMEOUT_MS = 1000; // Upper bound on one wait
+        static char discard[RawChunk::CAPACITY]; // Read target while a parser queue is full
+        std::vector<SerialDevice*> hung_up;
+        std::vector<size_t> appeared;
+        Histogram outage_ns;            // All ports, for the exit summary
+        Histogram recovery_ns;
+        auto last_stats_time = std::chrono::steady_clock::now();
+        uint64_t last_stats_lines = 0;
+        for (const std::string& name : missing) {
+            console.post_status(ConsoleEvent::ERR, "Waiting for " + name + " to appear");
+        }
+        console.start();
+        for (auto& parser : parsers) {
+            parser->start();
+        }
 
-                // Check if adding data exceeds max size
-                if (accumulated_data.size() + bytes_read > MAX_ACCUMULATED_SIZE) {
-                    std::cerr << getTimestamp() << " Warning: Accumulated data too large, clearing!\n";
-                    accumulated_data.clear();
+        // Hand the bytes just read to the device's parser, or count them as lost if it is behind
+        auto deliver = [&](SerialDevice& device, RawChunk* slot, int length) {
+            device.bytes.add(static_cast<uint64_t>(length));
+            if (slot) {
+                slot->time_ms = wall_clock_ms();
+                slot->device = device.id;
+                slot->length = static_cast<uint32_t>(length);
+                parsers[device.parser]->publish();
+                device.parser_behind = false;
+            } else {
+                device.dropped_bytes.add(static_cast<uint64_t>(length));
+                if (!device.parser_behind) {
+                    console.post_status(ConsoleEvent::ERR, "Warning: parser is behind, dropping serial data from " +
+                                                               device.name);
+                    device.parser_behind = true;
                 }
-                accumulated_data.append(buffer, bytes_read);
-                last_data_time = std::chrono::steady_clock::now();
-
-                // Process complete lines
-                size_t pos;
-                while ((pos = accumulated_data.find('\n')) != std::string::npos) {
-                    std::string line = accumulated_data.substr(0, pos);
-                    accumulated_data.erase(0, pos + 1);
-
-                    // Remove trailing \r or \n
-                    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
-                        line.pop_back();
-                    }
+            }
+        };
 
-                    // Process non-empty lines
-                    if (!line.empty()) {
-                        std::string timestamp = getTimestamp();
-                        if (line.find("Sensor values") != std::string::npos) {
-                            int gas, temp, s3;
-                            if (sscanf(line.c_str(), "Sensor values: gas=%d, temp=%d, s3=%d", &gas, &temp, &s3) == 3) {
-                                // Validate sensor values
-                                bool valid = true;
-                                if (gas < 0 || gas > 1023 || temp < 0 || temp > 1023 || s3 < 0 || s3 > 1023) {
-                                    std::cerr << timestamp << " Warning: Invalid sensor values - Gas: " << gas
-                                              << ", Temp: " << temp << ", S3: " << s3 << "\n";
-                                    valid = false;
-                                }
-                                if (valid) {
-                                    std::cout << timestamp << " Sensor | Gas: " << std::setw(4) << gas
-                                              << ", Temp: " << std::setw(4) << temp
-                                              << ", S3: " << std::setw(4) << s3 << "\n";
-                                    if (csv_file.good()) {
-                                        csv_file << timestamp << "," << gas << "," << temp << "," << s3 << "\n";
-                                        csv_file.flush();
-                                    }
+        // Read everything a port holds without blocking
+        // @return Bytes read, or a negative libserialport error
+        auto drain = [&](SerialDevice& device) {
+            ParserStage& parser = *parsers[device.parser];
+            int total = 0;
+            while (true) {
+                RawChunk* slot = parser.read_slot();
+                int chunk = sp_nonblocking_read(device.port.get(), slot ? slot->data : discard, RawChunk::CAPACITY);
+                if (chunk <= 0) {
+                    return chunk < 0 ? chunk : total;
+                }
+                deliver(device, slot, chunk);
+                total += chunk;
+            }
+        };
+
+        while (running) {
+            // Read data from the open ports
+            bool any_open = false;
+            bool any_closed = false;
+            bool changed = false;
+            for (auto& device : devices) {
+                any_open |= device->open;
+                any_closed |= !device->open;
+            }
+            // While a port is down, wake up often enough to stat() its node
+            const unsigned int wait_ms =
+                any_closed ? static_cast<unsigned int>(NODE_CHECK_INTERVAL.count()) : EVENT_WAIT_TIMEOUT_MS;
+            if (any_open) {
+                try {
+                    if (read_mode == ReadMode::EVENT) {
+                        // Sleep until a port signals data, then drain everything the ports hold
+                        auto wait_start = std::chrono::steady_clock::now();
+                        waiter.wait(wait_ms, hung_up);
+                        size_t open_count = 0;
+                        for (auto& device : devices) {
+                            if (!device->open) {
+                                continue;
+                            }
+                            ++open_count;
+                            int bytes_read = drain(*device);
+                            bool failed = bytes_read < 0 ||
+                                          (bytes_read == 0 &&
+                                           std::find(hung_up.begin(), hung_up.end(), device.get()) != hung_up.end());
+#ifdef _WIN32
+                            // Woken early with nothing to read: a lone device hung up
+                            failed |= bytes_read == 0 && devices.size() == 1 && running &&
+                                      std::chrono::steady_clock::now() - wait_start <
+                                          std::chrono::milliseconds(wait_ms);
+#else
+                            (void)wait_start;
+#endif
+                            if (failed) {
+                                console.post_status(ConsoleEvent::ERR, "Error reading from " + device->name +
+                                                                           ", reconnecting...");
+                                close_device(*device);
+                                changed = true;
+                            }
+                        }
+                    } else {
+                        for (auto& device : devices) {
+                            if (!device->open) {
+                                continue;
+                            }
+                            int bytes_read;
+                            if (devices.size() == 1) {
+                                RawChunk* slot = parsers[0]->read_slot();
+                                bytes_read = sp_blocking_read(device->port.get(), slot ? slot->data : discard,
+                                                              RawChunk::CAPACITY, 1000);
+                                if (bytes_read > 0) {
+                                    deliver(*device, slot, bytes_read);
                                 }
                             } else {
-                                std::cout << timestamp << " Invalid Sensor Data: " << line << "\n";
+                                bytes_read = drain(*device);
+                            }
+                            if (bytes_read < 0) {
+                                console.post_status(ConsoleEvent::ERR, "Error reading from " + device->name +
+                                                                           ", reconnecting...");
+                                close_device(*device);
                             }
-                        } else if (line.find("OK") != std::string::npos ||
-                                   line.find("ERROR") != std::string::npos ||
-                                   line.find("HTTP") != std::string::npos) {
-                            std::cout << timestamp << " Response | " << line << "\n";
-                        } else {
-                            std::cout << timestamp << " Data     | " << line << "\n";
                         }
                     }
+                } catch (const std::exception& e) {
+                    console.post_status(ConsoleEvent::ERR, std::string("Serial read exception: ") + e.what());
+                    // Trigger reconnect
+                    for (auto& device : devices) {
+                        if (device->open) {
+                            close_device(*device);
+                        }
+                    }
+                    changed = true;
+                }
+            }
+
+            // Reopen lost ports: a device path as soon as the hotplug watch or a stat()
+            // sees its node back, any other name every RECONNECT_INTERVAL
+            if (any_closed) {
+                hotplug.refresh();
+                hotplug.read_events(appeared);
+                for (size_t id : appeared) {
+                    devices[id]->node_appeared = true;
+                }
+            }
+            for (auto& device : devices) {
+                auto now = SerialDevice::Clock::now();
+                if (device->open || (!device->node_appeared && now < device->next_check)) {
+                    continue;
+                }
+                const bool by_path = is_device_path(device->name);
+                device->node_appeared = false;
+                device->next_check = now + (by_path ? NODE_CHECK_INTERVAL : RECONNECT_INTERVAL);
+                if (by_path) {
+                    if (!device_node_exists(device->name)) {
+                        device->node_seen = false;
+                        continue;
+                    }
+                    if (!device->node_seen) {
+                        device->node_seen = true;
+                        device->node_seen_at = now;
+                    }
                 }
-            } else if (bytes_read < 0 && port_open) {
-                unsigned long now = std::chrono::duration_cast<std::chrono::milliseconds>(
-                                        std::chrono::system_clock::now().time_since_epoch()).count();
-                if (now - lastReconnectAttempt >= RECONNECT_INTERVAL) {
-                    std::cerr << getTimestamp() << " Error reading from port, reconnecting...\n";
-                    sp_close(port.get());
-                    port_open = false;
-                    try {
-                        check_error(sp_open(port.get(), SP_MODE_READ), "Reopening port");
-                        check_error(sp_set_config(port.get(), config.get()), "Reapplying config");
-                        std::cout << getTimestamp() << " Reconnected to " << port_name << "\n";
-                        port_open = true;
-                    } catch (const std::exception& e) {
-                        std::cerr << getTimestamp() << " Reconnect failed: " << e.what() << ", retrying in "
-                                  << RECONNECT_INTERVAL / 1000 << "s\n";
+                const bool first_open = !device->ever_open;
+                try {
+                    open_device(*device, config.get());
+                    changed = true;
+                } catch (const std::exception& e) {
+                    device->reconnect_failures.add();
+                    if (now >= device->next_report) {
+                        console.post_status(ConsoleEvent::ERR,
+                                            "Reconnect to " + device->name + " failed: " + e.what() + ", retrying" +
+                                                (by_path ? "" : " in " + std::to_string(RECONNECT_INTERVAL.count() / 1000) + "s"));
+                        device->next_report = now + RECONNECT_INTERVAL;
                     }
-                    lastReconnectAttempt = now;
+                    continue;
+                }
+                auto reopened = SerialDevice::Clock::now();
+                if (first_open) {
+                    console.post_status(ConsoleEvent::OUT, "Opened " + device->name);
+                    continue;
+                }
+                device->reconnects.add();
+                device->next_report = reopened;
+                auto outage = std::chrono::duration_cast<std::chrono::nanoseconds>(reopened - device->lost_at).count();
+                device->outage_ns.record(static_cast<uint64_t>(outage));
+                outage_ns.record(static_cast<uint64_t>(outage));
+                char detail[96];
+                std::snprintf(detail, sizeof(detail), " after %.2f s offline", outage / 1e9);
+                std::string message = "Reconnected to " + device->name + detail;
+                if (by_path) {
+                    auto recovery =
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(reopened - device->node_seen_at).count();
+                    device->recovery_ns.record(static_cast<uint64_t>(recovery));
+                    recovery_ns.record(static_cast<uint64_t>(recovery));
+                    std::snprintf(detail, sizeof(detail), ", %.1f ms after the port reappeared", recovery / 1e6);
+                    message += detail;
                 }
+                console.post_status(ConsoleEvent::OUT, message);
+            }
+            if (changed && read_mode == ReadMode::EVENT) {
+                waiter.rebuild(devices, hotplug.fd());
             }
 
-            // Check for incomplete lines timeout
-            if (!accumulated_data.empty()) {
+            if (stats_interval > 0) {
                 auto now = std::chrono::steady_clock::now();
-                if (now - last_data_time > INCOMPLETE_LINE_TIMEOUT) {
-                    std::cerr << getTimestamp() << " Warning: Incomplete line timed out, clearing buffer\n";
-                    accumulated_data.clear();
-                    last_data_time = now;
+                double elapsed = std::chrono::duration<double>(now - last_stats_time).count();
+                if (elapsed >= stats_interval) {
+                    console.post_status(ConsoleEvent::ERR, format_stats(devices, parsers, console, log_sink,
+                                                                        recovery_ns, elapsed, last_stats_lines));
+                    last_stats_time = now;
                 }
             }
 
-            // Sleep to reduce CPU usage
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            // Poll mode sleeps to reduce CPU usage; while every port is down event mode
+            // waits on the hotplug watch alone
+            if (read_mode == ReadMode::POLL) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            } else if (!any_open) {
+                waiter.wait(wait_ms, hung_up);
+            }
         }
 
-        // Cleanup
-        std::cout << getTimestamp() << " Exiting gracefully...\n";
-        if (csv_file.is_open()) {
-            csv_file.close();
+        // Cleanup: drain the stages in pipeline order
+        for (auto& parser : parsers) {
+            parser->stop();
+        }
+        console.stop();
+        log_sink.stop();
+        for (auto& format_log : format_logs) {
+            if (format_log) {
+                format_log->stop();
+            }
+        }
+        if (console_options.mode != ConsoleMode::QUIET) {
+            if (outage_ns.count() > 0) {
+                char summary[160];
+                int length = std::snprintf(summary, sizeof(summary), "Reconnects: %llu, median outage %.2f s",
+                                           static_cast<unsigned long long>(outage_ns.count()),
+                                           outage_ns.quantile(0.5) / 1e9);
+                if (recovery_ns.count() > 0) {
+                    std::snprintf(summary + length, sizeof(summary) - length,
+                                  ", median recovery %.2f ms after the port reappeared", recovery_ns.quantile(0.5) / 1e6);
+                }
+                std::cout << getTimestamp() << " " << summary << "\n";
+            }
+            for (const auto& device : devices) {
+                SequenceStats sequence = parsers[device->parser]->sequence(device->id);
+                if (sequence.received == 0) {
+                    continue;
+                }
+                char summary[200];
+                std::snprintf(summary, sizeof(summary),
+                              "%s: %llu numbered samples, %llu lost (%.3f%%), %llu late, %llu duplicates, %llu restarts",
+                              device->name.c_str(), static_cast<unsigned long long>(sequence.received),
+                              static_cast<unsigned long long>(sequence.lost), 100.0 * sequence.loss_ratio(),
+                              static_cast<unsigned long long>(sequence.late),
+                              static_cast<unsigned long long>(sequence.duplicates),
+                              static_cast<unsigned long long>(sequence.restarts));
+                std::cout << getTimestamp() << " " << summary << "\n";
+            }
+            std::cout << getTimestamp() << " Exiting gracefully...\n";
+        }
+        if (log_sink.dropped() > 0) {
+            std::cerr << getTimestamp() << " Warning: " << log_sink.dropped() << " samples dropped by the log writer\n";
+        }
+        for (int f = 0; f < SAMPLE_FORMATS; ++f) {
+            if (format_logs[f] && format_logs[f]->dropped() > 0) {
+                std::cerr << getTimestamp() << " Warning: " << format_logs[f]->dropped() << " samples dropped by the "
+                          << format_log_name(log_filename, static_cast<LineFormat>(f)) << " writer\n";
+            }
         }
     } catch (const std::exception& e) {
         std::cerr << getTimestamp() << " Fatal error: " << e.what() << std::endl;
@@ -326,4 +1324,4 @@ int main(int argc, char* argv[]) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,504 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sensor_parser.h"
+#include "telemetry_frame.h"
+
+/**
+ * Stands in for a board on the serial port: creates a pseudo-terminal and
+ * writes the lines our sketches print, so the PC reader can be load-tested
+ * and its recovery paths exercised without hardware (Linux only).
+ * Build: g++ -O2 -std=c++17 arduino_simulator.cpp -o arduino_simulator -lutil
+ * Usage: arduino_simulator [options], then point the reader at the link:
+ *        "Serial Reader on PC" /tmp/ttyECM0 sensor_data.csv
+ *
+ *   --link=PATH          Symlink to the pty slave, kept across port drops (default /tmp/ttyECM0)
+ *   --format=F           legacy | json | temp | handler | dht | mixed (default legacy)
+ *   --protocol=P         text | binary: send each line as a telemetry frame (telemetry_frame.h)
+ *   --rate=HZ|max        Lines per second, fractional allowed (default 1); max writes as
+ *                        fast as the reader drains the pty. At a fixed rate, bytes the
+ *                        reader does not take in time are discarded, as on a UART
+ *   --baud=N             Also cap the byte rate at N/10 bytes per second, like a UART
+ *   --count=N            Stop after N lines (default: run until Ctrl+C)
+ *   --partial=P          Probability a line is cut short and never finished
+ *   --partial-stall=MS   Pause after a cut line (>10000 trips the reader's incomplete-line timeout)
+ *   --garbage=P          Probability of a burst of random bytes before a line (or frame)
+ *   --over-range=P       Probability a legacy line carries values outside 0..1023
+ *   --seq=on|off         Stamp text lines with the sketch's sequence number (default on;
+ *                        frames always carry one)
+ *   --millis=on|off      Stamp text lines with the sketch's millis() (default on; frames always do)
+ *   --millis-start=N     millis() of the first line, e.g. 4294900000 to cross its 49.7-day rollover
+ *   --clock-drift=PPM    How much slower the simulated board's clock runs than the host's
+ *   --duplicate=P        Probability a line (or frame) is sent twice
+ *   --reorder=P          Probability a line (or frame) is held back and sent after the next one
+ *   --drop-every=S       Remove the port every S seconds ...
+ *   --drop-for=MS        ... for MS milliseconds (default 2000), then recreate it
+ *   --send-log=FILE      Write "send_ms,gas,temp,s3" for every well-formed legacy line
+ *
+ * Legacy lines count through gas = n % 1024, temp = n / 1024 % 1024, so each
+ * logged row can be matched to its send time in the send log (latency) and
+ * missing rows stand out (loss). Each sketch format numbers its lines from 0,
+ * as the sketches do, so the reader's gap, duplicate and reordering counts
+ * can be checked against the faults injected here.
+ */
+
+volatile sig_atomic_t running = 1;
+
+void signal_handler(int) {
+    running = 0;
+}
+
+/**
+ * @return CLOCK_MONOTONIC in nanoseconds.
+ */
+int64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @return Wall-clock time in milliseconds since the Unix epoch.
+ */
+int64_t epoch_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Sleeps until an absolute CLOCK_MONOTONIC time, or until a signal stops the simulator.
+ */
+void sleep_until_ns(int64_t deadline) {
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(deadline / 1000000000);
+    ts.tv_nsec = static_cast<long>(deadline % 1000000000);
+    while (running && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+}
+
+/**
+ * A pseudo-terminal whose slave is published under a fixed symlink.
+ */
+class Pty {
+public:
+    explicit Pty(const std::string& link) : link_(link), master_(-1), slave_(-1) {}
+
+    ~Pty() {
+        close();
+    }
+
+    /**
+     * Creates the pty pair in raw mode and points the link at the slave.
+     * @return false on failure (errno is printed).
+     */
+    bool open() {
+        char name[256];
+        if (openpty(&master_, &slave_, name, nullptr, nullptr) != 0) {
+            std::perror("openpty");
+            return false;
+        }
+        // Raw mode: no newline translation or echo, as on a real UART
+        termios tio;
+        if (tcgetattr(slave_, &tio) == 0) {
+            cfmakeraw(&tio);
+            tcsetattr(slave_, TCSANOW, &tio);
+        }
+        fcntl(master_, F_SETFL, fcntl(master_, F_GETFL) | O_NONBLOCK);
+        slave_name_ = name;
+        unlink(link_.c_str());
+        if (symlink(name, link_.c_str()) != 0) {
+            std::perror(("symlink " + link_).c_str());
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Removes the link and both ends; a reader holding the slave sees a hang-up.
+     */
+    void close() {
+        if (master_ >= 0) {
+            unlink(link_.c_str());
+            ::close(master_);
+            ::close(slave_);
+            master_ = slave_ = -1;
+        }
+    }
+
+    /**
+     * Writes bytes to the master side.
+     * @param wait Wait while the pty buffer is full; otherwise the rest is discarded,
+     *             like a UART transmitting with nobody listening.
+     * @return Number of bytes written, or -1 if the pty failed.
+     */
+    ssize_t write_all(const char* data, size_t length, bool wait) {
+        size_t written = 0;
+        while (written < length && running) {
+            ssize_t n = ::write(master_, data + written, length - written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN) {
+                    return -1;
+                }
+                if (!wait) {
+                    break;
+                }
+                pollfd pfd = {master_, POLLOUT, 0};
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return static_cast<ssize_t>(written);
+    }
+
+    const std::string& slave_name() const { return slave_name_; }
+
+private:
+    std::string link_;
+    std::string slave_name_;
+    int master_;
+    int slave_;
+};
+
+/**
+ * What the sketches append to a sample line: its sequence number and millis().
+ */
+struct LineStamps {
+    bool seq = true;            // --seq
+    bool millis = true;         // --millis
+    uint32_t seqs[4] = {};      // Next sequence number per LineFormat
+    uint32_t device_ms = 0;     // Board millis() of the line being formatted
+};
+
+/**
+ * Formats sample n in one of the sketch formats.
+ * @param stamps Sequence numbers and device time; the line's sequence number is advanced.
+ * @return Line length including "\r\n" (Serial.println line ending).
+ */
+size_t format_line(const std::string& format, uint64_t n, bool over_range, LineStamps& stamps, std::mt19937& rng,
+                   char* out, size_t size) {
+    static const char* const MIXED[] = {"legacy", "json", "temp", "handler", "dht"};
+    const std::string& kind = format == "mixed" ? std::string(MIXED[n % 5]) : format;
+    std::uniform_int_distribution<int> percent(0, 9999);
+    int r = percent(rng);
+    int length;
+    char tail[48] = "";
+    auto stamp = [&](LineFormat line_format, const char* seq_pattern, const char* ms_pattern) {
+        uint32_t seq = stamps.seqs[static_cast<int>(line_format)]++;
+        int used = stamps.seq ? std::snprintf(tail, sizeof(tail), seq_pattern, static_cast<unsigned long>(seq)) : 0;
+        if (stamps.millis) {
+            std::snprintf(tail + used, sizeof(tail) - used, ms_pattern, static_cast<unsigned long>(stamps.device_ms));
+        }
+    };
+    if (kind == "json") {
+        // Sensor Stream (1).cpp
+        stamp(LineFormat::JSON, ", \"seq\":%lu", ", \"ms\":%lu");
+        length = std::snprintf(out, size, "{\"temperature\":%d.%02d, \"humidity\":%d.%02d, \"light\":%d%s}\r\n",
+                               15 + r % 20, r % 100, 30 + r % 50, r / 100 % 100, r % 1024, tail);
+    } else if (kind == "temp") {
+        // Sensors/Temperature sensor(2).cpp
+        stamp(LineFormat::JSON, ",\"seq\":%lu", ",\"ms\":%lu");
+        length = std::snprintf(out, size, "{\"temp\":%d.%02d%s}\r\n", 18 + r % 15, r % 100, tail);
+    } else if (kind == "handler") {
+        // Sensor handler.cpp
+        stamp(LineFormat::HANDLER, " | Seq: %lu", " | Time: %lu ms");
+        length = std::snprintf(out, size, "Gas: %d.%02d PPM | Temp (C): %d.%02d | Soil Moisture: %d.%02d%%%s\r\n",
+                               r % 500, r % 100, 18 + r % 15, r / 100 % 100, r % 101, r / 10 % 100, tail);
+    } else if (kind == "dht") {
+        // Sensors/humidity.cpp
+        stamp(LineFormat::DHT, " | Seq: %lu", " | Time: %lu ms");
+        length = std::snprintf(out, size, "Humidity: %d.%02d %% | Temperature: %d.%02d \xC2\xB0" "C%s\r\n",
+                               30 + r % 50, r % 100, 18 + r % 15, r / 100 % 100, tail);
+    } else {
+        // The ADC sketch the reader logs to CSV
+        int gas = static_cast<int>(n % 1024);
+        int temp = static_cast<int>(n / 1024 % 1024);
+        int s3 = r % 1024;
+        if (over_range) {
+            (r % 2 ? gas : s3) = 1024 + r % 3000;
+        }
+        stamp(LineFormat::LEGACY, ", seq=%lu", ", ms=%lu");
+        length = std::snprintf(out, size, "Sensor values: gas=%d, temp=%d, s3=%d%s\r\n", gas, temp, s3, tail);
+    }
+    return length > 0 ? static_cast<size_t>(length) : 0;
+}
+
+/**
+ * Re-encodes a line from format_line() as the frame the sketch sends with binary telemetry.
+ * @param encoders One encoder per TelemetryKind, keeping its sequence number.
+ * @param out At least TELEMETRY_MAX_FRAME bytes.
+ * @return Frame length including the 0x00 delimiter.
+ */
+size_t format_frame(const char* line, size_t length, TelemetryEncoder* encoders, uint32_t time_ms, char* out) {
+    SensorLine parsed;
+    parse_sensor_line(std::string_view(line, length >= 2 ? length - 2 : length), parsed); // Without "\r\n"
+    TelemetryEncoder& encoder = encoders[static_cast<int>(parsed.format) & 3];
+    telemetry_set_line(encoder, parsed);
+    return encoder.finish(time_ms, reinterpret_cast<uint8_t*>(out));
+}
+
+/**
+ * @param arg Command-line argument.
+ * @param name Option name including the leading dashes.
+ * @param value Receives the text after '='.
+ * @return true if arg is "name=value".
+ */
+bool option_value(const std::string& arg, const std::string& name, std::string& value) {
+    if (arg.compare(0, name.size() + 1, name + "=") != 0) {
+        return false;
+    }
+    value = arg.substr(name.size() + 1);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::string link = "/tmp/ttyECM0";
+    std::string format = "legacy";
+    bool binary = false;
+    std::string send_log_name;
+    double rate = 1.0;            // Lines per second; 0 = as fast as possible
+    long baud = 0;                // 0 = no byte-rate cap
+    uint64_t count = 0;           // 0 = unlimited
+    double p_partial = 0, p_garbage = 0, p_over_range = 0, p_duplicate = 0, p_reorder = 0;
+    LineStamps stamps;
+    uint32_t millis_start = 0;
+    double clock_drift_ppm = 0;
+    long partial_stall_ms = 0;
+    double drop_every_s = 0;
+    long drop_for_ms = 2000;
+    bool bad_args = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        std::string value;
+        if (option_value(arg, "--link", value)) {
+            link = value;
+        } else if (option_value(arg, "--format", value)) {
+            format = value;
+            bad_args |= value != "legacy" && value != "json" && value != "temp" && value != "handler" &&
+                        value != "dht" && value != "mixed";
+        } else if (option_value(arg, "--protocol", value)) {
+            binary = value == "binary";
+            bad_args |= value != "text" && value != "binary";
+        } else if (option_value(arg, "--rate", value)) {
+            rate = value == "max" ? 0.0 : std::atof(value.c_str());
+            bad_args |= value != "max" && rate <= 0;
+        } else if (option_value(arg, "--baud", value)) {
+            baud = std::atol(value.c_str());
+            bad_args |= baud <= 0;
+        } else if (option_value(arg, "--count", value)) {
+            count = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (option_value(arg, "--partial", value)) {
+            p_partial = std::atof(value.c_str());
+        } else if (option_value(arg, "--partial-stall", value)) {
+            partial_stall_ms = std::atol(value.c_str());
+        } else if (option_value(arg, "--garbage", value)) {
+            p_garbage = std::atof(value.c_str());
+        } else if (option_value(arg, "--over-range", value)) {
+            p_over_range = std::atof(value.c_str());
+        } else if (option_value(arg, "--seq", value)) {
+            stamps.seq = value == "on";
+            bad_args |= value != "on" && value != "off";
+        } else if (option_value(arg, "--millis", value)) {
+            stamps.millis = value == "on";
+            bad_args |= value != "on" && value != "off";
+        } else if (option_value(arg, "--millis-start", value)) {
+            millis_start = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (option_value(arg, "--clock-drift", value)) {
+            clock_drift_ppm = std::atof(value.c_str());
+        } else if (option_value(arg, "--duplicate", value)) {
+            p_duplicate = std::atof(value.c_str());
+        } else if (option_value(arg, "--reorder", value)) {
+            p_reorder = std::atof(value.c_str());
+        } else if (option_value(arg, "--drop-every", value)) {
+            drop_every_s = std::atof(value.c_str());
+        } else if (option_value(arg, "--drop-for", value)) {
+            drop_for_ms = std::atol(value.c_str());
+        } else if (option_value(arg, "--send-log", value)) {
+            send_log_name = value;
+        } else {
+            bad_args = true;
+        }
+    }
+    if (bad_args) {
+        std::cerr << "Usage: " << argv[0] << " [--link=PATH] [--format=legacy|json|temp|handler|dht|mixed]\n"
+                  << "       [--protocol=text|binary]\n"
+                  << "       [--rate=HZ|max] [--baud=N] [--count=N] [--partial=P] [--partial-stall=MS]\n"
+                  << "       [--garbage=P] [--over-range=P] [--seq=on|off] [--duplicate=P] [--reorder=P]\n"
+                  << "       [--millis=on|off] [--millis-start=N] [--clock-drift=PPM]\n"
+                  << "       [--drop-every=S] [--drop-for=MS] [--send-log=FILE]\n";
+        return 1;
+    }
+
+    // No SA_RESTART: Ctrl+C must interrupt a write blocked on a full pty
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::FILE* send_log = nullptr;
+    if (!send_log_name.empty()) {
+        send_log = std::fopen(send_log_name.c_str(), "w");
+        if (!send_log) {
+            std::cerr << "Failed to create " << send_log_name << "\n";
+            return 1;
+        }
+        std::fputs("send_ms,gas,temp,s3\n", send_log);
+    }
+
+    Pty pty(link);
+    if (!pty.open()) {
+        return 1;
+    }
+    std::cout << "Simulating " << format << (binary ? " frames" : "") << " on " << pty.slave_name() << " (link "
+              << link << ")\n";
+
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    const int64_t line_interval_ns = rate > 0 ? static_cast<int64_t>(1e9 / rate) : 0;
+    const int64_t ns_per_byte = baud > 0 ? 10000000000LL / baud : 0; // 10 bits per byte on the wire
+    const int64_t start = monotonic_ns();
+    int64_t next_line = start;
+    int64_t next_drop = drop_every_s > 0 ? start + static_cast<int64_t>(drop_every_s * 1e9) : INT64_MAX;
+    uint64_t sent = 0, bytes = 0, discarded = 0, partials = 0, garbage = 0, over_range = 0, drops = 0;
+    uint64_t duplicated = 0, reordered = 0;
+    const bool wait = rate == 0 && baud == 0; // Paced output is discarded when nobody reads, like a UART
+    char line[256];
+    char frame[TELEMETRY_MAX_FRAME];
+    char burst[64];
+    char held[256];               // --reorder: line held back until the next one is sent
+    size_t held_length = 0;
+    TelemetryEncoder encoders[4] = {{TELEMETRY_LEGACY, 1}, {TELEMETRY_JSON, 1}, {TELEMETRY_HANDLER, 1},
+                                    {TELEMETRY_DHT, 1}};
+
+    while (running && (count == 0 || sent < count)) {
+        if (monotonic_ns() >= next_drop) {
+            // Port disappearance: the reader's fd hangs up and the path vanishes
+            pty.close();
+            ++drops;
+            std::cout << "Port removed for " << drop_for_ms << " ms\n";
+            sleep_until_ns(monotonic_ns() + drop_for_ms * 1000000);
+            if (!running || !pty.open()) {
+                break;
+            }
+            std::cout << "Port back on " << pty.slave_name() << "\n";
+            next_drop = monotonic_ns() + static_cast<int64_t>(drop_every_s * 1e9);
+            next_line = monotonic_ns();
+        }
+        if (line_interval_ns > 0 || ns_per_byte > 0) {
+            sleep_until_ns(next_line);
+        }
+
+        size_t wire_bytes = 0;
+        if (p_garbage > 0 && chance(rng) < p_garbage) {
+            size_t n = 1 + static_cast<size_t>(byte(rng)) % sizeof(burst);
+            for (size_t i = 0; i < n; ++i) {
+                burst[i] = static_cast<char>(byte(rng));
+            }
+            ssize_t written = pty.write_all(burst, n, wait);
+            discarded += written >= 0 ? n - static_cast<size_t>(written) : 0;
+            wire_bytes += n;
+            ++garbage;
+        }
+
+        bool out_of_range = p_over_range > 0 && chance(rng) < p_over_range;
+        // The board's millis(), running clock_drift_ppm slow and wrapping at 2^32 like the real one
+        double elapsed_ms = (monotonic_ns() - start) / 1e6 * (1.0 - clock_drift_ppm * 1e-6);
+        stamps.device_ms = millis_start + static_cast<uint32_t>(static_cast<uint64_t>(elapsed_ms));
+        size_t length = format_line(format, sent, out_of_range, stamps, rng, line, sizeof(line));
+        const char* output = line;
+        size_t output_length = length;
+        if (binary) {
+            output_length = format_frame(line, length, encoders, stamps.device_ms, frame);
+            output = frame;
+        }
+        if (held_length == 0 && p_reorder > 0 && chance(rng) < p_reorder) {
+            std::memcpy(held, output, output_length);
+            held_length = output_length;
+            ++reordered;
+            over_range += out_of_range;
+            bytes += wire_bytes;
+            ++sent;
+            next_line += line_interval_ns;
+            continue;
+        }
+        bool cut = p_partial > 0 && chance(rng) < p_partial;
+        size_t write_length = cut ? output_length / 2 : output_length;
+        ssize_t written = pty.write_all(output, write_length, wait);
+        if (written < 0) {
+            std::cerr << "Write failed: " << std::strerror(errno) << "\n";
+            break;
+        }
+        if (!running) {
+            break;
+        }
+        discarded += write_length - static_cast<size_t>(written);
+        wire_bytes += write_length;
+        if (!cut && p_duplicate > 0 && chance(rng) < p_duplicate) {
+            written = pty.write_all(output, output_length, wait);
+            discarded += written >= 0 ? output_length - static_cast<size_t>(written) : 0;
+            wire_bytes += output_length;
+            ++duplicated;
+        }
+        if (held_length > 0) {
+            written = pty.write_all(held, held_length, wait);
+            discarded += written >= 0 ? held_length - static_cast<size_t>(written) : 0;
+            wire_bytes += held_length;
+            held_length = 0;
+        }
+        if (cut) {
+            ++partials;
+            if (partial_stall_ms > 0) {
+                sleep_until_ns(monotonic_ns() + partial_stall_ms * 1000000);
+                next_line = monotonic_ns();
+            }
+        } else if (send_log && line[0] == 'S' && !out_of_range && static_cast<size_t>(written) == output_length) {
+            int gas, temp, s3;
+            if (std::sscanf(line, "Sensor values: gas=%d, temp=%d, s3=%d", &gas, &temp, &s3) == 3) {
+                std::fprintf(send_log, "%lld,%d,%d,%d\n", static_cast<long long>(epoch_ms()), gas, temp, s3);
+            }
+        }
+        over_range += out_of_range;
+        bytes += wire_bytes;
+        ++sent;
+        next_line += std::max(line_interval_ns, static_cast<int64_t>(wire_bytes) * ns_per_byte);
+    }
+
+    double seconds = (monotonic_ns() - start) / 1e9;
+    std::cout << sent << " lines, " << bytes << " bytes in " << seconds << " s ("
+              << (seconds > 0 ? sent / seconds : 0) << " lines/s); faults: " << partials << " partial, "
+              << garbage << " garbage, " << over_range << " over-range, " << duplicated << " duplicated, "
+              << reordered << " reordered, " << drops << " port drops\n";
+    if (discarded > 0) {
+        std::cout << discarded << " bytes discarded while the reader was not keeping up\n";
+    }
+    if (send_log) {
+        std::fclose(send_log);
+    }
+    return 0;
+}
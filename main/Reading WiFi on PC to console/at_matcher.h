@@ -0,0 +1,213 @@
+#ifndef AT_MATCHER_H
+#define AT_MATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Finds every pattern the ESP module's responses are checked for ("OK",
+ * "SEND OK", "ERROR", "CLOSED", ...) in one pass over its output, a byte at a
+ * time, with no heap and no buffer of the response: an Aho-Corasick automaton
+ * over all patterns, so each byte costs a state transition instead of one
+ * substring search of the whole response per pattern.
+ *
+ * Patterns are added once (normally string literals; they must stay valid)
+ * and identified by a bit in the mask feed() returns; adding one that is
+ * already there returns its bit. Adding a new one rebuilds the automaton
+ * (matches under way carry on, though one of the new pattern that began
+ * before the add is missed), so it is cheapest to add each pattern early.
+ * The last TAIL_LENGTH bytes are kept for diagnostics. Plain C++ for avr-gcc,
+ * under 800 bytes of RAM; patterns are ASCII.
+ */
+class ATMatcher {
+public:
+    static const uint8_t MAX_PATTERNS = 16;
+    static const uint8_t MAX_STATES = 80;   // Trie nodes: the root plus one per pattern character, shared prefixes once
+    static const uint8_t TAIL_LENGTH = 32;  // Power of two
+    static const uint8_t NONE = 0xFF;
+
+    ATMatcher() {
+        clear();
+    }
+
+    /**
+     * Removes every pattern.
+     */
+    void clear() {
+        pattern_count_ = 0;
+        state_count_ = 1;
+        child_[0] = NONE;
+        sibling_[0] = NONE;
+        fail_[0] = 0;
+        ends_[0] = NONE;
+        output_[0] = 0;
+        memset(root_, 0, sizeof(root_));
+        reset();
+    }
+
+    /**
+     * Adds a pattern, or finds it if an equal one was added before.
+     * @param pattern Non-empty, '\0'-terminated; must stay valid.
+     * @return Bit of the pattern in feed()'s result, 0 if it does not fit.
+     */
+    uint16_t add(const char* pattern) {
+        if (pattern == nullptr || pattern[0] == '\0') {
+            return 0;
+        }
+        for (uint8_t i = 0; i < pattern_count_; ++i) {
+            if (strcmp(patterns_[i], pattern) == 0) {
+                return static_cast<uint16_t>(1u << i);
+            }
+        }
+        if (pattern_count_ == MAX_PATTERNS) {
+            return 0;
+        }
+        // Insert into the trie, checking first that the new nodes fit
+        uint8_t state = 0;
+        const char* p = pattern;
+        for (; *p != '\0'; ++p) {
+            uint8_t next = find_child(state, *p);
+            if (next == NONE) {
+                break;
+            }
+            state = next;
+        }
+        if (state_count_ + strlen(p) > MAX_STATES) {
+            return 0;
+        }
+        for (; *p != '\0'; ++p) {
+            uint8_t next = state_count_++;
+            label_[next] = *p;
+            ends_[next] = NONE;
+            child_[next] = NONE;
+            sibling_[next] = child_[state];
+            child_[state] = next;
+            state = next;
+        }
+        ends_[state] = pattern_count_;
+        patterns_[pattern_count_] = pattern;
+        build();
+        return static_cast<uint16_t>(1u << pattern_count_++);
+    }
+
+    /**
+     * Advances over one byte of module output.
+     * @return Bit i set: pattern i ends at this byte.
+     */
+    uint16_t feed(char c) {
+        tail_[tail_end_++ & (TAIL_LENGTH - 1)] = c;
+        if (tail_fill_ <= TAIL_LENGTH) {
+            ++tail_fill_;
+        }
+        uint8_t state = state_;
+        for (;;) {
+            if (state == 0) {
+                uint8_t u = static_cast<uint8_t>(c);
+                state = u < 128 ? root_[u] : 0;
+                break;
+            }
+            uint8_t next = find_child(state, c);
+            if (next != NONE) {
+                state = next;
+                break;
+            }
+            state = fail_[state];
+        }
+        state_ = state;
+        return output_[state];
+    }
+
+    /**
+     * Forgets partial matches and the tail, e.g. when a new command starts.
+     */
+    void reset() {
+        state_ = 0;
+        tail_end_ = 0;
+        tail_fill_ = 0;
+    }
+
+    /**
+     * Copies the last bytes fed since reset(), oldest first.
+     * @param out At least TAIL_LENGTH + 1 bytes; '\0'-terminated.
+     * @return Bytes copied.
+     */
+    size_t tail(char* out) const {
+        uint8_t count = tail_fill_ < TAIL_LENGTH ? tail_fill_ : TAIL_LENGTH;
+        for (uint8_t i = 0; i < count; ++i) {
+            out[i] = tail_[(tail_end_ - count + i) & (TAIL_LENGTH - 1)];
+        }
+        out[count] = '\0';
+        return count;
+    }
+
+    /**
+     * @return true if no more than TAIL_LENGTH bytes were fed since reset(), i.e. tail() is all of them.
+     */
+    bool tail_complete() const {
+        return tail_fill_ <= TAIL_LENGTH;
+    }
+
+private:
+    uint8_t find_child(uint8_t state, char c) const {
+        for (uint8_t next = child_[state]; next != NONE; next = sibling_[next]) {
+            if (label_[next] == c) {
+                return next;
+            }
+        }
+        return NONE;
+    }
+
+    /**
+     * Recomputes failure links and outputs breadth first: a state's output
+     * includes every pattern that is a suffix of its path, through its
+     * failure link, which always points to a shallower state.
+     */
+    void build() {
+        uint8_t queue[MAX_STATES];
+        uint8_t head = 0, tail = 0;
+        memset(root_, 0, sizeof(root_));
+        for (uint8_t next = child_[0]; next != NONE; next = sibling_[next]) {
+            fail_[next] = 0;
+            output_[next] = own_output(next);
+            if (static_cast<uint8_t>(label_[next]) < 128) {
+                root_[static_cast<uint8_t>(label_[next])] = next;
+            }
+            queue[tail++] = next;
+        }
+        while (head < tail) {
+            uint8_t state = queue[head++];
+            for (uint8_t next = child_[state]; next != NONE; next = sibling_[next]) {
+                uint8_t f = fail_[state];
+                uint8_t target;
+                while ((target = find_child(f, label_[next])) == NONE && f != 0) {
+                    f = fail_[f];
+                }
+                fail_[next] = target != NONE ? target : 0;
+                output_[next] = static_cast<uint16_t>(own_output(next) | output_[fail_[next]]);
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    uint16_t own_output(uint8_t state) const {
+        return ends_[state] != NONE ? static_cast<uint16_t>(1u << ends_[state]) : 0;
+    }
+
+    const char* patterns_[MAX_PATTERNS];
+    uint8_t pattern_count_;
+    uint8_t state_count_;
+    char label_[MAX_STATES];      // Character on the edge into the state
+    uint8_t child_[MAX_STATES];   // First child, NONE for a leaf
+    uint8_t sibling_[MAX_STATES]; // Next child of the same parent
+    uint8_t fail_[MAX_STATES];    // Longest proper suffix that is a trie path
+    uint8_t ends_[MAX_STATES];    // Index of the pattern ending exactly here, NONE if none
+    uint16_t output_[MAX_STATES]; // Patterns ending here, including through failure links
+    uint8_t root_[128];           // Root transitions for ASCII, 0: stay at the root
+    uint8_t state_;
+    char tail_[TAIL_LENGTH];
+    uint8_t tail_end_;            // Next position in tail_, modulo 256
+    uint8_t tail_fill_;           // Bytes fed since reset(), up to TAIL_LENGTH + 1
+};
+
+#endif // AT_MATCHER_H
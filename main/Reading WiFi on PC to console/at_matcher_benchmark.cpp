@@ -0,0 +1,288 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "at_matcher.h"
+
+/**
+ * Microbenchmark: the ESP sketch's AT response handling with ATMatcher against
+ * its original String path (append every byte, drop the oldest beyond 480
+ * bytes, then indexOf() the expected response and "ERROR", "FAIL", "busy").
+ * Both sides run the same exchanges and must complete them at the same byte.
+ * Build: g++ -O2 -std=c++17 at_matcher_benchmark.cpp -o at_matcher_benchmark
+ * Usage: at_matcher_benchmark [iterations]
+ */
+
+/**
+ * Module output for one command, or unsolicited output between commands.
+ */
+struct Exchange {
+    const char* expected;  // nullptr: output while no command waits
+    std::string response;
+};
+
+/**
+ * Substring search as avr-libc's strstr (behind String::indexOf) does it, a
+ * byte at a time; glibc's vectorised strstr would flatter the original on a PC.
+ */
+const char* avr_strstr(const char* haystack, const char* needle) {
+    for (; *haystack != '\0'; ++haystack) {
+        const char* h = haystack;
+        const char* n = needle;
+        while (*n != '\0' && *h == *n) {
+            ++h;
+            ++n;
+        }
+        if (*n == '\0') {
+            return haystack;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * The original engine: a reserved 512-byte String and a hand-rolled "CLOSED" matcher.
+ */
+class LegacyEngine {
+public:
+    static const size_t MAX_RESPONSE_LENGTH = 512;
+    static const size_t SAFETY_MARGIN = 32;
+
+    void start() {
+        length_ = 0;
+        response_[0] = '\0';
+    }
+
+    bool watch(char c) {
+        static const char CLOSED[] = "CLOSED";
+        closed_ = (c == CLOSED[closed_]) ? closed_ + 1 : (c == CLOSED[0] ? 1 : 0);
+        if (closed_ == sizeof(CLOSED) - 1) {
+            closed_ = 0;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @return 1 on the expected response, -1 on an error, 0 otherwise.
+     */
+    int receive(char c, const char* expected) {
+        response_[length_++] = c;
+        response_[length_] = '\0';
+        if (length_ > MAX_RESPONSE_LENGTH - SAFETY_MARGIN) {
+            size_t drop = length_ - (MAX_RESPONSE_LENGTH - SAFETY_MARGIN);
+            memmove(response_, response_ + drop, length_ - drop + 1);
+            length_ -= drop;
+        }
+        if (avr_strstr(response_, expected) != nullptr) {
+            return 1;
+        }
+        if (avr_strstr(response_, "ERROR") != nullptr ||
+            avr_strstr(response_, "FAIL") != nullptr ||
+            avr_strstr(response_, "busy") != nullptr) {
+            return -1;
+        }
+        return 0;
+    }
+
+private:
+    char response_[MAX_RESPONSE_LENGTH + 1];
+    size_t length_ = 0;
+    uint8_t closed_ = 0;
+};
+
+/**
+ * The sketch's engine now: one automaton over every pattern.
+ */
+class MatcherEngine {
+public:
+    MatcherEngine() {
+        closed_mask_ = matcher_.add("CLOSED");
+        error_mask_ = matcher_.add("ERROR") | matcher_.add("FAIL") | matcher_.add("busy");
+    }
+
+    void start(const char* expected) {
+        expected_mask_ = matcher_.add(expected);
+        matcher_.reset();
+    }
+
+    bool watch(char c) {
+        matches_ = matcher_.feed(c);
+        return (matches_ & closed_mask_) != 0;
+    }
+
+    int receive() const {
+        if (matches_ & expected_mask_) {
+            return 1;
+        }
+        return (matches_ & error_mask_) ? -1 : 0;
+    }
+
+private:
+    ATMatcher matcher_;
+    uint16_t closed_mask_;
+    uint16_t error_mask_;
+    uint16_t expected_mask_ = 0;
+    uint16_t matches_ = 0;
+};
+
+/**
+ * Builds the module output of a session: joining the network, then upload
+ * cycles (session) or access point listings of about 1.3 KB (long).
+ */
+std::vector<Exchange> make_corpus(bool long_responses) {
+    std::vector<Exchange> corpus;
+    corpus.push_back({"ready", "AT+RST\r\r\n\r\nOK\r\n\r\n ets Jan  8 2013,rst cause:2, boot mode:(3,6)\r\n\r\n"
+                               "load 0x40100000, len 2408, room 16 \r\ntail 8\r\nchksum 0xe5\r\n"
+                               "load 0x3ffe8000, len 776, room 0 \r\n\r\nready\r\n"});
+    corpus.push_back({"OK", "AT\r\r\n\r\nOK\r\n"});
+    corpus.push_back({"OK", "AT+CWMODE=1\r\r\n\r\nOK\r\n"});
+    corpus.push_back({"+CWMODE:1", "AT+CWMODE?\r\r\n+CWMODE:1\r\n\r\nOK\r\n"});
+    corpus.push_back({"OK", "AT+CWJAP=\"YourSSID\",\"YourPassword\"\r\r\nWIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n"});
+    corpus.push_back({"STATUS:3", "AT+CIPSTATUS\r\r\nSTATUS:3\r\n\r\nOK\r\n"});
+    corpus.push_back({"OK", "AT+CIFSR\r\r\n+CIFSR:STAIP,\"192.168.1.57\"\r\n"
+                            "+CIFSR:STAMAC,\"5c:cf:7f:01:02:03\"\r\n\r\nOK\r\n"});
+    char line[128];
+    for (int i = 0; i < 20; ++i) {
+        if (long_responses) {
+            std::string listing = "AT+CWLAP\r\r\n";
+            for (int ap = 0; ap < 20; ++ap) {
+                snprintf(line, sizeof(line), "+CWLAP:(%d,\"Network_%02d\",-%d,\"aa:bb:cc:%02x:%02x:%02x\",%d,%d,0)\r\n",
+                         ap % 5, ap, 40 + (ap * 7 + i) % 50, ap, i, ap ^ i, 1 + ap % 13, (ap * 37) % 100 - 50);
+                listing += line;
+            }
+            corpus.push_back({"OK", listing + "\r\nOK\r\n"});
+            continue;
+        }
+        corpus.push_back({"CONNECT", "AT+CIPSTART=\"TCP\",\"192.168.1.100\",80\r\r\nCONNECT\r\n\r\nOK\r\n"});
+        corpus.push_back({">", "AT+CIPSEND=441\r\r\n\r\nOK\r\n> "});
+        corpus.push_back({"SEND OK", "\r\nRecv 441 bytes\r\n\r\nSEND OK\r\n"});
+        corpus.push_back({nullptr, "\r\n+IPD,100:HTTP/1.1 204 No Content\r\nConnection: keep-alive\r\n"
+                                   "Server: batch_receiver\r\nContent-Length: 0\r\n\r\n"});
+        if (i % 5 == 4) {
+            corpus.push_back({nullptr, "CLOSED\r\n"});
+        }
+    }
+    return corpus;
+}
+
+/**
+ * Runs the exchanges through an engine.
+ * @return Checksum of where each command completed and how, and of "CLOSED" sightings.
+ */
+long long run_legacy(const std::vector<Exchange>& corpus, LegacyEngine& engine) {
+    long long sum = 0;
+    for (const Exchange& exchange : corpus) {
+        engine.start();
+        for (size_t i = 0; i < exchange.response.size(); ++i) {
+            char c = exchange.response[i];
+            sum += engine.watch(c) ? 1000 : 0;
+            int outcome = exchange.expected != nullptr ? engine.receive(c, exchange.expected) : 0;
+            if (outcome != 0) {
+                sum += static_cast<long long>(i + 1) * outcome;
+                break;
+            }
+        }
+    }
+    return sum;
+}
+
+long long run_matcher(const std::vector<Exchange>& corpus, MatcherEngine& engine, size_t* examined = nullptr) {
+    long long sum = 0;
+    for (const Exchange& exchange : corpus) {
+        if (exchange.expected != nullptr) {
+            engine.start(exchange.expected);
+        }
+        for (size_t i = 0; i < exchange.response.size(); ++i) {
+            sum += engine.watch(exchange.response[i]) ? 1000 : 0;
+            if (examined != nullptr) {
+                ++*examined;
+            }
+            int outcome = exchange.expected != nullptr ? engine.receive() : 0;
+            if (outcome != 0) {
+                sum += static_cast<long long>(i + 1) * outcome;
+                break;
+            }
+        }
+    }
+    return sum;
+}
+
+/**
+ * @return A timestamp in TSC ticks on x86, nanoseconds elsewhere.
+ */
+uint64_t now_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/**
+ * Times one pass of fn.
+ * @return Elapsed ticks.
+ */
+template <typename Fn>
+uint64_t time_pass(int iterations, Fn fn, long long& checksum) {
+    uint64_t start = now_ticks();
+    for (int it = 0; it < iterations; ++it) {
+        checksum += fn();
+    }
+    return now_ticks() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = (argc > 1) ? std::atoi(argv[1]) : 200;
+    if (iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [iterations]\n";
+        return 1;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    const char* unit = "cycles";
+#else
+    const char* unit = "ns";
+#endif
+
+    // Passes alternate between the two engines and the best of each is kept,
+    // so background load affects both sides alike
+    const int ROUNDS = 7;
+    const char* corpora[2] = {"upload session", "long responses (AT+CWLAP)"};
+    for (int c = 0; c < 2; ++c) {
+        std::vector<Exchange> corpus = make_corpus(c == 1);
+        LegacyEngine legacy;
+        MatcherEngine matcher;
+        long long legacy_once = run_legacy(corpus, legacy);
+        size_t examined = 0;
+        long long matcher_once = run_matcher(corpus, matcher, &examined);
+        if (legacy_once != matcher_once) {
+            std::cerr << corpora[c] << ": engines disagree (" << legacy_once << " vs " << matcher_once << ")\n";
+            return 1;
+        }
+        // Bytes examined: the rest of a command's output after it completes is skipped
+        double bytes = static_cast<double>(examined) * iterations;
+
+        long long legacy_sum = 0, matcher_sum = 0;
+        uint64_t legacy_best = UINT64_MAX, matcher_best = UINT64_MAX;
+        for (int round = 0; round < ROUNDS; ++round) {
+            uint64_t ticks = time_pass(iterations, [&] { return run_legacy(corpus, legacy); }, legacy_sum);
+            legacy_best = ticks < legacy_best ? ticks : legacy_best;
+            ticks = time_pass(iterations, [&] { return run_matcher(corpus, matcher); }, matcher_sum);
+            matcher_best = ticks < matcher_best ? ticks : matcher_best;
+        }
+        std::cout << corpora[c] << " (" << static_cast<long long>(bytes) << " bytes per pass)\n";
+        std::cout << "  String + indexOf: " << legacy_best / bytes << " " << unit << "/byte (checksum " << legacy_sum << ")\n";
+        std::cout << "  ATMatcher       : " << matcher_best / bytes << " " << unit << "/byte (checksum " << matcher_sum << ")\n";
+        std::cout << "  speedup: " << static_cast<double>(legacy_best) / matcher_best << "x\n";
+    }
+    return 0;
+}
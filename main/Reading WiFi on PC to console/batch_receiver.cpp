@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "device_clock.h"
+#include "log_sink.h"
+#include "sample_batch.h"
+#include "sequence_tracker.h"
+#include "timestamp.h"
+
+/**
+ * Receives the uploads of ESP_WiFi_Communication and appends the samples to a
+ * log in the serial reader's CSV format (Linux and macOS).
+ * Build: g++ -O2 -std=c++17 -pthread batch_receiver.cpp -o batch_receiver
+ * Usage: batch_receiver [csv_file] [--port=N]
+ *
+ *   csv_file   Log to append to (default wifi_data.csv), with the reader's rollups
+ *   --port=N   TCP port to listen on, on every interface (default 80, as NET_CONFIG.port)
+ *
+ * Serves HTTP/1.1 with keep-alive, so a board can hold one connection open:
+ *   POST /log[?now=N]  A batch body in either encoding of sample_batch.h,
+ *              N the board's millis() when it sent it. Samples are stamped
+ *              with the board's millis() mapped onto host time (DeviceClock),
+ *              numbering gaps get "#gap" rows, resent batches are dropped as
+ *              duplicates.
+ *   GET /log?gas=N&temp=N&s3=N  One sample (UPLOAD_SINGLE), stamped on arrival.
+ * Every request is answered with an empty 204, or 400 for a body that does not
+ * decode. Boards are told apart by their address; their rows share the log.
+ */
+
+namespace {
+
+const size_t MAX_HEADER_BYTES = 8192;
+const size_t MAX_BODY_BYTES = 65536;
+const int64_t IDLE_TIMEOUT_MS = 120000;  // Boards upload at least every BATCH_MAX_AGE
+
+volatile sig_atomic_t running = 1;
+void signal_handler(int) {
+    running = 0;
+}
+
+/**
+ * What is known about one board.
+ */
+struct Board {
+    DeviceClock clock;
+    SequenceTracker sequence;
+    uint64_t samples = 0;    // Rows logged
+    uint64_t batches = 0;
+    uint64_t rejected = 0;   // Bodies that did not decode
+    uint64_t invalid = 0;    // Samples outside 0..1023
+};
+
+struct Connection {
+    int fd;
+    std::string address;
+    std::string input;       // Bytes received and not yet handled
+    int64_t last_ms;         // Last activity
+};
+
+bool parse_query_int(const std::string& query, const char* name, int64_t min, int64_t max, int64_t& value) {
+    std::string key = std::string(name) + "=";
+    size_t at = 0;
+    while ((at = query.find(key, at)) != std::string::npos) {
+        if (at == 0 || query[at - 1] == '&' || query[at - 1] == '?') {
+            char* end;
+            long long parsed = std::strtoll(query.c_str() + at + key.size(), &end, 10);
+            if (end != query.c_str() + at + key.size() && (*end == '\0' || *end == '&') && parsed >= min &&
+                parsed <= max) {
+                value = parsed;
+                return true;
+            }
+            return false;
+        }
+        at += key.size();
+    }
+    return false;
+}
+
+class Receiver {
+public:
+    explicit Receiver(LogSink& log) : log_(log) {}
+
+    /**
+     * Handles one request.
+     * @param address Board address.
+     * @param method Request method.
+     * @param target Request target, e.g. "/log".
+     * @param body Request body.
+     * @return HTTP status line text, e.g. "204 No Content".
+     */
+    const char* handle(const std::string& address, const std::string& method, const std::string& target,
+                       const std::string& body) {
+        Board& board = board_for(address);
+        std::string path = target.substr(0, target.find('?'));
+        if (path != "/log") {
+            return "404 Not Found";
+        }
+        int64_t arrival_ms;
+        char timestamp[TimestampClock::BUFFER_SIZE];
+        clock_.now(timestamp, &arrival_ms);
+        if (method == "GET") {
+            int64_t gas, temp, s3;
+            if (!parse_query_int(target, "gas", INT16_MIN, INT16_MAX, gas) ||
+                !parse_query_int(target, "temp", INT16_MIN, INT16_MAX, temp) ||
+                !parse_query_int(target, "s3", INT16_MIN, INT16_MAX, s3)) {
+                return "400 Bad Request";
+            }
+            push(address, board, arrival_ms, timestamp, static_cast<int>(gas), static_cast<int>(temp),
+                 static_cast<int>(s3));
+            return "204 No Content";
+        }
+        if (method != "POST") {
+            return "405 Method Not Allowed";
+        }
+        size_t count;
+        BatchStatus status = decode_sample_batch(reinterpret_cast<const uint8_t*>(body.data()), body.size(), samples_, count);
+        if (status != BATCH_OK) {
+            ++board.rejected;
+            std::cerr << timestamp << " Warning: " << address << ": Rejected batch (" << batch_status_name(status)
+                      << "), " << body.size() << " bytes\n";
+            return "400 Bad Request";
+        }
+        ++board.batches;
+        // The board's millis() when it built the request: samples it stored through an outage are sent long
+        // after they were taken. Without it (or if it is before the newest sample), the newest sample's time.
+        uint32_t sent_device_ms = samples_[count - 1].time_ms;
+        int64_t now;
+        if (parse_query_int(target, "now", 0, UINT32_MAX, now) &&
+            static_cast<uint32_t>(now) - sent_device_ms <= INT32_MAX) {
+            sent_device_ms = static_cast<uint32_t>(now);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const BatchSample& sample = samples_[i];
+            SequenceTracker::Outcome order = board.sequence.observe(sample.seq, 32);
+            if (order == SequenceTracker::DUPLICATE) {
+                continue;
+            }
+            if (order == SequenceTracker::RESTART) {
+                std::cerr << timestamp << " Warning: " << address << ": Sample numbering restarted (board reset?)\n";
+                board.clock.reset();
+            }
+            // Each sample was taken at the latest that much device time before the arrival
+            int64_t sent_ms = arrival_ms - static_cast<int64_t>(sent_device_ms - sample.time_ms);
+            int64_t sample_ms = board.clock.to_host(sample.time_ms, 32, sent_ms);
+            char sample_stamp[TimestampClock::BUFFER_SIZE];
+            clock_.format(sample_ms, sample_stamp);
+            if (order == SequenceTracker::GAP) {
+                std::cerr << timestamp << " Warning: " << address << ": " << board.sequence.missing()
+                          << " samples lost before #" << sample.seq << "\n";
+                SampleRow gap;
+                gap.time_ms = sample_ms;
+                std::memcpy(gap.timestamp, sample_stamp, sizeof(gap.timestamp));
+                gap.lost = board.sequence.missing();
+                gap.first_lost = board.sequence.first_missing();
+                log_.push(gap);
+            }
+            push(address, board, sample_ms, sample_stamp, sample.value[0], sample.value[1], sample.value[2]);
+        }
+        return "204 No Content";
+    }
+
+    void print_summary() const {
+        for (const auto& entry : boards_) {
+            const Board& board = *entry.second;
+            std::cout << entry.first << ": " << board.samples << " samples logged, " << board.batches
+                      << " batches, " << board.sequence.lost() << " lost, " << board.sequence.duplicates()
+                      << " duplicates, " << board.rejected << " batches rejected, " << board.invalid
+                      << " invalid samples, clock drift " << board.clock.drift_ppm() << " ppm\n";
+        }
+    }
+
+private:
+    Board& board_for(const std::string& address) {
+        std::unique_ptr<Board>& board = boards_[address];
+        if (!board) {
+            board.reset(new Board());
+        }
+        return *board;
+    }
+
+    void push(const std::string& address, Board& board, int64_t time_ms, const char* timestamp, int gas, int temp,
+              int s3) {
+        if (gas < 0 || gas > 1023 || temp < 0 || temp > 1023 || s3 < 0 || s3 > 1023) {
+            ++board.invalid;
+            std::cerr << timestamp << " Warning: " << address << ": Invalid sensor values - Gas: " << gas
+                      << ", Temp: " << temp << ", S3: " << s3 << "\n";
+            return;
+        }
+        SampleRow row;
+        row.time_ms = time_ms;
+        std::memcpy(row.timestamp, timestamp, sizeof(row.timestamp));
+        row.value[0] = gas;
+        row.value[1] = temp;
+        row.value[2] = s3;
+        log_.push(row);
+        ++board.samples;
+    }
+
+    LogSink& log_;
+    TimestampClock clock_;
+    std::map<std::string, std::unique_ptr<Board>> boards_;
+    BatchSample samples_[BATCH_MAX_SAMPLES];
+};
+
+/**
+ * Case-insensitive search for a header line in a request's header block.
+ * @param headers Lower-cased header block, starting at the request line.
+ * @param name Lower-cased header name with the colon, e.g. "content-length:".
+ * @return The value with surrounding spaces removed, empty if there is none.
+ */
+std::string header_value(const std::string& headers, const std::string& name) {
+    size_t at = headers.find("\r\n" + name);
+    if (at == std::string::npos) {
+        return std::string();
+    }
+    size_t start = headers.find_first_not_of(' ', at + 2 + name.size());
+    size_t end = headers.find("\r\n", at + 2);
+    if (start == std::string::npos || start >= end) {
+        return std::string();
+    }
+    std::string value = headers.substr(start, end - start);
+    return value.substr(0, value.find_last_not_of(' ') + 1);
+}
+
+void respond(int fd, const char* status) {
+    char response[128];
+    // 204 has no body by definition; the other answers say so explicitly
+    int length = std::strncmp(status, "204", 3) == 0
+                     ? std::snprintf(response, sizeof(response), "HTTP/1.1 %s\r\n\r\n", status)
+                     : std::snprintf(response, sizeof(response), "HTTP/1.1 %s\r\nContent-Length: 0\r\n\r\n", status);
+    ssize_t sent = send(fd, response, static_cast<size_t>(length), MSG_NOSIGNAL); // A board that hangs up must not kill us
+    (void)sent;
+}
+
+/**
+ * Handles every complete request buffered on a connection.
+ * @return false if the connection is to be closed.
+ */
+bool serve(Connection& connection, Receiver& receiver) {
+    for (;;) {
+        size_t header_end = connection.input.find("\r\n\r\n");
+        if (header_end == std::string::npos) {
+            if (connection.input.size() > MAX_HEADER_BYTES) {
+                respond(connection.fd, "431 Request Header Fields Too Large");
+                return false;
+            }
+            return true;
+        }
+        std::string headers = connection.input.substr(0, header_end + 2);
+        std::transform(headers.begin(), headers.end(), headers.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        size_t content_length = 0;
+        std::string length_text = header_value(headers, "content-length:");
+        if (!length_text.empty()) {
+            char* end;
+            unsigned long parsed = std::strtoul(length_text.c_str(), &end, 10);
+            if (*end != '\0' || parsed > MAX_BODY_BYTES) {
+                respond(connection.fd, "413 Payload Too Large");
+                return false;
+            }
+            content_length = parsed;
+        }
+        if (connection.input.size() < header_end + 4 + content_length) {
+            return true; // Body still on its way
+        }
+        std::string request_line = connection.input.substr(0, connection.input.find("\r\n"));
+        size_t method_end = request_line.find(' ');
+        size_t target_end = request_line.find(' ', method_end + 1);
+        if (method_end == std::string::npos || target_end == std::string::npos) {
+            respond(connection.fd, "400 Bad Request");
+            return false;
+        }
+        const char* status = receiver.handle(connection.address, request_line.substr(0, method_end),
+                                             request_line.substr(method_end + 1, target_end - method_end - 1),
+                                             connection.input.substr(header_end + 4, content_length));
+        respond(connection.fd, status);
+        connection.input.erase(0, header_end + 4 + content_length);
+        if (header_value(headers, "connection:") == "close" ||
+            request_line.compare(target_end + 1, std::string::npos, "HTTP/1.0") == 0) {
+            return false;
+        }
+    }
+}
+
+int usage(const char* program) {
+    std::cerr << "Usage: " << program << " [csv_file] [--port=N]\n"
+              << "Defaults: csv_file=wifi_data.csv, port=80\n";
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filename = "wifi_data.csv";
+    int port = 80;
+    bool have_file = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 7, "--port=") == 0) {
+            port = std::atoi(arg.c_str() + 7);
+            if (port <= 0 || port > 65535) {
+                return usage(argv[0]);
+            }
+        } else if (arg.compare(0, 2, "--") == 0 || have_file) {
+            return usage(argv[0]);
+        } else {
+            filename = arg;
+            have_file = true;
+        }
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listener, 8) != 0) {
+        std::cerr << "Cannot listen on port " << port << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    LogSink log(filename, LogSink::Options());
+    if (!log.start()) {
+        std::cerr << "Failed to open " << filename << "\n";
+        return 1;
+    }
+    Receiver receiver(log);
+    std::cout << "Listening on port " << port << ", logging to " << filename << " (Ctrl+C to stop)\n";
+
+    std::vector<Connection> connections;
+    std::vector<pollfd> fds;
+    while (running) {
+        fds.assign(1, pollfd{listener, POLLIN, 0});
+        for (const Connection& connection : connections) {
+            fds.push_back(pollfd{connection.fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), 200) < 0) {
+            continue; // EINTR from Ctrl+C
+        }
+        const int64_t now_ms = wall_clock_ms();
+        std::vector<Connection> open;
+        for (size_t i = 0; i < connections.size(); ++i) {
+            Connection& connection = connections[i];
+            bool keep = now_ms - connection.last_ms < IDLE_TIMEOUT_MS;
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char chunk[4096];
+                ssize_t n = recv(connection.fd, chunk, sizeof(chunk), 0);
+                if (n > 0) {
+                    connection.input.append(chunk, static_cast<size_t>(n));
+                    connection.last_ms = now_ms;
+                    keep = serve(connection, receiver);
+                } else {
+                    keep = false;
+                }
+            }
+            if (keep) {
+                open.push_back(std::move(connection));
+            } else {
+                close(connection.fd);
+            }
+        }
+        connections.swap(open);
+        if (fds[0].revents & POLLIN) {
+            sockaddr_in peer;
+            socklen_t peer_length = sizeof(peer);
+            int fd = accept(listener, reinterpret_cast<sockaddr*>(&peer), &peer_length);
+            if (fd >= 0) {
+                char address[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+                connections.push_back(Connection{fd, address, std::string(), now_ms});
+            }
+        }
+    }
+
+    for (const Connection& connection : connections) {
+        close(connection.fd);
+    }
+    close(listener);
+    log.stop();
+    receiver.print_summary();
+    return 0;
+}
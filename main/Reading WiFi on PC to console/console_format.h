@@ -0,0 +1,186 @@
+#ifndef CONSOLE_FORMAT_H
+#define CONSOLE_FORMAT_H
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <ostream>
+#include <string_view>
+
+#include "sensor_parser.h"
+
+/**
+ * Collects one console line in a fixed buffer and hands it to the stream in
+ * a single write(), instead of one formatted insertion per piece. Text longer
+ * than the buffer goes out in several writes.
+ */
+class ConsoleLineBuffer {
+public:
+    explicit ConsoleLineBuffer(std::ostream& out) : out_(out), size_(0) {}
+
+    ~ConsoleLineBuffer() {
+        flush();
+    }
+
+    ConsoleLineBuffer& operator<<(std::string_view text) {
+        if (size_ + text.size() > CAPACITY) {
+            flush();
+            if (text.size() > CAPACITY) {
+                out_.write(text.data(), static_cast<std::streamsize>(text.size()));
+                return *this;
+            }
+        }
+        std::memcpy(data_ + size_, text.data(), text.size());
+        size_ += text.size();
+        return *this;
+    }
+
+    /**
+     * Appends value right-aligned in width characters, as std::setw(width) does
+     * (with at most MAX_PADDING spaces).
+     */
+    ConsoleLineBuffer& padded(int value, int width) {
+        unsigned long long magnitude = value < 0 ? 0 - static_cast<unsigned long long>(value) : value;
+        size_t length = digit_count(magnitude) + (value < 0);
+        size_t spaces = length < static_cast<size_t>(width) ? std::min(static_cast<size_t>(width) - length, MAX_PADDING) : 0;
+        char* start = reserve(MAX_PADDING + NUMBER_SIZE);
+        std::memset(start, ' ', MAX_PADDING);
+        char* first = write_digits(start + spaces + length, magnitude);
+        if (value < 0) {
+            first[-1] = '-';
+        }
+        size_ += spaces + length;
+        return *this;
+    }
+
+    /**
+     * Appends value as std::ostream's default formatting does (6 significant digits).
+     * Sensor readings carry at most two decimals and are printed from a count of
+     * hundredths; other values go through std::to_chars.
+     */
+    ConsoleLineBuffer& number(double value) {
+        char* start = reserve(NUMBER_SIZE);
+        char* end = start;
+        double hundredths = std::fabs(value) * 100;
+        unsigned long long count = hundredths < 1000000 ? static_cast<unsigned long long>(hundredths + 0.5) : 0;
+        if (count > 0 ? std::fabs(hundredths - static_cast<double>(count)) < 1e-6 : value == 0) {
+            if (std::signbit(value)) {
+                *end++ = '-';
+            }
+            end += digit_count(count / 100);
+            write_digits(end, count / 100);
+            unsigned fraction = static_cast<unsigned>(count % 100);
+            if (fraction != 0) {
+                *end++ = '.';
+                *end++ = static_cast<char>('0' + fraction / 10);
+                if (fraction % 10 != 0) {
+                    *end++ = static_cast<char>('0' + fraction % 10);
+                }
+            }
+        } else {
+            end = std::to_chars(start, start + NUMBER_SIZE, value, std::chars_format::general, 6).ptr;
+        }
+        size_ += static_cast<size_t>(end - start);
+        return *this;
+    }
+
+    void flush() {
+        if (size_ > 0) {
+            out_.write(data_, static_cast<std::streamsize>(size_));
+            size_ = 0;
+        }
+    }
+
+private:
+    static const size_t CAPACITY = 256;
+    static const size_t MAX_PADDING = 16;
+    static const size_t NUMBER_SIZE = 32;  // Longer than any '%g' or integer text
+
+    /**
+     * Makes room for length more bytes and returns where they go.
+     */
+    char* reserve(size_t length) {
+        if (size_ + length > CAPACITY) {
+            flush();
+        }
+        return data_ + size_;
+    }
+
+    static size_t digit_count(unsigned long long value) {
+        size_t count = 1;
+        for (; value >= 10; value /= 10) {
+            ++count;
+        }
+        return count;
+    }
+
+    /**
+     * Writes the decimal digits of value so that they end just before end.
+     * @return First digit written.
+     */
+    static char* write_digits(char* end, unsigned long long value) {
+        do {
+            *--end = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        return end;
+    }
+
+    std::ostream& out_;
+    size_t size_;
+    char data_[CAPACITY];
+};
+
+/**
+ * Writes the reader's console line for one parsed input line, e.g.
+ * "2025-06-04 13:00:00.123 Sensor | Gas:  512, Temp:  300, S3:   87".
+ * Range warnings for LEGACY samples are the caller's job (they go to std::cerr).
+ * @param out Console stream.
+ * @param timestamp Formatted arrival time.
+ * @param line Line text without the line ending.
+ * @param parsed Result of parse_sensor_line() for the line.
+ */
+inline void write_console_line(std::ostream& out, const char* timestamp, std::string_view line, const SensorLine& parsed) {
+    ConsoleLineBuffer text(out);
+    text << timestamp;
+    switch (parsed.format) {
+    case LineFormat::LEGACY:
+        text << " Sensor | Gas: ";
+        text.padded(static_cast<int>(parsed.value[FIELD_GAS]), 4) << ", Temp: ";
+        text.padded(static_cast<int>(parsed.value[FIELD_TEMP]), 4) << ", S3: ";
+        text.padded(static_cast<int>(parsed.value[FIELD_S3]), 4) << "\n";
+        break;
+    case LineFormat::JSON:
+    case LineFormat::HANDLER:
+    case LineFormat::DHT:
+        if (parsed.fields == 0 && parsed.errors == 0) {
+            text << " Device   | " << line << "\n";
+            break;
+        }
+        text << " Sensor |";
+        static constexpr std::string_view LABELS[FIELD_COUNT] = {" Gas: ", " Temp: ", " S3: ", " Humidity: ", " Light: ",
+                                                             " Soil: "};
+        for (unsigned f = 0, shown = parsed.fields | parsed.errors; (shown >> f) != 0; ++f) {
+            if (parsed.has(static_cast<SensorField>(f))) {
+                text << LABELS[f];
+                text.number(parsed.value[f]);
+            } else if ((shown >> f) & 1) {
+                text << LABELS[f] << "n/c";
+            }
+        }
+        text << (parsed.device_warning ? " (warning)\n" : "\n");
+        break;
+    case LineFormat::MALFORMED:
+        text << " Invalid Sensor Data: " << line << "\n";
+        break;
+    case LineFormat::RESPONSE:
+        text << " Response | " << line << "\n";
+        break;
+    default:
+        text << " Data     | " << line << "\n";
+        break;
+    }
+}
+
+#endif // CONSOLE_FORMAT_H
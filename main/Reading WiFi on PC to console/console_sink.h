@@ -0,0 +1,354 @@
+#ifndef CONSOLE_SINK_H
+#define CONSOLE_SINK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "console_format.h"
+#include "dashboard.h"
+#include "sensor_parser.h"
+#include "spsc_ring.h"
+#include "timestamp.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/**
+ * One console message, built in place in a ConsoleSink queue.
+ */
+struct ConsoleEvent {
+    static const size_t TEXT_SIZE = 480; // Longer lines are cut short on the console (not in the log)
+
+    enum Kind : uint8_t {
+        LINE,    // Input line: formatted with write_console_line() from parsed and text
+        OUT,     // Message text for stdout
+        ERR      // Message text for stderr
+    };
+
+    Kind kind;
+    uint16_t device;    // LINE and parser warnings: index into the sink's device names
+    char timestamp[TimestampClock::BUFFER_SIZE];
+    SensorLine parsed;  // LINE only
+    uint16_t length;
+    char text[TEXT_SIZE];
+
+    /**
+     * Copies text, truncating it to TEXT_SIZE bytes.
+     */
+    void set_text(std::string_view value) {
+        length = static_cast<uint16_t>(value.size() < TEXT_SIZE ? value.size() : TEXT_SIZE);
+        std::memcpy(text, value.data(), length);
+    }
+};
+
+/**
+ * What the console shows.
+ */
+enum class ConsoleMode {
+    LINES,      // One line per input line, as the reader always printed
+    DASHBOARD,  // Periodically redrawn per-sensor summary (see dashboard.h)
+    QUIET       // Nothing on stdout; warnings and errors still go to stderr
+};
+
+/**
+ * Console output on its own thread, so a slow terminal delays only the console.
+ *
+ * Each parser thread queues input lines on its own lines() queue and warnings
+ * on its own warnings() queue; the serial read thread queues its status
+ * messages on status(). Each queue has one producer; the line queues use the
+ * configured overflow policy, the warning queues never drop (a parser waits
+ * for room instead, so loss and gap reports survive the load they describe)
+ * and status() keeps the newest messages. stdout is flushed whenever all
+ * queues run empty. With more than one device, lines are tagged "[device]".
+ *
+ * In DASHBOARD mode parsers record samples on board() instead of queueing
+ * lines, and the console thread redraws the board refresh_hz times a second
+ * with the latest messages below it, so console cost does not grow with the
+ * sample rate.
+ */
+class ConsoleSink {
+public:
+    static const size_t STATUS_CAPACITY = 64;
+    static const size_t WARNING_CAPACITY = 256; // Per producer
+
+    struct Options {
+        size_t capacity = 4096;                           // Line queue size, per producer
+        OverflowPolicy overflow = OverflowPolicy::SAMPLE; // When the terminal falls behind
+        size_t producers = 1;                             // Parser threads, one line queue each
+        std::vector<std::string> devices;                 // Names for ConsoleEvent::device; tags only for more than one
+        ConsoleMode mode = ConsoleMode::LINES;
+        double refresh_hz = 10;                           // DASHBOARD redraws per second
+    };
+
+    /**
+     * @param out Stream for input lines, OUT messages and the dashboard.
+     * @param err Stream for ERR messages.
+     */
+    ConsoleSink(std::ostream& out, std::ostream& err, const Options& options)
+        : out_(out), err_(err), mode_(options.mode), refresh_hz_(options.refresh_hz > 0 ? options.refresh_hz : 10),
+          status_(STATUS_CAPACITY, OverflowPolicy::DROP_OLDEST, 1, 8, &ready_),
+          board_(options.devices.size()), dashboard_(options.devices) {
+        for (size_t i = 0; i < std::max<size_t>(options.producers, 1); ++i) {
+            lines_.emplace_back(new SinkChannel<ConsoleEvent>(options.capacity, options.overflow, 1, 8, &ready_));
+            warnings_.emplace_back(
+                new SinkChannel<ConsoleEvent>(WARNING_CAPACITY, OverflowPolicy::BLOCK, 1, 8, &ready_));
+        }
+        if (options.devices.size() > 1) {
+            for (const std::string& device : options.devices) {
+                tags_.push_back(" [" + device + "]");
+            }
+        }
+    }
+
+    ~ConsoleSink() {
+        stop();
+    }
+
+    ConsoleSink(const ConsoleSink&) = delete;
+    ConsoleSink& operator=(const ConsoleSink&) = delete;
+
+    void start() {
+        if (mode_ == ConsoleMode::DASHBOARD) {
+            enable_ansi();
+            writer_ = std::thread(&ConsoleSink::run_dashboard, this);
+        } else {
+            writer_ = std::thread(&ConsoleSink::run, this);
+        }
+    }
+
+    /**
+     * Prints everything still queued, then stops the console thread.
+     * Producers must have stopped.
+     */
+    void stop() {
+        for (auto& lines : lines_) {
+            lines->close();
+        }
+        for (auto& warnings : warnings_) {
+            warnings->close();
+        }
+        status_.close();
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+    }
+
+    /**
+     * Line queue of one parser thread.
+     */
+    SinkChannel<ConsoleEvent>& lines(size_t producer = 0) {
+        return *lines_[producer];
+    }
+
+    /**
+     * Warning queue of one parser thread, for ERR events; never drops.
+     */
+    SinkChannel<ConsoleEvent>& warnings(size_t producer = 0) {
+        return *warnings_[producer];
+    }
+
+    ConsoleMode mode() const {
+        return mode_;
+    }
+
+    /**
+     * Per-sensor statistics drawn in DASHBOARD mode; each device is written by its parser thread.
+     */
+    SensorBoard& board() {
+        return board_;
+    }
+
+    /**
+     * Queue for the serial read thread.
+     */
+    SinkChannel<ConsoleEvent>& status() {
+        return status_;
+    }
+
+    /**
+     * Queues a message on status(), stamped with the current time.
+     */
+    void post_status(ConsoleEvent::Kind kind, std::string_view text) {
+        status_.offer_with([&](ConsoleEvent& event) {
+            event.kind = kind;
+            event.device = UINT16_MAX; // Status text names its port itself
+            TimestampClock clock;
+            clock.now(event.timestamp);
+            event.set_text(text);
+        });
+    }
+
+    /**
+     * @return Line queue entries dropped by the overflow policy.
+     */
+    uint64_t dropped() const {
+        uint64_t total = 0;
+        for (const auto& lines : lines_) {
+            total += lines->dropped();
+        }
+        return total;
+    }
+
+    size_t queued() const {
+        size_t total = 0;
+        for (const auto& lines : lines_) {
+            total += lines->size();
+        }
+        for (const auto& warnings : warnings_) {
+            total += warnings->size();
+        }
+        return total;
+    }
+
+private:
+    void run() {
+        ConsoleEvent event;
+        while (true) {
+            bool stop_requested = status_.closed();
+            bool any = false;
+            while (status_.pop(event)) {
+                write(event);
+                any = true;
+            }
+            for (auto& warnings : warnings_) {
+                while (warnings->pop(event)) {
+                    write(event);
+                    any = true;
+                }
+            }
+            for (auto& lines : lines_) {
+                for (int n = 0; n < 256 && lines->pop(event); ++n) {
+                    write(event);
+                    any = true;
+                }
+            }
+            if (any) {
+                continue;
+            }
+            out_.flush();
+            if (stop_requested) {
+                break;
+            }
+            ready_.wait(std::chrono::milliseconds(100), [this] {
+                auto ready = [](const auto& queue) { return queue->ready(); };
+                return status_.ready() || std::any_of(lines_.begin(), lines_.end(), ready) ||
+                       std::any_of(warnings_.begin(), warnings_.end(), ready);
+            });
+        }
+    }
+
+    /**
+     * DASHBOARD mode: redraws at the refresh rate and keeps messages for the message area.
+     */
+    void run_dashboard() {
+        const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / refresh_hz_));
+        auto next_frame = std::chrono::steady_clock::now();
+        ConsoleEvent event;
+        while (true) {
+            bool stop_requested = status_.closed();
+            while (status_.pop(event)) {
+                keep_message(event);
+            }
+            for (auto& warnings : warnings_) {
+                while (warnings->pop(event)) {
+                    keep_message(event);
+                }
+            }
+            for (auto& lines : lines_) {
+                while (lines->pop(event)) {
+                    keep_message(event);
+                }
+            }
+            const std::string& frame = dashboard_.render(board_, dropped());
+            out_.write(frame.data(), static_cast<std::streamsize>(frame.size()));
+            out_.flush();
+            if (stop_requested) {
+                break;
+            }
+            // Messages ring the doorbell too; only a stop request ends the wait early
+            next_frame += period;
+            auto now = std::chrono::steady_clock::now();
+            if (next_frame < now) {
+                next_frame = now + period;
+            }
+            while (!status_.closed() && (now = std::chrono::steady_clock::now()) < next_frame) {
+                ready_.wait(std::chrono::duration_cast<std::chrono::milliseconds>(next_frame - now) +
+                                std::chrono::milliseconds(1),
+                            [this] { return status_.closed(); });
+            }
+        }
+    }
+
+    void keep_message(const ConsoleEvent& event) {
+        if (event.kind == ConsoleEvent::LINE) {
+            return;
+        }
+        char timestamp[TimestampClock::BUFFER_SIZE + 64];
+        const char* tag = event.device < tags_.size() ? tags_[event.device].c_str() : "";
+        std::snprintf(timestamp, sizeof(timestamp), "%s%s", event.timestamp, tag);
+        dashboard_.add_message(timestamp, event.text, event.length);
+    }
+
+    /**
+     * Lets the Windows console interpret the dashboard's cursor codes.
+     */
+    static void enable_ansi() {
+#ifdef _WIN32
+        HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        if (handle != INVALID_HANDLE_VALUE && GetConsoleMode(handle, &mode)) {
+            SetConsoleMode(handle, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+        }
+#endif
+    }
+
+    void write(const ConsoleEvent& event) {
+        if (mode_ == ConsoleMode::QUIET && event.kind != ConsoleEvent::ERR) {
+            return;
+        }
+        std::string_view text(event.text, event.length);
+        const char* timestamp = event.timestamp;
+        char tagged[TimestampClock::BUFFER_SIZE + 64];
+        if (event.kind != ConsoleEvent::OUT && event.device < tags_.size()) {
+            std::snprintf(tagged, sizeof(tagged), "%s%s", event.timestamp, tags_[event.device].c_str());
+            timestamp = tagged;
+        }
+        switch (event.kind) {
+        case ConsoleEvent::LINE:
+            write_console_line(out_, timestamp, text, event.parsed);
+            break;
+        case ConsoleEvent::OUT:
+            out_ << timestamp << " " << text << "\n";
+            break;
+        case ConsoleEvent::ERR:
+            err_ << timestamp << " " << text << "\n";
+            break;
+        }
+    }
+
+    std::ostream& out_;
+    std::ostream& err_;
+    const ConsoleMode mode_;
+    const double refresh_hz_;
+    Doorbell ready_;                // Shared by the queues below
+    std::vector<std::unique_ptr<SinkChannel<ConsoleEvent>>> lines_;
+    std::vector<std::unique_ptr<SinkChannel<ConsoleEvent>>> warnings_;
+    SinkChannel<ConsoleEvent> status_;
+    std::vector<std::string> tags_; // " [device]" per device, empty for a single device
+    SensorBoard board_;
+    DashboardRenderer dashboard_;   // Console thread only
+    std::thread writer_;
+};
+
+#endif // CONSOLE_SINK_H
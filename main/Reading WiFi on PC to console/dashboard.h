@@ -0,0 +1,220 @@
+#ifndef DASHBOARD_H
+#define DASHBOARD_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+#include "sensor_parser.h"
+#include "timestamp.h"
+
+/**
+ * Latest value, min/max and sample count of every sensor of every device, for
+ * the dashboard console. Each device is written by the one parser thread that
+ * owns it (relaxed atomics, no locks); the console thread reads a
+ * consistent-enough view at its refresh rate.
+ */
+class SensorBoard {
+public:
+    explicit SensorBoard(size_t devices) : devices_(devices > 0 ? devices : 1) {
+        for (auto& device : devices_) {
+            device.reset(new Device());
+        }
+    }
+
+    /**
+     * Parser thread: accounts one non-empty line of a device.
+     * @param time_ms Arrival time of the line.
+     */
+    void record(uint16_t device, const SensorLine& parsed, int64_t time_ms) {
+        if (device >= devices_.size()) {
+            return;
+        }
+        Device& d = *devices_[device];
+        d.lines.add();
+        d.last_ms.store(time_ms, std::memory_order_relaxed);
+        for (int f = 0; f < FIELD_COUNT; ++f) {
+            if (!parsed.has(static_cast<SensorField>(f))) {
+                continue;
+            }
+            Sensor& s = d.sensors[f];
+            double value = parsed.value[f];
+            if (s.count.value() == 0 || value < s.min.load(std::memory_order_relaxed)) {
+                s.min.store(value, std::memory_order_relaxed);
+            }
+            if (s.count.value() == 0 || value > s.max.load(std::memory_order_relaxed)) {
+                s.max.store(value, std::memory_order_relaxed);
+            }
+            s.latest.store(value, std::memory_order_relaxed);
+            s.count.add();
+        }
+    }
+
+    size_t devices() const {
+        return devices_.size();
+    }
+
+    uint64_t lines(size_t device) const {
+        return devices_[device]->lines.value();
+    }
+
+    int64_t last_ms(size_t device) const {
+        return devices_[device]->last_ms.load(std::memory_order_relaxed);
+    }
+
+    uint64_t count(size_t device, int field) const {
+        return devices_[device]->sensors[field].count.value();
+    }
+
+    double latest(size_t device, int field) const {
+        return devices_[device]->sensors[field].latest.load(std::memory_order_relaxed);
+    }
+
+    double min(size_t device, int field) const {
+        return devices_[device]->sensors[field].min.load(std::memory_order_relaxed);
+    }
+
+    double max(size_t device, int field) const {
+        return devices_[device]->sensors[field].max.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Sensor {
+        std::atomic<double> latest{0};
+        std::atomic<double> min{0};
+        std::atomic<double> max{0};
+        Counter count;
+    };
+
+    struct alignas(64) Device {     // One cache line set per writer
+        Counter lines;
+        std::atomic<int64_t> last_ms{0};
+        Sensor sensors[FIELD_COUNT];
+    };
+
+    std::vector<std::unique_ptr<Device>> devices_;
+};
+
+/**
+ * Draws a SensorBoard as a fixed-layout, top-style screen: one header line, one
+ * row per device and sensor seen so far, and the last few console messages.
+ * Each frame is one string written over the previous one with ANSI cursor
+ * codes, so the cost per frame depends on the number of sensors, not on the
+ * sample rate.
+ */
+class DashboardRenderer {
+public:
+    static const size_t MESSAGE_LINES = 6;
+
+    /**
+     * @param devices Device names by device index (may be empty).
+     */
+    explicit DashboardRenderer(const std::vector<std::string>& devices)
+        : names_(devices), started_(std::chrono::steady_clock::now()), previous_time_(started_),
+          first_frame_(true) {}
+
+    /**
+     * Keeps a console message for the message area; older ones scroll out.
+     */
+    void add_message(const char* timestamp, const char* text, size_t length) {
+        messages_.push_back(std::string(timestamp) + " " + std::string(text, length));
+        if (messages_.size() > MESSAGE_LINES) {
+            messages_.pop_front();
+        }
+    }
+
+    /**
+     * Builds the next frame.
+     * @param dropped Console messages dropped so far, for the header.
+     */
+    const std::string& render(const SensorBoard& board, uint64_t dropped) {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - previous_time_).count();
+        previous_time_ = now;
+        size_t cells = board.devices() * (FIELD_COUNT + 1);
+        if (previous_counts_.size() != cells) {
+            previous_counts_.assign(cells, 0);
+        }
+        auto rate = [&](size_t cell, uint64_t count) {
+            double per_second = elapsed > 0 ? (count - previous_counts_[cell]) / elapsed : 0.0;
+            previous_counts_[cell] = count;
+            return per_second;
+        };
+
+        frame_.assign(first_frame_ ? "\x1b[2J\x1b[H" : "\x1b[H");
+        first_frame_ = false;
+        char line[256];
+        char clock[TimestampClock::BUFFER_SIZE];
+        int64_t now_ms = 0;
+        clock_.now(clock, &now_ms);
+        long uptime = static_cast<long>(std::chrono::duration_cast<std::chrono::seconds>(now - started_).count());
+        uint64_t total = 0;
+        double total_rate = 0;
+        for (size_t d = 0; d < board.devices(); ++d) {
+            uint64_t lines = board.lines(d);
+            total += lines;
+            total_rate += rate(d * (FIELD_COUNT + 1) + FIELD_COUNT, lines);
+        }
+        std::snprintf(line, sizeof(line), "ECM sensor reader | %.19s | up %ld:%02ld:%02ld | %llu lines, %.1f/s | %llu dropped",
+                      clock, uptime / 3600, uptime / 60 % 60, uptime % 60, static_cast<unsigned long long>(total),
+                      total_rate, static_cast<unsigned long long>(dropped));
+        append_line(line);
+        std::snprintf(line, sizeof(line), "%-20s %-9s %12s %12s %12s %9s %7s", "Device", "Sensor", "Latest", "Min",
+                      "Max", "Rate/s", "Age s");
+        append_line(line);
+        for (size_t d = 0; d < board.devices(); ++d) {
+            std::string name = d < names_.size() ? names_[d] : std::to_string(d);
+            if (name.size() > 20) {
+                name = "..." + name.substr(name.size() - 17);
+            }
+            int64_t last_ms = board.last_ms(d);
+            double age = last_ms > 0 ? (now_ms - last_ms) / 1000.0 : 0.0;
+            bool shown = false;
+            for (int f = 0; f < FIELD_COUNT; ++f) {
+                uint64_t count = board.count(d, f);
+                double per_second = rate(d * (FIELD_COUNT + 1) + f, count);
+                if (count == 0) {
+                    continue;
+                }
+                std::snprintf(line, sizeof(line), "%-20s %-9s %12.6g %12.6g %12.6g %9.1f %7.1f", shown ? "" : name.c_str(),
+                              field_name(static_cast<SensorField>(f)), board.latest(d, f), board.min(d, f),
+                              board.max(d, f), per_second, age);
+                append_line(line);
+                shown = true;
+            }
+            if (!shown) {
+                std::snprintf(line, sizeof(line), "%-20s %-9s", name.c_str(), last_ms > 0 ? "(no sensor values)" : "(no data)");
+                append_line(line);
+            }
+        }
+        append_line("");
+        for (const std::string& message : messages_) {
+            append_line(message.substr(0, 160).c_str());
+        }
+        frame_ += "\x1b[J";
+        return frame_;
+    }
+
+private:
+    void append_line(const char* text) {
+        frame_ += text;
+        frame_ += "\x1b[K\n"; // Clear what the previous frame left on this line
+    }
+
+    std::vector<std::string> names_;
+    std::deque<std::string> messages_;
+    std::vector<uint64_t> previous_counts_; // Per device: one per sensor, then lines
+    std::chrono::steady_clock::time_point started_;
+    std::chrono::steady_clock::time_point previous_time_;
+    TimestampClock clock_;
+    std::string frame_;
+    bool first_frame_;
+};
+
+#endif // DASHBOARD_H
@@ -0,0 +1,272 @@
+#ifndef DEVICE_CLOCK_H
+#define DEVICE_CLOCK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "metrics.h"
+
+/**
+ * Maps a sketch's millis() onto host time, so that a sample is stamped with
+ * when it was taken rather than when its line happened to be parsed.
+ *
+ * Every sample gives one point (device time, arrival time - device time).
+ * The arrival time is the true acquisition time plus a delay that is never
+ * negative (serial transfer, USB bridge latency, the reader's poll interval),
+ * so the lower envelope of the points is the clock offset. The reader keeps
+ * the minimum per WINDOW_MS of device time for the last WINDOWS windows, fits
+ * their slope by least squares (the drift of the board's resonator against
+ * the host clock, typically hundreds of ppm) and lowers the line until it
+ * touches the lowest point. The estimate for a sample is its device time
+ * mapped through that line; it is never later than the sample's arrival, and
+ * never earlier than the estimate of a sample the board took before it (a
+ * lowered line would otherwise step the log's time back) unless that would
+ * put it after its arrival, as when a later line of the same read spent
+ * longer on the wire.
+ *
+ * millis() wraps after 49.7 days (frames carry only 24 bits, 4.66 hours);
+ * device times are unwrapped to 64 bits, with small steps back taken as late
+ * samples. A larger step back (the board was reset) or a run of samples
+ * arriving more than MAX_DELAY_MS after their estimate (the host clock was
+ * stepped) starts the model over.
+ *
+ * Written by one parser thread; drift_ppm(), resets() and delay() can be read
+ * from any thread.
+ */
+class DeviceClock {
+public:
+    static const int64_t WINDOW_MS = 5000;      // Device time covered by one minimum
+    static const size_t WINDOWS = 120;          // Minima in the fit: the last 10 minutes
+    static const int64_t MAX_BACK_MS = 60000;   // Smaller steps back in device time are late samples
+    static const int64_t MAX_DELAY_MS = 5000;   // Arriving this much after the estimate is not a delay...
+    static const int STEP_SAMPLES = 3;          // ... once it happens to this many samples in a row
+    static constexpr double MAX_DRIFT = 0.01;   // Fitted slopes are clamped to +-1%
+
+    DeviceClock()
+        : started_(false), bits_(0), last_raw_(0), last_ms_(0), base_ms_(0), base_offset_(0), slope_(0),
+          intercept_(0), newest_ms_(0), newest_estimate_(0), late_run_(0), drift_ppm_(0) {}
+
+    /**
+     * Estimates when a sample was taken.
+     * @param device_ms Sketch millis() at the sample, modulo 2^bits.
+     * @param bits Width of device_ms (32 for text lines, 24 for frames).
+     * @param arrival_ms Host time (ms since the epoch) the sample could have been sent at the latest:
+     *                   its arrival minus the time its bytes took on the wire.
+     * @return Estimated host time of the sample, ms since the epoch.
+     */
+    int64_t to_host(uint32_t device_ms, uint8_t bits, int64_t arrival_ms) {
+        int64_t t;
+        if (!unwrap(device_ms, bits, t)) {
+            restart(device_ms, bits, arrival_ms);
+            t = last_ms_;
+        }
+        add_point(t, arrival_ms - t);
+        int64_t estimate = map(t);
+        if (estimate > arrival_ms) {
+            estimate = arrival_ms;
+        }
+        if (t >= newest_ms_) {
+            if (estimate < newest_estimate_) {
+                // Not before the previous sample's estimate, unless that is after this arrival
+                estimate = newest_estimate_ < arrival_ms ? newest_estimate_ : arrival_ms;
+            }
+            newest_ms_ = t;
+            newest_estimate_ = estimate;
+        }
+        if (arrival_ms - estimate > MAX_DELAY_MS) {
+            if (++late_run_ >= STEP_SAMPLES) {
+                restart(device_ms, bits, arrival_ms);
+                estimate = arrival_ms;
+                newest_estimate_ = estimate;
+            }
+        } else {
+            late_run_ = 0;
+        }
+        delay_ns_.record(static_cast<uint64_t>(arrival_ms > estimate ? arrival_ms - estimate : 0) * 1000000);
+        return estimate;
+    }
+
+    /**
+     * Starts the model over with the next sample, for a board known to have been
+     * reset (its millis() may have stepped back by less than MAX_BACK_MS).
+     */
+    void reset() {
+        if (started_) {
+            resets_.add();
+        }
+        started_ = false;
+    }
+
+    /**
+     * @return Fitted drift of the device clock against the host clock, in ppm (positive: device is slow).
+     */
+    double drift_ppm() const {
+        return drift_ppm_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return Times the model started over (board reset, host clock step).
+     */
+    uint64_t resets() const {
+        return resets_.value();
+    }
+
+    /**
+     * @return Arrival time minus estimated sample time (before the wire time the caller took off).
+     */
+    const Histogram& delay() const {
+        return delay_ns_;
+    }
+
+private:
+    struct Point {
+        int64_t window;  // Device time / WINDOW_MS
+        int64_t x;       // Device time of the minimum, relative to base_ms_
+        int64_t y;       // Minimum offset, relative to base_offset_
+    };
+
+    /**
+     * Extends device_ms to 64 bits from the previous sample.
+     * @return false if the numbering cannot continue (not started, other width, large step back).
+     */
+    bool unwrap(uint32_t device_ms, uint8_t bits, int64_t& t) {
+        const uint32_t mask = bits >= 32 ? UINT32_MAX : (1u << bits) - 1;
+        device_ms &= mask;
+        if (!started_ || bits != bits_) {
+            return false;
+        }
+        const uint32_t forward = (device_ms - last_raw_) & mask;
+        if (forward <= mask / 2) {
+            last_raw_ = device_ms;
+            last_ms_ += forward;
+            t = last_ms_;
+            return true;
+        }
+        const uint32_t back = (last_raw_ - device_ms) & mask;
+        if (back > MAX_BACK_MS) {
+            return false;
+        }
+        t = last_ms_ - back;
+        return true;
+    }
+
+    void restart(uint32_t device_ms, uint8_t bits, int64_t arrival_ms) {
+        if (started_) {
+            resets_.add();
+        }
+        started_ = true;
+        bits_ = bits;
+        last_raw_ = device_ms & (bits >= 32 ? UINT32_MAX : (1u << bits) - 1);
+        last_ms_ = last_raw_;
+        base_ms_ = last_ms_;
+        base_offset_ = arrival_ms - last_ms_;
+        points_.clear();
+        slope_ = 0;
+        intercept_ = 0;
+        newest_ms_ = last_ms_;
+        newest_estimate_ = INT64_MIN;
+        late_run_ = 0;
+        drift_ppm_.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Keeps the lowest offset of the window t falls in and refits when a window
+     * closes (slope) or the envelope moves (intercept).
+     */
+    void add_point(int64_t t, int64_t offset) {
+        const int64_t window = t >= 0 ? t / WINDOW_MS : -1;
+        const int64_t x = t - base_ms_;
+        const int64_t y = offset - base_offset_;
+        if (!points_.empty() && window < points_.back().window) {
+            // Late sample from a window already closed
+            if (y - fitted(x) < 0) {
+                intercept_ += static_cast<double>(y) - fitted(x);
+            }
+            return;
+        }
+        if (points_.empty() || window > points_.back().window) {
+            if (points_.size() == WINDOWS) {
+                points_.erase(points_.begin());
+            }
+            points_.push_back({window, x, y});
+            fit_slope();
+            fit_intercept();
+        } else if (y < points_.back().y) {
+            points_.back().x = x;
+            points_.back().y = y;
+            fit_intercept();
+        }
+    }
+
+    /**
+     * Least-squares slope through the window minima.
+     */
+    void fit_slope() {
+        slope_ = 0;
+        if (points_.size() >= 3) {
+            double n = static_cast<double>(points_.size());
+            double sx = 0, sy = 0;
+            for (const Point& p : points_) {
+                sx += static_cast<double>(p.x);
+                sy += static_cast<double>(p.y);
+            }
+            double mx = sx / n, my = sy / n, sxx = 0, sxy = 0;
+            for (const Point& p : points_) {
+                double dx = static_cast<double>(p.x) - mx;
+                sxx += dx * dx;
+                sxy += dx * (static_cast<double>(p.y) - my);
+            }
+            if (sxx > 0) {
+                slope_ = sxy / sxx;
+                slope_ = slope_ > MAX_DRIFT ? MAX_DRIFT : slope_ < -MAX_DRIFT ? -MAX_DRIFT : slope_;
+            }
+        }
+        drift_ppm_.store(slope_ * 1e6, std::memory_order_relaxed);
+    }
+
+    /**
+     * Lowers the fitted line onto the lowest window minimum.
+     */
+    void fit_intercept() {
+        bool first = true;
+        for (const Point& p : points_) {
+            double candidate = static_cast<double>(p.y) - slope_ * static_cast<double>(p.x);
+            if (first || candidate < intercept_) {
+                intercept_ = candidate;
+                first = false;
+            }
+        }
+    }
+
+    double fitted(int64_t x) const {
+        return intercept_ + slope_ * static_cast<double>(x);
+    }
+
+    /**
+     * @return Host time for unwrapped device time t.
+     */
+    int64_t map(int64_t t) const {
+        double offset = fitted(t - base_ms_);
+        return t + base_offset_ + static_cast<int64_t>(offset < 0 ? offset - 0.5 : offset + 0.5);
+    }
+
+    bool started_;
+    uint8_t bits_;
+    uint32_t last_raw_;         // Newest device_ms as received
+    int64_t last_ms_;           // The same, unwrapped
+    int64_t base_ms_;           // Origin of the fit, to keep the doubles small
+    int64_t base_offset_;
+    std::vector<Point> points_; // Window minima, oldest first
+    double slope_;              // Offset change per device ms
+    double intercept_;          // Offset at base_ms_, relative to base_offset_
+    int64_t newest_ms_;         // Latest device time estimated so far
+    int64_t newest_estimate_;   // Its estimate
+    int late_run_;              // Samples in a row arriving more than MAX_DELAY_MS late
+    std::atomic<double> drift_ppm_;
+    Counter resets_;
+    Histogram delay_ns_;
+};
+
+#endif // DEVICE_CLOCK_H
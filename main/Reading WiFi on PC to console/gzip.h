@@ -0,0 +1,529 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "sensor_log.h"
+
+/*
+ * Built-in gzip (RFC 1952) writer for closed log segments, so rotation needs no
+ * external tool or library.
+ *
+ * The DEFLATE (RFC 1951) encoder finds matches with a hash chain over a 32 KiB
+ * window, defers a match by one byte when the next position matches longer, and
+ * emits each run of up to BLOCK_SYMBOLS symbols as a dynamic-Huffman block (or
+ * a fixed-Huffman block when that is smaller). Sample logs repeat timestamp
+ * prefixes and digits on every row, which this catches; the output is readable
+ * by gzip, zcat and zlib.
+ */
+
+namespace gzip {
+
+const size_t WINDOW_SIZE = 32768;
+const int MIN_MATCH = 3;
+const int MAX_MATCH = 258;
+const int HASH_BITS = 15;
+const int MAX_CHAIN = 64;        // Candidates tried per position
+const int LAZY_LIMIT = 32;       // Take matches at least this long without looking one byte ahead
+const size_t BLOCK_SYMBOLS = 16384;
+const int LITLEN_SYMBOLS = 286;
+const int DIST_SYMBOLS = 30;
+const int CODELEN_SYMBOLS = 19;
+
+const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DIST_BASE[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,    65,    97,    129,
+                                193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const uint8_t CODELEN_ORDER[CODELEN_SYMBOLS] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+/**
+ * Appends bits LSB first, as DEFLATE stores them.
+ */
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out), bits_(0), count_(0) {}
+
+    void put(uint32_t value, int length) {
+        bits_ |= static_cast<uint64_t>(value) << count_;
+        count_ += length;
+        while (count_ >= 8) {
+            out_.push_back(static_cast<uint8_t>(bits_));
+            bits_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    /**
+     * Pads to a byte boundary.
+     */
+    void align() {
+        if (count_ > 0) {
+            out_.push_back(static_cast<uint8_t>(bits_));
+            bits_ = 0;
+            count_ = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint64_t bits_;
+    int count_;
+};
+
+/**
+ * Huffman code lengths for the given symbol frequencies, none longer than limit.
+ * Frequencies are halved until the tree fits, which costs little for the small
+ * alphabets used here. At least two symbols get a code, so the code is complete.
+ */
+inline void build_lengths(const uint32_t* freq, int count, int limit, uint8_t* lengths) {
+    std::vector<uint32_t> weights(freq, freq + count);
+    int used = 0;
+    for (int i = 0; i < count; ++i) {
+        used += weights[i] > 0;
+    }
+    for (int i = 0; used < 2 && i < count; ++i) {
+        if (weights[i] == 0) {
+            weights[i] = 1;
+            ++used;
+        }
+    }
+    std::vector<int> parent(2 * count);
+    while (true) {
+        typedef std::pair<uint64_t, int> Entry; // (weight, node)
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+        for (int i = 0; i < count; ++i) {
+            if (weights[i] > 0) {
+                heap.push(Entry(weights[i], i));
+            }
+        }
+        int next = count;
+        while (heap.size() > 1) {
+            Entry a = heap.top();
+            heap.pop();
+            Entry b = heap.top();
+            heap.pop();
+            parent[a.second] = next;
+            parent[b.second] = next;
+            heap.push(Entry(a.first + b.first, next++));
+        }
+        int root = heap.top().second;
+        int longest = 0;
+        for (int i = 0; i < count; ++i) {
+            int depth = 0;
+            if (weights[i] > 0) {
+                for (int node = i; node != root; node = parent[node]) {
+                    ++depth;
+                }
+            }
+            lengths[i] = static_cast<uint8_t>(depth);
+            longest = std::max(longest, depth);
+        }
+        if (longest <= limit) {
+            return;
+        }
+        for (uint32_t& w : weights) {
+            w = w > 0 ? (w + 1) / 2 : 0;
+        }
+    }
+}
+
+/**
+ * Canonical codes (RFC 1951 3.2.2) for code lengths, bit-reversed for BitWriter.
+ */
+inline void build_codes(const uint8_t* lengths, int count, uint16_t* codes) {
+    uint16_t length_count[16] = {0};
+    for (int i = 0; i < count; ++i) {
+        ++length_count[lengths[i]];
+    }
+    length_count[0] = 0;
+    uint16_t next[16] = {0};
+    uint16_t code = 0;
+    for (int bits = 1; bits < 16; ++bits) {
+        code = static_cast<uint16_t>((code + length_count[bits - 1]) << 1);
+        next[bits] = code;
+    }
+    for (int i = 0; i < count; ++i) {
+        int length = lengths[i];
+        uint16_t value = length ? next[length]++ : 0;
+        uint16_t reversed = 0;
+        for (int b = 0; b < length; ++b) {
+            reversed = static_cast<uint16_t>((reversed << 1) | ((value >> b) & 1));
+        }
+        codes[i] = reversed;
+    }
+}
+
+inline int length_symbol(int length) {
+    int i = 28;
+    while (LENGTH_BASE[i] > length) {
+        --i;
+    }
+    return i;
+}
+
+inline int distance_symbol(int distance) {
+    int i = 29;
+    while (DIST_BASE[i] > distance) {
+        --i;
+    }
+    return i;
+}
+
+/**
+ * Streaming DEFLATE encoder. Compressed bytes are appended to the output vector
+ * as they are produced; the caller may drain it between calls.
+ */
+class Deflater {
+public:
+    explicit Deflater(std::vector<uint8_t>& out)
+        : bits_(out), window_(2 * WINDOW_SIZE), end_(0), pos_(0), head_(size_t(1) << HASH_BITS, -1),
+          prev_(WINDOW_SIZE, -1) {
+        symbols_.reserve(BLOCK_SYMBOLS);
+        clear_frequencies();
+    }
+
+    void write(const uint8_t* data, size_t length) {
+        while (length > 0) {
+            size_t n = std::min(length, window_.size() - end_);
+            std::memcpy(&window_[end_], data, n);
+            end_ += n;
+            data += n;
+            length -= n;
+            if (end_ == window_.size()) {
+                compress(end_ - MAX_MATCH);
+                slide();
+            }
+        }
+    }
+
+    /**
+     * Encodes the remaining input and ends the stream on a byte boundary.
+     */
+    void finish() {
+        compress(end_);
+        flush_block(true);
+        bits_.align();
+    }
+
+private:
+    /**
+     * A literal (distance 0) or a match.
+     */
+    struct Symbol {
+        uint16_t value;     // Literal byte or match length
+        uint16_t distance;
+    };
+
+    uint32_t hash(size_t pos) const {
+        uint32_t h = (static_cast<uint32_t>(window_[pos]) << 16) | (static_cast<uint32_t>(window_[pos + 1]) << 8) |
+                     window_[pos + 2];
+        return (h * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    void insert(size_t pos) {
+        if (pos + MIN_MATCH <= end_) {
+            uint32_t h = hash(pos);
+            prev_[pos & (WINDOW_SIZE - 1)] = head_[h];
+            head_[h] = static_cast<int32_t>(pos);
+        }
+    }
+
+    /**
+     * Longest earlier match for the bytes at pos (positions up to pos must be inserted before pos itself).
+     */
+    int longest_match(size_t pos, int& distance) const {
+        if (pos + MIN_MATCH > end_) {
+            return 0;
+        }
+        int limit = static_cast<int>(std::min<size_t>(MAX_MATCH, end_ - pos));
+        int best = MIN_MATCH - 1;
+        int32_t candidate = head_[hash(pos)];
+        const uint8_t* current = &window_[pos];
+        for (int chain = 0; candidate >= 0 && chain < MAX_CHAIN; ++chain) {
+            size_t from = static_cast<size_t>(candidate);
+            if (from >= pos || pos - from > WINDOW_SIZE) {
+                break;
+            }
+            const uint8_t* match = &window_[from];
+            if (match[best] == current[best] && match[0] == current[0]) {
+                int length = 0;
+                while (length < limit && match[length] == current[length]) {
+                    ++length;
+                }
+                if (length > best) {
+                    best = length;
+                    distance = static_cast<int>(pos - from);
+                    if (length == limit) {
+                        break;
+                    }
+                }
+            }
+            int32_t older = prev_[from & (WINDOW_SIZE - 1)];
+            if (older >= candidate) {
+                break; // Slot reused by a newer position
+            }
+            candidate = older;
+        }
+        return best >= MIN_MATCH ? best : 0;
+    }
+
+    void compress(size_t limit) {
+        while (pos_ < limit) {
+            int distance = 0;
+            int length = longest_match(pos_, distance);
+            insert(pos_);
+            if (length > 0 && length < LAZY_LIMIT && pos_ + 1 < limit) {
+                int next_distance = 0;
+                if (longest_match(pos_ + 1, next_distance) > length) {
+                    emit(window_[pos_], 0);
+                    ++pos_;
+                    continue;
+                }
+            }
+            if (length > 0) {
+                emit(static_cast<uint16_t>(length), static_cast<uint16_t>(distance));
+                for (int i = 1; i < length; ++i) {
+                    insert(pos_ + i);
+                }
+                pos_ += length;
+            } else {
+                emit(window_[pos_], 0);
+                ++pos_;
+            }
+        }
+    }
+
+    /**
+     * Drops the older half of the window once the encoder has passed it.
+     */
+    void slide() {
+        std::memmove(&window_[0], &window_[WINDOW_SIZE], end_ - WINDOW_SIZE);
+        end_ -= WINDOW_SIZE;
+        pos_ -= WINDOW_SIZE;
+        const int32_t shift = static_cast<int32_t>(WINDOW_SIZE);
+        for (int32_t& p : head_) {
+            p = p >= shift ? p - shift : -1;
+        }
+        for (int32_t& p : prev_) {
+            p = p >= shift ? p - shift : -1;
+        }
+    }
+
+    void emit(uint16_t value, uint16_t distance) {
+        symbols_.push_back(Symbol{value, distance});
+        if (distance == 0) {
+            ++litlen_freq_[value];
+        } else {
+            ++litlen_freq_[257 + length_symbol(value)];
+            ++dist_freq_[distance_symbol(distance)];
+        }
+        if (symbols_.size() == BLOCK_SYMBOLS) {
+            flush_block(false);
+        }
+    }
+
+    void clear_frequencies() {
+        std::fill(litlen_freq_, litlen_freq_ + LITLEN_SYMBOLS, 0);
+        std::fill(dist_freq_, dist_freq_ + DIST_SYMBOLS, 0);
+    }
+
+    /**
+     * Writes the buffered symbols as one block, dynamic or fixed Huffman, whichever is smaller.
+     */
+    void flush_block(bool final) {
+        ++litlen_freq_[256];
+        uint8_t litlen_lengths[LITLEN_SYMBOLS];
+        uint8_t dist_lengths[DIST_SYMBOLS];
+        build_lengths(litlen_freq_, LITLEN_SYMBOLS, 15, litlen_lengths);
+        build_lengths(dist_freq_, DIST_SYMBOLS, 15, dist_lengths);
+
+        // Code length sequence, run-length coded with symbols 16-18
+        int hlit = LITLEN_SYMBOLS;
+        while (hlit > 257 && litlen_lengths[hlit - 1] == 0) {
+            --hlit;
+        }
+        int hdist = DIST_SYMBOLS;
+        while (hdist > 1 && dist_lengths[hdist - 1] == 0) {
+            --hdist;
+        }
+        std::vector<uint8_t> sequence(litlen_lengths, litlen_lengths + hlit);
+        sequence.insert(sequence.end(), dist_lengths, dist_lengths + hdist);
+        std::vector<std::pair<uint8_t, uint8_t>> runs; // (symbol, extra bits value)
+        uint32_t codelen_freq[CODELEN_SYMBOLS] = {0};
+        for (size_t i = 0; i < sequence.size();) {
+            uint8_t value = sequence[i];
+            size_t run = 1;
+            while (i + run < sequence.size() && sequence[i + run] == value) {
+                ++run;
+            }
+            size_t left = run;
+            if (value == 0) {
+                while (left >= 11) {
+                    size_t n = std::min<size_t>(left, 138);
+                    runs.emplace_back(18, static_cast<uint8_t>(n - 11));
+                    left -= n;
+                }
+                if (left >= 3) {
+                    runs.emplace_back(17, static_cast<uint8_t>(left - 3));
+                    left = 0;
+                }
+            } else {
+                runs.emplace_back(value, 0);
+                --left;
+                while (left >= 3) {
+                    size_t n = std::min<size_t>(left, 6);
+                    runs.emplace_back(16, static_cast<uint8_t>(n - 3));
+                    left -= n;
+                }
+            }
+            for (; left > 0; --left) {
+                runs.emplace_back(value, 0);
+            }
+            i += run;
+        }
+        for (const auto& r : runs) {
+            ++codelen_freq[r.first];
+        }
+        uint8_t codelen_lengths[CODELEN_SYMBOLS];
+        build_lengths(codelen_freq, CODELEN_SYMBOLS, 7, codelen_lengths);
+        int hclen = CODELEN_SYMBOLS;
+        while (hclen > 4 && codelen_lengths[CODELEN_ORDER[hclen - 1]] == 0) {
+            --hclen;
+        }
+
+        // Compare sizes; extra bits cost the same either way
+        uint64_t dynamic_bits = 14 + 3 * static_cast<uint64_t>(hclen);
+        for (const auto& r : runs) {
+            dynamic_bits += codelen_lengths[r.first] + (r.first == 16 ? 2 : r.first == 17 ? 3 : r.first == 18 ? 7 : 0);
+        }
+        uint64_t fixed_bits = 0;
+        for (int i = 0; i < LITLEN_SYMBOLS; ++i) {
+            dynamic_bits += static_cast<uint64_t>(litlen_freq_[i]) * litlen_lengths[i];
+            fixed_bits += static_cast<uint64_t>(litlen_freq_[i]) * (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+        }
+        for (int i = 0; i < DIST_SYMBOLS; ++i) {
+            dynamic_bits += static_cast<uint64_t>(dist_freq_[i]) * dist_lengths[i];
+            fixed_bits += static_cast<uint64_t>(dist_freq_[i]) * 5;
+        }
+
+        bits_.put(final ? 1 : 0, 1);
+        if (fixed_bits <= dynamic_bits) {
+            bits_.put(1, 2);
+            for (int i = 0; i < LITLEN_SYMBOLS; ++i) {
+                litlen_lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            }
+            std::fill(dist_lengths, dist_lengths + DIST_SYMBOLS, 5);
+        } else {
+            bits_.put(2, 2);
+            bits_.put(static_cast<uint32_t>(hlit - 257), 5);
+            bits_.put(static_cast<uint32_t>(hdist - 1), 5);
+            bits_.put(static_cast<uint32_t>(hclen - 4), 4);
+            for (int i = 0; i < hclen; ++i) {
+                bits_.put(codelen_lengths[CODELEN_ORDER[i]], 3);
+            }
+            uint16_t codelen_codes[CODELEN_SYMBOLS];
+            build_codes(codelen_lengths, CODELEN_SYMBOLS, codelen_codes);
+            for (const auto& r : runs) {
+                bits_.put(codelen_codes[r.first], codelen_lengths[r.first]);
+                if (r.first >= 16) {
+                    bits_.put(r.second, r.first == 16 ? 2 : r.first == 17 ? 3 : 7);
+                }
+            }
+        }
+        uint16_t litlen_codes[LITLEN_SYMBOLS];
+        uint16_t dist_codes[DIST_SYMBOLS];
+        build_codes(litlen_lengths, LITLEN_SYMBOLS, litlen_codes);
+        build_codes(dist_lengths, DIST_SYMBOLS, dist_codes);
+
+        for (const Symbol& s : symbols_) {
+            if (s.distance == 0) {
+                bits_.put(litlen_codes[s.value], litlen_lengths[s.value]);
+                continue;
+            }
+            int ls = length_symbol(s.value);
+            bits_.put(litlen_codes[257 + ls], litlen_lengths[257 + ls]);
+            bits_.put(static_cast<uint32_t>(s.value - LENGTH_BASE[ls]), LENGTH_EXTRA[ls]);
+            int ds = distance_symbol(s.distance);
+            bits_.put(dist_codes[ds], dist_lengths[ds]);
+            bits_.put(static_cast<uint32_t>(s.distance - DIST_BASE[ds]), DIST_EXTRA[ds]);
+        }
+        bits_.put(litlen_codes[256], litlen_lengths[256]);
+        symbols_.clear();
+        clear_frequencies();
+    }
+
+    BitWriter bits_;
+    std::vector<uint8_t> window_;   // Two windows: history plus input not yet encoded
+    size_t end_;                    // Bytes in window_
+    size_t pos_;                    // Next byte to encode
+    std::vector<int32_t> head_;     // Newest position per hash, -1 if none
+    std::vector<int32_t> prev_;     // Previous position with the same hash, by position in the window
+    std::vector<Symbol> symbols_;   // Current block
+    uint32_t litlen_freq_[LITLEN_SYMBOLS];
+    uint32_t dist_freq_[DIST_SYMBOLS];
+};
+
+/**
+ * Compresses a file into a single-member .gz file.
+ * @param input File to compress.
+ * @param output File to create (overwritten).
+ * @param cancel If not null, checked between 64 KiB reads; compression stops once it is set.
+ * @return false on any I/O error or cancellation; a partial output file is removed.
+ */
+inline bool compress_file(const std::string& input, const std::string& output,
+                          const std::atomic<bool>* cancel = nullptr) {
+    std::FILE* in = std::fopen(input.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    std::FILE* out = std::fopen(output.c_str(), "wb");
+    if (!out) {
+        std::fclose(in);
+        return false;
+    }
+    // Header: magic, deflate, no flags or mtime, unknown OS
+    const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};
+    bool ok = std::fwrite(header, 1, sizeof(header), out) == sizeof(header);
+    std::vector<uint8_t> compressed;
+    Deflater deflater(compressed);
+    std::vector<uint8_t> buffer(1 << 16);
+    uint32_t crc = 0;
+    uint32_t size = 0;
+    size_t n;
+    while (ok && !(cancel && *cancel) && (n = std::fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+        crc = sensor_log::crc32(buffer.data(), n, crc);
+        size += static_cast<uint32_t>(n);
+        deflater.write(buffer.data(), n);
+        ok = std::fwrite(compressed.data(), 1, compressed.size(), out) == compressed.size();
+        compressed.clear();
+    }
+    ok = ok && !std::ferror(in) && !(cancel && *cancel);
+    if (ok) {
+        deflater.finish();
+        uint8_t trailer[8];
+        sensor_log::put_u32(trailer, crc);
+        sensor_log::put_u32(trailer + 4, size);
+        compressed.insert(compressed.end(), trailer, trailer + sizeof(trailer));
+        ok = std::fwrite(compressed.data(), 1, compressed.size(), out) == compressed.size();
+    }
+    std::fclose(in);
+    ok = (std::fclose(out) == 0) && ok;
+    if (!ok) {
+        std::remove(output.c_str());
+    }
+    return ok;
+}
+
+} // namespace gzip
+
+#endif // GZIP_H
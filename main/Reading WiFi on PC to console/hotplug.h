@@ -0,0 +1,197 @@
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+/**
+ * @return true if name is a device path ("/dev/ttyUSB0", "/dev/serial/by-id/...")
+ *         rather than a name only the serial port enumeration knows ("COM3").
+ */
+inline bool is_device_path(const std::string& name) {
+#ifdef _WIN32
+    (void)name;
+    return false;
+#else
+    return name.find('/') != std::string::npos;
+#endif
+}
+
+/**
+ * One stat() instead of enumerating every serial port of the host.
+ * @return true if path (or the node a by-id link points to) is a character device.
+ */
+inline bool device_node_exists(const std::string& path) {
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISCHR(st.st_mode);
+#endif
+}
+
+/**
+ * Watches the directories holding the reader's device nodes, so that a port
+ * that comes back (USB replug, udev recreating /dev/ttyUSB0 or its by-id link)
+ * is reopened as soon as its node appears rather than at the next retry.
+ *
+ * On Linux this is one inotify descriptor for all directories; fd() joins the
+ * read loop's poll set and read_events() reports which ports' nodes were
+ * created, moved in or had their permissions changed (udev creates the node
+ * first and hands it to the dialout group a moment later). A watched
+ * directory that disappears (the last USB serial adapter removes
+ * /dev/serial/by-id) is watched again by refresh() once it is back. Elsewhere
+ * fd() is -1 and the reader falls back to checking device_node_exists().
+ */
+class HotplugWatcher {
+public:
+    HotplugWatcher() : fd_(-1) {}
+
+    ~HotplugWatcher() {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    HotplugWatcher(const HotplugWatcher&) = delete;
+    HotplugWatcher& operator=(const HotplugWatcher&) = delete;
+
+    /**
+     * Starts watching the parent directories of the device paths among names.
+     * @param names Port names by device index; names that are not device paths are ignored.
+     * @return false if nothing could be watched (fd() is then -1).
+     */
+    bool start(const std::vector<std::string>& names) {
+#ifdef __linux__
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (!is_device_path(names[i])) {
+                continue;
+            }
+            size_t slash = names[i].find_last_of('/');
+            std::string directory = slash == 0 ? "/" : names[i].substr(0, slash);
+            size_t d = 0;
+            while (d < directories_.size() && directories_[d].path != directory) {
+                ++d;
+            }
+            if (d == directories_.size()) {
+                directories_.push_back({directory, -1});
+            }
+            nodes_.push_back({i, d, names[i].substr(slash + 1)});
+        }
+        if (nodes_.empty()) {
+            return false;
+        }
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd_ < 0) {
+            return false;
+        }
+        refresh();
+        return true;
+#else
+        (void)names;
+        return false;
+#endif
+    }
+
+    /**
+     * @return Descriptor that becomes readable when read_events() has something, or -1.
+     */
+    int fd() const {
+        return fd_;
+    }
+
+    /**
+     * Reads every pending event without blocking.
+     * @param appeared Receives the device indexes whose node appeared (may repeat).
+     */
+    void read_events(std::vector<size_t>& appeared) {
+        appeared.clear();
+#ifdef __linux__
+        if (fd_ < 0) {
+            return;
+        }
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t length = read(fd_, buffer, sizeof(buffer));
+            if (length <= 0) {
+                return;
+            }
+            for (ssize_t offset = 0; offset < length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were lost; let the caller check every node
+                    for (const Node& node : nodes_) {
+                        appeared.push_back(node.device);
+                    }
+                    continue;
+                }
+                for (size_t d = 0; d < directories_.size(); ++d) {
+                    if (directories_[d].wd != event->wd) {
+                        continue;
+                    }
+                    if (event->mask & IN_IGNORED) {
+                        directories_[d].wd = -1; // Directory removed; refresh() watches it again
+                    } else if (event->len > 0) {
+                        for (const Node& node : nodes_) {
+                            if (node.directory == d && node.name == event->name) {
+                                appeared.push_back(node.device);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+#endif
+    }
+
+    /**
+     * Watches again any directory that was removed and has come back.
+     * @return true if a watch was added (its nodes may already be there).
+     */
+    bool refresh() {
+        bool added = false;
+#ifdef __linux__
+        for (Directory& directory : directories_) {
+            if (fd_ >= 0 && directory.wd < 0) {
+                directory.wd = inotify_add_watch(fd_, directory.path.c_str(),
+                                                 IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_ONLYDIR);
+                added |= directory.wd >= 0;
+            }
+        }
+#endif
+        return added;
+    }
+
+private:
+    struct Directory {
+        std::string path;
+        int wd;             // inotify watch, -1 while the directory is missing
+    };
+
+    struct Node {
+        size_t device;      // Index into the names given to start()
+        size_t directory;   // Index into directories_
+        std::string name;   // File name within the directory
+    };
+
+    int fd_;
+    std::vector<Directory> directories_;
+    std::vector<Node> nodes_;
+};
+
+#endif // HOTPLUG_H
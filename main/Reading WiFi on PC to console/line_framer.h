@@ -0,0 +1,160 @@
+#ifndef LINE_FRAMER_H
+#define LINE_FRAMER_H
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+/**
+ * Fixed-capacity framer that splits a serial byte stream into lines without copying.
+ *
+ * Bytes are read straight into write_ptr()/write_space() and published with commit().
+ * next_line() then hands out each complete line as a std::string_view into the
+ * internal buffer, with the trailing "\r" removed and the delimiter replaced by '\0'
+ * so the view can also be passed to C string functions.
+ *
+ * The buffer is used as a ring whose read and write positions only move forward;
+ * instead of wrapping, the one unfinished line left at the end is moved back to the
+ * front when the write area runs out. That move is bounded by the maximum line
+ * length, so every byte is touched a constant number of times.
+ *
+ * Views returned by next_line() stay valid until the next call to write_ptr().
+ * The delimiter is '\n' for text; binary telemetry frames (telemetry_frame.h)
+ * end in '\0' and are split the same way, without the "\r" handling.
+ */
+class LineFramer {
+public:
+    static const size_t BUFFER_SIZE = 16384;           // Total buffer capacity
+    static const size_t DEFAULT_MAX_LINE_LENGTH = 4096; // Longest partial line kept
+
+    /**
+     * @param max_line_length Longest unfinished line kept before it is discarded.
+     * @param delimiter Byte that ends a line.
+     */
+    explicit LineFramer(size_t max_line_length = DEFAULT_MAX_LINE_LENGTH, char delimiter = '\n')
+        : max_line_length_(max_line_length < BUFFER_SIZE / 2 ? max_line_length : BUFFER_SIZE / 2),
+          delimiter_(delimiter), head_(0), scan_(0), tail_(0) {}
+
+    /**
+     * Returns where the next read should store its bytes, compacting the buffer first
+     * if the free tail is smaller than half the buffer.
+     * Invalidates all views returned by next_line().
+     * @return Pointer to at least write_space() writable bytes.
+     */
+    char* write_ptr() {
+        if (BUFFER_SIZE - tail_ < BUFFER_SIZE / 2) {
+            compact();
+        }
+        return buffer_ + tail_;
+    }
+
+    /**
+     * @return Number of bytes that may be written at write_ptr().
+     */
+    size_t write_space() const {
+        return BUFFER_SIZE - tail_;
+    }
+
+    /**
+     * Publishes bytes written at write_ptr().
+     * @param length Number of bytes written, at most write_space().
+     */
+    void commit(size_t length) {
+        tail_ += length;
+    }
+
+    /**
+     * Copies bytes into the framer. Convenience for callers that already hold the data.
+     * @param data Bytes to append.
+     * @param length Number of bytes.
+     * @return Number of bytes accepted (less than length only if the buffer is full).
+     */
+    size_t append(const char* data, size_t length) {
+        char* dest = write_ptr();
+        size_t count = length < write_space() ? length : write_space();
+        std::memcpy(dest, data, count);
+        commit(count);
+        return count;
+    }
+
+    /**
+     * Extracts the next complete line.
+     * @param line Receives the line without its delimiter (and, for "\n", trailing "\r" characters).
+     * @return true if a line was found, false if only a partial line remains.
+     */
+    bool next_line(std::string_view& line) {
+        const void* found = std::memchr(buffer_ + scan_, delimiter_, tail_ - scan_);
+        if (!found) {
+            scan_ = tail_;
+            return false;
+        }
+        size_t end = static_cast<const char*>(found) - buffer_;
+        size_t start = head_;
+        head_ = scan_ = end + 1;
+
+        buffer_[end] = '\0';
+        while (delimiter_ == '\n' && end > start && buffer_[end - 1] == '\r') {
+            buffer_[--end] = '\0';
+        }
+        line = std::string_view(buffer_ + start, end - start);
+        return true;
+    }
+
+    /**
+     * Checks the unfinished line against the size limit and discards it if too long.
+     * Call after next_line() has returned false.
+     * @return true if data was discarded.
+     */
+    bool enforce_limit() {
+        if (tail_ - head_ > max_line_length_) {
+            clear();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @return true if bytes of an unfinished line are buffered.
+     */
+    bool has_partial() const {
+        return tail_ != head_;
+    }
+
+    /**
+     * @return Number of buffered bytes not yet returned as lines.
+     */
+    size_t pending() const {
+        return tail_ - head_;
+    }
+
+    /**
+     * Discards all buffered bytes.
+     */
+    void clear() {
+        head_ = scan_ = tail_ = 0;
+    }
+
+private:
+    /**
+     * Moves the unfinished line to the start of the buffer.
+     */
+    void compact() {
+        if (head_ == 0) {
+            return;
+        }
+        size_t remaining = tail_ - head_;
+        std::memmove(buffer_, buffer_ + head_, remaining);
+        scan_ -= head_;
+        tail_ = remaining;
+        head_ = 0;
+    }
+
+    size_t max_line_length_;
+    char delimiter_;
+    size_t head_;  // Start of the first unreturned byte
+    size_t scan_;  // Bytes before this offset are known to contain no delimiter
+    size_t tail_;  // End of committed data
+    char buffer_[BUFFER_SIZE];
+};
+
+#endif // LINE_FRAMER_H
@@ -0,0 +1,233 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sensor_log.h"
+#include "timestamp.h"
+
+/**
+ * Converts sample logs between the reader's CSV format and the binary columnar format.
+ * Build: g++ -O2 -std=c++17 log_convert.cpp -o log_convert
+ * Usage: log_convert csv2bin <in.csv> <out.bin>
+ *        log_convert bin2csv <in.bin> <out.csv>
+ */
+
+/**
+ * Parses "YYYY-MM-DD HH:MM:SS" (local time, optional ".mmm") into epoch milliseconds.
+ * mktime() is only called when the date or hour changes; within an hour the
+ * minutes and seconds are added to the cached base.
+ */
+class TimestampParser {
+public:
+    TimestampParser() : cached_hour_base_(0) {
+        cached_prefix_[0] = '\0';
+    }
+
+    /**
+     * @param text Timestamp text.
+     * @param length Length of the text.
+     * @param time_ms Receives milliseconds since the epoch.
+     * @return false if the text is not a timestamp.
+     */
+    bool parse(const char* text, size_t length, int64_t& time_ms) {
+        static const char PATTERN[] = "0000-00-00 00:00:00";
+        const size_t BASE_LENGTH = sizeof(PATTERN) - 1;
+        if (length < BASE_LENGTH) {
+            return false;
+        }
+        for (size_t i = 0; i < BASE_LENGTH; ++i) {
+            bool digit = text[i] >= '0' && text[i] <= '9';
+            if (PATTERN[i] == '0' ? !digit : text[i] != PATTERN[i]) {
+                return false;
+            }
+        }
+        auto number = [text](size_t at, size_t digits) {
+            int value = 0;
+            for (size_t i = 0; i < digits; ++i) {
+                value = value * 10 + (text[at + i] - '0');
+            }
+            return value;
+        };
+        int milliseconds = 0;
+        if (length > BASE_LENGTH) {
+            if (length != BASE_LENGTH + 4 || text[BASE_LENGTH] != '.') {
+                return false;
+            }
+            for (size_t i = BASE_LENGTH + 1; i < length; ++i) {
+                if (text[i] < '0' || text[i] > '9') {
+                    return false;
+                }
+            }
+            milliseconds = number(BASE_LENGTH + 1, 3);
+        }
+
+        // "YYYY-MM-DD HH" identifies the hour
+        const size_t HOUR_PREFIX = 13;
+        if (std::memcmp(cached_prefix_, text, HOUR_PREFIX) != 0) {
+            std::tm tm = {};
+            tm.tm_year = number(0, 4) - 1900;
+            tm.tm_mon = number(5, 2) - 1;
+            tm.tm_mday = number(8, 2);
+            tm.tm_hour = number(11, 2);
+            tm.tm_isdst = -1;
+            std::time_t base = std::mktime(&tm);
+            if (base == static_cast<std::time_t>(-1)) {
+                return false;
+            }
+            cached_hour_base_ = static_cast<int64_t>(base);
+            std::memcpy(cached_prefix_, text, HOUR_PREFIX);
+        }
+        int64_t seconds = cached_hour_base_ + number(14, 2) * 60 + number(17, 2);
+        time_ms = seconds * 1000 + milliseconds;
+        return true;
+    }
+
+private:
+    char cached_prefix_[16];
+    int64_t cached_hour_base_;
+};
+
+/**
+ * Splits a CSV row into timestamp and the three values.
+ * @return false for the header or any malformed row.
+ */
+bool parse_csv_row(const std::string& line, TimestampParser& parser, sensor_log::LogSample& sample) {
+    size_t comma = line.find(',');
+    if (comma == std::string::npos || !parser.parse(line.data(), comma, sample.time_ms)) {
+        return false;
+    }
+    const char* p = line.c_str() + comma + 1;
+    for (int c = 0; c < sensor_log::COLUMN_COUNT; ++c) {
+        char* end = nullptr;
+        long value = std::strtol(p, &end, 10);
+        if (end == p || value < 0 || value > 65535 || (c + 1 < sensor_log::COLUMN_COUNT && *end != ',')) {
+            return false;
+        }
+        sample.value[c] = static_cast<uint16_t>(value);
+        p = end + 1;
+    }
+    return true;
+}
+
+int csv_to_binary(const char* input, const char* output) {
+    std::FILE* in = std::fopen(input, "rb");
+    if (!in) {
+        std::cerr << "Failed to open " << input << "\n";
+        return 1;
+    }
+    std::remove(output);
+    sensor_log::LogWriter writer;
+    if (!writer.open(output)) {
+        std::cerr << "Failed to create " << output << "\n";
+        std::fclose(in);
+        return 1;
+    }
+
+    TimestampParser parser;
+    std::string line;
+    char chunk[65536];
+    unsigned long rows = 0, skipped = 0, markers = 0;
+    bool first_line = true;
+    bool ok = true;
+    auto handle_line = [&]() {
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] == '#') {
+            ++markers; // Gap marker: the binary format has no marker rows
+        } else if (!line.empty()) {
+            sensor_log::LogSample sample;
+            if (parse_csv_row(line, parser, sample)) {
+                ok = ok && writer.append(sample);
+                ++rows;
+            } else if (!first_line) {
+                ++skipped;
+            }
+            first_line = false;
+        }
+        line.clear();
+    };
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            line.push_back(chunk[i]);
+            if (chunk[i] == '\n') {
+                handle_line();
+            }
+        }
+    }
+    handle_line();
+    std::fclose(in);
+    writer.close();
+
+    if (!ok) {
+        std::cerr << "Write error on " << output << "\n";
+        return 1;
+    }
+    std::cout << rows << " rows converted";
+    if (skipped > 0) {
+        std::cout << ", " << skipped << " malformed rows skipped";
+    }
+    if (markers > 0) {
+        std::cout << ", " << markers << " gap markers left out";
+    }
+    std::cout << "\n";
+    return 0;
+}
+
+int binary_to_csv(const char* input, const char* output) {
+    sensor_log::LogReader reader;
+    if (!reader.open(input)) {
+        std::cerr << "Failed to open " << input << " (not a sensor log?)\n";
+        return 1;
+    }
+    std::FILE* out = std::fopen(output, "wb");
+    if (!out) {
+        std::cerr << "Failed to create " << output << "\n";
+        return 1;
+    }
+    std::fputs("Timestamp,Gas,Temp,S3\n", out);
+
+    TimestampClock clock;
+    char timestamp[TimestampClock::BUFFER_SIZE];
+    sensor_log::BlockView block;
+    std::vector<int64_t> times;
+    unsigned long rows = 0;
+    while (reader.next_block(block)) {
+        block.decode_timestamps(times);
+        for (uint32_t i = 0; i < block.info.row_count; ++i) {
+            clock.format(times[i], timestamp);
+            std::fprintf(out, "%s,%u,%u,%u\n", timestamp,
+                         block.value(0, i), block.value(1, i), block.value(2, i));
+        }
+        rows += block.info.row_count;
+    }
+    bool ok = std::fclose(out) == 0;
+    if (!ok) {
+        std::cerr << "Write error on " << output << "\n";
+        return 1;
+    }
+    std::cout << rows << " rows converted\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " csv2bin <in.csv> <out.bin>\n"
+                  << "       " << argv[0] << " bin2csv <in.bin> <out.csv>\n";
+        return 1;
+    }
+    const std::string mode = argv[1];
+    if (mode == "csv2bin") {
+        return csv_to_binary(argv[2], argv[3]);
+    }
+    if (mode == "bin2csv") {
+        return binary_to_csv(argv[2], argv[3]);
+    }
+    std::cerr << "Unknown mode: " << mode << "\n";
+    return 1;
+}
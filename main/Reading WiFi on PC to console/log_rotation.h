@@ -0,0 +1,296 @@
+#ifndef LOG_ROTATION_H
+#define LOG_ROTATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "gzip.h"
+#include "metrics.h"
+#include "timestamp.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * Log rotation: the live log keeps its name; when it reaches a size limit or
+ * crosses a local-time boundary it is renamed to "<base>.<YYYY-MM-DD_HH-MM-SS>.<ext>"
+ * (the time the segment was started) and a fresh file is opened. Closed
+ * segments are gzipped on a background thread at idle priority and replaced by
+ * "<segment>.gz" once the compressed copy is complete.
+ */
+
+/**
+ * Wall-clock boundary at which the log rolls to a new segment.
+ */
+enum class RotateInterval {
+    NONE,
+    HOURLY,
+    DAILY
+};
+
+/**
+ * @param text "none", "hourly" or "daily".
+ * @param interval Receives the interval.
+ * @return false if text names no interval.
+ */
+inline bool parse_rotate_interval(const std::string& text, RotateInterval& interval) {
+    if (text == "none") {
+        interval = RotateInterval::NONE;
+    } else if (text == "hourly") {
+        interval = RotateInterval::HOURLY;
+    } else if (text == "daily") {
+        interval = RotateInterval::DAILY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @param text Byte count with an optional K, M or G suffix (powers of 1024), e.g. "100M".
+ * @param bytes Receives the count.
+ * @return false if text is not a positive size.
+ */
+inline bool parse_byte_size(const std::string& text, uint64_t& bytes) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || value == 0) {
+        return false;
+    }
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') {
+        shift = 10;
+    } else if (*end == 'M' || *end == 'm') {
+        shift = 20;
+    } else if (*end == 'G' || *end == 'g') {
+        shift = 30;
+    }
+    if (end[shift ? 1 : 0] != '\0') {
+        return false;
+    }
+    bytes = static_cast<uint64_t>(value) << shift;
+    return true;
+}
+
+/**
+ * @return Start of the local hour or day after time_ms, in ms since the epoch;
+ *         INT64_MAX for RotateInterval::NONE or an unrepresentable time.
+ */
+inline int64_t next_rotation_ms(int64_t time_ms, RotateInterval interval) {
+    std::tm local;
+    if (interval == RotateInterval::NONE || !to_local_tm(static_cast<std::time_t>(time_ms / 1000), local)) {
+        return INT64_MAX;
+    }
+    local.tm_sec = 0;
+    local.tm_min = 0;
+    if (interval == RotateInterval::DAILY) {
+        local.tm_hour = 0;
+        ++local.tm_mday;
+    } else {
+        ++local.tm_hour;
+    }
+    local.tm_isdst = -1;
+    std::time_t next = std::mktime(&local);
+    return next == static_cast<std::time_t>(-1) ? INT64_MAX : static_cast<int64_t>(next) * 1000;
+}
+
+/**
+ * Name for a closed segment of a log: "sensor_data.csv" started at 13:00:05
+ * becomes "sensor_data.2025-06-04_13-00-05.csv", with "-2", "-3", ... appended
+ * to the time if that name (or its .gz) is taken.
+ */
+inline std::string segment_name(const std::string& log_filename, int64_t start_ms) {
+    std::string base = log_filename;
+    std::string extension;
+    size_t dot = base.find_last_of('.');
+    size_t slash = base.find_last_of("/\\");
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        extension = base.substr(dot);
+        base.erase(dot);
+    }
+    std::tm local;
+    char stamp[32] = "unknown";
+    if (to_local_tm(static_cast<std::time_t>(start_ms / 1000), local)) {
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%d_%H-%M-%S", &local);
+    }
+    std::string name = base + "." + stamp + extension;
+    std::error_code ec;
+    for (int n = 2; std::filesystem::exists(name, ec) || std::filesystem::exists(name + ".gz", ec); ++n) {
+        name = base + "." + stamp + "-" + std::to_string(n) + extension;
+    }
+    return name;
+}
+
+/**
+ * Finds closed segments of a log that were never compressed (the reader
+ * stopped before their turn came).
+ * @return Paths of uncompressed segments, oldest first.
+ */
+inline std::vector<std::string> uncompressed_segments(const std::string& log_filename) {
+    std::filesystem::path log(log_filename);
+    std::string stem = log.stem().string() + ".";
+    std::string extension = log.extension().string();
+    std::filesystem::path directory = log.has_parent_path() ? log.parent_path() : std::filesystem::path(".");
+    std::vector<std::string> found;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        // "<stem>.YYYY-MM-DD_HH-MM-SS[-N]<ext>"; rollup files ("<stem>.1s<ext>") do not match
+        const char* pattern = "dddd-dd-dd_dd-dd-dd";
+        if (name.size() < stem.size() + 19 + extension.size() || name.compare(0, stem.size(), stem) != 0 ||
+            name.compare(name.size() - extension.size(), extension.size(), extension) != 0) {
+            continue;
+        }
+        bool match = true;
+        for (size_t i = 0; i < 19 && match; ++i) {
+            char c = name[stem.size() + i];
+            match = pattern[i] == 'd' ? (c >= '0' && c <= '9') : c == pattern[i];
+        }
+        if (match && it->is_regular_file(ec)) {
+            found.push_back(it->path().string());
+        }
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+/**
+ * Gzips closed log segments on a background thread at idle CPU priority, so
+ * that neither ingest nor the log writer waits for compression. Each segment
+ * is compressed to "<segment>.gz.tmp", renamed to "<segment>.gz" and only then
+ * removed; a segment interrupted by shutdown or a crash is left as it was and
+ * picked up again by the next start().
+ */
+class SegmentCompressor {
+public:
+    SegmentCompressor() : stopping_(false) {}
+
+    ~SegmentCompressor() {
+        stop();
+    }
+
+    SegmentCompressor(const SegmentCompressor&) = delete;
+    SegmentCompressor& operator=(const SegmentCompressor&) = delete;
+
+    /**
+     * Starts the compressor thread and queues segments left over from earlier runs.
+     * @param log_filename Live log whose segments are compressed.
+     */
+    void start(const std::string& log_filename) {
+        for (const std::string& path : uncompressed_segments(log_filename)) {
+            enqueue(path);
+        }
+        stopping_ = false;
+        thread_ = std::thread(&SegmentCompressor::run, this);
+    }
+
+    /**
+     * Queues a closed segment for compression.
+     */
+    void enqueue(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(path);
+        wake_.notify_one();
+    }
+
+    /**
+     * Abandons the segment being compressed and stops; pending segments stay uncompressed.
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            wake_.notify_one();
+        }
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    /**
+     * @return Segments compressed.
+     */
+    uint64_t compressed() const {
+        return compressed_.value();
+    }
+
+    /**
+     * @return Segments that could not be compressed (left uncompressed).
+     */
+    uint64_t failures() const {
+        return failures_.value();
+    }
+
+private:
+    void run() {
+        lower_priority();
+        while (true) {
+            std::string path;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+                if (stopping_) {
+                    return;
+                }
+                path = pending_.front();
+                pending_.pop_front();
+            }
+            std::string target = path + ".gz";
+            std::string temp = target + ".tmp";
+            std::error_code ec;
+            if (!gzip::compress_file(path, temp, &stopping_)) {
+                if (!stopping_) {
+                    failures_.add();
+                    std::cerr << getTimestamp() << " Warning: could not compress " << path << "\n";
+                }
+                continue;
+            }
+            std::filesystem::rename(temp, target, ec);
+            if (ec || !std::filesystem::remove(path, ec)) {
+                failures_.add();
+                std::cerr << getTimestamp() << " Warning: could not replace " << path << " with " << target << "\n";
+                continue;
+            }
+            compressed_.add();
+        }
+    }
+
+    /**
+     * Lets every other thread of the machine run first.
+     */
+    static void lower_priority() {
+#ifdef _WIN32
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(__linux__)
+        sched_param param = {};
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::string> pending_;
+    std::atomic<bool> stopping_;
+    Counter compressed_;            // Written by the compressor thread
+    Counter failures_;
+    std::thread thread_;
+};
+
+#endif // LOG_ROTATION_H
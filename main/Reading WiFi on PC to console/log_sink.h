@@ -0,0 +1,583 @@
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log_rotation.h"
+#include "metrics.h"
+#include "rollup.h"
+#include "sensor_log.h"
+#include "sensor_parser.h"
+#include "spsc_ring.h"
+#include "timestamp.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * How hard the writer thread pushes each committed batch towards the disk.
+ */
+enum class Durability {
+    NONE,   // Leave data in the stdio buffer until it fills or the file is closed
+    FLUSH,  // fflush() after every batch: visible to other readers, survives a crash of the reader
+    FSYNC   // fflush() + fsync() after every batch: survives power loss
+};
+
+/**
+ * On-disk format of the sample log.
+ */
+enum class LogFormat {
+    CSV,    // "Timestamp,Gas,Temp,S3" text (or the configured columns), with "#gap" marker rows
+    BINARY  // Columnar blocks, see sensor_log.h
+};
+
+/**
+ * One validated sensor sample queued for the log, or a gap marker.
+ */
+struct SampleRow {
+    int64_t time_ms;      // Milliseconds since the Unix epoch
+    char timestamp[TimestampClock::BUFFER_SIZE]; // Same instant formatted for the CSV
+    int value[ROLLUP_COLUMNS]; // Samples: one per log column, fixed point (see LogColumn)
+    uint8_t absent = 0;   // Samples: bit c set if column c had no reading (sensor not connected)
+    uint16_t device = 0;  // Index into LogSink::Options::devices
+    uint32_t lost = 0;    // Nonzero: gap marker for this many samples missing before the next one
+    uint32_t first_lost;  // Gap markers: sequence number of the first missing sample
+    uint16_t stream = 0;  // Gap markers: sample_stream() the samples were missing from
+};
+
+/**
+ * Sample log sink that writes on a dedicated thread.
+ *
+ * Ingest threads only copy rows into bounded lock-free queues, one per producer
+ * thread; the writer thread takes everything queued once batch_rows rows are
+ * waiting on a queue or batch_interval has passed, formats the batch into one
+ * buffer and commits it with a single write plus the configured durability step.
+ * When a queue is full the overflow policy applies; dropped rows are counted.
+ * With more than one device the CSV gets a trailing "Device" column (the binary
+ * format has no device column and is for single-device logs). The writer thread also feeds the
+ * 1 s / 1 min / 1 h rollups (see rollup.h) and appends their closed buckets
+ * with the same durability; samples with an absent value are left out of them.
+ * The value columns default to the ADC log's gas, temp and s3; a CSV log can
+ * name others, with their fixed-point decimals, for the sketches' other formats.
+ *
+ * A CSV log can roll to a new segment at a size limit or a local hour/day
+ * boundary (see log_rotation.h): the writer renames the live file, reopens it
+ * with a fresh header and hands the closed segment to a SegmentCompressor.
+ * Rows are split at the boundary, so every row lands in the segment of its time.
+ *
+ * Samples a sketch numbered but the reader never received are recorded in the
+ * CSV as "#gap,<timestamp>,<count>,<first missing seq>,<stream>[,<device>]"
+ * rows just before the sample that revealed the gap (CSV readers skip '#'
+ * rows). Every numbered stream gets its markers, named as by stream_name()
+ * (e.g. "handler/2"), including the streams whose samples the CSV does not
+ * hold. A sample
+ * that turns up late afterwards is logged when it arrives; the marker is not
+ * revised. The binary format has no marker rows, and rollups only see samples;
+ * a sample whose rollup bucket was already written is left out of that tier.
+ */
+class LogSink {
+public:
+    struct Options {
+        LogFormat format = LogFormat::CSV;
+        size_t queue_capacity = 8192;                         // Rows buffered between threads
+        OverflowPolicy overflow = OverflowPolicy::BLOCK;      // When the writer falls behind
+        size_t producers = 1;                                 // Threads calling push(), one queue each
+        std::vector<std::string> devices;                     // Names for SampleRow::device (CSV only)
+        size_t batch_rows = 64;                               // Commit when this many rows are waiting
+        std::chrono::milliseconds batch_interval{200};        // ... or at least this often
+        Durability durability = Durability::FLUSH;
+        bool rollups = true;                                  // Keep rollup files next to the log
+        uint64_t rotate_bytes = 0;                            // Roll the CSV log at this size, 0: never
+        RotateInterval rotate_every = RotateInterval::NONE;   // ... or at each local hour/day boundary
+        bool compress = true;                                 // Gzip closed segments in the background
+        std::vector<LogColumn> columns = adc_columns();       // Value columns, at most ROLLUP_COLUMNS (CSV only)
+        bool open_on_first_row = false;                       // Create the files only once there is a row
+        // Opens the CSV log; tests substitute streams that fail
+        std::FILE* (*open_stream)(const char* path, const char* mode) = std::fopen;
+    };
+
+    LogSink(const std::string& filename, const Options& options)
+        : filename_(filename), options_(options), file_(nullptr), files_open_(false), segment_start_ms_(0),
+          next_rotation_ms_(INT64_MAX), segment_bytes_(0) {
+        for (size_t i = 0; i < std::max<size_t>(options.producers, 1); ++i) {
+            queues_.emplace_back(new SinkChannel<SampleRow>(options.queue_capacity, options.overflow,
+                                                            options.batch_rows, 8, &ready_));
+        }
+    }
+
+    ~LogSink() {
+        stop();
+    }
+
+    LogSink(const LogSink&) = delete;
+    LogSink& operator=(const LogSink&) = delete;
+
+    /**
+     * Opens the file (writing the header if it is empty) and starts the writer thread.
+     * With Options::open_on_first_row the writer thread opens the file with the first row.
+     * @return false if the file cannot be opened.
+     */
+    bool start() {
+        if (!options_.open_on_first_row && !open_files()) {
+            return false;
+        }
+        writer_ = std::thread(&LogSink::run, this);
+        return true;
+    }
+
+    /**
+     * Queues a row without waiting for the disk (with OverflowPolicy::BLOCK, waits
+     * for queue room instead).
+     * @param row Row to append.
+     * @param producer Queue of the calling thread, below Options::producers; one thread per queue.
+     * @return false if a row was dropped by the overflow policy.
+     */
+    bool push(const SampleRow& row, size_t producer = 0) {
+        return queues_[producer]->offer(row);
+    }
+
+    /**
+     * Writes everything still queued, then stops the writer thread and closes the file.
+     * The threads calling push() must have stopped.
+     */
+    void stop() {
+        for (auto& queue : queues_) {
+            queue->close();
+        }
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        close_file();
+        compressor_.stop();
+    }
+
+    /**
+     * @return Rows dropped by the overflow policy.
+     */
+    uint64_t dropped() const {
+        uint64_t total = 0;
+        for (const auto& queue : queues_) {
+            total += queue->dropped();
+        }
+        return total;
+    }
+
+    /**
+     * @return Rows waiting for the writer thread.
+     */
+    size_t queued() const {
+        size_t total = 0;
+        for (const auto& queue : queues_) {
+            total += queue->size();
+        }
+        return total;
+    }
+
+    /**
+     * @return Rows committed to the log file.
+     */
+    uint64_t rows_written() const {
+        return rows_written_.value();
+    }
+
+    /**
+     * @return Failed commits (each followed by a reopen and one retry of the rows not yet written).
+     */
+    uint64_t write_errors() const {
+        return write_errors_.value();
+    }
+
+    /**
+     * @return Time per batch commit (write plus durability step), in ns.
+     */
+    const Histogram& commit_latency() const {
+        return commit_ns_;
+    }
+
+    /**
+     * @param tier 0, 1 or 2 for the 1 s, 1 min and 1 h rollups.
+     * @return Samples left out of a rollup tier because their bucket was already written.
+     */
+    uint64_t rollup_late(int tier) const {
+        return rollups_.late(tier);
+    }
+
+    /**
+     * @return Segments closed by rotation.
+     */
+    uint64_t rotations() const {
+        return rotations_.value();
+    }
+
+    /**
+     * @return Closed segments replaced by their .gz.
+     */
+    uint64_t segments_compressed() const {
+        return compressor_.compressed();
+    }
+
+private:
+    /**
+     * Opens the log, its rollup files and the compressor of its closed segments.
+     * @return false if the log cannot be opened.
+     */
+    bool open_files() {
+        if (!open_file()) {
+            return false;
+        }
+        files_open_ = true;
+        if (options_.rollups && !rollups_.open(filename_, options_.devices, options_.columns)) {
+            std::cerr << getTimestamp() << " Warning: could not open rollup files, will retry\n";
+        }
+        if (rotating() && options_.compress) {
+            compressor_.start(filename_);
+        }
+        return true;
+    }
+
+    bool rotating() const {
+        return options_.format == LogFormat::CSV &&
+               (options_.rotate_bytes > 0 || options_.rotate_every != RotateInterval::NONE);
+    }
+
+    /**
+     * @return Time of the first row of an existing CSV log, or now for an empty or unreadable one.
+     */
+    int64_t first_row_ms() const {
+        int64_t time_ms = wall_clock_ms();
+        std::FILE* file = std::fopen(filename_.c_str(), "r");
+        if (!file) {
+            return time_ms;
+        }
+        char line[128];
+        std::tm tm = {};
+        bool found = std::fgets(line, sizeof(line), file) != nullptr; // Header
+        do {
+            found = found && std::fgets(line, sizeof(line), file) != nullptr;
+        } while (found && line[0] == '#'); // Gap markers
+        if (found && std::sscanf(line, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min,
+                        &tm.tm_sec) == 6) {
+            tm.tm_year -= 1900;
+            tm.tm_mon -= 1;
+            tm.tm_isdst = -1;
+            std::time_t seconds = std::mktime(&tm);
+            if (seconds != static_cast<std::time_t>(-1)) {
+                time_ms = static_cast<int64_t>(seconds) * 1000;
+            }
+        }
+        std::fclose(file);
+        return time_ms;
+    }
+
+    /**
+     * Opens the file for appending and writes the header into an empty file.
+     */
+    bool open_file() {
+        if (options_.format == LogFormat::BINARY) {
+            return binary_.open(filename_);
+        }
+        file_ = options_.open_stream(filename_.c_str(), "a");
+        if (!file_) {
+            return false;
+        }
+        std::fseek(file_, 0, SEEK_END);
+        long size = std::ftell(file_);
+        if (size == 0) {
+            std::string header = "Timestamp";
+            for (const LogColumn& column : options_.columns) {
+                header += "," + column.name;
+            }
+            header += options_.devices.size() > 1 ? ",Device\n" : "\n";
+            std::fputs(header.c_str(), file_);
+            size = static_cast<long>(header.size());
+        }
+        if (rotating()) {
+            segment_bytes_ = size > 0 ? static_cast<uint64_t>(size) : 0;
+            segment_start_ms_ = first_row_ms();
+            next_rotation_ms_ = next_rotation_ms(segment_start_ms_, options_.rotate_every);
+        }
+        return true;
+    }
+
+    /**
+     * Closes the live CSV log, renames it to a segment name and opens a fresh one.
+     * @param now_ms Time of the row that triggered the rotation.
+     * @return false if the live log cannot be reopened.
+     */
+    bool rotate(int64_t now_ms) {
+        if (file_) {
+            sync(file_);
+            std::fclose(file_);
+            file_ = nullptr;
+        }
+        std::string segment = segment_name(filename_, segment_start_ms_);
+        bool renamed = std::rename(filename_.c_str(), segment.c_str()) == 0;
+        if (!renamed) {
+            std::cerr << getTimestamp() << " Warning: could not rename " << filename_ << " to " << segment
+                      << ", rotating at the next boundary\n";
+        }
+        if (!open_file()) {
+            return false;
+        }
+        if (renamed) {
+            rotations_.add();
+            if (options_.compress) {
+                compressor_.enqueue(segment);
+            }
+        } else {
+            // Keep appending until the next size step or boundary instead of retrying per row
+            segment_bytes_ = 0;
+            next_rotation_ms_ = next_rotation_ms(now_ms, options_.rotate_every);
+        }
+        return true;
+    }
+
+    /**
+     * @param keep_pending Write rows appended since the last commit before closing.
+     */
+    void close_file(bool keep_pending = true) {
+        binary_.close(keep_pending);
+        rollups_.close();
+        if (file_) {
+            std::fclose(file_);
+            file_ = nullptr;
+        }
+    }
+
+    /**
+     * Writer thread: waits for a full batch or the batch interval, then commits.
+     */
+    void run() {
+        std::vector<SampleRow> batch;
+        batch.reserve(options_.queue_capacity);
+        std::string text;
+        while (true) {
+            ready_.wait(options_.batch_interval, [this] {
+                return std::any_of(queues_.begin(), queues_.end(), [](const auto& queue) { return queue->ready(); });
+            });
+            bool stop_requested = queues_.front()->closed();
+            SampleRow row;
+            for (auto& queue : queues_) {
+                while (queue->pop(row)) {
+                    batch.push_back(row);
+                }
+            }
+            if (queues_.size() > 1) {
+                // Each queue is in time order; interleave them
+                std::stable_sort(batch.begin(), batch.end(), [](const SampleRow& a, const SampleRow& b) {
+                    return a.time_ms < b.time_ms;
+                });
+            }
+
+            if (!batch.empty() && !files_open_ && !open_files()) {
+                write_errors_.add();
+                std::cerr << getTimestamp() << " Warning: could not create " << filename_ << ", " << batch.size()
+                          << " rows lost\n";
+                batch.clear();
+            }
+            if (!batch.empty()) {
+                uint64_t commit_start = metrics_now_ns();
+                size_t committed = 0;
+                bool ok = commit(batch, committed, text);
+                commit_ns_.record(metrics_now_ns() - commit_start);
+                if (!ok) {
+                    write_errors_.add();
+                    // Same recovery as the old inline writer: reopen and retry once, from the
+                    // first row not yet in the log so that no row is written twice
+                    const char* kind = options_.format == LogFormat::BINARY ? "Log" : "CSV";
+                    std::cerr << getTimestamp() << " " << kind << " file error, attempting to reopen...\n";
+                    close_file(false);
+                    if (!open_file()) {
+                        std::cerr << getTimestamp() << " Failed to reopen " << kind << " file!\n";
+                    } else if (!commit(batch, committed, text)) {
+                        std::cerr << getTimestamp() << " Warning: " << kind << " write failed, "
+                                  << batch.size() - committed << " rows lost\n";
+                    }
+                }
+                rows_written_.add(static_cast<uint64_t>(std::count_if(
+                    batch.begin(), batch.begin() + committed, [](const SampleRow& row) { return row.lost == 0; })));
+                if (options_.rollups) {
+                    for (const SampleRow& row : batch) {
+                        if (row.lost == 0 && row.absent == 0) {
+                            rollups_.add(row.time_ms, row.timestamp, row.value, row.device);
+                        }
+                    }
+                }
+                batch.clear();
+            }
+            if (options_.rollups) {
+                // Rows reach this thread within one batch interval of being stamped
+                if (stop_requested) {
+                    rollups_.close_all();
+                } else {
+                    rollups_.close_idle(wall_clock_ms(), options_.batch_interval.count() + 1000);
+                }
+                if (!rollups_.flush([this](std::FILE* stream) { return sync(stream); })) {
+                    std::cerr << getTimestamp() << " Warning: rollup write failed, rows lost\n";
+                }
+            }
+
+            if (stop_requested && queued() == 0) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * Formats rows [begin, end) of a batch into one text block.
+     */
+    void format_batch(const std::vector<SampleRow>& batch, size_t begin, size_t end, std::string& text) const {
+        text.clear();
+        const bool device_column = options_.devices.size() > 1;
+        const size_t columns = std::min<size_t>(options_.columns.size(), ROLLUP_COLUMNS);
+        const bool whole = std::all_of(options_.columns.begin(), options_.columns.end(),
+                                       [](const LogColumn& column) { return column.decimals == 0; });
+        char line[96];
+        char stream[16];
+        for (size_t i = begin; i < end; ++i) {
+            const SampleRow& row = batch[i];
+            int length;
+            if (row.lost > 0) {
+                stream_name(row.stream, stream, sizeof(stream));
+                length = std::snprintf(line, sizeof(line),
+                                       device_column ? "#gap,%s,%lu,%lu,%s," : "#gap,%s,%lu,%lu,%s\n", row.timestamp, static_cast<unsigned long>(row.lost),
+                                       static_cast<unsigned long>(row.first_lost), stream);
+            } else if (columns == 3 && whole && row.absent == 0) {
+                // The ADC log's rows
+                length = std::snprintf(line, sizeof(line), device_column ? "%s,%d,%d,%d," : "%s,%d,%d,%d\n",
+                                       row.timestamp, row.value[0], row.value[1], row.value[2]);
+            } else {
+                length = std::snprintf(line, sizeof(line), "%s", row.timestamp);
+                for (size_t c = 0; c < columns && length > 0; ++c) {
+                    line[length++] = ',';
+                    if (!((row.absent >> c) & 1)) {
+                        length += format_fixed(line + length, sizeof(line) - length, row.value[c],
+                                               options_.columns[c].decimals);
+                    }
+                }
+                line[length++] = device_column ? ',' : '\n';
+            }
+            text.append(line, length > 0 ? static_cast<size_t>(length) : 0);
+            if (device_column) {
+                text += row.device < options_.devices.size() ? options_.devices[row.device] : std::to_string(row.device);
+                text += '\n';
+            }
+        }
+    }
+
+    /**
+     * Appends a batch in the configured format and applies the durability mode.
+     * A CSV batch is written and synced segment by segment, so an error can
+     * leave the rows of earlier segments in the log.
+     * @param batch Rows to write.
+     * @param committed Rows at the start of the batch already in the log, where writing
+     *                  starts; advanced past every row written and synced.
+     * @param text Scratch buffer for the CSV text.
+     * @return false on any I/O error.
+     */
+    bool commit(const std::vector<SampleRow>& batch, size_t& committed, std::string& text) {
+        if (options_.format == LogFormat::BINARY) {
+            // One block commit: the batch is written entirely or not at all
+            std::FILE* stream = binary_.stream();
+            if (!stream) {
+                return false;
+            }
+            for (size_t i = committed; i < batch.size(); ++i) {
+                const SampleRow& row = batch[i];
+                if (row.lost > 0) {
+                    continue;
+                }
+                sensor_log::LogSample sample = {row.time_ms, {static_cast<uint16_t>(row.value[0]),
+                                                              static_cast<uint16_t>(row.value[1]),
+                                                              static_cast<uint16_t>(row.value[2])}};
+                if (!binary_.append(sample)) {
+                    return false;
+                }
+            }
+            if (!binary_.commit() || !sync(stream)) {
+                return false;
+            }
+            committed = batch.size();
+            return true;
+        }
+        // Write the rows segment by segment, rotating at the size limit and time boundaries
+        for (size_t begin = committed; begin < batch.size();) {
+            if (batch[begin].time_ms >= next_rotation_ms_ ||
+                (options_.rotate_bytes > 0 && segment_bytes_ >= options_.rotate_bytes)) {
+                if (!rotate(batch[begin].time_ms)) {
+                    return false;
+                }
+            }
+            size_t end = begin + 1;
+            while (end < batch.size() && batch[end].time_ms < next_rotation_ms_) {
+                ++end;
+            }
+            std::FILE* stream = file_;
+            if (!stream || std::ferror(stream)) {
+                return false;
+            }
+            format_batch(batch, begin, end, text);
+            if (std::fwrite(text.data(), 1, text.size(), stream) != text.size() || !sync(stream)) {
+                return false;
+            }
+            segment_bytes_ += text.size();
+            committed = end;
+            begin = end;
+        }
+        return true;
+    }
+
+    /**
+     * Applies the durability mode to a stream just written to.
+     * @return false on any I/O error.
+     */
+    bool sync(std::FILE* stream) {
+        if (options_.durability == Durability::NONE) {
+            return true;
+        }
+        if (std::fflush(stream) != 0) {
+            return false;
+        }
+        if (options_.durability == Durability::FSYNC) {
+#ifdef _WIN32
+            return _commit(_fileno(stream)) == 0;
+#else
+            return fsync(fileno(stream)) == 0;
+#endif
+        }
+        return true;
+    }
+
+    std::string filename_;
+    Options options_;
+    std::FILE* file_;               // CSV stream; only touched by the writer thread after start()
+    bool files_open_;               // open_files() succeeded; see Options::open_on_first_row
+    int64_t segment_start_ms_;      // Rotation state of the live CSV log, writer thread only
+    int64_t next_rotation_ms_;      // Rows at or after this time go to the next segment
+    uint64_t segment_bytes_;
+    SegmentCompressor compressor_;
+    Counter rotations_;
+    sensor_log::LogWriter binary_;  // Binary log, used instead of file_ for LogFormat::BINARY
+    Rollups rollups_;               // Writer thread only
+    Counter rows_written_;          // Metrics below are written by the writer thread
+    Counter write_errors_;
+    Histogram commit_ns_;
+    Doorbell ready_;                // Shared by the queues below
+    std::vector<std::unique_ptr<SinkChannel<SampleRow>>> queues_; // Ingest threads -> writer thread
+    std::thread writer_;
+};
+
+#endif // LOG_SINK_H
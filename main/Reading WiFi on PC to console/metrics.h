@@ -0,0 +1,394 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Reader metrics: counters, log-linear latency histograms and a small HTTP
+ * server that exposes them in Prometheus text format.
+ *
+ * Every metric has exactly one writing thread, so updates are a relaxed load
+ * and store (no locked instruction); any other thread may read concurrently
+ * and sees a value that is at most one update old.
+ */
+
+/**
+ * Monotonic counter written by a single thread.
+ */
+class Counter {
+public:
+    Counter() : value_(0) {}
+
+    void add(uint64_t n = 1) {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_;
+};
+
+/**
+ * HDR-style histogram of non-negative integer values (nanoseconds for latencies).
+ *
+ * Values below 32 get exact buckets; above that each power of two is split
+ * into 16 linear sub-buckets, so any recorded value is known to within 6.25%.
+ * Covers 0 .. 2^40 (about 18 minutes in ns); larger values land in the top bucket.
+ * Written by a single thread.
+ */
+class Histogram {
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_EXPONENT = 36;
+    static const int BUCKET_COUNT = (MAX_EXPONENT + 2) * SUB_BUCKETS;
+
+    Histogram() : count_(0), sum_(0), max_(0) {
+        for (std::atomic<uint64_t>& b : buckets_) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t value) {
+        bump(buckets_[index_of(value)], 1);
+        bump(count_, 1);
+        bump(sum_, value);
+        if (value > max_.load(std::memory_order_relaxed)) {
+            max_.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    /**
+     * @return Number of recorded values strictly below limit, exact when limit
+     *         is a power of two or below 32.
+     */
+    uint64_t count_below(uint64_t limit) const {
+        uint64_t total = 0;
+        for (int i = 0; i < BUCKET_COUNT && upper_bound(i) <= limit; ++i) {
+            total += buckets_[i].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    /**
+     * @param q Quantile in [0, 1].
+     * @return Upper bound of the bucket holding the q-th value (0 if empty).
+     */
+    uint64_t quantile(double q) const {
+        uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t bound = upper_bound(i) - 1;
+                return bound < max() ? bound : max();
+            }
+        }
+        return max();
+    }
+
+    static int index_of(uint64_t value) {
+        if (value < 2 * SUB_BUCKETS) {
+            return static_cast<int>(value);
+        }
+        int msb = 63;
+        while (!((value >> msb) & 1)) {
+            --msb;
+        }
+        int exponent = msb - SUB_BUCKET_BITS;
+        if (exponent > MAX_EXPONENT) {
+            return BUCKET_COUNT - 1;
+        }
+        return (exponent + 1) * SUB_BUCKETS + static_cast<int>((value >> exponent) - SUB_BUCKETS);
+    }
+
+    /**
+     * @return First value above bucket i.
+     */
+    static uint64_t upper_bound(int i) {
+        if (i < 2 * SUB_BUCKETS) {
+            return static_cast<uint64_t>(i) + 1;
+        }
+        int exponent = i / SUB_BUCKETS - 1;
+        return (static_cast<uint64_t>(SUB_BUCKETS + i % SUB_BUCKETS) + 1) << exponent;
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& cell, uint64_t n) {
+        cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets_[BUCKET_COUNT];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+/**
+ * @return Nanoseconds on the steady clock, for latency measurements.
+ */
+inline uint64_t metrics_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * Appends Prometheus text exposition lines.
+ */
+class PrometheusText {
+public:
+    explicit PrometheusText(std::string& out) : out_(out) {}
+
+    void header(const char* name, const char* type, const char* help) {
+        out_ += "# HELP ";
+        out_ += name;
+        out_ += ' ';
+        out_ += help;
+        out_ += "\n# TYPE ";
+        out_ += name;
+        out_ += ' ';
+        out_ += type;
+        out_ += '\n';
+    }
+
+    /**
+     * @param labels Label set without braces (e.g. "format=\"json\""), or nullptr.
+     */
+    void sample(const char* name, const char* labels, double value) {
+        char number[64];
+        std::snprintf(number, sizeof(number), "%.15g", value);
+        out_ += name;
+        if (labels && *labels) {
+            out_ += '{';
+            out_ += labels;
+            out_ += '}';
+        }
+        out_ += ' ';
+        out_ += number;
+        out_ += '\n';
+    }
+
+    void counter(const char* name, const char* help, uint64_t value) {
+        header(name, "counter", help);
+        sample(name, nullptr, static_cast<double>(value));
+    }
+
+    void gauge(const char* name, const char* help, double value) {
+        header(name, "gauge", help);
+        sample(name, nullptr, value);
+    }
+
+    /**
+     * Writes a nanosecond histogram as seconds, with le bounds at powers of two
+     * from 1 us to 16 s (these fall on bucket edges, so the counts are exact).
+     * @param help Help text, or nullptr for further series after header() was written.
+     * @param labels Labels of this series without braces, or nullptr.
+     */
+    void histogram_seconds(const char* name, const char* help, const Histogram& h, const char* labels = nullptr) {
+        if (help) {
+            header(name, "histogram", help);
+        }
+        std::string prefix = labels && *labels ? std::string(labels) + "," : std::string();
+        std::string bucket = std::string(name) + "_bucket";
+        uint64_t total = h.count();
+        char label[48];
+        for (int exponent = 10; exponent <= 34; ++exponent) {
+            uint64_t limit = uint64_t(1) << exponent;
+            std::snprintf(label, sizeof(label), "le=\"%.9g\"", static_cast<double>(limit) / 1e9);
+            sample(bucket.c_str(), (prefix + label).c_str(), static_cast<double>(h.count_below(limit)));
+        }
+        sample(bucket.c_str(), (prefix + "le=\"+Inf\"").c_str(), static_cast<double>(total));
+        sample((std::string(name) + "_sum").c_str(), labels, static_cast<double>(h.sum()) / 1e9);
+        sample((std::string(name) + "_count").c_str(), labels, static_cast<double>(total));
+    }
+
+private:
+    std::string& out_;
+};
+
+/**
+ * Minimal HTTP/1.0 server on 127.0.0.1 for scraping; one connection at a time
+ * on its own thread, so a slow client never touches the ingest path.
+ */
+class MetricsServer {
+public:
+    /**
+     * Answers one GET request.
+     * @param path Request path, e.g. "/metrics".
+     * @param body Receives the response body.
+     * @param content_type Receives the Content-Type.
+     * @return false for 404 Not Found.
+     */
+    using Handler = std::function<bool(const std::string& path, std::string& body, std::string& content_type)>;
+
+    MetricsServer() : listener_(INVALID), stopping_(false) {}
+
+    ~MetricsServer() {
+        stop();
+    }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    /**
+     * Binds the port and starts serving.
+     * @param port TCP port on the loopback interface.
+     * @param handler Called on the server thread for each request.
+     * @return false if the port cannot be bound.
+     */
+    bool start(uint16_t port, Handler handler) {
+#ifdef _WIN32
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            return false;
+        }
+#endif
+        handler_ = std::move(handler);
+        listener_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener_ == INVALID) {
+            return false;
+        }
+        int yes = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof(yes));
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener_, 8) != 0) {
+            close_socket(listener_);
+            listener_ = INVALID;
+            return false;
+        }
+        thread_ = std::thread(&MetricsServer::run, this);
+        return true;
+    }
+
+    void stop() {
+        stopping_ = true;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        if (listener_ != INVALID) {
+            close_socket(listener_);
+            listener_ = INVALID;
+#ifdef _WIN32
+            WSACleanup();
+#endif
+        }
+    }
+
+private:
+#ifdef _WIN32
+    using Socket = SOCKET;
+    static constexpr Socket INVALID = INVALID_SOCKET;
+    static void close_socket(Socket s) { closesocket(s); }
+    static const int SEND_FLAGS = 0;
+#else
+    using Socket = int;
+    static constexpr Socket INVALID = -1;
+    static void close_socket(Socket s) { ::close(s); }
+    static const int SEND_FLAGS = MSG_NOSIGNAL; // A client that hangs up must not kill the reader
+#endif
+
+    /**
+     * Waits up to timeout_ms for s to become readable.
+     */
+    static bool wait_readable(Socket s, int timeout_ms) {
+#ifdef _WIN32
+        WSAPOLLFD pfd = {s, POLLRDNORM, 0};
+        return WSAPoll(&pfd, 1, timeout_ms) > 0;
+#else
+        pollfd pfd = {s, POLLIN, 0};
+        return poll(&pfd, 1, timeout_ms) > 0;
+#endif
+    }
+
+    void run() {
+        while (!stopping_) {
+            if (!wait_readable(listener_, 200)) {
+                continue;
+            }
+            Socket client = accept(listener_, nullptr, nullptr);
+            if (client == INVALID) {
+                continue;
+            }
+            serve(client);
+            close_socket(client);
+        }
+    }
+
+    void serve(Socket client) {
+        // Read until the end of the request headers (or 8 KiB / 2 s)
+        std::string request;
+        char chunk[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192 &&
+               wait_readable(client, 2000)) {
+            int n = static_cast<int>(recv(client, chunk, sizeof(chunk), 0));
+            if (n <= 0) {
+                break;
+            }
+            request.append(chunk, static_cast<size_t>(n));
+        }
+        std::string status = "400 Bad Request";
+        std::string body;
+        std::string content_type = "text/plain; charset=utf-8";
+        if (request.compare(0, 4, "GET ") == 0) {
+            size_t end = request.find(' ', 4);
+            std::string path = request.substr(4, end == std::string::npos ? std::string::npos : end - 4);
+            status = handler_(path, body, content_type) ? "200 OK" : "404 Not Found";
+            if (status[0] == '4' && body.empty()) {
+                body = "Not found\n";
+            }
+        }
+        std::string response = "HTTP/1.0 " + status + "\r\nContent-Type: " + content_type +
+                               "\r\nContent-Length: " + std::to_string(body.size()) +
+                               "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            int n = static_cast<int>(send(client, response.data() + sent, static_cast<int>(response.size() - sent),
+                                          SEND_FLAGS));
+            if (n <= 0) {
+                break;
+            }
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    Socket listener_;
+    std::atomic<bool> stopping_;
+    Handler handler_;
+    std::thread thread_;
+};
+
+#endif // METRICS_H
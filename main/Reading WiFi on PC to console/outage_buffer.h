@@ -0,0 +1,387 @@
+#ifndef OUTAGE_BUFFER_H
+#define OUTAGE_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sample_batch.h"
+#include "telemetry_frame.h"
+
+/*
+ * Store-and-forward buffering for ESP_WiFi_Communication: every sample goes
+ * into a SampleRing in RAM and leaves it only once the server has taken the
+ * batch it was sent in, so samples taken while the link is down are uploaded
+ * in order once it is back. Optionally the ring spills its oldest samples to
+ * a SampleLog in EEPROM when it fills, which both extends the capacity and
+ * keeps them across the board restart that ends a long outage.
+ * Plain C++ for avr-gcc, no heap.
+ */
+
+/**
+ * Fixed-capacity FIFO of samples. When full, a push overwrites the oldest
+ * sample (counted in overwritten(); the receiver sees the hole in the numbers).
+ * Every sample pushed gets an index counting all pushes, so samples that were
+ * sent can be removed even if some of them were overwritten or taken out in
+ * the meantime.
+ */
+template <uint16_t CAPACITY>
+class SampleRing {
+public:
+    SampleRing() : head_(0), count_(0), first_index_(0), overwritten_(0) {}
+
+    /**
+     * Appends a sample.
+     * @return false if the ring was full and the oldest sample was overwritten.
+     */
+    bool push(const BatchSample& sample) {
+        bool room = count_ < CAPACITY;
+        if (!room) {
+            pop(1);
+            ++overwritten_;
+        }
+        samples_[(head_ + count_) % CAPACITY] = sample;
+        ++count_;
+        return room;
+    }
+
+    /**
+     * @param i 0 for the oldest sample; below size().
+     */
+    const BatchSample& at(uint16_t i) const {
+        return samples_[(head_ + i) % CAPACITY];
+    }
+
+    /**
+     * Removes the n oldest samples.
+     */
+    void pop(uint16_t n) {
+        n = n < count_ ? n : count_;
+        head_ = (head_ + n) % CAPACITY;
+        count_ -= n;
+        first_index_ += n;
+    }
+
+    /**
+     * Removes the samples with an index below end (those that were sent).
+     */
+    void pop_until(uint32_t end) {
+        if (static_cast<int32_t>(end - first_index_) > 0) {
+            pop(static_cast<uint16_t>(end - first_index_ < count_ ? end - first_index_ : count_));
+        }
+    }
+
+    /**
+     * @return Index of at(0); at(i) has index first_index() + i.
+     */
+    uint32_t first_index() const {
+        return first_index_;
+    }
+
+    uint16_t size() const {
+        return count_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    bool full() const {
+        return count_ == CAPACITY;
+    }
+
+    /**
+     * @return Samples lost to a full ring.
+     */
+    uint32_t overwritten() const {
+        return overwritten_;
+    }
+
+private:
+    BatchSample samples_[CAPACITY];
+    uint16_t head_;
+    uint16_t count_;
+    uint32_t first_index_;
+    uint32_t overwritten_;
+};
+
+/**
+ * Circular log of samples in byte-addressed non-volatile memory, written so
+ * that wear is spread evenly: records are only ever appended, each to the
+ * slot after the previous one, so every slot is written once per lap.
+ * Nothing is kept at a fixed address; begin() finds the newest record and
+ * the position up to which samples were sent by scanning all slots.
+ *
+ * Record (RECORD_SIZE bytes, little endian):
+ *   pos   4 bytes: position in the log, counting every record ever written
+ *         (slot = pos % SLOTS); top bit set for an ack record
+ *   seq   4 bytes: sample number; ack record: position up to which the
+ *         samples before it were sent
+ *   time  4 bytes: device millis() of the sample
+ *   value 2 bytes each: gas, temp, s3
+ *   crc   2 bytes: CRC-16/CCITT-FALSE of the bytes before it
+ *
+ * A record with a bad CRC (torn by a reset mid-write, or bytes never written)
+ * or in the wrong slot is skipped. A sample whose ack record was lost is sent
+ * again; the receiver skips the duplicate. Writes go a byte at a time, only
+ * when the storage is ready (an AVR EEPROM byte takes 3.3 ms), from poll().
+ *
+ * Storage provides uint8_t read(size_t address), void write(size_t address,
+ * uint8_t value) (best skipping unchanged bytes) and bool ready().
+ */
+template <uint16_t SLOTS, class Storage>
+class SampleLog {
+public:
+    static const size_t RECORD_SIZE = 12 + 2 * BATCH_VALUES + 2;
+    static const size_t SIZE = RECORD_SIZE * SLOTS;  // Bytes of storage used from the base address
+
+    SampleLog(Storage& storage, size_t base)
+        : storage_(storage), base_(base), end_(0), next_(0), boot_end_(0), restored_ms_(0), samples_(0),
+          writing_(false), written_(0),
+          writing_sample_(false), ack_due_(false), ack_pos_(0) {}
+
+    /**
+     * Recovers the log from storage; call once before anything else.
+     * @return Samples waiting to be sent.
+     */
+    uint32_t begin() {
+        uint32_t newest = 0, newest_sample = 0, acked = 0;
+        bool found = false;
+        uint8_t record[RECORD_SIZE];
+        for (uint16_t slot = 0; slot < SLOTS; ++slot) {
+            if (!load(slot, record)) {
+                continue;
+            }
+            uint32_t pos = get32(record, 0) & POS_MASK;
+            if (!found || pos > newest) {
+                newest = pos;
+                found = true;
+            }
+            if (!(get32(record, 0) & ACK_FLAG)) {
+                if (pos >= newest_sample) {
+                    newest_sample = pos;
+                    restored_ms_ = get32(record, 8);
+                }
+            } else if (get32(record, 4) > acked) {
+                acked = get32(record, 4);
+            }
+        }
+        end_ = found ? newest + 1 : 0;
+        next_ = end_ > SLOTS && end_ - SLOTS > acked ? end_ - SLOTS : acked;
+        boot_end_ = end_;
+        samples_ = count_samples(next_, end_);
+        return samples_;
+    }
+
+    /**
+     * Starts writing a sample.
+     * @return false if a record is still being written or the log is full.
+     */
+    bool append(const BatchSample& sample) {
+        if (writing_ || full()) {
+            return false;
+        }
+        put32(record_, 0, end_ & POS_MASK);
+        put32(record_, 4, sample.seq);
+        put32(record_, 8, sample.time_ms);
+        for (uint8_t v = 0; v < BATCH_VALUES; ++v) {
+            put16(record_, 12 + 2 * v, static_cast<uint16_t>(sample.value[v]));
+        }
+        start_write();
+        writing_sample_ = true;
+        return true;
+    }
+
+    /**
+     * Writes what the storage takes now; call from every loop().
+     */
+    void poll() {
+        if (!writing_ && ack_due_ && !full()) {
+            ack_due_ = false;
+            put32(record_, 0, (end_ & POS_MASK) | ACK_FLAG);
+            put32(record_, 4, ack_pos_);
+            for (size_t i = 8; i < RECORD_SIZE - 2; ++i) {
+                record_[i] = 0;
+            }
+            start_write();
+        }
+        while (writing_ && storage_.ready()) {
+            storage_.write(base_ + (end_ - 1) % SLOTS * RECORD_SIZE + written_, record_[written_]);
+            if (++written_ == RECORD_SIZE) {
+                writing_ = false;
+                samples_ += writing_sample_ ? 1 : 0;
+                writing_sample_ = false;
+            }
+        }
+    }
+
+    /**
+     * Waits until every pending write is done (before a restart).
+     */
+    void flush() {
+        while (writing_ || (ack_due_ && !full())) {
+            poll();
+        }
+    }
+
+    /**
+     * Reads the next sample waiting to be sent.
+     * @param pos Position to read from, normally first() or the pos a previous read left;
+     *            advanced past the sample.
+     * @return false if there is no sample at or after pos.
+     */
+    bool read(uint32_t& pos, BatchSample& sample) const {
+        uint8_t record[RECORD_SIZE];
+        uint32_t stored = writing_ ? end_ - 1 : end_;
+        while (pos < stored) {
+            uint32_t at = pos++;
+            if (!load(at % SLOTS, record) || get32(record, 0) != (at & POS_MASK)) {
+                continue; // An ack record, or a slot not written
+            }
+            sample.seq = get32(record, 4);
+            sample.time_ms = get32(record, 8);
+            for (uint8_t v = 0; v < BATCH_VALUES; ++v) {
+                sample.value[v] = static_cast<int16_t>(get16(record, 12 + 2 * v));
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Records that every sample before pos was sent (or could not be read back).
+     */
+    void ack(uint32_t pos) {
+        if (pos <= next_) {
+            return;
+        }
+        samples_ = pos >= (writing_ ? end_ - 1 : end_) ? 0 : samples_ - count_samples(next_, pos);
+        next_ = pos;
+        ack_pos_ = pos;
+        ack_due_ = true;
+    }
+
+    /**
+     * @return true if the record at pos was there before begin(): its sample was
+     *         probably taken before the board last restarted, on another millis().
+     */
+    bool restored(uint32_t pos) const {
+        return pos < boot_end_;
+    }
+
+    /**
+     * @return Device time of the newest sample there before begin(): about when
+     *         the board restarted, on the millis() of the restored samples.
+     */
+    uint32_t restored_ms() const {
+        return restored_ms_;
+    }
+
+    /**
+     * @return Position of the oldest sample waiting to be sent.
+     */
+    uint32_t first() const {
+        return next_;
+    }
+
+    /**
+     * @return Samples waiting to be sent, including one being written.
+     */
+    uint32_t size() const {
+        return samples_ + (writing_sample_ ? 1 : 0);
+    }
+
+    /**
+     * @return true if no sample can be read; one may be being written.
+     */
+    bool empty() const {
+        return samples_ == 0;
+    }
+
+    /**
+     * @return true while a record is being written.
+     */
+    bool busy() const {
+        return writing_;
+    }
+
+    /**
+     * @return true if another record would overwrite a sample not yet sent.
+     */
+    bool full() const {
+        return end_ - next_ >= SLOTS;
+    }
+
+private:
+    // Positions count up for 2^31 records: decades at one record a second
+    static const uint32_t ACK_FLAG = 0x80000000u;
+    static const uint32_t POS_MASK = 0x7FFFFFFFu;
+
+    void start_write() {
+        put16(record_, RECORD_SIZE - 2, telemetry_crc16(record_, RECORD_SIZE - 2));
+        writing_ = true;
+        written_ = 0;
+        ++end_;
+    }
+
+    /**
+     * Reads the record in a slot.
+     * @return false if its CRC does not match or it belongs to another slot.
+     */
+    bool load(uint16_t slot, uint8_t* record) const {
+        size_t address = base_ + static_cast<size_t>(slot) * RECORD_SIZE;
+        for (size_t i = 0; i < RECORD_SIZE; ++i) {
+            record[i] = storage_.read(address + i);
+        }
+        return get16(record, RECORD_SIZE - 2) == telemetry_crc16(record, RECORD_SIZE - 2) &&
+               (get32(record, 0) & POS_MASK) % SLOTS == slot;
+    }
+
+    /**
+     * @return Sample records stored at positions from .. to - 1.
+     */
+    uint32_t count_samples(uint32_t from, uint32_t to) const {
+        uint32_t count = 0;
+        BatchSample sample;
+        uint32_t pos = from;
+        while (pos < to && read(pos, sample)) {
+            if (pos <= to) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    static void put16(uint8_t* out, size_t n, uint16_t value) {
+        out[n] = static_cast<uint8_t>(value);
+        out[n + 1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    static void put32(uint8_t* out, size_t n, uint32_t value) {
+        put16(out, n, static_cast<uint16_t>(value));
+        put16(out, n + 2, static_cast<uint16_t>(value >> 16));
+    }
+
+    static uint16_t get16(const uint8_t* in, size_t n) {
+        return static_cast<uint16_t>(in[n] | (in[n + 1] << 8));
+    }
+
+    static uint32_t get32(const uint8_t* in, size_t n) {
+        return get16(in, n) | (static_cast<uint32_t>(get16(in, n + 2)) << 16);
+    }
+
+    Storage& storage_;
+    size_t base_;
+    uint32_t end_;          // Position of the next record; the one before it is being written while writing_
+    uint32_t next_;         // Position of the oldest sample not yet sent
+    uint32_t boot_end_;     // end_ as begin() found it
+    uint32_t restored_ms_;
+    uint32_t samples_;      // Samples written and not yet sent
+    uint8_t record_[RECORD_SIZE];
+    bool writing_;
+    uint8_t written_;       // Bytes of record_ written so far
+    bool writing_sample_;   // record_ holds a sample rather than an ack
+    bool ack_due_;          // An ack record for ack_pos_ is still to be written
+    uint32_t ack_pos_;
+};
+
+#endif // OUTAGE_BUFFER_H
@@ -0,0 +1,201 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "sensor_parser.h"
+
+/**
+ * Microbenchmark: parse_sensor_line() against the reader's original find + sscanf path
+ * (extended with one sscanf per field for the formats the reader did not handle).
+ * Build: g++ -O2 -std=c++17 parser_benchmark.cpp -o parser_benchmark
+ * Usage: parser_benchmark [iterations]
+ */
+
+/**
+ * The original classification and parse from Serial Reader on PC.cpp.
+ * @return Number of fields extracted (3 for a valid sensor line).
+ */
+int legacy_parse(const std::string& line, int& gas, int& temp, int& s3) {
+    if (line.find("Sensor values") != std::string::npos) {
+        return sscanf(line.c_str(), "Sensor values: gas=%d, temp=%d, s3=%d", &gas, &temp, &s3);
+    } else if (line.find("OK") != std::string::npos ||
+               line.find("ERROR") != std::string::npos ||
+               line.find("HTTP") != std::string::npos) {
+        return -1;
+    }
+    return -2;
+}
+
+/**
+ * The original approach extended to the other sketch formats: find, then sscanf per field.
+ * @param values Receives the values extracted, in the order found.
+ * @return Number of values extracted, or -1 for an AT/HTTP response.
+ */
+int sscanf_parse(const std::string& line, float* values) {
+    int gas, temp, s3;
+    int n = legacy_parse(line, gas, temp, s3);
+    if (n >= 0) {
+        values[0] = static_cast<float>(gas);
+        values[1] = static_cast<float>(temp);
+        values[2] = static_cast<float>(s3);
+    }
+    if (n != -2) {
+        return n;
+    }
+    if (line.find('{') != std::string::npos) {
+        static const char* const KEYS[] = {"\"temp\":", "\"temperature\":", "\"humidity\":", "\"light\":"};
+        int found = 0;
+        for (const char* key : KEYS) {
+            const char* at = strstr(line.c_str(), key);
+            if (at) {
+                found += sscanf(at + strlen(key), "%f", &values[found]);
+            }
+        }
+        return found;
+    }
+    if (line.find("Gas:") != std::string::npos) {
+        return sscanf(line.c_str(), "Gas: %f PPM | Temp (C): %f | Soil Moisture: %f%%", &values[0], &values[1], &values[2]);
+    }
+    if (line.find("Humidity:") != std::string::npos) {
+        return sscanf(line.c_str(), "Humidity: %f %% | Temperature: %f", &values[0], &values[1]);
+    }
+    return 0;
+}
+
+/**
+ * Builds a corpus of lines in the given formats.
+ */
+std::vector<std::string> make_corpus(bool mixed) {
+    std::vector<std::string> lines;
+    char line[128];
+    for (int i = 0; i < 1000; ++i) {
+        int kind = mixed ? i % 5 : 0;
+        switch (kind) {
+        case 0:
+            snprintf(line, sizeof(line), "Sensor values: gas=%d, temp=%d, s3=%d", i % 1024, (i * 7) % 1024, (i * 13) % 1024);
+            break;
+        case 1:
+            snprintf(line, sizeof(line), "{\"temp\":%d.%02d}", 20 + i % 10, i % 100);
+            break;
+        case 2:
+            snprintf(line, sizeof(line), "{\"temperature\":%d.%02d, \"humidity\":%d.%02d, \"light\":%d}",
+                     15 + i % 10, i % 100, 30 + i % 40, (i * 3) % 100, i % 1024);
+            break;
+        case 3:
+            snprintf(line, sizeof(line), "Gas: %d.%02d PPM | Temp (C): %d.%02d | Soil Moisture: %d.00%%",
+                     i % 500, i % 100, 20 + i % 15, (i * 7) % 100, i % 101);
+            break;
+        default:
+            snprintf(line, sizeof(line), "Humidity: %d.00 %% | Temperature: %d.00 \xC2\xB0" "C", 30 + i % 50, 18 + i % 12);
+            break;
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * Reduces a parse to what both parsers must agree on: how many values the line
+ * gave and what they were, in hundredths (the sketches print two decimals).
+ */
+long long fold(int count, long long hundredths) {
+    return count * 1000000000LL + hundredths;
+}
+
+long long hundredths(double value) {
+    return static_cast<long long>(value * 100 + (value < 0 ? -0.5 : 0.5));
+}
+
+/**
+ * Times one pass of fn over the corpus.
+ * @return Elapsed seconds.
+ */
+template <typename Fn>
+double time_pass(const std::vector<std::string>& corpus, int iterations, Fn fn, long long& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        for (const std::string& line : corpus) {
+            checksum += fn(line);
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Prints the rate for the best pass.
+ * @return Lines per second.
+ */
+double report(const char* name, double best_seconds, double lines, long long checksum) {
+    double rate = lines / best_seconds;
+    std::cout << "  " << name << ": " << static_cast<long long>(rate) << " lines/s, "
+              << best_seconds * 1e9 / lines << " ns/line (checksum " << checksum << ")\n";
+    return rate;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = (argc > 1) ? std::atoi(argv[1]) : 200;
+    if (iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [iterations]\n";
+        return 1;
+    }
+
+    // Both sides reduce to the same checksum, so a difference in the totals is a parse disagreement
+    auto before_fn = [](const std::string& line) {
+        float values[4];
+        int n = sscanf_parse(line, values);
+        long long sum = 0;
+        for (int i = 0; i < n; ++i) {
+            sum += hundredths(values[i]);
+        }
+        return fold(n > 0 ? n : 0, sum);
+    };
+    auto after_fn = [](const std::string& line) {
+        SensorLine parsed;
+        parse_sensor_line(line, parsed);
+        int n = 0;
+        long long sum = 0;
+        for (int f = 0; f < FIELD_COUNT; ++f) {
+            if (parsed.has(static_cast<SensorField>(f))) {
+                ++n;
+                sum += hundredths(parsed.value[f]);
+            }
+        }
+        return fold(n, sum);
+    };
+
+    // Passes alternate between the two parsers and the best of each is kept,
+    // so background load affects both sides alike
+    const int ROUNDS = 7;
+    const char* corpora[2] = {"legacy lines", "mixed sketch formats"};
+    for (int c = 0; c < 2; ++c) {
+        std::vector<std::string> corpus = make_corpus(c == 1);
+        double lines = static_cast<double>(corpus.size()) * iterations;
+        std::cout << corpora[c] << " (" << static_cast<long long>(lines) << " lines per pass)\n";
+
+        long long before_once = 0, after_once = 0;
+        time_pass(corpus, 1, before_fn, before_once);
+        time_pass(corpus, 1, after_fn, after_once);
+        if (before_once != after_once) {
+            std::cerr << corpora[c] << ": parsers disagree (" << before_once << " vs " << after_once << ")\n";
+            return 1;
+        }
+
+        long long before_sum = 0, after_sum = 0;
+        double before_best = 1e30, after_best = 1e30;
+        for (int round = 0; round < ROUNDS; ++round) {
+            double seconds = time_pass(corpus, iterations, before_fn, before_sum);
+            before_best = seconds < before_best ? seconds : before_best;
+            seconds = time_pass(corpus, iterations, after_fn, after_sum);
+            after_best = seconds < after_best ? seconds : after_best;
+        }
+        double before = report("find + sscanf     ", before_best, lines, before_sum);
+        double after = report("parse_sensor_line ", after_best, lines, after_sum);
+        std::cout << "  speedup: " << after / before << "x\n";
+    }
+    return 0;
+}
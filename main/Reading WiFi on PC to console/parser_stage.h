@@ -0,0 +1,483 @@
+#ifndef PARSER_STAGE_H
+#define PARSER_STAGE_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "console_sink.h"
+#include "device_clock.h"
+#include "line_framer.h"
+#include "log_sink.h"
+#include "metrics.h"
+#include "sensor_parser.h"
+#include "sequence_tracker.h"
+#include "series_store.h"
+#include "spsc_ring.h"
+#include "telemetry_frame.h"
+#include "timestamp.h"
+
+/**
+ * What the sketches send: text lines ending in "\n", or binary telemetry
+ * frames ending in 0x00 (telemetry_frame.h).
+ */
+enum class SerialProtocol {
+    TEXT,
+    BINARY
+};
+
+/**
+ * Counters of one parser thread, written by that thread only; read by the
+ * metrics server thread and the --stats-interval dump.
+ */
+struct ParserMetrics {
+    static const int FORMAT_COUNT = static_cast<int>(LineFormat::MALFORMED) + 1;
+    static const unsigned PROCESS_SAMPLE_EVERY = 16; // Two clock reads cost more than a short read's lines
+
+    Counter lines[FORMAT_COUNT];    // Non-empty lines by LineFormat
+    Counter invalid_samples;        // LEGACY lines with values outside 0..1023
+    Counter buffer_overflows;       // "Accumulated data too large, clearing!"
+    Counter corrupt_frames;         // BINARY frames that failed the COBS, CRC or length check
+    Counter incomplete_timeouts;    // Partial lines dropped after the incomplete-line timeout
+    Histogram process_ns;           // Parser time for one read, for 1 in PROCESS_SAMPLE_EVERY reads
+    unsigned reads = 0;             // Reads parsed, for sampling process_ns
+
+    uint64_t total_lines() const {
+        uint64_t total = 0;
+        for (const Counter& c : lines) {
+            total += c.value();
+        }
+        return total;
+    }
+};
+
+/**
+ * Bytes from one serial read, passed from the read thread to a parser stage.
+ */
+struct RawChunk {
+    static const size_t CAPACITY = 4096;
+
+    int64_t time_ms;        // Wall clock when the read returned; stamps the lines it completes
+    uint16_t device;        // SerialDevice::id
+    uint32_t length;
+    char data[CAPACITY];
+};
+
+/**
+ * @return History series of one field of a device's sample stream (see sample_stream()).
+ */
+inline size_t history_series(uint16_t device, int stream, int field) {
+    return (static_cast<size_t>(device) * SAMPLE_STREAMS + static_cast<size_t>(stream)) * FIELD_COUNT +
+           static_cast<size_t>(field);
+}
+
+/**
+ * @return Value columns of the log of a sample format other than LEGACY: the
+ *         fields of its telemetry frame layout, with the frame's decimals.
+ */
+inline std::vector<LogColumn> format_log_columns(LineFormat format) {
+    const TelemetryLayout& layout = telemetry_layout(static_cast<uint8_t>(format));
+    std::vector<LogColumn> columns;
+    for (uint8_t slot = 0; slot < layout.count; ++slot) {
+        columns.push_back({field_name(static_cast<SensorField>(layout.field[slot])), layout.decimals[slot]});
+    }
+    return columns;
+}
+
+/**
+ * @return SampleRow::device of a sensor's rows in a format log: each sensor id of a port is a device of its own.
+ */
+inline uint16_t format_log_device(uint16_t device, uint8_t sensor_id) {
+    return static_cast<uint16_t>(device * SENSOR_IDS + sensor_id % SENSOR_IDS);
+}
+
+/**
+ * Parser stage: frames the read thread's chunks into lines, parses them and fans
+ * them out to the console and log sinks on its own thread, so that neither
+ * parsing nor a sink with OverflowPolicy::BLOCK can delay a serial read.
+ * Each stage serves a share of the ports and keeps a line framer per port.
+ * The LEGACY samples and every gap marker go to the main log; the samples of
+ * the other formats go to the format logs given in the options, if any.
+ *
+ * The read thread reads straight into read_slot() and calls publish(); when the
+ * queue is full it gets nullptr and discards the read instead of waiting.
+ */
+class ParserStage {
+public:
+    static const size_t QUEUE_CHUNKS = 1024; // Up to 4 MiB of reads in flight
+    static const int INCOMPLETE_LINE_TIMEOUT_S = 10;
+
+    static const size_t MAX_FRAME_BYTES = 64;     // BINARY: longer runs without a 0x00 are noise
+
+    struct Options {
+        SerialProtocol protocol = SerialProtocol::TEXT; // What the sketches send
+        int baud_rate = 9600;                           // For the time a line spends on the wire
+        bool device_time = true;                        // Stamp samples from the sketch's millis() where given
+        SeriesStore* history = nullptr;                 // Keeps every sensor's recent samples; series
+                                                        // by history_series()
+        LogSink* format_logs[SAMPLE_FORMATS] = {};      // By LineFormat, for the formats other than LEGACY:
+                                                        // columns by format_log_columns(), devices by
+                                                        // format_log_device(); nullptr: not logged
+    };
+
+    /**
+     * @param index Producer index of this stage in the console and log sinks.
+     * @param device_count Number of devices; their ids index the per-port state.
+     */
+    ParserStage(size_t index, size_t device_count, const Options& options, ConsoleSink& console, LogSink& log_sink)
+        : index_(index), protocol_(options.protocol), device_time_(options.device_time), history_(options.history),
+          ms_per_byte_(options.baud_rate > 0 ? 10000.0 / options.baud_rate : 0.0), chunks_(QUEUE_CHUNKS),
+          console_(console), console_mode_(console.mode()), ports_(device_count),
+          log_dropping_(), done_(false) {
+        std::copy(options.format_logs, options.format_logs + SAMPLE_FORMATS, format_logs_);
+        format_logs_[static_cast<int>(LineFormat::LEGACY)] = &log_sink;
+    }
+
+    ~ParserStage() {
+        stop();
+    }
+
+    ParserStage(const ParserStage&) = delete;
+    ParserStage& operator=(const ParserStage&) = delete;
+
+    /**
+     * Assigns a device to this stage. Call before start().
+     */
+    void add_device(uint16_t device) {
+        ports_[device].reset(new PortState(protocol_));
+    }
+
+    void start() {
+        thread_ = std::thread(&ParserStage::run, this);
+    }
+
+    /**
+     * Handles every chunk already published, then stops the parser thread.
+     * Call from the read thread once it has stopped reading.
+     */
+    void stop() {
+        done_ = true;
+        ready_.ring();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    /**
+     * Read thread: the chunk to read into next, or nullptr if the parser is behind.
+     */
+    RawChunk* read_slot() {
+        return chunks_.write_slot();
+    }
+
+    /**
+     * Read thread: hands the chunk from read_slot() to the parser.
+     */
+    void publish() {
+        chunks_.publish();
+        ready_.ring();
+    }
+
+    size_t queued() const {
+        return chunks_.size();
+    }
+
+    const ParserMetrics& metrics() const {
+        return metrics_;
+    }
+
+    /**
+     * @return Clock model of a device of this stage, or nullptr for other stages' devices.
+     */
+    const DeviceClock* clock(uint16_t device) const {
+        return device < ports_.size() && ports_[device] ? &ports_[device]->clock : nullptr;
+    }
+
+    /**
+     * @return Sequence accounting of a device, all streams added up; zero for other stages' devices.
+     */
+    SequenceStats sequence(uint16_t device) const {
+        SequenceStats stats;
+        if (device < ports_.size() && ports_[device]) {
+            for (const SequenceTracker& tracker : ports_[device]->sequence) {
+                stats.add(tracker);
+            }
+        }
+        return stats;
+    }
+
+private:
+    /**
+     * Framing state of one port.
+     */
+    struct PortState {
+        explicit PortState(SerialProtocol protocol)
+            : framer(protocol == SerialProtocol::BINARY ? MAX_FRAME_BYTES : LineFramer::DEFAULT_MAX_LINE_LENGTH,
+                     protocol == SerialProtocol::BINARY ? '\0' : '\n') {}
+
+        LineFramer framer;   // Buffers partial lines, keeps at most 4096 bytes of one (64 of a frame)
+        std::chrono::steady_clock::time_point last_data_time = std::chrono::steady_clock::now();
+        SequenceTracker sequence[SAMPLE_STREAMS]; // Numbered samples by sample_stream(); each sensor counts on its own
+        DeviceClock clock;   // Maps the board's millis() to host time
+    };
+
+    void run() {
+        while (true) {
+            bool done = done_;
+            const RawChunk* chunk;
+            while ((chunk = chunks_.front()) != nullptr) {
+                process(*chunk);
+                chunks_.pop_front();
+            }
+
+            // Check for incomplete lines timeout
+            auto now = std::chrono::steady_clock::now();
+            for (size_t device = 0; device < ports_.size(); ++device) {
+                PortState* port = ports_[device].get();
+                if (port && port->framer.has_partial() &&
+                    now - port->last_data_time > std::chrono::seconds(INCOMPLETE_LINE_TIMEOUT_S)) {
+                    warn(device, getTimestamp().c_str(), "Warning: Incomplete line timed out, clearing buffer");
+                    port->framer.clear();
+                    port->last_data_time = now;
+                    metrics_.incomplete_timeouts.add();
+                }
+            }
+            if (done) {
+                break;
+            }
+            ready_.wait(std::chrono::milliseconds(1000), [this] { return done_ || chunks_.size() > 0; });
+        }
+    }
+
+    /**
+     * Frames one read and handles every complete line or frame.
+     */
+    void process(const RawChunk& chunk) {
+        bool timed = ++metrics_.reads % ParserMetrics::PROCESS_SAMPLE_EVERY == 0;
+        uint64_t start_ns = timed ? metrics_now_ns() : 0;
+        PortState& port = *ports_[chunk.device];
+        port.framer.append(chunk.data, chunk.length);
+        port.last_data_time = std::chrono::steady_clock::now();
+
+        // All lines completed by one read share its arrival time; samples that
+        // carry the sketch's millis() are stamped with when they were taken
+        char timestamp[TimestampClock::BUFFER_SIZE];
+        clock_.format(chunk.time_ms, timestamp);
+        char sample_timestamp[TimestampClock::BUFFER_SIZE];
+
+        // Process complete lines
+        std::string_view line;
+        while (port.framer.next_line(line)) {
+            // Process non-empty lines
+            if (line.empty()) {
+                continue;
+            }
+            const size_t wire_bytes = line.size() + (protocol_ == SerialProtocol::BINARY ? 1 : 2); // Delimiter, "\r\n"
+            if (protocol_ == SerialProtocol::BINARY) {
+                TelemetryFrame frame;
+                TelemetryStatus status =
+                    decode_telemetry_frame(reinterpret_cast<const uint8_t*>(line.data()), line.size(), frame);
+                if (status != TELEMETRY_OK) {
+                    metrics_.corrupt_frames.add();
+                    char message[80];
+                    std::snprintf(message, sizeof(message), "Warning: Corrupt frame (%s), %zu bytes dropped",
+                                  telemetry_status_name(status), line.size() + 1);
+                    warn(chunk.device, timestamp, message);
+                    continue;
+                }
+                telemetry_to_sensor_line(frame, parsed_);
+                line = std::string_view(); // Frames only show up on the console through their values
+            } else {
+                parse_sensor_line(line, parsed_);
+            }
+            metrics_.lines[static_cast<int>(parsed_.format)].add();
+            const int stream = sample_stream(parsed_);
+            SequenceTracker::Outcome order = SequenceTracker::IN_ORDER;
+            SequenceTracker* sequence = nullptr;
+            if (parsed_.seq_bits > 0 && stream >= 0) {
+                sequence = &port.sequence[stream];
+                order = sequence->observe(parsed_.seq, parsed_.seq_bits);
+                if (order == SequenceTracker::RESTART) {
+                    port.clock.reset(); // The sketch was reset, so its millis() started over too
+                }
+                if (order >= SequenceTracker::GAP && !check_sequence(chunk.device, timestamp, order, *sequence)) {
+                    continue;
+                }
+            }
+            int64_t sample_ms = chunk.time_ms;
+            const char* sample_stamp = timestamp;
+            if (parsed_.time_bits > 0 && device_time_) {
+                // The sketch reads millis() before printing: the last byte left at least the wire time later
+                int64_t sent_ms = chunk.time_ms - static_cast<int64_t>(wire_bytes * ms_per_byte_);
+                sample_ms = port.clock.to_host(parsed_.device_ms, parsed_.time_bits, sent_ms);
+                clock_.format(sample_ms, sample_timestamp);
+                sample_stamp = sample_timestamp;
+            }
+            if (order == SequenceTracker::GAP) {
+                // Logged for every stream, before the sample that revealed the gap is checked
+                SampleRow marker;
+                marker.time_ms = sample_ms;
+                std::memcpy(marker.timestamp, sample_stamp, sizeof(marker.timestamp));
+                marker.device = chunk.device;
+                marker.lost = sequence->missing();
+                marker.first_lost = sequence->first_missing();
+                marker.stream = static_cast<uint16_t>(stream);
+                push_row(static_cast<int>(LineFormat::LEGACY), marker, timestamp);
+            }
+            if (parsed_.format == LineFormat::LEGACY && !legacy_in_range(parsed_)) {
+                metrics_.invalid_samples.add();
+                char message[96];
+                std::snprintf(message, sizeof(message), "Warning: Invalid sensor values - Gas: %d, Temp: %d, S3: %d",
+                              static_cast<int>(parsed_.value[FIELD_GAS]), static_cast<int>(parsed_.value[FIELD_TEMP]),
+                              static_cast<int>(parsed_.value[FIELD_S3]));
+                warn(chunk.device, timestamp, message);
+                continue;
+            }
+            if (console_mode_ == ConsoleMode::LINES) {
+                console_.lines(index_).offer_with([&](ConsoleEvent& event) {
+                    event.kind = ConsoleEvent::LINE;
+                    event.device = chunk.device;
+                    std::memcpy(event.timestamp, sample_stamp, sizeof(event.timestamp));
+                    event.parsed = parsed_;
+                    event.set_text(line);
+                });
+            } else if (console_mode_ == ConsoleMode::DASHBOARD) {
+                console_.board().record(chunk.device, parsed_, sample_ms);
+            }
+            if (history_ && stream >= 0) {
+                for (int f = 0; f < FIELD_COUNT; ++f) {
+                    if (parsed_.has(static_cast<SensorField>(f))) {
+                        history_->append(history_series(chunk.device, stream, f), sample_ms, parsed_.value[f]);
+                    }
+                }
+            }
+            if (parsed_.format == LineFormat::LEGACY) {
+                SampleRow row;
+                row.time_ms = sample_ms;
+                std::memcpy(row.timestamp, sample_stamp, sizeof(row.timestamp));
+                row.device = chunk.device;
+                row.value[0] = static_cast<int>(parsed_.value[FIELD_GAS]);
+                row.value[1] = static_cast<int>(parsed_.value[FIELD_TEMP]);
+                row.value[2] = static_cast<int>(parsed_.value[FIELD_S3]);
+                push_row(static_cast<int>(LineFormat::LEGACY), row, timestamp);
+            } else if (stream >= 0 && format_logs_[stream / SENSOR_IDS] && parsed_.fields != 0) {
+                // In the fixed point of the format's frames, whether the sample came as a frame or a line
+                static const double SCALE[3] = {1.0, 10.0, 100.0};
+                const TelemetryLayout& layout = telemetry_layout(static_cast<uint8_t>(parsed_.format));
+                SampleRow row;
+                row.time_ms = sample_ms;
+                std::memcpy(row.timestamp, sample_stamp, sizeof(row.timestamp));
+                row.device = format_log_device(chunk.device, parsed_.sensor_id);
+                for (uint8_t slot = 0; slot < layout.count; ++slot) {
+                    SensorField field = static_cast<SensorField>(layout.field[slot]);
+                    if (parsed_.has(field)) {
+                        double scaled = parsed_.value[field] * SCALE[layout.decimals[slot]];
+                        row.value[slot] = static_cast<int>(std::lround(scaled));
+                    } else {
+                        row.absent |= static_cast<uint8_t>(1 << slot);
+                    }
+                }
+                push_row(stream / SENSOR_IDS, row, timestamp);
+            }
+        }
+
+        // Check if the unfinished line exceeds max size
+        if (port.framer.enforce_limit()) {
+            warn(chunk.device, timestamp, "Warning: Accumulated data too large, clearing!");
+            metrics_.buffer_overflows.add();
+        }
+        if (timed) {
+            metrics_.process_ns.record(metrics_now_ns() - start_ns);
+        }
+    }
+
+    /**
+     * Reports a sample that is not the next one of its device's numbering.
+     * @param order GAP, LATE, DUPLICATE or RESTART.
+     * @return false if the sample is a duplicate and is dropped.
+     */
+    bool check_sequence(uint16_t device, const char* timestamp, SequenceTracker::Outcome order,
+                        const SequenceTracker& sequence) {
+        char message[128];
+        char stream[16];
+        stream_name(sample_stream(parsed_), stream, sizeof(stream));
+        uint32_t seq = parsed_.seq;
+        switch (order) {
+        case SequenceTracker::GAP:
+            std::snprintf(message, sizeof(message), "Warning: Sequence gap (%s), %lu samples lost before seq %lu",
+                          stream, static_cast<unsigned long>(sequence.missing()), static_cast<unsigned long>(seq));
+            break;
+        case SequenceTracker::LATE:
+            std::snprintf(message, sizeof(message), "Warning: Late sample (%s) seq %lu (newest %lu)", stream,
+                          static_cast<unsigned long>(seq), static_cast<unsigned long>(sequence.expected() - 1));
+            break;
+        case SequenceTracker::DUPLICATE:
+            std::snprintf(message, sizeof(message), "Warning: Duplicate sample (%s) seq %lu dropped", stream,
+                          static_cast<unsigned long>(seq));
+            break;
+        default:
+            std::snprintf(message, sizeof(message), "Sequence (%s) restarted at %lu (sketch reset?)", stream,
+                          static_cast<unsigned long>(seq));
+            break;
+        }
+        warn(device, timestamp, message);
+        return order != SequenceTracker::DUPLICATE;
+    }
+
+    /**
+     * Queues a sample or gap marker for a log, reporting once when its queue starts dropping.
+     * @param format LineFormat whose log takes the row: LEGACY for the main log.
+     */
+    void push_row(int format, const SampleRow& row, const char* timestamp) {
+        if (format_logs_[format]->push(row, index_)) {
+            log_dropping_[format] = false;
+        } else if (!log_dropping_[format]) {
+            size_t device = format == static_cast<int>(LineFormat::LEGACY) ? row.device : row.device / SENSOR_IDS;
+            warn(device, timestamp, "Warning: log writer is behind, dropping samples");
+            log_dropping_[format] = true;
+        }
+    }
+
+    /**
+     * Queues a warning for stderr. The warning queue never drops: under the load
+     * these warnings report, the parser waits for the console instead.
+     */
+    void warn(size_t device, const char* timestamp, std::string_view text) {
+        console_.warnings(index_).offer_with([&](ConsoleEvent& event) {
+            event.kind = ConsoleEvent::ERR;
+            event.device = static_cast<uint16_t>(device);
+            std::snprintf(event.timestamp, sizeof(event.timestamp), "%s", timestamp);
+            event.set_text(text);
+        });
+    }
+
+    const size_t index_;
+    const SerialProtocol protocol_;
+    const bool device_time_;
+    SeriesStore* const history_;
+    const double ms_per_byte_;   // 10 bits per byte at the configured baud rate; 0 if unknown
+    SpscRing<RawChunk> chunks_;  // Read thread -> parser thread
+    Doorbell ready_;
+    ConsoleSink& console_;
+    const ConsoleMode console_mode_;
+    std::vector<std::unique_ptr<PortState>> ports_; // By device id; null for other stages' ports
+    SensorLine parsed_;          // Fields of the line being handled
+    TimestampClock clock_;       // Formats line timestamps without a localtime() call per line
+    LogSink* format_logs_[SAMPLE_FORMATS]; // By LineFormat; LEGACY: the main log
+    bool log_dropping_[SAMPLE_FORMATS];    // Whether each log's queue overflow was already reported
+    ParserMetrics metrics_;
+    std::atomic<bool> done_;
+    std::thread thread_;
+};
+
+using ParserList = std::vector<std::unique_ptr<ParserStage>>;
+
+#endif // PARSER_STAGE_H
@@ -0,0 +1,716 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "console_format.h"
+#include "dashboard.h"
+#include "line_framer.h"
+#include "log_sink.h"
+#include "metrics.h"
+#include "sensor_parser.h"
+#include "series_store.h"
+#include "telemetry_frame.h"
+#include "timestamp.h"
+
+/**
+ * Stage-by-stage benchmark of the PC reader's ingest path, without serial hardware.
+ * Build: g++ -O2 -std=c++17 -pthread reader_bench.cpp -o reader_bench
+ * Usage: reader_bench [--capture=FILE] [--lines=N] [--format=legacy|mixed]
+ *                     [--chunk=BYTES] [--rounds=N] [--json]
+ *
+ * Input is a raw serial capture (e.g. `cat /dev/ttyACM0 > capture.bin`, or the
+ * output of arduino_simulator) or a synthetic one in the sketch formats. Each
+ * stage of "Serial Reader on PC.cpp" is timed on its own over the whole input,
+ * next to the implementation the reader originally shipped with:
+ *
+ *   framing     LineFramer                     string append + find + substr + erase
+ *   parse       parse_sensor_line()            find + sscanf classification
+ *   binary      LineFramer + decode_telemetry_frame() on the same samples sent
+ *               as telemetry frames (--protocol=binary: framing and parse in one)
+ *   validate    legacy_in_range()              (same check)
+ *   timestamp   TimestampClock                 time + localtime + strftime into std::string
+ *   console     write_console_line()           same ostream code for LEGACY lines, other
+ *                                              formats echoed verbatim
+ *               SensorBoard::record()          (the --console=dashboard per-line cost; frames
+ *                                              are drawn at a fixed rate on the console thread)
+ *   history     SeriesStore::append()          (none: the original kept no history); "read"
+ *               SeriesStore::read()            decodes it all back, counted per sample
+ *   csv         LogSink writer thread          std::ofstream << row, flush per row
+ *   metrics     ReaderMetrics updates          (none: the original had no metrics)
+ *   pipeline    all of the above per read, as ParserStage::process() does (in one thread)
+ *
+ * Console output goes to a stream that discards bytes, so "console" measures
+ * formatting only. The best of --rounds runs is reported as lines/s and ns/line,
+ * with heap allocations per line counted by a replaced operator new. --json
+ * prints the same numbers as one JSON object for tracking between versions.
+ */
+
+static std::atomic<uint64_t> allocation_count(0);
+
+// Every form of operator new and delete is replaced as a matching pair, and
+// kept out of line so that the compiler does not pair an inlined free() with
+// an allocation it knows only as operator new (-Wmismatched-new-delete)
+__attribute__((noinline)) void* counted_alloc(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void counted_free(void* p) noexcept {
+    std::free(p);
+}
+
+void* operator new(size_t size) {
+    return counted_alloc(size);
+}
+
+void* operator new[](size_t size) {
+    return counted_alloc(size);
+}
+
+void operator delete(void* p) noexcept {
+    counted_free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    counted_free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    counted_free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    counted_free(p);
+}
+
+/**
+ * Stream buffer that counts and discards everything written to it.
+ */
+class NullBuffer : public std::streambuf {
+public:
+    uint64_t bytes = 0;
+
+protected:
+    int overflow(int c) override {
+        ++bytes;
+        return c;
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        bytes += static_cast<uint64_t>(n);
+        return n;
+    }
+};
+
+/**
+ * One line of the report.
+ */
+struct StageResult {
+    std::string stage;
+    std::string implementation;
+    uint64_t lines;
+    double seconds;
+    double allocations;
+};
+
+/**
+ * Runs fn rounds times and keeps the fastest run.
+ * @param fn Runs the stage once over the input and returns the number of lines handled.
+ */
+template <typename Fn>
+StageResult measure(const char* stage, const char* implementation, int rounds, Fn fn) {
+    StageResult result = {stage, implementation, 0, 1e30, 0};
+    for (int r = 0; r < rounds; ++r) {
+        uint64_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t lines = fn();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+        if (seconds < result.seconds) {
+            result.seconds = seconds;
+            result.lines = lines;
+            result.allocations = lines ? static_cast<double>(allocations) / lines : 0;
+        }
+    }
+    return result;
+}
+
+/**
+ * Builds a synthetic capture in the sketch formats, with Serial.println() line endings.
+ */
+std::string make_capture(uint64_t lines, bool mixed) {
+    std::string capture;
+    char line[128];
+    for (uint64_t i = 0; i < lines; ++i) {
+        int v = static_cast<int>(i * 2654435761u % 10000);
+        int kind = mixed ? static_cast<int>(i % 6) : 0;
+        switch (kind) {
+        case 0:
+            std::snprintf(line, sizeof(line), "Sensor values: gas=%d, temp=%d, s3=%d\r\n",
+                          static_cast<int>(i % 1024), v % 1024, (v / 7) % 1024);
+            break;
+        case 1:
+            std::snprintf(line, sizeof(line), "{\"temperature\":%d.%02d, \"humidity\":%d.%02d, \"light\":%d}\r\n",
+                          15 + v % 20, v % 100, 30 + v % 50, v / 100 % 100, v % 1024);
+            break;
+        case 2:
+            std::snprintf(line, sizeof(line), "{\"temp\":%d.%02d}\r\n", 18 + v % 15, v % 100);
+            break;
+        case 3:
+            std::snprintf(line, sizeof(line), "Gas: %d.%02d PPM | Temp (C): %d.%02d | Soil Moisture: %d.%02d%%\r\n",
+                          v % 500, v % 100, 18 + v % 15, v / 100 % 100, v % 101, v / 10 % 100);
+            break;
+        case 4:
+            std::snprintf(line, sizeof(line), "Humidity: %d.%02d %% | Temperature: %d.%02d \xC2\xB0" "C\r\n",
+                          30 + v % 50, v % 100, 18 + v % 15, v / 100 % 100);
+            break;
+        default:
+            std::snprintf(line, sizeof(line), "HTTP/1.1 200 OK\r\n");
+            break;
+        }
+        capture += line;
+    }
+    return capture;
+}
+
+/**
+ * The original getTimestamp(): time + localtime + strftime, returned as a new string.
+ */
+std::string original_timestamp() {
+    std::time_t now = std::time(nullptr);
+    char buf[20] = "Invalid time";
+    if (std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now)) == 0) {
+        return "Invalid time";
+    }
+    return buf;
+}
+
+/**
+ * The original classification and parse.
+ * @return LEGACY with the three values, RESPONSE, DATA or MALFORMED.
+ */
+LineFormat original_parse(const std::string& line, int& gas, int& temp, int& s3) {
+    if (line.find("Sensor values") != std::string::npos) {
+        return sscanf(line.c_str(), "Sensor values: gas=%d, temp=%d, s3=%d", &gas, &temp, &s3) == 3
+                   ? LineFormat::LEGACY : LineFormat::MALFORMED;
+    } else if (line.find("OK") != std::string::npos ||
+               line.find("ERROR") != std::string::npos ||
+               line.find("HTTP") != std::string::npos) {
+        return LineFormat::RESPONSE;
+    }
+    return LineFormat::DATA;
+}
+
+/**
+ * The original framing loop over one read.
+ * @param on_line Called with each complete, non-empty line.
+ */
+template <typename Fn>
+void original_frame(std::string& accumulated, const char* data, size_t length, Fn on_line) {
+    const size_t MAX_ACCUMULATED_SIZE = 4096;
+    if (accumulated.size() + length > MAX_ACCUMULATED_SIZE) {
+        accumulated.clear();
+    }
+    accumulated.append(data, length);
+    size_t pos;
+    while ((pos = accumulated.find('\n')) != std::string::npos) {
+        std::string line = accumulated.substr(0, pos);
+        accumulated.erase(0, pos + 1);
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            on_line(line);
+        }
+    }
+}
+
+/**
+ * Feeds the capture to a LineFramer in reads of chunk bytes.
+ */
+template <typename Fn>
+void current_frame(LineFramer& framer, const std::string& capture, size_t chunk, Fn on_line) {
+    size_t offset = 0;
+    while (offset < capture.size()) {
+        size_t n = std::min({chunk, framer.write_space(), capture.size() - offset});
+        std::memcpy(framer.write_ptr(), capture.data() + offset, n);
+        framer.commit(n);
+        offset += n;
+        std::string_view line;
+        while (framer.next_line(line)) {
+            if (!line.empty()) {
+                on_line(line);
+            }
+        }
+        framer.enforce_limit();
+    }
+}
+
+/**
+ * @param arg Command-line argument.
+ * @param name Option name including the leading dashes.
+ * @param value Receives the text after '='.
+ * @return true if arg is "name=value".
+ */
+bool option_value(const std::string& arg, const std::string& name, std::string& value) {
+    if (arg.compare(0, name.size() + 1, name + "=") != 0) {
+        return false;
+    }
+    value = arg.substr(name.size() + 1);
+    return true;
+}
+
+/**
+ * Escapes a string for a JSON value.
+ */
+std::string json_string(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        if (static_cast<unsigned char>(c) >= 0x20) {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    std::string capture_name;
+    uint64_t synthetic_lines = 200000;
+    bool mixed = true;
+    size_t chunk = 256;
+    int rounds = 5;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        std::string value;
+        if (option_value(arg, "--capture", value)) {
+            capture_name = value;
+        } else if (option_value(arg, "--lines", value)) {
+            synthetic_lines = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--format=legacy" || arg == "--format=mixed") {
+            mixed = arg == "--format=mixed";
+        } else if (option_value(arg, "--chunk", value)) {
+            chunk = static_cast<size_t>(std::max(1, std::atoi(value.c_str())));
+        } else if (option_value(arg, "--rounds", value)) {
+            rounds = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--json") {
+            json = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--capture=FILE] [--lines=N] [--format=legacy|mixed]\n"
+                      << "       [--chunk=BYTES] [--rounds=N] [--json]\n";
+            return 1;
+        }
+    }
+
+    std::string capture;
+    if (!capture_name.empty()) {
+        std::ifstream in(capture_name, std::ios::binary);
+        if (!in) {
+            std::cerr << "Failed to open " << capture_name << "\n";
+            return 1;
+        }
+        capture.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    } else {
+        capture = make_capture(synthetic_lines, mixed);
+    }
+
+    // Pre-split lines and parse results so later stages can be timed in isolation
+    std::vector<std::string> lines;
+    {
+        LineFramer framer;
+        current_frame(framer, capture, chunk, [&](std::string_view line) { lines.emplace_back(line); });
+    }
+    std::vector<SensorLine> parsed(lines.size());
+    uint64_t legacy_rows = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        parse_sensor_line(lines[i], parsed[i]);
+        legacy_rows += parsed[i].format == LineFormat::LEGACY && legacy_in_range(parsed[i]);
+    }
+    if (lines.empty()) {
+        std::cerr << "No lines in the capture\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path(ec) / "reader_bench";
+    std::filesystem::create_directories(temp_dir, ec);
+    const std::string csv_path = (temp_dir / "bench.csv").string();
+    auto remove_outputs = [&]() {
+        for (const char* suffix : {".csv", ".1s.csv", ".1m.csv", ".1h.csv"}) {
+            std::filesystem::remove(temp_dir / (std::string("bench") + suffix), ec);
+        }
+    };
+
+    NullBuffer null_buffer;
+    std::ostream console(&null_buffer);
+    volatile uint64_t sink = 0; // Keeps results observable
+    std::vector<StageResult> results;
+
+    // framing
+    results.push_back(measure("framing", "LineFramer", rounds, [&]() {
+        LineFramer framer;
+        uint64_t n = 0;
+        current_frame(framer, capture, chunk, [&](std::string_view line) { n += line.size() > 0; });
+        return n;
+    }));
+    results.push_back(measure("framing", "original", rounds, [&]() {
+        std::string accumulated;
+        uint64_t n = 0;
+        for (size_t offset = 0; offset < capture.size(); offset += chunk) {
+            original_frame(accumulated, capture.data() + offset, std::min(chunk, capture.size() - offset),
+                           [&](const std::string& line) { n += line.size() > 0; });
+        }
+        return n;
+    }));
+
+    // parse
+    results.push_back(measure("parse", "parse_sensor_line", rounds, [&]() {
+        SensorLine out;
+        uint64_t formats = 0;
+        for (const std::string& line : lines) {
+            formats += static_cast<int>(parse_sensor_line(line, out));
+        }
+        sink = sink + formats;
+        return static_cast<uint64_t>(lines.size());
+    }));
+    results.push_back(measure("parse", "original", rounds, [&]() {
+        uint64_t formats = 0;
+        int gas, temp, s3;
+        for (const std::string& line : lines) {
+            formats += static_cast<int>(original_parse(line, gas, temp, s3));
+        }
+        sink = sink + formats;
+        return static_cast<uint64_t>(lines.size());
+    }));
+
+    // binary: the input's sensor lines re-encoded as frames, then framed and decoded
+    std::string frames;
+    {
+        TelemetryEncoder encoders[4] = {{TELEMETRY_LEGACY, 1}, {TELEMETRY_JSON, 1}, {TELEMETRY_HANDLER, 1},
+                                        {TELEMETRY_DHT, 1}};
+        uint8_t frame[TELEMETRY_MAX_FRAME];
+        for (size_t i = 0; i < parsed.size(); ++i) {
+            int kind = static_cast<int>(parsed[i].format);
+            if (kind <= TELEMETRY_DHT && telemetry_set_line(encoders[kind], parsed[i])) {
+                frames.append(reinterpret_cast<const char*>(frame), encoders[kind].finish(static_cast<uint32_t>(i), frame));
+            }
+        }
+    }
+    if (!frames.empty()) {
+        results.push_back(measure("binary", "telemetry frames", rounds, [&]() {
+            LineFramer framer(64, '\0');
+            TelemetryFrame frame;
+            SensorLine out{};
+            uint64_t n = 0;
+            current_frame(framer, frames, chunk, [&](std::string_view data) {
+                if (decode_telemetry_frame(reinterpret_cast<const uint8_t*>(data.data()), data.size(), frame) ==
+                    TELEMETRY_OK) {
+                    telemetry_to_sensor_line(frame, out);
+                    ++n;
+                }
+            });
+            sink = sink + out.fields;
+            return n;
+        }));
+    }
+
+    // validate
+    results.push_back(measure("validate", "legacy_in_range", rounds, [&]() {
+        uint64_t valid = 0;
+        for (const SensorLine& p : parsed) {
+            valid += p.format == LineFormat::LEGACY && legacy_in_range(p);
+        }
+        sink = sink + valid;
+        return static_cast<uint64_t>(parsed.size());
+    }));
+
+    // timestamp
+    results.push_back(measure("timestamp", "TimestampClock", rounds, [&]() {
+        TimestampClock clock;
+        char timestamp[TimestampClock::BUFFER_SIZE];
+        int64_t now_ms = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            clock.now(timestamp, &now_ms);
+        }
+        sink = sink + static_cast<uint64_t>(now_ms) + timestamp[22];
+        return static_cast<uint64_t>(lines.size());
+    }));
+    results.push_back(measure("timestamp", "original", rounds, [&]() {
+        size_t total = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            total += original_timestamp().size();
+        }
+        sink = sink + total;
+        return static_cast<uint64_t>(lines.size());
+    }));
+
+    // console
+    results.push_back(measure("console", "write_console_line", rounds, [&]() {
+        TimestampClock clock;
+        char timestamp[TimestampClock::BUFFER_SIZE];
+        clock.now(timestamp);
+        for (size_t i = 0; i < lines.size(); ++i) {
+            write_console_line(console, timestamp, lines[i], parsed[i]);
+        }
+        return static_cast<uint64_t>(lines.size());
+    }));
+    results.push_back(measure("console", "SensorBoard", rounds, [&]() {
+        SensorBoard board(1);
+        int64_t now_ms = wall_clock_ms();
+        for (size_t i = 0; i < lines.size(); ++i) {
+            board.record(0, parsed[i], now_ms);
+        }
+        sink = sink + board.lines(0);
+        return static_cast<uint64_t>(lines.size());
+    }));
+    results.push_back(measure("console", "original", rounds, [&]() {
+        std::string timestamp = original_timestamp();
+        for (size_t i = 0; i < lines.size(); ++i) {
+            const SensorLine& p = parsed[i];
+            if (p.format == LineFormat::LEGACY) {
+                console << timestamp << " Sensor | Gas: " << std::setw(4) << static_cast<int>(p.value[FIELD_GAS])
+                        << ", Temp: " << std::setw(4) << static_cast<int>(p.value[FIELD_TEMP])
+                        << ", S3: " << std::setw(4) << static_cast<int>(p.value[FIELD_S3]) << "\n";
+            } else if (p.format == LineFormat::RESPONSE) {
+                console << timestamp << " Response | " << lines[i] << "\n";
+            } else {
+                console << timestamp << " Data     | " << lines[i] << "\n";
+            }
+        }
+        return static_cast<uint64_t>(lines.size());
+    }));
+
+    // history: every sensor value of every line at 10 Hz, then all of it read back
+    results.push_back(measure("history", "SeriesStore append", rounds, [&]() {
+        SeriesStore history(FIELD_COUNT, SeriesStore::Options());
+        int64_t time_ms = wall_clock_ms();
+        for (const SensorLine& p : parsed) {
+            time_ms += 100;
+            for (int f = 0; f < FIELD_COUNT; ++f) {
+                if (p.has(static_cast<SensorField>(f))) {
+                    history.append(f, time_ms, p.value[f]);
+                }
+            }
+        }
+        sink = sink + history.memory_bytes();
+        return static_cast<uint64_t>(lines.size());
+    }));
+    {
+        SeriesStore history(FIELD_COUNT, SeriesStore::Options());
+        int64_t time_ms = wall_clock_ms();
+        uint64_t samples = 0;
+        for (const SensorLine& p : parsed) {
+            time_ms += 100;
+            for (int f = 0; f < FIELD_COUNT; ++f) {
+                if (p.has(static_cast<SensorField>(f))) {
+                    samples += history.append(f, time_ms, p.value[f]);
+                }
+            }
+        }
+        std::vector<SeriesPoint> points;
+        points.reserve(samples);
+        results.push_back(measure("history", "SeriesStore read", rounds, [&]() {
+            uint64_t n = 0;
+            for (int f = 0; f < FIELD_COUNT; ++f) {
+                points.clear();
+                n += history.read(f, INT64_MIN, INT64_MAX, points);
+            }
+            return n;
+        }));
+    }
+
+    // metrics: the counter and histogram updates ParserStage::process() adds, per read and per line
+    results.push_back(measure("metrics", "Counter+Histogram", rounds, [&]() {
+        Counter format_lines[static_cast<int>(LineFormat::MALFORMED) + 1];
+        Counter bytes, invalid_samples;
+        Histogram process_ns;
+        size_t line = 0;
+        unsigned reads = 0;
+        size_t lines_per_read = std::max<size_t>(1, lines.size() * chunk / capture.size());
+        for (size_t offset = 0; offset < capture.size(); offset += chunk) {
+            bool timed = ++reads % 16 == 0; // As ReaderMetrics::PROCESS_SAMPLE_EVERY
+            uint64_t start_ns = timed ? metrics_now_ns() : 0;
+            bytes.add(std::min(chunk, capture.size() - offset));
+            for (size_t i = 0; i < lines_per_read && line < parsed.size(); ++i, ++line) {
+                const SensorLine& p = parsed[line];
+                format_lines[static_cast<int>(p.format)].add();
+                if (p.format == LineFormat::LEGACY && !legacy_in_range(p)) {
+                    invalid_samples.add();
+                }
+            }
+            if (timed) {
+                process_ns.record(metrics_now_ns() - start_ns);
+            }
+        }
+        sink = sink + process_ns.count() + bytes.value() + invalid_samples.value() + format_lines[0].value();
+        return static_cast<uint64_t>(lines.size());
+    }));
+
+    // csv: rows per valid LEGACY line, measured until the writer has drained
+    std::vector<SampleRow> rows;
+    {
+        TimestampClock clock;
+        for (const SensorLine& p : parsed) {
+            if (p.format == LineFormat::LEGACY && legacy_in_range(p)) {
+                SampleRow row;
+                clock.now(row.timestamp, &row.time_ms);
+                row.value[0] = static_cast<int>(p.value[FIELD_GAS]);
+                row.value[1] = static_cast<int>(p.value[FIELD_TEMP]);
+                row.value[2] = static_cast<int>(p.value[FIELD_S3]);
+                rows.push_back(row);
+            }
+        }
+    }
+    uint64_t dropped = 0;
+    if (!rows.empty()) {
+        for (bool rollups : {false, true}) {
+            results.push_back(measure("csv", rollups ? "LogSink+rollups" : "LogSink", rounds, [&]() {
+                remove_outputs();
+                LogSink::Options options;
+                options.queue_capacity = rows.size();
+                options.durability = Durability::FLUSH;
+                options.rollups = rollups;
+                LogSink log_sink(csv_path, options);
+                if (!log_sink.start()) {
+                    return static_cast<uint64_t>(0);
+                }
+                for (const SampleRow& row : rows) {
+                    log_sink.push(row);
+                }
+                log_sink.stop();
+                dropped += log_sink.dropped();
+                return static_cast<uint64_t>(rows.size());
+            }));
+        }
+        results.push_back(measure("csv", "original", rounds, [&]() {
+            remove_outputs();
+            std::ofstream csv_file(csv_path, std::ios::app);
+            csv_file << "Timestamp,Gas,Temp,S3\n";
+            for (const SampleRow& row : rows) {
+                std::string timestamp(row.timestamp, 19);
+                csv_file << timestamp << "," << row.value[0] << "," << row.value[1] << "," << row.value[2] << "\n";
+                csv_file.flush();
+            }
+            return static_cast<uint64_t>(rows.size());
+        }));
+    }
+
+    // pipeline: what ParserStage::process() does per read, log writer included
+    results.push_back(measure("pipeline", "current", rounds, [&]() {
+        remove_outputs();
+        LogSink::Options options;
+        options.queue_capacity = rows.size() + 1;
+        LogSink log_sink(csv_path, options);
+        log_sink.start();
+        LineFramer framer;
+        TimestampClock clock;
+        SensorLine out;
+        uint64_t n = 0;
+        current_frame(framer, capture, chunk, [&](std::string_view line) {
+            char timestamp[TimestampClock::BUFFER_SIZE];
+            int64_t now_ms;
+            clock.now(timestamp, &now_ms);
+            parse_sensor_line(line, out);
+            ++n;
+            if (out.format == LineFormat::LEGACY && !legacy_in_range(out)) {
+                return;
+            }
+            write_console_line(console, timestamp, line, out);
+            if (out.format == LineFormat::LEGACY) {
+                SampleRow row;
+                row.time_ms = now_ms;
+                std::memcpy(row.timestamp, timestamp, sizeof(timestamp));
+                row.value[0] = static_cast<int>(out.value[FIELD_GAS]);
+                row.value[1] = static_cast<int>(out.value[FIELD_TEMP]);
+                row.value[2] = static_cast<int>(out.value[FIELD_S3]);
+                log_sink.push(row);
+            }
+        });
+        log_sink.stop();
+        return n;
+    }));
+    results.push_back(measure("pipeline", "original", rounds, [&]() {
+        remove_outputs();
+        std::ofstream csv_file(csv_path, std::ios::app);
+        csv_file << "Timestamp,Gas,Temp,S3\n";
+        std::string accumulated;
+        uint64_t n = 0;
+        for (size_t offset = 0; offset < capture.size(); offset += chunk) {
+            original_frame(accumulated, capture.data() + offset, std::min(chunk, capture.size() - offset),
+                           [&](const std::string& line) {
+                ++n;
+                std::string timestamp = original_timestamp();
+                int gas, temp, s3;
+                LineFormat format = original_parse(line, gas, temp, s3);
+                if (format == LineFormat::LEGACY) {
+                    if (gas < 0 || gas > 1023 || temp < 0 || temp > 1023 || s3 < 0 || s3 > 1023) {
+                        return;
+                    }
+                    console << timestamp << " Sensor | Gas: " << std::setw(4) << gas
+                            << ", Temp: " << std::setw(4) << temp << ", S3: " << std::setw(4) << s3 << "\n";
+                    csv_file << timestamp << "," << gas << "," << temp << "," << s3 << "\n";
+                    csv_file.flush();
+                } else if (format == LineFormat::MALFORMED) {
+                    console << timestamp << " Invalid Sensor Data: " << line << "\n";
+                } else if (format == LineFormat::RESPONSE) {
+                    console << timestamp << " Response | " << line << "\n";
+                } else {
+                    console << timestamp << " Data     | " << line << "\n";
+                }
+            });
+        }
+        return n;
+    }));
+    remove_outputs();
+    std::filesystem::remove(temp_dir, ec);
+
+    if (json) {
+        std::cout << "{\"schema\":1,\"input\":" << json_string(capture_name.empty() ? (mixed ? "synthetic-mixed" : "synthetic-legacy") : capture_name)
+                  << ",\"bytes\":" << capture.size() << ",\"lines\":" << lines.size()
+                  << ",\"chunk\":" << chunk << ",\"rounds\":" << rounds << ",\"stages\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const StageResult& r = results[i];
+            char numbers[160];
+            std::snprintf(numbers, sizeof(numbers), ",\"lines\":%llu,\"lines_per_sec\":%.0f,\"ns_per_line\":%.2f,\"allocs_per_line\":%.3f}",
+                          static_cast<unsigned long long>(r.lines), r.lines / r.seconds, r.seconds * 1e9 / r.lines, r.allocations);
+            std::cout << (i ? "," : "") << "{\"stage\":" << json_string(r.stage)
+                      << ",\"implementation\":" << json_string(r.implementation) << numbers;
+        }
+        std::cout << "]}\n";
+    } else {
+        std::cout << capture.size() << " bytes, " << lines.size() << " lines (" << rows.size()
+                  << " logged samples), reads of " << chunk << " bytes, best of " << rounds << "\n";
+        std::printf("%-10s %-20s %14s %10s %12s\n", "stage", "implementation", "lines/s", "ns/line", "allocs/line");
+        for (const StageResult& r : results) {
+            std::printf("%-10s %-20s %14.0f %10.1f %12.3f\n", r.stage.c_str(), r.implementation.c_str(),
+                        r.lines / r.seconds, r.seconds * 1e9 / r.lines, r.allocations);
+        }
+    }
+    if (dropped > 0) {
+        std::cerr << "Warning: " << dropped << " rows dropped by the log writer during the csv stage\n";
+    }
+    return 0;
+}
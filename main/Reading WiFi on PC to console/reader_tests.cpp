@@ -0,0 +1,422 @@
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "console_sink.h"
+#include "log_sink.h"
+#include "parser_stage.h"
+#include "rollup.h"
+#include "timestamp.h"
+
+/**
+ * Regression tests for the PC reader's ingest path, without serial hardware.
+ * Build: g++ -O2 -std=c++17 -pthread reader_tests.cpp -o reader_tests
+ * Usage: reader_tests
+ *
+ * Each test works in a fresh directory under the system temp directory and
+ * prints PASS or FAIL with the checks that failed; the exit status is the
+ * number of failed tests. POSIX only (a full disk is simulated with /dev/full).
+ */
+
+namespace fs = std::filesystem;
+
+/**
+ * Check results of the running test.
+ */
+struct TestContext {
+    std::string name;
+    fs::path dir;        // Empty directory of the test
+    int failed = 0;
+
+    void expect(bool ok, const std::string& what) {
+        if (!ok) {
+            std::cout << "  " << name << ": " << what << "\n";
+            ++failed;
+        }
+    }
+};
+
+/**
+ * @return Lines of a text file, without line terminators.
+ */
+std::vector<std::string> read_lines(const fs::path& path) {
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * @return A sample row at time_ms with the timestamp the parser stage would give it.
+ */
+SampleRow sample_row(int64_t time_ms, int gas, int temp = 0, int s3 = 0) {
+    static TimestampClock clock;
+    SampleRow row;
+    row.time_ms = time_ms;
+    clock.format(time_ms, row.timestamp);
+    row.value[0] = gas;
+    row.value[1] = temp;
+    row.value[2] = s3;
+    return row;
+}
+
+// The CSV log opener used by test_log_retry_resumes: its second stream is a full disk
+int log_opens = 0;
+
+std::FILE* open_second_full(const char* path, const char* mode) {
+    return std::fopen(++log_opens == 2 ? "/dev/full" : path, mode);
+}
+
+/**
+ * A batch that crosses an hour boundary is written as two CSV segments. The
+ * second segment's stream fails; the retry after reopening must write only
+ * the rows that were not yet in the log, so every row is logged exactly once.
+ */
+void test_log_retry_resumes(TestContext& t) {
+    const std::string log = (t.dir / "log.csv").string();
+    LogSink::Options options;
+    options.rollups = false;
+    options.compress = false;
+    options.rotate_every = RotateInterval::HOURLY;
+    options.batch_interval = std::chrono::milliseconds(10000); // The whole batch is taken at stop()
+    options.open_stream = open_second_full;
+    log_opens = 0;
+
+    // The live log started three hours ago, so the batch crosses the end of that hour
+    const int64_t started = wall_clock_ms() - 3 * 3600 * 1000;
+    const int64_t boundary = next_rotation_ms(started, RotateInterval::HOURLY);
+    const int64_t times[] = {boundary - 2000, boundary - 1000, boundary, boundary + 1000, boundary + 2000};
+    {
+        std::ofstream out(log);
+        out << "Timestamp,Gas,Temp,S3\n" << sample_row(started, 1).timestamp << ",1,0,0\n";
+    }
+
+    LogSink sink(log, options);
+    t.expect(sink.start(), "log not opened");
+    for (int64_t time_ms : times) {
+        sink.push(sample_row(time_ms, static_cast<int>(time_ms - boundary + 5000) / 1000));
+    }
+    sink.stop();
+
+    std::map<std::string, int> logged; // Row -> times written
+    int files = 0;
+    for (const fs::directory_entry& entry : fs::directory_iterator(t.dir)) {
+        ++files;
+        for (const std::string& line : read_lines(entry.path())) {
+            if (line.compare(0, 10, "Timestamp,") != 0) {
+                ++logged[line];
+            }
+        }
+    }
+    t.expect(files == 2, "expected the live log and one closed segment, found " + std::to_string(files) + " files");
+    t.expect(logged.size() == 6, std::to_string(logged.size()) + " distinct rows logged, expected 6");
+    for (const auto& row : logged) {
+        t.expect(row.second == 1, "written " + std::to_string(row.second) + " times: " + row.first);
+    }
+    t.expect(sink.write_errors() == 1, "write_errors " + std::to_string(sink.write_errors()) + ", expected 1");
+    t.expect(sink.rows_written() == 5, "rows_written " + std::to_string(sink.rows_written()) + ", expected 5");
+}
+
+/**
+ * Feeds a sample whose 1 s bucket was already written, then one whose buckets
+ * were all written. Each bucket must appear once in its tier file, and the
+ * late samples must be counted in the tiers they were left out of.
+ */
+void test_rollup_late_sample(TestContext& t) {
+    Rollups rollups;
+    t.expect(rollups.open((t.dir / "log.csv").string()), "rollup files not opened");
+    const int64_t minute = wall_clock_ms() / 60000 * 60000;
+    auto add = [&](int64_t offset_ms, int value) {
+        SampleRow row = sample_row(minute + offset_ms, value, value, value);
+        rollups.add(row.time_ms, row.timestamp, row.value);
+    };
+    add(100, 1);
+    add(1200, 2);
+    add(900, 3);  // Second 0 was closed by the sample before
+    add(2000, 4);
+    rollups.close_all();
+    add(1500, 5); // Every bucket of it was closed
+    rollups.close_all();
+    t.expect(rollups.flush([](std::FILE*) { return true; }), "rollup flush failed");
+    rollups.close();
+
+    const char* const files[ROLLUP_TIERS] = {"log.1s.csv", "log.1m.csv", "log.1h.csv"};
+    const uint64_t samples[ROLLUP_TIERS] = {3, 4, 4}; // Counted into each tier
+    for (int tier = 0; tier < ROLLUP_TIERS; ++tier) {
+        std::vector<std::string> lines = read_lines(t.dir / files[tier]);
+        std::map<std::string, int> keys; // Bucket start -> rows
+        uint64_t count = 0;
+        for (size_t i = 1; i < lines.size(); ++i) {
+            size_t comma = lines[i].find(',');
+            ++keys[lines[i].substr(0, comma)];
+            count += std::stoull(lines[i].substr(comma + 1));
+        }
+        for (const auto& key : keys) {
+            t.expect(key.second == 1, std::string(files[tier]) + ": " + std::to_string(key.second) + " rows for " +
+                                          key.first);
+        }
+        t.expect(count == samples[tier], std::string(files[tier]) + ": " + std::to_string(count) +
+                                             " samples, expected " + std::to_string(samples[tier]));
+        t.expect(rollups.late(tier) == 5 - samples[tier], std::string(files[tier]) + ": late " +
+                                                              std::to_string(rollups.late(tier)));
+    }
+}
+
+/**
+ * Feeds JSON and Sensor handler lines with sequence gaps through a parser
+ * stage. Their samples are not logged, but each gap must leave one marker
+ * row naming its stream in the CSV log.
+ */
+void test_parser_gap_markers(TestContext& t) {
+    const std::string log = (t.dir / "log.csv").string();
+    std::ostringstream out, err;
+    ConsoleSink::Options console_options;
+    console_options.mode = ConsoleMode::QUIET;
+    ConsoleSink console(out, err, console_options);
+    LogSink::Options log_options;
+    log_options.rollups = false;
+    LogSink log_sink(log, log_options);
+    t.expect(log_sink.start(), "log not opened");
+    console.start();
+
+    ParserStage::Options options;
+    options.device_time = false;
+    ParserStage parser(0, 1, options, console, log_sink);
+    parser.add_device(0);
+    parser.start();
+    const std::string lines =
+        "{\"temperature\":21.5,\"humidity\":40,\"light\":300,\"seq\":0}\r\n"
+        "Gas: 12.5 PPM | Temp (C): 21.50 | Soil Moisture: 40% | Seq: 7\r\n"
+        "{\"temperature\":21.6,\"humidity\":40,\"light\":300,\"seq\":1}\r\n"
+        "{\"temperature\":21.7,\"humidity\":41,\"light\":300,\"seq\":4}\r\n"
+        "Gas: 12.5 PPM | Temp (C): 21.50 | Soil Moisture: 40% | Seq: 8\r\n"
+        "Gas: 12.6 PPM | Temp (C): 21.55 | Soil Moisture: 40% | Seq: 11\r\n";
+    RawChunk* chunk = parser.read_slot();
+    chunk->time_ms = wall_clock_ms();
+    chunk->device = 0;
+    chunk->length = static_cast<uint32_t>(lines.size());
+    std::memcpy(chunk->data, lines.data(), lines.size());
+    parser.publish();
+    parser.stop();
+    log_sink.stop();
+    console.stop();
+
+    std::vector<std::string> markers;
+    for (const std::string& line : read_lines(log)) {
+        if (line.compare(0, 5, "#gap,") == 0) {
+            markers.push_back(line.substr(line.find(',', 5) + 1)); // Without the timestamp
+        }
+    }
+    t.expect(markers.size() == 2, std::to_string(markers.size()) + " gap markers, expected 2");
+    t.expect(markers.size() > 0 && markers[0] == "2,2,json", "JSON gap marker: " + (markers.empty() ? "" : markers[0]));
+    t.expect(markers.size() > 1 && markers[1] == "2,9,handler",
+             "Sensor handler gap marker: " + (markers.size() > 1 ? markers[1] : ""));
+    t.expect(parser.sequence(0).lost == 4, "lost " + std::to_string(parser.sequence(0).lost) + ", expected 4");
+}
+
+/**
+ * A sketch reset shows as its sequence numbering starting over, with millis()
+ * stepped back by less than the clock model would notice by itself. The
+ * parser must restart the device clock, so that the samples after the reset
+ * are not stamped as if taken before the ones logged ahead of them.
+ */
+void test_parser_clock_restart(TestContext& t) {
+    const std::string log = (t.dir / "log.csv").string();
+    std::ostringstream out, err;
+    ConsoleSink::Options console_options;
+    console_options.mode = ConsoleMode::QUIET;
+    ConsoleSink console(out, err, console_options);
+    LogSink::Options log_options;
+    log_options.rollups = false;
+    LogSink log_sink(log, log_options);
+    t.expect(log_sink.start(), "log not opened");
+    console.start();
+
+    ParserStage parser(0, 1, ParserStage::Options(), console, log_sink);
+    parser.add_device(0);
+    parser.start();
+    const std::string lines = "Sensor values: gas=1, temp=2, s3=3, seq=5, ms=20000\r\n"
+                              "Sensor values: gas=1, temp=2, s3=3, seq=6, ms=20100\r\n"
+                              "Sensor values: gas=1, temp=2, s3=3, seq=0, ms=300\r\n"
+                              "Sensor values: gas=1, temp=2, s3=3, seq=1, ms=400\r\n";
+    RawChunk* chunk = parser.read_slot();
+    chunk->time_ms = wall_clock_ms();
+    chunk->device = 0;
+    chunk->length = static_cast<uint32_t>(lines.size());
+    std::memcpy(chunk->data, lines.data(), lines.size());
+    parser.publish();
+    parser.stop();
+    log_sink.stop();
+    console.stop();
+
+    std::vector<std::string> stamps;
+    for (const std::string& line : read_lines(log)) {
+        if (line.compare(0, 10, "Timestamp,") != 0 && line[0] != '#') {
+            stamps.push_back(line.substr(0, line.find(',')));
+        }
+    }
+    t.expect(stamps.size() == 4, std::to_string(stamps.size()) + " samples logged, expected 4");
+    for (size_t i = 1; i < stamps.size(); ++i) {
+        t.expect(stamps[i] >= stamps[i - 1], "sample " + std::to_string(i) + " stamped " + stamps[i] + ", before " +
+                                                 stamps[i - 1]);
+    }
+    t.expect(parser.clock(0)->resets() == 1, "clock resets " + std::to_string(parser.clock(0)->resets()) +
+                                                  ", expected 1");
+}
+
+/**
+ * Lines of one read are stamped from when their last byte could have been
+ * sent: the read time minus their time on the wire. A later line that is
+ * longer could have been sent before the line ahead of it; its stamp must
+ * still not be after that time, and the clock's delay must not go negative.
+ */
+void test_parser_clock_wire_order(TestContext& t) {
+    const std::string log = (t.dir / "log.csv").string();
+    std::ostringstream out, err;
+    ConsoleSink::Options console_options;
+    console_options.mode = ConsoleMode::QUIET;
+    ConsoleSink console(out, err, console_options);
+    LogSink::Options log_options;
+    log_options.rollups = false;
+    LogSink log_sink(log, log_options);
+    t.expect(log_sink.start(), "log not opened");
+    console.start();
+
+    ParserStage::Options options;
+    options.baud_rate = 300; // 33 ms per byte: the longer line left 400 ms earlier
+    ParserStage parser(0, 1, options, console, log_sink);
+    parser.add_device(0);
+    parser.start();
+    const std::string second = "Sensor values: gas=1000, temp=1000, s3=1000, seq=1, ms=1001";
+    const std::string lines = "Sensor values: gas=1, temp=2, s3=3, seq=0, ms=1000\r\n" + second + "\r\n";
+    const int64_t read_ms = wall_clock_ms();
+    RawChunk* chunk = parser.read_slot();
+    chunk->time_ms = read_ms;
+    chunk->device = 0;
+    chunk->length = static_cast<uint32_t>(lines.size());
+    std::memcpy(chunk->data, lines.data(), lines.size());
+    parser.publish();
+    parser.stop();
+    log_sink.stop();
+    console.stop();
+
+    std::vector<std::string> stamps;
+    for (const std::string& line : read_lines(log)) {
+        if (line.compare(0, 10, "Timestamp,") != 0 && line[0] != '#') {
+            stamps.push_back(line.substr(0, line.find(',')));
+        }
+    }
+    TimestampClock clock;
+    char sent[TimestampClock::BUFFER_SIZE];
+    clock.format(read_ms - static_cast<int64_t>((second.size() + 2) * 10000.0 / options.baud_rate), sent);
+    t.expect(stamps.size() == 2, std::to_string(stamps.size()) + " samples logged, expected 2");
+    t.expect(stamps.size() == 2 && stamps[1] <= sent, "second sample stamped " +
+                                                           (stamps.size() == 2 ? stamps[1] : "") + ", after " + sent);
+    const double max_delay_ms = parser.clock(0)->delay().max() / 1e6;
+    t.expect(max_delay_ms < 1000, "clock delay up to " + std::to_string(max_delay_ms) + " ms");
+}
+
+/**
+ * Sensor handler samples go to the format's own log, in its columns, stamped
+ * by the device clock: two samples taken 500 ms apart, the second read 800 ms
+ * after the first, must be logged 500 ms apart.
+ */
+void test_parser_format_log(TestContext& t) {
+    const std::string log = (t.dir / "log.csv").string();
+    const std::string handler_log = (t.dir / "log.handler.csv").string();
+    std::ostringstream out, err;
+    ConsoleSink::Options console_options;
+    console_options.mode = ConsoleMode::QUIET;
+    ConsoleSink console(out, err, console_options);
+    LogSink::Options log_options;
+    log_options.rollups = false;
+    LogSink log_sink(log, log_options);
+    log_options.columns = format_log_columns(LineFormat::HANDLER);
+    log_options.open_on_first_row = true;
+    LogSink format_log(handler_log, log_options);
+    t.expect(log_sink.start() && format_log.start(), "logs not started");
+    console.start();
+
+    ParserStage::Options options;
+    options.format_logs[static_cast<int>(LineFormat::HANDLER)] = &format_log;
+    ParserStage parser(0, 1, options, console, log_sink);
+    parser.add_device(0);
+    parser.start();
+    const std::string lines[2] = {
+        "Gas: 12.5 PPM | Temp (C): 21.50 | Soil Moisture: 40% | Seq: 0 | Time: 1000 ms\r\n",
+        "Gas: 13 PPM | Temp (C): NOT CONNECTED / ERROR | Soil Moisture: 41.5% | Seq: 1 | Time: 1500 ms\r\n"};
+    const int64_t read_ms = wall_clock_ms();
+    for (int i = 0; i < 2; ++i) {
+        RawChunk* chunk = parser.read_slot();
+        chunk->time_ms = read_ms + 800 * i;
+        chunk->device = 0;
+        chunk->length = static_cast<uint32_t>(lines[i].size());
+        std::memcpy(chunk->data, lines[i].data(), lines[i].size());
+        parser.publish();
+    }
+    parser.stop();
+    log_sink.stop();
+    format_log.stop();
+    console.stop();
+
+    std::vector<std::string> rows = read_lines(handler_log);
+    t.expect(rows.size() == 3, std::to_string(rows.size()) + " lines in the Sensor handler log, expected 3");
+    if (rows.size() == 3) {
+        t.expect(rows[0] == "Timestamp,Gas,Temp,Soil", "header " + rows[0]);
+        t.expect(rows[1].substr(23) == ",12.5,21.50,40.00", "first row " + rows[1]);
+        t.expect(rows[2].substr(23) == ",13.0,,41.50", "second row " + rows[2]);
+        int first_ms = std::stoi(rows[1].substr(17, 2)) * 1000 + std::stoi(rows[1].substr(20, 3));
+        int second_ms = std::stoi(rows[2].substr(17, 2)) * 1000 + std::stoi(rows[2].substr(20, 3));
+        t.expect((second_ms - first_ms + 60000) % 60000 == 500, "rows stamped " + rows[1].substr(0, 23) + " and " +
+                                                                    rows[2].substr(0, 23));
+    }
+    t.expect(read_lines(log).size() == 1, "Sensor handler samples in the main log");
+}
+
+int main() {
+    struct Test {
+        const char* name;
+        void (*run)(TestContext&);
+    };
+    const Test tests[] = {
+        {"log_retry_resumes", test_log_retry_resumes},
+        {"rollup_late_sample", test_rollup_late_sample},
+        {"parser_gap_markers", test_parser_gap_markers},
+        {"parser_clock_restart", test_parser_clock_restart},
+        {"parser_clock_wire_order", test_parser_clock_wire_order},
+        {"parser_format_log", test_parser_format_log},
+    };
+
+    const fs::path root = fs::temp_directory_path() / ("reader_tests." + std::to_string(wall_clock_ms()));
+    int failed_tests = 0;
+    for (const Test& test : tests) {
+        TestContext t;
+        t.name = test.name;
+        t.dir = root / test.name;
+        std::error_code ec;
+        fs::create_directories(t.dir, ec);
+        if (ec) {
+            std::cerr << "Cannot create " << t.dir << ": " << ec.message() << "\n";
+            return 1;
+        }
+        test.run(t);
+        std::cout << (t.failed == 0 ? "PASS " : "FAIL ") << test.name << "\n";
+        failed_tests += t.failed > 0 ? 1 : 0;
+        if (t.failed == 0) {
+            fs::remove_all(t.dir, ec);
+        }
+    }
+    std::error_code ec;
+    fs::remove(root, ec); // Left in place with the directories of failed tests
+    return failed_tests;
+}
@@ -0,0 +1,333 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "timestamp.h"
+
+/**
+ * Streaming min/max/sum/count rollups of the sample log at 1 s, 1 min and 1 h.
+ *
+ * Each tier keeps one open bucket; a sample costs one prefix compare and a
+ * min/max/sum update per column in each tier. Buckets are identified by the
+ * sample's local timestamp text ("YYYY-MM-DD HH:MM:SS" truncated to the tier),
+ * so they line up with local minutes and hours in any time zone. A bucket is
+ * closed and appended to its tier's file ("<log>.1s.csv", "<log>.1m.csv",
+ * "<log>.1h.csv", with <log> the log name minus its extension) when a sample
+ * from a later bucket arrives, or once no sample for it can still be in flight.
+ * Each bucket is written once: a sample that arrives after its bucket was
+ * closed (stamped by a device clock, or merged from another queue) is left
+ * out of that tier and counted in late().
+ *
+ * Rollup files are CSV with a "Timestamp" first column (the bucket start),
+ * so sensor_query can read them like the raw log, then the count and
+ * "<column>_min,<column>_max,<column>_sum" for each value column of the log.
+ * With more than one device, each device has its own buckets and rows end
+ * with a "Device" column.
+ */
+
+const int ROLLUP_COLUMNS = 3; // Value columns of a log row at most (gas, temp, s3 in the ADC log)
+const int ROLLUP_TIERS = 3;
+
+/**
+ * A value column of the sample log and its rollups.
+ */
+struct LogColumn {
+    std::string name;
+    int decimals;       // Values are fixed point with this many decimals (0..3)
+};
+
+/**
+ * @return Columns of the ADC sample log: whole gas, temp and s3 counts.
+ */
+inline std::vector<LogColumn> adc_columns() {
+    return {{"Gas", 0}, {"Temp", 0}, {"S3", 0}};
+}
+
+/**
+ * Formats a fixed-point value, e.g. 2150 with 2 decimals as "21.50".
+ * @return As snprintf().
+ */
+inline int format_fixed(char* out, size_t size, int64_t value, int decimals) {
+    static const uint64_t SCALE[4] = {1, 10, 100, 1000};
+    if (decimals <= 0) {
+        return std::snprintf(out, size, "%lld", static_cast<long long>(value));
+    }
+    decimals = std::min(decimals, 3);
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    return std::snprintf(out, size, "%s%llu.%0*llu", value < 0 ? "-" : "",
+                         static_cast<unsigned long long>(magnitude / SCALE[decimals]), decimals,
+                         static_cast<unsigned long long>(magnitude % SCALE[decimals]));
+}
+
+class Rollups {
+public:
+    Rollups() {
+        static const char* const SUFFIX[ROLLUP_TIERS] = {".1s.csv", ".1m.csv", ".1h.csv"};
+        static const size_t PREFIX[ROLLUP_TIERS] = {19, 16, 13}; // "YYYY-MM-DD HH:MM:SS" / "...HH:MM" / "...HH"
+        static const int64_t WIDTH_MS[ROLLUP_TIERS] = {1000, 60 * 1000, 3600 * 1000};
+        for (int t = 0; t < ROLLUP_TIERS; ++t) {
+            tiers_[t].suffix = SUFFIX[t];
+            tiers_[t].prefix_length = PREFIX[t];
+            tiers_[t].width_ms = WIDTH_MS[t];
+        }
+    }
+
+    ~Rollups() {
+        close();
+    }
+
+    Rollups(const Rollups&) = delete;
+    Rollups& operator=(const Rollups&) = delete;
+
+    /**
+     * Derives the tier file names from the raw log name and opens them for appending.
+     * @param log_filename Raw sample log, e.g. "sensor_data.csv".
+     * @param devices Device names, indexed by SampleRow::device; empty or one name for a single device.
+     * @param columns Value columns of the log, at most ROLLUP_COLUMNS.
+     * @return false if any tier file cannot be opened.
+     */
+    bool open(const std::string& log_filename, const std::vector<std::string>& devices = {},
+              const std::vector<LogColumn>& columns = adc_columns()) {
+        devices_ = devices.size() > 1 ? devices : std::vector<std::string>();
+        columns_.assign(columns.begin(), columns.begin() + std::min<size_t>(columns.size(), ROLLUP_COLUMNS));
+        for (Tier& tier : tiers_) {
+            tier.buckets.assign(devices_.empty() ? 1 : devices_.size(), Bucket());
+        }
+        std::string base = log_filename;
+        size_t dot = base.find_last_of('.');
+        size_t slash = base.find_last_of("/\\");
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+            base.erase(dot);
+        }
+        bool ok = true;
+        for (Tier& tier : tiers_) {
+            tier.filename = base + tier.suffix;
+            ok = open_tier(tier, !devices_.empty()) && ok;
+        }
+        return ok;
+    }
+
+    /**
+     * Adds one sample to every tier whose bucket for it was not closed yet,
+     * closing buckets it has moved past.
+     * @param time_ms Sample time, milliseconds since the Unix epoch.
+     * @param timestamp The same instant as "YYYY-MM-DD HH:MM:SS.mmm" local time.
+     * @param values ROLLUP_COLUMNS values (fixed point, see LogColumn).
+     * @param device Index into the device names passed to open().
+     */
+    void add(int64_t time_ms, const char* timestamp, const int* values, size_t device = 0) {
+        if (std::strlen(timestamp) < TimestampClock::LENGTH || timestamp[4] != '-') {
+            return; // "Invalid time"
+        }
+        for (Tier& tier : tiers_) {
+            if (device >= tier.buckets.size()) {
+                tier.buckets.resize(device + 1);
+            }
+            Bucket& b = tier.buckets[device];
+            int64_t start_ms = bucket_start_ms(tier, time_ms, timestamp);
+            if (start_ms < b.start_ms || (start_ms == b.start_ms && b.count == 0)) {
+                tier.late.store(tier.late.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                continue; // Its bucket was closed already
+            }
+            if (start_ms > b.start_ms) {
+                if (b.count > 0) {
+                    emit(tier, device);
+                }
+                std::memcpy(b.key, timestamp, tier.prefix_length);
+                b.start_ms = start_ms;
+                for (int c = 0; c < ROLLUP_COLUMNS; ++c) {
+                    b.min[c] = b.max[c] = values[c];
+                    b.sum[c] = 0;
+                }
+            }
+            ++b.count;
+            for (int c = 0; c < ROLLUP_COLUMNS; ++c) {
+                b.min[c] = std::min(b.min[c], values[c]);
+                b.max[c] = std::max(b.max[c], values[c]);
+                b.sum[c] += values[c];
+            }
+        }
+    }
+
+    /**
+     * Closes buckets that have ended, so quiet periods do not hold rows back.
+     * @param now_ms Current time, milliseconds since the Unix epoch.
+     * @param grace_ms How long after a bucket's end a queued sample may still arrive.
+     */
+    void close_idle(int64_t now_ms, int64_t grace_ms) {
+        for (Tier& tier : tiers_) {
+            for (size_t d = 0; d < tier.buckets.size(); ++d) {
+                const Bucket& b = tier.buckets[d];
+                if (b.count > 0 && now_ms > b.start_ms + tier.width_ms + grace_ms) {
+                    emit(tier, d);
+                }
+            }
+        }
+    }
+
+    /**
+     * Closes every open bucket (on shutdown; a partial bucket is better than none).
+     */
+    void close_all() {
+        for (Tier& tier : tiers_) {
+            for (size_t d = 0; d < tier.buckets.size(); ++d) {
+                if (tier.buckets[d].count > 0) {
+                    emit(tier, d);
+                }
+            }
+        }
+    }
+
+    /**
+     * Appends the closed buckets to their files.
+     * @param sync Called with each stream written to; returns false on error
+     *             (lets the caller apply its durability setting).
+     * @return false if any tier could not be written; its rows are discarded
+     *         and the file is reopened on the next call.
+     */
+    template <typename Sync>
+    bool flush(Sync sync) {
+        bool ok = true;
+        for (Tier& tier : tiers_) {
+            if (tier.pending.empty()) {
+                continue;
+            }
+            if (!tier.file && !open_tier(tier, !devices_.empty())) {
+                ok = false;
+            } else if (std::fwrite(tier.pending.data(), 1, tier.pending.size(), tier.file) != tier.pending.size() ||
+                       !sync(tier.file)) {
+                std::fclose(tier.file);
+                tier.file = nullptr;
+                ok = false;
+            }
+            tier.pending.clear();
+        }
+        return ok;
+    }
+
+    /**
+     * Safe to call from any thread.
+     * @param tier 0, 1 or 2 for the 1 s, 1 min and 1 h tier.
+     * @return Samples left out of the tier because their bucket was already closed.
+     */
+    uint64_t late(int tier) const {
+        return tiers_[tier].late.load(std::memory_order_relaxed);
+    }
+
+    void close() {
+        for (Tier& tier : tiers_) {
+            if (tier.file) {
+                std::fclose(tier.file);
+                tier.file = nullptr;
+            }
+        }
+    }
+
+private:
+    struct Bucket {
+        char key[TimestampClock::BUFFER_SIZE] = {};
+        int64_t start_ms = INT64_MIN;  // Kept after the bucket is closed, to recognise late samples
+        uint64_t count = 0;            // 0: closed
+        int min[ROLLUP_COLUMNS];
+        int max[ROLLUP_COLUMNS];
+        int64_t sum[ROLLUP_COLUMNS];
+    };
+
+    struct Tier {
+        const char* suffix = nullptr;
+        size_t prefix_length = 0;
+        int64_t width_ms = 0;
+        std::string filename;
+        std::FILE* file = nullptr;
+        std::vector<Bucket> buckets = std::vector<Bucket>(1); // One open bucket per device
+        std::string pending; // Closed buckets not yet written
+        std::atomic<uint64_t> late{0}; // Written by the adding thread, read by any
+    };
+
+    /**
+     * @return Start of a sample's bucket in a tier, in ms since the epoch. Taken
+     *         from its local timestamp: a local hour can be offset from a UTC one.
+     */
+    static int64_t bucket_start_ms(const Tier& tier, int64_t time_ms, const char* timestamp) {
+        auto digits = [timestamp](int at, int count) {
+            int value = 0;
+            for (int i = at; i < at + count; ++i) {
+                value = value * 10 + (timestamp[i] - '0');
+            }
+            return value;
+        };
+        int64_t offset_ms = digits(20, 3);           // "YYYY-MM-DD HH:MM:SS.mmm"
+        if (tier.width_ms > 1000) {
+            offset_ms += digits(17, 2) * 1000;
+        }
+        if (tier.width_ms > 60 * 1000) {
+            offset_ms += digits(14, 2) * 60 * 1000;
+        }
+        return time_ms - offset_ms;
+    }
+
+    /**
+     * Opens a tier file for appending and writes the header into an empty file.
+     * @param device_column Whether rows carry a trailing Device column.
+     */
+    bool open_tier(Tier& tier, bool device_column) const {
+        tier.file = std::fopen(tier.filename.c_str(), "a");
+        if (!tier.file) {
+            return false;
+        }
+        std::fseek(tier.file, 0, SEEK_END);
+        if (std::ftell(tier.file) == 0) {
+            std::string header = "Timestamp,Count";
+            for (const LogColumn& column : columns_) {
+                header += "," + column.name + "_min," + column.name + "_max," + column.name + "_sum";
+            }
+            header += device_column ? ",Device\n" : "\n";
+            std::fputs(header.c_str(), tier.file);
+        }
+        return true;
+    }
+
+    /**
+     * Formats a device's open bucket of a tier as a row and resets it.
+     */
+    void emit(Tier& tier, size_t device) {
+        Bucket& b = tier.buckets[device];
+        char line[256];
+        // Pad the truncated key back to a full "YYYY-MM-DD HH:MM:SS" bucket start
+        static const char ZERO_TIME[] = "0000-00-00 00:00:00";
+        char start[sizeof(ZERO_TIME)];
+        std::memcpy(start, ZERO_TIME, sizeof(ZERO_TIME));
+        std::memcpy(start, b.key, tier.prefix_length);
+        int length = std::snprintf(line, sizeof(line), "%s,%llu", start, static_cast<unsigned long long>(b.count));
+        for (size_t c = 0; c < columns_.size() && length > 0; ++c) {
+            const int64_t values[3] = {b.min[c], b.max[c], b.sum[c]};
+            for (int64_t value : values) {
+                line[length++] = ',';
+                length += format_fixed(line + length, sizeof(line) - length, value, columns_[c].decimals);
+            }
+        }
+        if (length > 0 && static_cast<size_t>(length) < sizeof(line) - 1) {
+            tier.pending.append(line, static_cast<size_t>(length));
+            if (!devices_.empty()) {
+                tier.pending += ',';
+                tier.pending += device < devices_.size() ? devices_[device] : std::to_string(device);
+            }
+            tier.pending += '\n';
+        }
+        b.count = 0;
+    }
+
+    Tier tiers_[ROLLUP_TIERS];
+    std::vector<std::string> devices_; // Empty for a single device (no Device column)
+    std::vector<LogColumn> columns_ = adc_columns();
+};
+
+#endif // ROLLUP_H
@@ -0,0 +1,348 @@
+#ifndef SAMPLE_BATCH_H
+#define SAMPLE_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "telemetry_frame.h"
+
+/*
+ * Batches of legacy samples (gas, temp, s3 ADC counts) that ESP_WiFi_Communication
+ * uploads as one HTTP POST body instead of one GET request per sample. Shared
+ * by the sketch (plain C++ for avr-gcc, no heap) and batch_receiver.
+ *
+ * Binary body (Content-Type: application/octet-stream), little endian:
+ *   magic   2 bytes: 'E' 'B'
+ *   version 1 byte: 1
+ *   count   1 byte: samples in the batch, 1..255
+ *   time    4 bytes: device millis() of the first sample
+ *   seq     4 bytes: number of the first sample; the sketch numbers samples from 0
+ *           after a reset and the samples of a batch follow on from each other
+ *   sample  8 bytes each: ms after the previous sample (first: 0) as uint16,
+ *           then gas, temp, s3 as int16
+ *   crc     2 bytes: CRC-16/CCITT-FALSE of magic .. last sample (catches bytes
+ *           lost or changed on the UART between the board and its ESP module)
+ *
+ * CSV body (Content-Type: text/csv), the same fields as text:
+ *   #batch,<time>,<seq>,<count>
+ *   <ms after previous>,<gas>,<temp>,<s3>    one line per sample
+ *
+ * One sample sent alone as a GET request costs about 90 bytes of HTTP plus two
+ * AT command round trips; in a binary batch of 32 it costs 8 bytes plus a
+ * 1/32 share of one request.
+ */
+
+static const uint8_t BATCH_VALUES = 3;              // gas, temp, s3
+static const uint8_t BATCH_MAX_SAMPLES = 255;
+static const uint8_t BATCH_VERSION = 1;
+static const size_t BATCH_HEADER_SIZE = 12;         // magic, version, count, time, seq
+static const size_t BATCH_SAMPLE_SIZE = 2 + 2 * BATCH_VALUES;
+static const size_t BATCH_CSV_HEADER_MAX = 33;      // "#batch,4294967295,4294967295,255\n"
+static const size_t BATCH_CSV_LINE_MAX = 27;        // "65535,-32768,-32768,-32768\n"
+
+/**
+ * Accumulates up to CAPACITY samples and encodes them as one batch body.
+ * Samples that do not fit are dropped but keep their number, so the receiver
+ * counts them as lost; once one is dropped the batch takes no more samples
+ * until it is sent.
+ */
+template <uint8_t CAPACITY>
+class SampleBatch {
+public:
+    static const size_t BINARY_SIZE = BATCH_HEADER_SIZE + BATCH_SAMPLE_SIZE * CAPACITY + 2;
+    static const size_t CSV_SIZE = BATCH_CSV_HEADER_MAX + BATCH_CSV_LINE_MAX * CAPACITY + 1; // With the '\0'
+
+    SampleBatch() : first_ms_(0), last_ms_(0), first_seq_(0), count_(0), dropped_(0) {}
+
+    /**
+     * Adds a sample.
+     * @param time_ms Device time of the sample, normally millis().
+     * @return false if the sample was dropped: the batch is full, already dropped
+     *         one, or the sample is more than 65535 ms after the previous one.
+     */
+    bool add(uint32_t time_ms, int16_t gas, int16_t temp, int16_t s3) {
+        if (count_ > 0 && (count_ == CAPACITY || dropped_ > 0 || time_ms - last_ms_ > 0xFFFF)) {
+            ++dropped_;
+            return false;
+        }
+        if (count_ == 0) {
+            first_ms_ = time_ms;
+            last_ms_ = time_ms;
+        }
+        step_[count_] = static_cast<uint16_t>(time_ms - last_ms_);
+        value_[count_][0] = gas;
+        value_[count_][1] = temp;
+        value_[count_][2] = s3;
+        last_ms_ = time_ms;
+        ++count_;
+        return true;
+    }
+
+    uint8_t size() const {
+        return count_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    /**
+     * @return true once the batch takes no more samples.
+     */
+    bool full() const {
+        return count_ == CAPACITY || dropped_ > 0;
+    }
+
+    /**
+     * @return How long ago the first sample was taken, 0 for an empty batch.
+     */
+    uint32_t age(uint32_t now_ms) const {
+        return count_ > 0 ? now_ms - first_ms_ : 0;
+    }
+
+    /**
+     * @return Samples dropped since the batch was last sent.
+     */
+    uint32_t dropped() const {
+        return dropped_;
+    }
+
+    /**
+     * Starts the next batch, numbered on from this one; call once this one is
+     * encoded (the encoded body can be uploaded while the next batch fills).
+     */
+    void clear() {
+        first_seq_ += count_ + dropped_;
+        count_ = 0;
+        dropped_ = 0;
+    }
+
+    /**
+     * Empties the batch to fill it again from stored samples.
+     * @param first_seq Number of the first sample added; the others follow on from it.
+     */
+    void start(uint32_t first_seq) {
+        first_seq_ = first_seq;
+        count_ = 0;
+        dropped_ = 0;
+    }
+
+    /**
+     * Encodes the binary body.
+     * @param out At least BINARY_SIZE bytes.
+     * @return Body length.
+     */
+    size_t encode_binary(uint8_t* out) const {
+        size_t n = 0;
+        out[n++] = 'E';
+        out[n++] = 'B';
+        out[n++] = BATCH_VERSION;
+        out[n++] = count_;
+        n = put32(out, n, first_ms_);
+        n = put32(out, n, first_seq_);
+        for (uint8_t i = 0; i < count_; ++i) {
+            n = put16(out, n, step_[i]);
+            for (uint8_t v = 0; v < BATCH_VALUES; ++v) {
+                n = put16(out, n, static_cast<uint16_t>(value_[i][v]));
+            }
+        }
+        return put16(out, n, telemetry_crc16(out, n));
+    }
+
+    /**
+     * Encodes the CSV body, '\0'-terminated.
+     * @param out At least CSV_SIZE bytes.
+     * @return Body length without the '\0'.
+     */
+    size_t encode_csv(char* out) const {
+        static const char HEADER[] = "#batch,";
+        size_t n = 0;
+        for (size_t i = 0; i < sizeof(HEADER) - 1; ++i) {
+            out[n++] = HEADER[i];
+        }
+        n = put_decimal(out, n, first_ms_, false);
+        out[n++] = ',';
+        n = put_decimal(out, n, first_seq_, false);
+        out[n++] = ',';
+        n = put_decimal(out, n, count_, false);
+        out[n++] = '\n';
+        for (uint8_t i = 0; i < count_; ++i) {
+            n = put_decimal(out, n, step_[i], false);
+            for (uint8_t v = 0; v < BATCH_VALUES; ++v) {
+                out[n++] = ',';
+                int16_t value = value_[i][v];
+                n = put_decimal(out, n, value < 0 ? static_cast<uint32_t>(-static_cast<int32_t>(value)) : value, value < 0);
+            }
+            out[n++] = '\n';
+        }
+        out[n] = '\0';
+        return n;
+    }
+
+private:
+    static size_t put16(uint8_t* out, size_t n, uint16_t value) {
+        out[n++] = static_cast<uint8_t>(value);
+        out[n++] = static_cast<uint8_t>(value >> 8);
+        return n;
+    }
+
+    static size_t put32(uint8_t* out, size_t n, uint32_t value) {
+        return put16(out, put16(out, n, static_cast<uint16_t>(value)), static_cast<uint16_t>(value >> 16));
+    }
+
+    // Without snprintf: its %lu / %u widths differ between avr-gcc and the PC
+    static size_t put_decimal(char* out, size_t n, uint32_t value, bool negative) {
+        char digits[10];
+        uint8_t count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        if (negative) {
+            out[n++] = '-';
+        }
+        while (count > 0) {
+            out[n++] = digits[--count];
+        }
+        return n;
+    }
+
+    uint32_t first_ms_;
+    uint32_t last_ms_;
+    uint32_t first_seq_;
+    uint8_t count_;
+    uint32_t dropped_;
+    uint16_t step_[CAPACITY];
+    int16_t value_[CAPACITY][BATCH_VALUES];
+};
+
+/**
+ * One decoded sample of a batch.
+ */
+struct BatchSample {
+    uint32_t time_ms;              // Device millis()
+    uint32_t seq;
+    int16_t value[BATCH_VALUES];   // gas, temp, s3
+};
+
+/**
+ * Why a batch body was rejected.
+ */
+enum BatchStatus : uint8_t {
+    BATCH_OK,
+    BATCH_BAD_FORMAT,   // Neither encoding, or an unknown version
+    BATCH_BAD_CRC,      // Bytes changed on the way
+    BATCH_BAD_LENGTH    // Truncated, or the size does not match the count
+};
+
+#ifndef ARDUINO
+/**
+ * Parses a decimal field of a CSV batch and the separator after it.
+ * @return false if the field is empty, not a number or larger than max.
+ */
+inline bool batch_parse_field(const uint8_t* data, size_t length, size_t& i, char end, uint32_t max, bool allow_sign,
+                              int64_t& value) {
+    bool negative = allow_sign && i < length && data[i] == '-';
+    if (negative) {
+        ++i;
+    }
+    size_t start = i;
+    uint64_t magnitude = 0;
+    while (i < length && data[i] >= '0' && data[i] <= '9' && i - start < 10) {
+        magnitude = magnitude * 10 + (data[i++] - '0');
+    }
+    if (i == start || i == length || data[i] != end || magnitude > max + (negative ? 1u : 0u)) {
+        return false;
+    }
+    ++i;
+    value = negative ? -static_cast<int64_t>(magnitude) : static_cast<int64_t>(magnitude);
+    return true;
+}
+
+inline BatchStatus decode_csv_batch(const uint8_t* data, size_t length, BatchSample* out, size_t& count) {
+    static const char HEADER[] = "#batch,";
+    const size_t header = sizeof(HEADER) - 1;
+    size_t i = header;
+    int64_t first_ms, first_seq, n;
+    if (!batch_parse_field(data, length, i, ',', UINT32_MAX, false, first_ms) ||
+        !batch_parse_field(data, length, i, ',', UINT32_MAX, false, first_seq) ||
+        !batch_parse_field(data, length, i, '\n', BATCH_MAX_SAMPLES, false, n) || n == 0) {
+        return BATCH_BAD_LENGTH;
+    }
+    uint32_t time_ms = static_cast<uint32_t>(first_ms);
+    for (int64_t s = 0; s < n; ++s) {
+        int64_t step, value[BATCH_VALUES];
+        if (!batch_parse_field(data, length, i, ',', 0xFFFF, false, step) ||
+            !batch_parse_field(data, length, i, ',', 32767, true, value[0]) ||
+            !batch_parse_field(data, length, i, ',', 32767, true, value[1]) ||
+            !batch_parse_field(data, length, i, '\n', 32767, true, value[2])) {
+            return BATCH_BAD_LENGTH;
+        }
+        time_ms += static_cast<uint32_t>(step);
+        out[s].time_ms = time_ms;
+        out[s].seq = static_cast<uint32_t>(first_seq) + static_cast<uint32_t>(s);
+        for (uint8_t v = 0; v < BATCH_VALUES; ++v) {
+            out[s].value[v] = static_cast<int16_t>(value[v]);
+        }
+    }
+    if (i != length) {
+        return BATCH_BAD_LENGTH;
+    }
+    count = static_cast<size_t>(n);
+    return BATCH_OK;
+}
+
+/**
+ * Decodes and checks one batch body of either encoding.
+ * @param out At least BATCH_MAX_SAMPLES entries.
+ * @param count Receives the number of samples.
+ */
+inline BatchStatus decode_sample_batch(const uint8_t* data, size_t length, BatchSample* out, size_t& count) {
+    count = 0;
+    if (length >= 7 && data[0] == '#' && data[1] == 'b' && data[2] == 'a' && data[3] == 't' && data[4] == 'c' &&
+        data[5] == 'h' && data[6] == ',') {
+        return decode_csv_batch(data, length, out, count);
+    }
+    if (length < 3 || data[0] != 'E' || data[1] != 'B' || data[2] != BATCH_VERSION) {
+        return BATCH_BAD_FORMAT;
+    }
+    if (length < BATCH_HEADER_SIZE + BATCH_SAMPLE_SIZE + 2 ||
+        length != BATCH_HEADER_SIZE + BATCH_SAMPLE_SIZE * data[3] + 2) {
+        return BATCH_BAD_LENGTH;
+    }
+    uint16_t crc = static_cast<uint16_t>(data[length - 2] | data[length - 1] << 8);
+    if (telemetry_crc16(data, length - 2) != crc) {
+        return BATCH_BAD_CRC;
+    }
+    auto get16 = [data](size_t at) { return static_cast<uint16_t>(data[at] | data[at + 1] << 8); };
+    uint32_t time_ms = get16(4) | static_cast<uint32_t>(get16(6)) << 16;
+    const uint32_t first_seq = get16(8) | static_cast<uint32_t>(get16(10)) << 16;
+    const uint8_t n = data[3];
+    for (uint8_t s = 0; s < n; ++s) {
+        size_t at = BATCH_HEADER_SIZE + BATCH_SAMPLE_SIZE * s;
+        time_ms += get16(at);
+        out[s].time_ms = time_ms;
+        out[s].seq = first_seq + s;
+        for (uint8_t v = 0; v < BATCH_VALUES; ++v) {
+            out[s].value[v] = static_cast<int16_t>(get16(at + 2 + 2 * v));
+        }
+    }
+    count = n;
+    return BATCH_OK;
+}
+
+inline const char* batch_status_name(BatchStatus status) {
+    switch (status) {
+    case BATCH_OK:
+        return "ok";
+    case BATCH_BAD_FORMAT:
+        return "bad format";
+    case BATCH_BAD_CRC:
+        return "bad CRC";
+    default:
+        return "bad length";
+    }
+}
+#endif
+
+#endif // SAMPLE_BATCH_H
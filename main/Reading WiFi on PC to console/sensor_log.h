@@ -0,0 +1,493 @@
+#ifndef SENSOR_LOG_H
+#define SENSOR_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Append-only binary sample log ("ECM sensor log", .bin)
+ *
+ * File layout, all integers little-endian:
+ *
+ *   FileHeader (32 bytes)
+ *   Block 0
+ *   Block 1
+ *   ...
+ *
+ * Each block holds up to BLOCK_ROWS samples stored column by column:
+ *
+ *   BlockHeader (32 bytes)
+ *   timestamps  row_count zigzag varints, delta from the previous row
+ *               (the first row's delta is from BlockHeader::first_ms),
+ *               zero-padded to an even length
+ *   gas         row_count x uint16
+ *   temp        row_count x uint16
+ *   s3          row_count x uint16
+ *
+ * The writer keeps the newest block open and rewrites it in place on every
+ * commit until it is full; sealed blocks are never touched again, and a reader
+ * that maps the file sees every committed row. A block whose CRC does not
+ * match marks the end of the valid data, so a crash in the middle of a rewrite
+ * costs at most the open block (BLOCK_ROWS rows).
+ */
+
+namespace sensor_log {
+
+const char FILE_MAGIC[8] = {'E', 'C', 'M', 'S', 'L', 'O', 'G', '1'};
+const uint32_t BLOCK_MAGIC = 0x314B4C42; // "BLK1"
+const uint16_t FORMAT_VERSION = 1;
+const uint32_t BLOCK_ROWS = 1024;
+const size_t FILE_HEADER_SIZE = 32;
+const size_t BLOCK_HEADER_SIZE = 32;
+const int COLUMN_COUNT = 3; // gas, temp, s3
+
+/**
+ * CRC-32 (IEEE 802.3, as used by zip/gzip).
+ * @param data Bytes to checksum.
+ * @param length Number of bytes.
+ * @param crc Running CRC from a previous call, or 0.
+ * @return Updated CRC.
+ */
+inline uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0) {
+    struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+    };
+    static const Table table;
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+inline void put_u32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+inline void put_i64(uint8_t* p, int64_t v) {
+    uint64_t u = static_cast<uint64_t>(v);
+    for (int i = 0; i < 8; ++i) {
+        p[i] = static_cast<uint8_t>(u >> (8 * i));
+    }
+}
+
+inline uint16_t get_u16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t get_u32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline int64_t get_i64(const uint8_t* p) {
+    uint64_t u = 0;
+    for (int i = 7; i >= 0; --i) {
+        u = (u << 8) | p[i];
+    }
+    return static_cast<int64_t>(u);
+}
+
+/**
+ * Block header fields, decoded.
+ */
+struct BlockInfo {
+    uint32_t row_count;
+    uint32_t timestamp_bytes;  // Varint column length including padding
+    int64_t first_ms;
+    int64_t last_ms;
+    uint32_t crc;              // CRC-32 of the payload after the header
+};
+
+/**
+ * One sample as stored in the log.
+ */
+struct LogSample {
+    int64_t time_ms;  // Milliseconds since the Unix epoch
+    uint16_t value[COLUMN_COUNT];
+};
+
+/**
+ * Builds the 32-byte file header.
+ */
+inline void encode_file_header(uint8_t* out) {
+    std::memset(out, 0, FILE_HEADER_SIZE);
+    std::memcpy(out, FILE_MAGIC, sizeof(FILE_MAGIC));
+    put_u16(out + 8, FORMAT_VERSION);
+    put_u16(out + 10, COLUMN_COUNT);
+    put_u32(out + 12, BLOCK_ROWS);
+}
+
+/**
+ * @return true if the buffer starts with a file header this code can read.
+ */
+inline bool check_file_header(const uint8_t* data, size_t size) {
+    return size >= FILE_HEADER_SIZE && std::memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0 &&
+           get_u16(data + 8) == FORMAT_VERSION && get_u16(data + 10) == COLUMN_COUNT;
+}
+
+/**
+ * Encodes samples into one complete block (header + columns).
+ * @param rows Samples in arrival order; at most BLOCK_ROWS.
+ * @param count Number of samples.
+ * @param out Receives the encoded block (replaced).
+ */
+inline void encode_block(const LogSample* rows, size_t count, std::vector<uint8_t>& out) {
+    out.assign(BLOCK_HEADER_SIZE, 0);
+    int64_t previous = count > 0 ? rows[0].time_ms : 0;
+    for (size_t i = 0; i < count; ++i) {
+        int64_t delta = rows[i].time_ms - previous;
+        previous = rows[i].time_ms;
+        uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+        while (zigzag >= 0x80) {
+            out.push_back(static_cast<uint8_t>(zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(zigzag));
+    }
+    if ((out.size() - BLOCK_HEADER_SIZE) % 2 != 0) {
+        out.push_back(0);
+    }
+    uint32_t timestamp_bytes = static_cast<uint32_t>(out.size() - BLOCK_HEADER_SIZE);
+    size_t column_start = out.size();
+    out.resize(column_start + count * 2 * COLUMN_COUNT);
+    for (int c = 0; c < COLUMN_COUNT; ++c) {
+        uint8_t* column = out.data() + column_start + c * count * 2;
+        for (size_t i = 0; i < count; ++i) {
+            put_u16(column + 2 * i, rows[i].value[c]);
+        }
+    }
+
+    uint8_t* header = out.data();
+    put_u32(header, BLOCK_MAGIC);
+    put_u32(header + 4, static_cast<uint32_t>(count));
+    put_i64(header + 8, count > 0 ? rows[0].time_ms : 0);
+    put_i64(header + 16, count > 0 ? rows[count - 1].time_ms : 0);
+    put_u32(header + 24, timestamp_bytes);
+    put_u32(header + 28, crc32(out.data() + BLOCK_HEADER_SIZE, out.size() - BLOCK_HEADER_SIZE));
+}
+
+/**
+ * Validates the block at data and decodes its header.
+ * @param data Start of the block.
+ * @param available Bytes from data to the end of the file.
+ * @param info Receives the header fields.
+ * @return Total block size in bytes, or 0 if the block is missing or damaged.
+ */
+inline size_t read_block_info(const uint8_t* data, size_t available, BlockInfo& info) {
+    if (available < BLOCK_HEADER_SIZE || get_u32(data) != BLOCK_MAGIC) {
+        return 0;
+    }
+    info.row_count = get_u32(data + 4);
+    info.first_ms = get_i64(data + 8);
+    info.last_ms = get_i64(data + 16);
+    info.timestamp_bytes = get_u32(data + 24);
+    info.crc = get_u32(data + 28);
+    if (info.row_count > BLOCK_ROWS || info.timestamp_bytes % 2 != 0 ||
+        info.timestamp_bytes > info.row_count * 10 + 1) {
+        return 0;
+    }
+    size_t size = BLOCK_HEADER_SIZE + info.timestamp_bytes + static_cast<size_t>(info.row_count) * 2 * COLUMN_COUNT;
+    if (size > available ||
+        crc32(data + BLOCK_HEADER_SIZE, size - BLOCK_HEADER_SIZE) != info.crc) {
+        return 0;
+    }
+    return size;
+}
+
+/**
+ * Read-only view of one block inside a mapped file. Value columns are used in place.
+ */
+struct BlockView {
+    BlockInfo info;
+    const uint8_t* timestamps;               // Varint deltas
+    const uint8_t* columns[COLUMN_COUNT];    // row_count little-endian uint16 each
+
+    uint16_t value(int column, size_t row) const {
+        return get_u16(columns[column] + 2 * row);
+    }
+
+    /**
+     * Decodes the timestamp column.
+     * @param out Receives row_count timestamps in milliseconds (replaced).
+     */
+    void decode_timestamps(std::vector<int64_t>& out) const {
+        out.resize(info.row_count);
+        const uint8_t* p = timestamps;
+        int64_t current = info.first_ms;
+        for (uint32_t i = 0; i < info.row_count; ++i) {
+            uint64_t zigzag = 0;
+            int shift = 0;
+            uint8_t byte;
+            do {
+                byte = *p++;
+                zigzag |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                shift += 7;
+            } while ((byte & 0x80) && shift < 64);
+            current += static_cast<int64_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            out[i] = current;
+        }
+    }
+};
+
+/**
+ * Maps a binary log read-only and walks its blocks.
+ * Falls back to reading the whole file into memory where mmap is unavailable.
+ */
+class LogReader {
+public:
+    LogReader() : data_(nullptr), size_(0), offset_(FILE_HEADER_SIZE), mapped_(false) {}
+
+    ~LogReader() {
+        close();
+    }
+
+    LogReader(const LogReader&) = delete;
+    LogReader& operator=(const LogReader&) = delete;
+
+    /**
+     * @param filename Log file to map.
+     * @return false if the file cannot be read or is not a sensor log.
+     */
+    bool open(const std::string& filename) {
+        close();
+#ifndef _WIN32
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                data_ = static_cast<const uint8_t*>(map);
+                size_ = static_cast<size_t>(st.st_size);
+                mapped_ = true;
+                madvise(map, size_, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+#endif
+        if (!mapped_) {
+            std::FILE* file = std::fopen(filename.c_str(), "rb");
+            if (!file) {
+                return false;
+            }
+            uint8_t chunk[65536];
+            size_t n;
+            while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+                buffer_.insert(buffer_.end(), chunk, chunk + n);
+            }
+            std::fclose(file);
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+        }
+        offset_ = FILE_HEADER_SIZE;
+        return check_file_header(data_, size_);
+    }
+
+    /**
+     * Advances to the next valid block.
+     * @param block Receives pointers into the mapped file.
+     * @return false at the end of the valid data.
+     */
+    bool next_block(BlockView& block) {
+        if (!data_ || offset_ >= size_) {
+            return false;
+        }
+        size_t block_size = read_block_info(data_ + offset_, size_ - offset_, block.info);
+        if (block_size == 0) {
+            return false;
+        }
+        const uint8_t* p = data_ + offset_ + BLOCK_HEADER_SIZE;
+        block.timestamps = p;
+        p += block.info.timestamp_bytes;
+        for (int c = 0; c < COLUMN_COUNT; ++c) {
+            block.columns[c] = p + static_cast<size_t>(c) * block.info.row_count * 2;
+        }
+        offset_ += block_size;
+        return true;
+    }
+
+    /**
+     * @return Offset just past the last block returned (end of valid data once next_block() fails).
+     */
+    size_t offset() const {
+        return offset_;
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (mapped_) {
+            munmap(const_cast<uint8_t*>(data_), size_);
+        }
+#endif
+        buffer_.clear();
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_;
+    bool mapped_;
+    std::vector<uint8_t> buffer_;
+};
+
+/**
+ * Appends samples to a binary log, keeping the newest block open.
+ * Not thread-safe; used from one writer thread.
+ */
+class LogWriter {
+public:
+    LogWriter() : file_(nullptr), block_offset_(0) {}
+
+    ~LogWriter() {
+        close();
+    }
+
+    LogWriter(const LogWriter&) = delete;
+    LogWriter& operator=(const LogWriter&) = delete;
+
+    /**
+     * Opens or creates a log. Existing data is kept; anything after the last valid
+     * block (a torn write) is cut off and new samples start a fresh block.
+     * @param filename Log file.
+     * @return false if the file cannot be opened or is not a sensor log.
+     */
+    bool open(const std::string& filename) {
+        close();
+        std::error_code ec;
+        uintmax_t existing = std::filesystem::exists(filename, ec) ? std::filesystem::file_size(filename, ec) : 0;
+        if (ec) {
+            return false;
+        }
+        if (existing == 0) {
+            file_ = std::fopen(filename.c_str(), "w+b");
+            if (!file_) {
+                return false;
+            }
+            uint8_t header[FILE_HEADER_SIZE];
+            encode_file_header(header);
+            if (std::fwrite(header, 1, sizeof(header), file_) != sizeof(header)) {
+                close();
+                return false;
+            }
+            block_offset_ = FILE_HEADER_SIZE;
+        } else {
+            LogReader reader;
+            if (!reader.open(filename)) {
+                return false;
+            }
+            BlockView block;
+            while (reader.next_block(block)) {
+            }
+            block_offset_ = reader.offset();
+            reader.close();
+            if (block_offset_ < existing) {
+                std::filesystem::resize_file(filename, block_offset_, ec);
+                if (ec) {
+                    return false;
+                }
+            }
+            file_ = std::fopen(filename.c_str(), "r+b");
+            if (!file_) {
+                return false;
+            }
+        }
+        open_rows_.clear();
+        return true;
+    }
+
+    /**
+     * Adds one sample to the open block, writing the block out once it is full.
+     * @return false on a write error.
+     */
+    bool append(const LogSample& sample) {
+        open_rows_.push_back(sample);
+        if (open_rows_.size() == BLOCK_ROWS) {
+            if (!write_open_block()) {
+                return false;
+            }
+            block_offset_ += encoded_.size();
+            open_rows_.clear();
+        }
+        return true;
+    }
+
+    /**
+     * Writes the open block so every appended sample is in the file.
+     * @return false on a write error.
+     */
+    bool commit() {
+        return open_rows_.empty() || write_open_block();
+    }
+
+    /**
+     * @return Underlying stdio stream (for flush/fsync), or nullptr if closed.
+     */
+    std::FILE* stream() const {
+        return file_;
+    }
+
+    /**
+     * @param keep_pending Write samples appended since the last commit() first.
+     */
+    void close(bool keep_pending = true) {
+        if (file_) {
+            if (keep_pending) {
+                commit();
+            }
+            std::fclose(file_);
+            file_ = nullptr;
+        }
+        open_rows_.clear();
+    }
+
+private:
+    bool write_open_block() {
+        encode_block(open_rows_.data(), open_rows_.size(), encoded_);
+        return std::fseek(file_, static_cast<long>(block_offset_), SEEK_SET) == 0 &&
+               std::fwrite(encoded_.data(), 1, encoded_.size(), file_) == encoded_.size();
+    }
+
+    std::FILE* file_;
+    size_t block_offset_;              // File offset of the open block
+    std::vector<LogSample> open_rows_;
+    std::vector<uint8_t> encoded_;
+};
+
+} // namespace sensor_log
+
+#endif // SENSOR_LOG_H
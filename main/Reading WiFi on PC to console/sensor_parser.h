@@ -0,0 +1,625 @@
+#ifndef SENSOR_PARSER_H
+#define SENSOR_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+/**
+ * Line formats printed by the project sketches, recognised from their first bytes.
+ */
+enum class LineFormat : uint8_t {
+    LEGACY,    // "Sensor values: gas=%d, temp=%d, s3=%d"
+    JSON,      // {"temp":..} (Temperature sensor) or {"temperature":..,"humidity":..,"light":..} (Sensor Stream)
+    HANDLER,   // "Gas: .. PPM | Temp (C): .. | Soil Moisture: ..%" (Sensor handler)
+    DHT,       // "Humidity: .. % | Temperature: .. °C" (humidity)
+    RESPONSE,  // ESP AT/HTTP output containing OK, ERROR or HTTP
+    DATA,      // Anything else
+    MALFORMED  // Looked like a sensor line but a field could not be parsed
+};
+
+/**
+ * Sensor channels a line can carry. Used as indexes into SensorLine::value
+ * and as bit positions in SensorLine::fields / SensorLine::errors.
+ */
+enum SensorField : uint8_t {
+    FIELD_GAS = 0,
+    FIELD_TEMP,
+    FIELD_S3,
+    FIELD_HUMIDITY,
+    FIELD_LIGHT,
+    FIELD_SOIL,
+    FIELD_COUNT
+};
+
+/**
+ * Result of parsing one line. Plain data, no heap allocation.
+ */
+struct SensorLine {
+    LineFormat format;
+    uint8_t fields;             // Bit (1 << FIELD_x) set when value[FIELD_x] holds a reading
+    uint8_t errors;             // Bit set when the sketch reported the sensor as disconnected
+    bool device_error;          // JSON line carried an "error" key
+    bool device_warning;        // JSON line carried a "warning" key
+    uint8_t seq_bits;           // Width of seq: 0 if the line carried none, 32 for text lines, 8 for frames
+    uint8_t time_bits;          // Width of device_ms: 0 if the line carried none, 32 for text lines, 24 for frames
+    uint8_t sensor_id;          // Which sensor of its format on the link (binary frames); 0 for text lines
+    uint32_t seq;               // Sample sequence number stamped by the sketch
+    uint32_t device_ms;         // Sketch millis() when the sample was taken, modulo 2^time_bits
+    double value[FIELD_COUNT];  // Readings; LEGACY fields are whole ADC counts
+
+    bool has(SensorField field) const {
+        return (fields >> field) & 1;
+    }
+};
+
+/**
+ * Display name of a sensor field.
+ * @param field Field index.
+ * @return Short label used in console output.
+ */
+inline const char* field_name(SensorField field) {
+    static const char* const NAMES[FIELD_COUNT] = {"Gas", "Temp", "S3", "Humidity", "Light", "Soil"};
+    return field < FIELD_COUNT ? NAMES[field] : "?";
+}
+
+static const int SENSOR_IDS = 64;                                         // Values of SensorLine::sensor_id
+static const int SAMPLE_FORMATS = static_cast<int>(LineFormat::DHT) + 1;  // Formats that carry sensor samples
+static const int SAMPLE_STREAMS = SAMPLE_FORMATS * SENSOR_IDS;
+
+/**
+ * Sample stream of a line: the samples of one sensor, told apart by format and
+ * sensor id. Each stream is numbered on its own by the sketch.
+ * @return Index below SAMPLE_STREAMS, or -1 for lines that carry no samples.
+ */
+inline int sample_stream(const SensorLine& line) {
+    int format = static_cast<int>(line.format);
+    return format < SAMPLE_FORMATS ? format * SENSOR_IDS + (line.sensor_id % SENSOR_IDS) : -1;
+}
+
+/**
+ * Name of a sample stream: its format, followed by "/id" for sensors other than 0 (e.g. "handler/2").
+ * @param out Receives the name; 16 bytes are enough.
+ */
+inline void stream_name(int stream, char* out, size_t size) {
+    static const char* const FORMATS[SAMPLE_FORMATS] = {"legacy", "json", "handler", "dht"};
+    const char* format = stream >= 0 && stream < SAMPLE_STREAMS ? FORMATS[stream / SENSOR_IDS] : "?";
+    int id = stream >= 0 ? stream % SENSOR_IDS : 0;
+    if (id == 0) {
+        std::snprintf(out, size, "%s", format);
+    } else {
+        std::snprintf(out, size, "%s/%d", format, id);
+    }
+}
+
+namespace sensor_parser_detail {
+
+inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    return p;
+}
+
+/**
+ * Matches a literal at p.
+ * @return Pointer past the literal, or nullptr if it does not match.
+ */
+inline const char* match(const char* p, const char* end, std::string_view literal) {
+    if (static_cast<size_t>(end - p) < literal.size() ||
+        std::memcmp(p, literal.data(), literal.size()) != 0) {
+        return nullptr;
+    }
+    return p + literal.size();
+}
+
+/**
+ * Parses a decimal integer like sscanf("%d"): leading blanks, optional sign, digits.
+ * @return Pointer past the number, or nullptr if there are no digits or it overflows.
+ */
+inline const char* parse_int(const char* p, const char* end, double& out) {
+    p = skip_spaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    const char* digits = p;
+    int64_t value = 0;
+    while (p < end && is_digit(*p) && p - digits < 11) {
+        value = value * 10 + (*p - '0');
+        ++p;
+    }
+    if (p == digits || value > (negative ? 2147483648LL : 2147483647LL)) {
+        return nullptr;
+    }
+    out = static_cast<double>(negative ? -value : value);
+    return p;
+}
+
+/**
+ * Parses a decimal number with an optional fraction, as printed by Serial.print(float).
+ * Digits are accumulated as an integer and scaled once, so "23.45" is exact to one rounding.
+ * @return Pointer past the number, or nullptr if there are no digits.
+ */
+inline const char* parse_decimal(const char* p, const char* end, double& out) {
+    static constexpr double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                   1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+    p = skip_spaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction_digits = 0;
+    int dropped_digits = 0;
+    while (p < end && is_digit(*p)) {
+        if (digits < 18) {
+            mantissa = mantissa * 10 + (*p - '0');
+            ++digits;
+        } else {
+            ++dropped_digits;
+        }
+        ++p;
+    }
+    int integer_digits = digits + dropped_digits;
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && is_digit(*p)) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (*p - '0');
+                ++digits;
+                ++fraction_digits;
+            }
+            ++p;
+        }
+    }
+    if (integer_digits == 0 && fraction_digits == 0) {
+        return nullptr;
+    }
+    double value = static_cast<double>(mantissa);
+    if (fraction_digits > 0) {
+        value /= POW10[fraction_digits];
+    } else {
+        for (int i = 0; i < dropped_digits; ++i) {
+            value *= 10.0;
+        }
+    }
+    out = negative ? -value : value;
+    return p;
+}
+
+/**
+ * Parses an unsigned 32-bit decimal (a sequence number or millis() value).
+ * @return Pointer past the digits, or nullptr if there are none or the value overflows.
+ */
+inline const char* parse_u32(const char* p, const char* end, uint32_t& out) {
+    const char* digits = p;
+    uint64_t value = 0;
+    while (p < end && is_digit(*p) && p - digits < 10) {
+        value = value * 10 + static_cast<uint64_t>(*p - '0');
+        ++p;
+    }
+    if (p == digits || value > UINT32_MAX || (p < end && is_digit(*p))) {
+        return nullptr;
+    }
+    out = static_cast<uint32_t>(value);
+    return p;
+}
+
+inline const char* parse_seq(const char* p, const char* end, SensorLine& out) {
+    if ((p = parse_u32(p, end, out.seq))) {
+        out.seq_bits = 32;
+    }
+    return p;
+}
+
+inline const char* parse_device_ms(const char* p, const char* end, SensorLine& out) {
+    if ((p = parse_u32(p, end, out.device_ms))) {
+        out.time_bits = 32;
+    }
+    return p;
+}
+
+/**
+ * Optional ", seq=N" and ", ms=N" after the last value of a legacy line, in either order;
+ * anything else ends the line as far as the parser is concerned.
+ */
+inline void parse_legacy_tail(const char* p, const char* end, SensorLine& out) {
+    while (p) {
+        p = skip_spaces(p, end);
+        if (!(p = match(p, end, ","))) {
+            return;
+        }
+        p = skip_spaces(p, end);
+        const char* value;
+        if ((value = match(p, end, "seq="))) {
+            p = parse_seq(value, end, out);
+        } else if ((value = match(p, end, "ms="))) {
+            p = parse_device_ms(value, end, out);
+        } else {
+            return;
+        }
+    }
+}
+
+inline void set_field(SensorLine& out, SensorField field, double value) {
+    out.value[field] = value;
+    out.fields |= static_cast<uint8_t>(1u << field);
+}
+
+/**
+ * One separator and unsigned value of the legacy fast path, e.g. ", temp=300".
+ * @return Pointer past the digits, or nullptr if the text does not have that exact shape.
+ */
+inline const char* parse_legacy_value(const char* p, const char* end, std::string_view separator, uint32_t& out) {
+    if (!(p = match(p, end, separator))) {
+        return nullptr;
+    }
+    const char* digits = p;
+    uint32_t value = 0;
+    while (p < end && is_digit(*p) && p - digits < 9) {
+        value = value * 10 + static_cast<uint32_t>(*p - '0');
+        ++p;
+    }
+    if (p == digits || (p < end && is_digit(*p))) {
+        return nullptr;
+    }
+    out = value;
+    return p;
+}
+
+/**
+ * "Sensor values: gas=%d, temp=%d, s3=%d[, seq=%lu][, ms=%lu]" - anything else after s3 is ignored,
+ * as with sscanf.
+ */
+inline bool parse_legacy(const char* p, const char* end, SensorLine& out) {
+    static constexpr std::string_view KEYS[3] = {"gas=", "temp=", "s3="};
+    static constexpr SensorField FIELDS[3] = {FIELD_GAS, FIELD_TEMP, FIELD_S3};
+    p += sizeof("Sensor values:") - 1;
+
+    // Fast path for the exact layout the sketch prints: unsigned values of up to 9 digits.
+    // Written out per field so each separator is a constant-length compare.
+    uint32_t gas, temp, s3;
+    const char* q = p;
+    if ((q = parse_legacy_value(q, end, " gas=", gas)) && (q = parse_legacy_value(q, end, ", temp=", temp)) &&
+        (q = parse_legacy_value(q, end, ", s3=", s3))) {
+        set_field(out, FIELD_GAS, gas);
+        set_field(out, FIELD_TEMP, temp);
+        set_field(out, FIELD_S3, s3);
+        parse_legacy_tail(q, end, out);
+        return true;
+    }
+
+    // Tolerant path: any blanks around the separators, signed values
+    for (int i = 0; i < 3; ++i) {
+        if (i > 0 && !(p = match(p, end, ","))) {
+            return false;
+        }
+        p = skip_spaces(p, end);
+        if (!(p = match(p, end, KEYS[i]))) {
+            return false;
+        }
+        double value;
+        if (!(p = parse_int(p, end, value))) {
+            return false;
+        }
+        set_field(out, FIELDS[i], value);
+    }
+    parse_legacy_tail(p, end, out);
+    return true;
+}
+
+/**
+ * Matches a key the sketches print, with its closing quote and colon, in one compare.
+ * @param p First byte of the key, after its opening quote.
+ * @param field Receives the key's field.
+ * @return Pointer past the colon, or nullptr for other keys.
+ */
+inline const char* match_json_key(const char* p, const char* end, SensorField& field) {
+    const char* q = nullptr;
+    switch (p < end ? *p : '\0') {
+    case 't':
+        field = FIELD_TEMP;
+        if (!(q = match(p, end, "temperature\":"))) {
+            q = match(p, end, "temp\":");
+        }
+        break;
+    case 'h':
+        field = FIELD_HUMIDITY;
+        q = match(p, end, "humidity\":");
+        break;
+    case 'l':
+        field = FIELD_LIGHT;
+        q = match(p, end, "light\":");
+        break;
+    default:
+        break;
+    }
+    return q;
+}
+
+/**
+ * Flat JSON object with numeric or string values, e.g. {"temperature":21.30, "light":512}.
+ * Unknown keys are skipped; "error" and "warning" are flagged.
+ */
+inline bool parse_json(const char* p, const char* end, SensorLine& out) {
+    ++p; // '{'
+    while (true) {
+        p = skip_spaces(p, end);
+        if (p < end && *p == '}') {
+            return true;
+        }
+        if (p >= end || *p != '"') {
+            return false;
+        }
+        const char* key = ++p;
+        SensorField field;
+        double value;
+        const char* known = match_json_key(key, end, field);
+        if (known && (known = parse_decimal(known, end, value))) {
+            set_field(out, field, value);
+            p = skip_spaces(known, end);
+            if (p < end && *p == ',') {
+                ++p;
+            }
+            continue;
+        }
+        while (p < end && *p != '"') {
+            ++p;
+        }
+        if (p >= end) {
+            return false;
+        }
+        std::string_view name(key, p - key);
+        p = skip_spaces(p + 1, end);
+        if (p >= end || *p != ':') {
+            return false;
+        }
+        p = skip_spaces(p + 1, end);
+        if (p < end && *p == '"') {
+            // String value: only meaningful for error/warning
+            ++p;
+            while (p < end && *p != '"') {
+                p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+            }
+            if (p >= end) {
+                return false;
+            }
+            ++p;
+            if (name == "error") {
+                out.device_error = true;
+            } else if (name == "warning") {
+                out.device_warning = true;
+            }
+        } else {
+            if (!(p = parse_decimal(p, end, value))) {
+                return false;
+            }
+            if (name == "temp" || name == "temperature") {
+                set_field(out, FIELD_TEMP, value);
+            } else if (name == "humidity") {
+                set_field(out, FIELD_HUMIDITY, value);
+            } else if (name == "light") {
+                set_field(out, FIELD_LIGHT, value);
+            } else if (name == "gas") {
+                set_field(out, FIELD_GAS, value);
+            } else if (name == "sensor3" || name == "s3") {
+                set_field(out, FIELD_S3, value);
+            } else if (value >= 0 && value <= UINT32_MAX && value == static_cast<uint32_t>(value)) {
+                if (name == "seq") {
+                    out.seq = static_cast<uint32_t>(value);
+                    out.seq_bits = 32;
+                } else if (name == "ms") {
+                    out.device_ms = static_cast<uint32_t>(value);
+                    out.time_bits = 32;
+                }
+            }
+        }
+        p = skip_spaces(p, end);
+        if (p < end && *p == ',') {
+            ++p;
+        }
+    }
+}
+
+/**
+ * Maps a "Label: value" label from the handler/DHT sketches to a field.
+ * @return Field index, or FIELD_COUNT if unknown.
+ */
+inline SensorField labelled_field(std::string_view label) {
+    if (label == "Gas") return FIELD_GAS;
+    if (label == "Temp (C)" || label == "Temp" || label == "Temperature") return FIELD_TEMP;
+    if (label == "Soil Moisture") return FIELD_SOIL;
+    if (label == "Humidity") return FIELD_HUMIDITY;
+    return FIELD_COUNT;
+}
+
+/**
+ * Matches a label the handler/DHT sketches print for a reading, with its colon, in one compare.
+ * @param field Receives the label's field.
+ * @return Pointer past the colon, or nullptr for other labels (these go through labelled_field()).
+ */
+inline const char* match_label(const char* p, const char* end, SensorField& field) {
+    const char* q = nullptr;
+    switch (p < end ? *p : '\0') {
+    case 'G':
+        field = FIELD_GAS;
+        q = match(p, end, "Gas:");
+        break;
+    case 'T':
+        field = FIELD_TEMP;
+        if (!(q = match(p, end, "Temp (C):"))) {
+            q = match(p, end, "Temperature:");
+        }
+        break;
+    case 'S':
+        field = FIELD_SOIL;
+        q = match(p, end, "Soil Moisture:");
+        break;
+    case 'H':
+        field = FIELD_HUMIDITY;
+        q = match(p, end, "Humidity:");
+        break;
+    default:
+        break;
+    }
+    return q;
+}
+
+/**
+ * " | "-separated "Label: value unit" segments; "NOT CONNECTED / ERROR" marks a sensor as missing
+ * and "Seq: N" / "Time: N ms" segments carry the sequence number and the sketch's millis().
+ */
+inline bool parse_labelled(const char* p, const char* end, SensorLine& out) {
+    while (p < end) {
+        SensorField field;
+        const char* known = match_label(p, end, field);
+        if (known) {
+            p = skip_spaces(known, end);
+        } else {
+            const char* label = p;
+            p = static_cast<const char*>(std::memchr(p, ':', end - p));
+            if (!p) {
+                return false;
+            }
+            std::string_view name(label, p - label);
+            p = skip_spaces(p + 1, end);
+            if (name == "Seq" || name == "Time") {
+                if (!(p = name == "Seq" ? parse_seq(p, end, out) : parse_device_ms(p, end, out))) {
+                    return false;
+                }
+                const char* separator = static_cast<const char*>(std::memchr(p, '|', end - p));
+                p = separator ? skip_spaces(separator + 1, end) : end;
+                continue;
+            }
+            field = labelled_field(name);
+        }
+        double value;
+        const char* after = parse_decimal(p, end, value);
+        if (after) {
+            if (field != FIELD_COUNT) {
+                set_field(out, field, value);
+            }
+            p = after;
+        } else if (match(p, end, "NOT CONNECTED")) {
+            if (field != FIELD_COUNT) {
+                out.errors |= static_cast<uint8_t>(1u << field);
+            }
+        } else {
+            return false;
+        }
+        // Skip the unit up to the next separator (a few bytes: cheaper inline than a memchr call)
+        while (p < end && *p != '|') {
+            ++p;
+        }
+        p = p < end ? skip_spaces(p + 1, end) : end;
+    }
+    return out.fields != 0 || out.errors != 0;
+}
+
+/**
+ * Single pass over the line looking for the tokens that mark ESP AT/HTTP responses.
+ */
+inline bool is_response(const char* p, const char* end) {
+    for (; p < end; ++p) {
+        switch (*p) {
+        case 'O':
+            if (match(p, end, "OK")) return true;
+            break;
+        case 'E':
+            if (match(p, end, "ERROR")) return true;
+            break;
+        case 'H':
+            if (match(p, end, "HTTP")) return true;
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+} // namespace sensor_parser_detail
+
+/**
+ * Classifies a line by its first bytes and extracts its sensor fields.
+ * Hand-written single pass; no allocation and no sscanf.
+ * @param line Line without its line terminator.
+ * @param out Receives the format and the fields found.
+ * @return The detected format (also stored in out.format).
+ */
+inline LineFormat parse_sensor_line(std::string_view line, SensorLine& out) {
+    using namespace sensor_parser_detail;
+    out.fields = 0;
+    out.errors = 0;
+    out.device_error = false;
+    out.device_warning = false;
+    out.seq_bits = 0;
+    out.time_bits = 0;
+    out.sensor_id = 0;
+
+    const char* p = line.data();
+    const char* end = p + line.size();
+    LineFormat format = LineFormat::DATA;
+    bool parsed = true;
+    if (p < end) {
+        switch (*p) {
+        case 'S':
+            if (match(p, end, "Sensor values:")) {
+                format = LineFormat::LEGACY;
+                parsed = parse_legacy(p, end, out);
+            }
+            break;
+        case '{':
+            format = LineFormat::JSON;
+            parsed = parse_json(p, end, out);
+            break;
+        case 'G':
+            if (match(p, end, "Gas:")) {
+                format = LineFormat::HANDLER;
+                parsed = parse_labelled(p, end, out);
+            }
+            break;
+        case 'H':
+            if (match(p, end, "Humidity:")) {
+                format = LineFormat::DHT;
+                parsed = parse_labelled(p, end, out);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (!parsed) {
+        format = LineFormat::MALFORMED;
+    } else if (format == LineFormat::DATA && is_response(p, end)) {
+        format = LineFormat::RESPONSE;
+    }
+    out.format = format;
+    return format;
+}
+
+/**
+ * Range check applied to LEGACY samples before they are logged (10-bit ADC counts).
+ * @param line Parsed LEGACY line.
+ * @return true if gas, temp and s3 are all within 0..1023.
+ */
+inline bool legacy_in_range(const SensorLine& line) {
+    for (int f = FIELD_GAS; f <= FIELD_S3; ++f) {
+        if (line.value[f] < 0 || line.value[f] > 1023) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // SENSOR_PARSER_H
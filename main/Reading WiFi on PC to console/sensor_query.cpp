@@ -0,0 +1,762 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "sensor_log.h"
+#include "timestamp.h"
+
+/**
+ * Range queries and time-bucket aggregates over the reader's CSV sample log.
+ * Build: g++ -O2 -std=c++17 -pthread sensor_query.cpp -o sensor_query
+ * Usage: sensor_query <log.csv> [options]
+ *   --from=TIME, --to=TIME      Local time range, "YYYY-MM-DD[ HH:MM[:SS]]", end exclusive
+ *   --last=DURATION             Range ending now, e.g. 90m, 24h, 7d
+ *   --group=DURATION|all        Bucket size (default all)
+ *   --stats=min,max,avg,count   Statistics to print (default all four)
+ *   --device=NAME               Only rows of this port (logs of a multi-port reader)
+ *   --threads=N                 Worker threads (default: all cores)
+ *   --no-index                  Do not read or write the sparse index
+ * Example, max gas per hour over the last week:
+ *   sensor_query sensor_data.csv --last=7d --group=1h --stats=max
+ *
+ * The log is mapped and cut into newline-aligned segments of SEGMENT_SIZE bytes,
+ * which worker threads scan independently. The first and last timestamp seen in
+ * each segment are kept in "<log>.idx"; later queries skip every segment whose
+ * time span misses the requested range and only scan bytes appended since the
+ * index was written. Times are handled as local wall-clock milliseconds (the
+ * text in the log read as if it were UTC), so buckets line up with local
+ * midnight and hours without a mktime() call per row. A trailing "Device"
+ * column (written when the reader serves several ports) is not aggregated; it
+ * only selects rows for --device.
+ */
+
+const size_t SEGMENT_SIZE = 1 << 20;  // Bytes per scan unit and index entry
+const int MAX_COLUMNS = 8;             // Value columns after the timestamp
+
+/**
+ * Days since 1970-01-01 for a proleptic Gregorian date.
+ */
+int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = static_cast<unsigned>(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+/**
+ * Inverse of days_from_civil().
+ */
+void civil_from_days(int64_t z, int& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = static_cast<unsigned>(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<int>(static_cast<int64_t>(yoe) + era * 400 + (m <= 2));
+}
+
+int64_t floor_div(int64_t value, int64_t divisor) {
+    int64_t quotient = value / divisor;
+    return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+/**
+ * Formats wall-clock milliseconds as "YYYY-MM-DD HH:MM:SS".
+ */
+std::string format_wall_ms(int64_t wall_ms) {
+    int64_t seconds = floor_div(wall_ms, 1000);
+    int64_t days = floor_div(seconds, 86400);
+    int second_of_day = static_cast<int>(seconds - days * 86400);
+    int y;
+    unsigned m, d;
+    civil_from_days(days, y, m, d);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%04d-%02u-%02u %02d:%02d:%02d", y, m, d,
+                  second_of_day / 3600, second_of_day / 60 % 60, second_of_day % 60);
+    return buf;
+}
+
+/**
+ * Parses the timestamp at the start of a CSV row, "YYYY-MM-DD HH:MM:SS" with optional ".mmm".
+ * @param p Row text.
+ * @param end End of the row.
+ * @param wall_ms Receives wall-clock milliseconds.
+ * @return Pointer just past the timestamp, or nullptr if the row does not start with one.
+ */
+const char* parse_row_time(const char* p, const char* end, int64_t& wall_ms) {
+    const size_t BASE_LENGTH = 19;
+    if (end - p < static_cast<ptrdiff_t>(BASE_LENGTH) || p[4] != '-' || p[7] != '-' ||
+        p[10] != ' ' || p[13] != ':' || p[16] != ':') {
+        return nullptr;
+    }
+    static const unsigned char DIGITS[] = {0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18};
+    for (unsigned char at : DIGITS) {
+        if (static_cast<unsigned>(p[at] - '0') > 9) {
+            return nullptr;
+        }
+    }
+    auto two = [p](int at) { return (p[at] - '0') * 10 + (p[at + 1] - '0'); };
+    int year = two(0) * 100 + two(2);
+    int64_t days = days_from_civil(year, static_cast<unsigned>(two(5)), static_cast<unsigned>(two(8)));
+    int64_t seconds = days * 86400 + two(11) * 3600 + two(14) * 60 + two(17);
+    int millis = 0;
+    p += BASE_LENGTH;
+    if (p < end && *p == '.') {
+        if (end - p < 4 || static_cast<unsigned>(p[1] - '0') > 9 ||
+            static_cast<unsigned>(p[2] - '0') > 9 || static_cast<unsigned>(p[3] - '0') > 9) {
+            return nullptr;
+        }
+        millis = (p[1] - '0') * 100 + (p[2] - '0') * 10 + (p[3] - '0');
+        p += 4;
+    }
+    wall_ms = seconds * 1000 + millis;
+    return p;
+}
+
+/**
+ * Parses a command-line time: "YYYY-MM-DD", "YYYY-MM-DD HH:MM" or "YYYY-MM-DD HH:MM:SS" ('T' also accepted).
+ */
+bool parse_time_arg(const std::string& text, int64_t& wall_ms) {
+    int y = 0, mo = 0, d = 0, h = 0, mi = 0, s = 0;
+    char sep = ' ';
+    int n = std::sscanf(text.c_str(), "%d-%d-%d%c%d:%d:%d", &y, &mo, &d, &sep, &h, &mi, &s);
+    if (n != 3 && n != 6 && n != 7) {
+        return false;
+    }
+    if ((sep != ' ' && sep != 'T') || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 60) {
+        return false;
+    }
+    wall_ms = (days_from_civil(y, static_cast<unsigned>(mo), static_cast<unsigned>(d)) * 86400 +
+               h * 3600 + mi * 60 + s) * 1000;
+    return true;
+}
+
+/**
+ * Parses a duration such as "30s", "15m", "1h" or "7d" (a bare number is seconds).
+ * @return Milliseconds, or 0 if invalid.
+ */
+int64_t parse_duration(const std::string& text) {
+    char* end = nullptr;
+    long long count = std::strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str() || count <= 0) {
+        return 0;
+    }
+    std::string unit = end;
+    if (unit.empty() || unit == "s") return count * 1000;
+    if (unit == "m") return count * 60 * 1000;
+    if (unit == "h") return count * 3600 * 1000;
+    if (unit == "d") return count * 86400 * 1000;
+    return 0;
+}
+
+/**
+ * @return The current local time as wall-clock milliseconds.
+ */
+int64_t wall_now_ms() {
+    int64_t now = wall_clock_ms();
+    std::tm tm;
+    if (!to_local_tm(static_cast<std::time_t>(floor_div(now, 1000)), tm)) {
+        return now;
+    }
+    int64_t days = days_from_civil(tm.tm_year + 1900, static_cast<unsigned>(tm.tm_mon + 1),
+                                   static_cast<unsigned>(tm.tm_mday));
+    return (days * 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec) * 1000 + (now % 1000 + 1000) % 1000;
+}
+
+/**
+ * Read-only view of a whole file: mmap where available, otherwise read into memory.
+ */
+class MappedFile {
+public:
+    MappedFile() : data_(nullptr), size_(0), mapped_(false) {}
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename) {
+#ifndef _WIN32
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                data_ = static_cast<const char*>(map);
+                size_ = static_cast<size_t>(st.st_size);
+                mapped_ = true;
+                madvise(map, size_, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+#endif
+        if (!mapped_) {
+            std::FILE* file = std::fopen(filename.c_str(), "rb");
+            if (!file) {
+                return false;
+            }
+            char chunk[65536];
+            size_t n;
+            while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+                buffer_.insert(buffer_.end(), chunk, chunk + n);
+            }
+            std::fclose(file);
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+        }
+        return true;
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<char> buffer_;
+};
+
+/**
+ * A newline-aligned byte range of the log and the time span of its rows.
+ */
+struct Segment {
+    size_t begin;
+    size_t end;       // Just past the segment's last newline
+    int64_t min_ms;   // INT64_MAX if the segment holds no rows
+    int64_t max_ms;
+    bool indexed;     // Span known from the index, so it may be skipped
+};
+
+/**
+ * Sparse timestamp index stored next to the log as "<log>.idx".
+ *
+ * Layout, little-endian:
+ *   header (32 bytes): "ECMSIDX1", u32 version, u32 segment size,
+ *                      i64 bytes covered, u32 CRC-32 of the log's first
+ *                      min(covered, 4096) bytes, u32 entry count
+ *   entries (24 bytes each): i64 segment end, i64 min ms, i64 max ms
+ * Segments are contiguous from offset 0 to "bytes covered". The CRC detects a
+ * log that was replaced or rotated, in which case the index is rebuilt.
+ */
+namespace sparse_index {
+
+const char MAGIC[8] = {'E', 'C', 'M', 'S', 'I', 'D', 'X', '1'};
+const uint32_t VERSION = 1;
+const size_t HEADER_SIZE = 32;
+const size_t ENTRY_SIZE = 24;
+const size_t FINGERPRINT_BYTES = 4096;
+
+uint32_t fingerprint(const char* data, size_t covered) {
+    return sensor_log::crc32(reinterpret_cast<const uint8_t*>(data), std::min(covered, FINGERPRINT_BYTES));
+}
+
+/**
+ * Loads the segments of an index that still matches the log.
+ * @return Number of bytes covered (0 if the index is missing or stale).
+ */
+size_t load(const std::string& path, const MappedFile& log, std::vector<Segment>& segments) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+    uint8_t header[HEADER_SIZE];
+    size_t covered = 0;
+    if (std::fread(header, 1, HEADER_SIZE, file) == HEADER_SIZE && std::memcmp(header, MAGIC, 8) == 0 &&
+        sensor_log::get_u32(header + 8) == VERSION && sensor_log::get_u32(header + 12) == SEGMENT_SIZE) {
+        int64_t bytes = sensor_log::get_i64(header + 16);
+        uint32_t count = sensor_log::get_u32(header + 28);
+        if (bytes > 0 && static_cast<uint64_t>(bytes) <= log.size() &&
+            sensor_log::get_u32(header + 24) == fingerprint(log.data(), static_cast<size_t>(bytes))) {
+            std::vector<uint8_t> entries(static_cast<size_t>(count) * ENTRY_SIZE);
+            if (std::fread(entries.data(), 1, entries.size(), file) == entries.size()) {
+                size_t begin = 0;
+                for (uint32_t i = 0; i < count; ++i) {
+                    const uint8_t* e = entries.data() + i * ENTRY_SIZE;
+                    Segment segment = {begin, static_cast<size_t>(sensor_log::get_i64(e)),
+                                       sensor_log::get_i64(e + 8), sensor_log::get_i64(e + 16), true};
+                    if (segment.end <= begin) {
+                        break;
+                    }
+                    segments.push_back(segment);
+                    begin = segment.end;
+                }
+                if (begin == static_cast<size_t>(bytes)) {
+                    covered = begin;
+                } else {
+                    segments.clear();
+                }
+            }
+        }
+    }
+    std::fclose(file);
+    return covered;
+}
+
+/**
+ * Writes the index for all scanned segments; written to a temporary file and renamed into place.
+ * @return false on any I/O error (the query result is unaffected).
+ */
+bool save(const std::string& path, const MappedFile& log, const std::vector<Segment>& segments) {
+    size_t covered = segments.empty() ? 0 : segments.back().end;
+    std::vector<uint8_t> data(HEADER_SIZE + segments.size() * ENTRY_SIZE, 0);
+    std::memcpy(data.data(), MAGIC, 8);
+    sensor_log::put_u32(&data[8], VERSION);
+    sensor_log::put_u32(&data[12], static_cast<uint32_t>(SEGMENT_SIZE));
+    sensor_log::put_i64(&data[16], static_cast<int64_t>(covered));
+    sensor_log::put_u32(&data[24], fingerprint(log.data(), covered));
+    sensor_log::put_u32(&data[28], static_cast<uint32_t>(segments.size()));
+    for (size_t i = 0; i < segments.size(); ++i) {
+        uint8_t* e = &data[HEADER_SIZE + i * ENTRY_SIZE];
+        sensor_log::put_i64(e, static_cast<int64_t>(segments[i].end));
+        sensor_log::put_i64(e + 8, segments[i].min_ms);
+        sensor_log::put_i64(e + 16, segments[i].max_ms);
+    }
+    std::string temp = path + ".tmp";
+    std::FILE* file = std::fopen(temp.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = (std::fclose(file) == 0) && ok;
+    std::error_code ec;
+    if (ok) {
+        std::filesystem::rename(temp, path, ec);
+    }
+    if (!ok || ec) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace sparse_index
+
+/**
+ * Cuts [begin, size) into newline-aligned segments of about SEGMENT_SIZE bytes.
+ * A trailing line without a newline (still being written) is left out.
+ */
+void split_segments(const MappedFile& log, size_t begin, std::vector<Segment>& segments) {
+    const char* data = log.data();
+    size_t size = log.size();
+    while (begin < size) {
+        size_t target = std::min(begin + SEGMENT_SIZE, size) - 1;
+        const void* nl = std::memchr(data + target, '\n', size - target);
+        if (!nl) {
+            // No newline at or after target: end at the last one before it, if any
+            size_t last = target;
+            while (last > begin && data[last - 1] != '\n') {
+                --last;
+            }
+            if (last <= begin) {
+                return;
+            }
+            segments.push_back({begin, last, INT64_MAX, INT64_MIN, false});
+            return;
+        }
+        size_t end = static_cast<size_t>(static_cast<const char*>(nl) - data) + 1;
+        segments.push_back({begin, end, INT64_MAX, INT64_MIN, false});
+        begin = end;
+    }
+}
+
+/**
+ * Running statistics of one bucket.
+ */
+struct BucketStats {
+    uint64_t rows = 0;
+    int64_t min[MAX_COLUMNS];
+    int64_t max[MAX_COLUMNS];
+    int64_t sum[MAX_COLUMNS];
+
+    BucketStats() {
+        for (int c = 0; c < MAX_COLUMNS; ++c) {
+            min[c] = INT64_MAX;
+            max[c] = INT64_MIN;
+            sum[c] = 0;
+        }
+    }
+
+    void add(const int64_t* values, int columns) {
+        ++rows;
+        for (int c = 0; c < columns; ++c) {
+            min[c] = std::min(min[c], values[c]);
+            max[c] = std::max(max[c], values[c]);
+            sum[c] += values[c];
+        }
+    }
+
+    void merge(const BucketStats& other, int columns) {
+        rows += other.rows;
+        for (int c = 0; c < columns; ++c) {
+            min[c] = std::min(min[c], other.min[c]);
+            max[c] = std::max(max[c], other.max[c]);
+            sum[c] += other.sum[c];
+        }
+    }
+};
+
+/**
+ * What to scan for: a time range, the bucket size, the number of value columns
+ * and optionally one device.
+ */
+struct Query {
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;  // Exclusive
+    int64_t group_ms = 0;       // 0: one bucket for the whole range
+    int columns = 3;
+    std::string device;         // Empty: all rows; else the Device column must match
+};
+
+/**
+ * Per-thread scan state.
+ */
+struct ScanResult {
+    std::unordered_map<int64_t, BucketStats> buckets;
+    uint64_t matched = 0;
+    uint64_t malformed = 0;
+    uint64_t bytes = 0;
+};
+
+/**
+ * Parses up to columns comma-separated integers following the timestamp.
+ * @return Position after the last value (end or a ','), or nullptr if the row
+ *         has fewer values or non-numeric text.
+ */
+const char* parse_values(const char* p, const char* end, int columns, int64_t* values) {
+    for (int c = 0; c < columns; ++c) {
+        if (p >= end || *p != ',') {
+            return nullptr;
+        }
+        ++p;
+        bool negative = p < end && *p == '-';
+        p += negative;
+        const char* start = p;
+        int64_t value = 0;
+        while (p < end && static_cast<unsigned>(*p - '0') <= 9) {
+            value = value * 10 + (*p - '0');
+            ++p;
+        }
+        if (p == start) {
+            return nullptr;
+        }
+        values[c] = negative ? -value : value;
+    }
+    return p == end || *p == ',' ? p : nullptr;
+}
+
+/**
+ * @param p Position after the value columns, as returned by parse_values().
+ * @return true if the next column is exactly device.
+ */
+bool device_matches(const char* p, const char* end, const std::string& device) {
+    if (p >= end || *p != ',') {
+        return false;
+    }
+    ++p;
+    const char* comma = static_cast<const char*>(std::memchr(p, ',', static_cast<size_t>(end - p)));
+    size_t length = static_cast<size_t>((comma ? comma : end) - p);
+    return length == device.size() && std::memcmp(p, device.data(), length) == 0;
+}
+
+/**
+ * Scans one segment, recording its time span and adding matching rows to the result.
+ */
+void scan_segment(const char* data, Segment& segment, const Query& query, ScanResult& result) {
+    const char* p = data + segment.begin;
+    const char* stop = data + segment.end;
+    int64_t min_ms = INT64_MAX, max_ms = INT64_MIN;
+    int64_t last_key = INT64_MIN;
+    BucketStats* last_bucket = nullptr;
+    int64_t values[MAX_COLUMNS];
+    while (p < stop) {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(stop - p)));
+        const char* end = nl ? nl : stop;
+        const char* line = p;
+        p = end + 1;
+        if (end > line && end[-1] == '\r') {
+            --end;
+        }
+        if (line == end || *line == '#') {
+            continue; // Blank line or marker row
+        }
+        int64_t time_ms;
+        const char* rest = parse_row_time(line, end, time_ms);
+        if (!rest) {
+            if (*line != 'T') { // "Timestamp,..." header
+                ++result.malformed;
+            }
+            continue;
+        }
+        min_ms = std::min(min_ms, time_ms);
+        max_ms = std::max(max_ms, time_ms);
+        if (time_ms < query.from_ms || time_ms >= query.to_ms) {
+            continue;
+        }
+        const char* after = parse_values(rest, end, query.columns, values);
+        if (!after) {
+            ++result.malformed;
+            continue;
+        }
+        if (!query.device.empty() && !device_matches(after, end, query.device)) {
+            continue;
+        }
+        int64_t key = query.group_ms > 0 ? floor_div(time_ms, query.group_ms) * query.group_ms : 0;
+        if (key != last_key || !last_bucket) {
+            last_bucket = &result.buckets[key];
+            last_key = key;
+        }
+        last_bucket->add(values, query.columns);
+        ++result.matched;
+    }
+    segment.min_ms = min_ms;
+    segment.max_ms = max_ms;
+    result.bytes += segment.end - segment.begin;
+}
+
+/**
+ * Reads value column names from the "Timestamp,..." header row, if present.
+ * @param has_device Set if the last column is "Device" (left out of the result).
+ */
+std::vector<std::string> read_columns(const MappedFile& log, bool& has_device) {
+    std::vector<std::string> columns;
+    const char* data = log.data();
+    size_t size = log.size();
+    const void* nl = size ? std::memchr(data, '\n', size) : nullptr;
+    std::string header(data, nl ? static_cast<size_t>(static_cast<const char*>(nl) - data) : size);
+    if (!header.empty() && header.back() == '\r') {
+        header.pop_back();
+    }
+    has_device = false;
+    if (header.compare(0, 10, "Timestamp,") == 0) {
+        size_t start = 10;
+        while (start <= header.size() && columns.size() <= static_cast<size_t>(MAX_COLUMNS)) {
+            size_t comma = header.find(',', start);
+            columns.push_back(header.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+            if (comma == std::string::npos) {
+                break;
+            }
+            start = comma + 1;
+        }
+        if (!columns.empty() && columns.back() == "Device") {
+            columns.pop_back();
+            has_device = true;
+        }
+        if (columns.size() > static_cast<size_t>(MAX_COLUMNS)) {
+            columns.resize(MAX_COLUMNS);
+        }
+    }
+    if (columns.empty()) {
+        columns = {"Gas", "Temp", "S3"};
+    }
+    return columns;
+}
+
+/**
+ * @param arg Command-line argument.
+ * @param name Option name including the leading dashes.
+ * @param value Receives the text after '='.
+ * @return true if arg is "name=value".
+ */
+bool option_value(const std::string& arg, const std::string& name, std::string& value) {
+    if (arg.compare(0, name.size() + 1, name + "=") != 0) {
+        return false;
+    }
+    value = arg.substr(name.size() + 1);
+    return true;
+}
+
+int usage(const char* program) {
+    std::cerr << "Usage: " << program << " <log.csv> [--from=TIME] [--to=TIME] [--last=DURATION]\n"
+              << "       [--group=DURATION|all] [--stats=min,max,avg,count] [--device=NAME] [--threads=N]\n"
+              << "       [--no-index]\n"
+              << "TIME: YYYY-MM-DD[ HH:MM[:SS]] local time; DURATION: N[s|m|h|d]\n";
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        return usage(argv[0]);
+    }
+    std::string log_path;
+    Query query;
+    bool use_index = true;
+    bool show_min = true, show_max = true, show_avg = true, show_count = true;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (option_value(arg, "--from", value)) {
+            if (!parse_time_arg(value, query.from_ms)) {
+                std::cerr << "Invalid --from time: " << value << "\n";
+                return 1;
+            }
+        } else if (option_value(arg, "--to", value)) {
+            if (!parse_time_arg(value, query.to_ms)) {
+                std::cerr << "Invalid --to time: " << value << "\n";
+                return 1;
+            }
+        } else if (option_value(arg, "--last", value)) {
+            int64_t span = parse_duration(value);
+            if (span == 0) {
+                std::cerr << "Invalid --last duration: " << value << "\n";
+                return 1;
+            }
+            query.to_ms = wall_now_ms() + 1;
+            query.from_ms = query.to_ms - span;
+        } else if (option_value(arg, "--group", value)) {
+            query.group_ms = (value == "all") ? 0 : parse_duration(value);
+            if (value != "all" && query.group_ms == 0) {
+                std::cerr << "Invalid --group duration: " << value << "\n";
+                return 1;
+            }
+        } else if (option_value(arg, "--stats", value)) {
+            show_min = value.find("min") != std::string::npos;
+            show_max = value.find("max") != std::string::npos;
+            show_avg = value.find("avg") != std::string::npos;
+            show_count = value.find("count") != std::string::npos;
+        } else if (option_value(arg, "--device", value)) {
+            query.device = value;
+        } else if (option_value(arg, "--threads", value)) {
+            threads = static_cast<unsigned>(std::max(1, std::atoi(value.c_str())));
+        } else if (arg == "--no-index") {
+            use_index = false;
+        } else if (arg.compare(0, 2, "--") == 0 || !log_path.empty()) {
+            return usage(argv[0]);
+        } else {
+            log_path = arg;
+        }
+    }
+    if (log_path.empty()) {
+        return usage(argv[0]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    MappedFile log;
+    if (!log.open(log_path)) {
+        std::cerr << "Failed to open " << log_path << "\n";
+        return 1;
+    }
+    bool has_device = false;
+    std::vector<std::string> columns = read_columns(log, has_device);
+    query.columns = static_cast<int>(columns.size());
+    if (!query.device.empty() && !has_device) {
+        std::cerr << "--device needs a log with a Device column (written by a multi-port reader)\n";
+        return 1;
+    }
+
+    // Indexed segments first, then new segments for whatever was appended since
+    std::vector<Segment> segments;
+    std::string index_path = log_path + ".idx";
+    size_t covered = use_index ? sparse_index::load(index_path, log, segments) : 0;
+    size_t indexed_segments = segments.size();
+    split_segments(log, covered, segments);
+
+    std::vector<size_t> work;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const Segment& s = segments[i];
+        if (!s.indexed || (s.max_ms >= query.from_ms && s.min_ms < query.to_ms)) {
+            work.push_back(i);
+        }
+    }
+
+    threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(work.size(), 1)));
+    std::vector<ScanResult> results(threads);
+    std::atomic<size_t> next(0);
+    auto worker = [&](unsigned id) {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < work.size()) {
+            scan_segment(log.data(), segments[work[i]], query, results[id]);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) {
+        pool.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread& t : pool) {
+        t.join();
+    }
+
+    std::map<int64_t, BucketStats> buckets;
+    uint64_t matched = 0, malformed = 0, bytes = 0;
+    for (const ScanResult& r : results) {
+        for (const auto& entry : r.buckets) {
+            buckets[entry.first].merge(entry.second, query.columns);
+        }
+        matched += r.matched;
+        malformed += r.malformed;
+        bytes += r.bytes;
+    }
+
+    // Every segment now has a known span, so the index can cover all of them
+    if (use_index && segments.size() > indexed_segments &&
+        !sparse_index::save(index_path, log, segments)) {
+        std::cerr << "Warning: could not write index " << index_path << "\n";
+    }
+
+    std::cout << "bucket";
+    if (show_count) {
+        std::cout << ",count";
+    }
+    for (const std::string& name : columns) {
+        if (show_min) std::cout << "," << name << "_min";
+        if (show_max) std::cout << "," << name << "_max";
+        if (show_avg) std::cout << "," << name << "_avg";
+    }
+    std::cout << "\n";
+    char number[32];
+    for (const auto& entry : buckets) {
+        const BucketStats& b = entry.second;
+        std::cout << (query.group_ms > 0 ? format_wall_ms(entry.first) : std::string("all"));
+        if (show_count) {
+            std::cout << "," << b.rows;
+        }
+        for (int c = 0; c < query.columns; ++c) {
+            if (show_min) std::cout << "," << b.min[c];
+            if (show_max) std::cout << "," << b.max[c];
+            if (show_avg) {
+                std::snprintf(number, sizeof(number), "%.2f", static_cast<double>(b.sum[c]) / b.rows);
+                std::cout << "," << number;
+            }
+        }
+        std::cout << "\n";
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::snprintf(number, sizeof(number), "%.1f MB scanned in %.3f s", bytes / 1048576.0, seconds);
+    std::cerr << matched << " rows matched, " << number << " (" << work.size() << " of "
+              << segments.size() << " segments, " << threads << " threads)";
+    if (malformed > 0) {
+        std::cerr << ", " << malformed << " malformed rows skipped";
+    }
+    std::cerr << "\n";
+    return 0;
+}
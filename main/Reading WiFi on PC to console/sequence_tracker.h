@@ -0,0 +1,202 @@
+#ifndef SEQUENCE_TRACKER_H
+#define SEQUENCE_TRACKER_H
+
+#include <cstdint>
+
+#include "metrics.h"
+
+/**
+ * Follows the sequence numbers a sketch stamps on one stream of samples (see
+ * SensorLine::seq) and accounts every sample that did not arrive exactly once
+ * and in order: gaps (samples lost on the wire or dropped by the reader when
+ * it clears a buffer, times out a partial line or loses the port), duplicates
+ * and late, reordered samples.
+ *
+ * The numbering is modular (8-bit in binary frames, 32-bit in text lines), so
+ * a jump forward of up to half the range is a gap; a gap of 128 or more frames
+ * aliases to a smaller one. The last WINDOW numbers are remembered, so a
+ * sample that turns up late is told apart from a duplicate and is taken back
+ * out of the loss count. A sketch numbers from 0 after a reset, so a jump back
+ * to 0, or further back than the window, starts the count over instead of
+ * counting as loss.
+ *
+ * Written by one parser thread; the counters can be read from any thread.
+ */
+class SequenceTracker {
+public:
+    static const uint32_t WINDOW = 64;               // Numbers remembered behind the newest one
+    static const uint32_t MAX_TEXT_JUMP = 1u << 20;  // 32-bit numbering: a larger jump forward is a restart
+
+    enum Outcome : uint8_t {
+        FIRST,      // First numbered sample of the device
+        IN_ORDER,   // The number after the previous one
+        GAP,        // Ahead of the next expected number; missing() samples were skipped
+        LATE,       // Behind the newest number and not seen before: fills part of an earlier gap
+        DUPLICATE,  // Already seen
+        RESTART     // Numbering started over (sketch reset, different width); nothing counted as lost
+    };
+
+    SequenceTracker() : started_(false), bits_(0), last_(0), window_(0), missing_(0), first_missing_(0) {}
+
+    /**
+     * Accounts one numbered sample.
+     * @param seq Sequence number.
+     * @param bits Width of the numbering (8 or 32).
+     * @return How the sample relates to the ones before it.
+     */
+    Outcome observe(uint32_t seq, uint8_t bits) {
+        const uint32_t mask = bits >= 32 ? UINT32_MAX : (1u << bits) - 1;
+        seq &= mask;
+        if (!started_ || bits != bits_) {
+            Outcome outcome = started_ ? RESTART : FIRST;
+            start(seq, bits, outcome);
+            return outcome;
+        }
+        const uint32_t forward = (seq - last_) & mask;
+        if (forward == 0) {
+            duplicates_.add();
+            return DUPLICATE;
+        }
+        if (forward <= mask / 2) {
+            if (bits >= 32 && forward > MAX_TEXT_JUMP) {
+                start(seq, bits, RESTART);
+                return RESTART;
+            }
+            window_ = forward >= WINDOW ? 1 : (window_ << forward) | 1;
+            first_missing_ = (last_ + 1) & mask;
+            last_ = seq;
+            received_.add();
+            missing_ = forward - 1;
+            if (missing_ == 0) {
+                return IN_ORDER;
+            }
+            skipped_.add(missing_);
+            return GAP;
+        }
+        const uint32_t back = (last_ - seq) & mask;
+        if (seq == 0 || back >= WINDOW) {
+            start(seq, bits, RESTART);
+            return RESTART;
+        }
+        const uint64_t bit = uint64_t(1) << back;
+        if (window_ & bit) {
+            duplicates_.add();
+            return DUPLICATE;
+        }
+        window_ |= bit;
+        received_.add();
+        late_.add();
+        return LATE;
+    }
+
+    /**
+     * @return For GAP: number of samples skipped.
+     */
+    uint32_t missing() const {
+        return missing_;
+    }
+
+    /**
+     * @return For GAP: number of the first sample skipped.
+     */
+    uint32_t first_missing() const {
+        return first_missing_;
+    }
+
+    /**
+     * @return Number after the newest sample, i.e. the next one expected.
+     */
+    uint32_t expected() const {
+        return bits_ >= 32 ? last_ + 1 : (last_ + 1) & ((1u << bits_) - 1);
+    }
+
+    /**
+     * @return Distinct samples received (duplicates excluded).
+     */
+    uint64_t received() const {
+        return received_.value();
+    }
+
+    /**
+     * @return Samples skipped by gaps that have not turned up late since.
+     */
+    uint64_t lost() const {
+        uint64_t late = late_.value(); // Before skipped_, so a concurrent reader never sees late > skipped
+        uint64_t skipped = skipped_.value();
+        return skipped > late ? skipped - late : 0;
+    }
+
+    uint64_t late() const {
+        return late_.value();
+    }
+
+    uint64_t duplicates() const {
+        return duplicates_.value();
+    }
+
+    uint64_t restarts() const {
+        return restarts_.value();
+    }
+
+private:
+    void start(uint32_t seq, uint8_t bits, Outcome outcome) {
+        if (outcome == RESTART) {
+            restarts_.add();
+        }
+        started_ = true;
+        bits_ = bits;
+        last_ = seq;
+        window_ = ~uint64_t(0); // Anything before the first sample counts as seen, not late
+        missing_ = 0;
+        received_.add();
+    }
+
+    bool started_;
+    uint8_t bits_;
+    uint32_t last_;         // Newest number
+    uint64_t window_;       // Bit n set: number last_ - n was seen
+    uint32_t missing_;      // Of the last GAP
+    uint32_t first_missing_;
+    Counter received_;
+    Counter skipped_;       // Samples skipped by gaps, including ones that arrived late afterwards
+    Counter late_;
+    Counter duplicates_;
+    Counter restarts_;
+};
+
+/**
+ * Counters of several SequenceTrackers added up (e.g. every stream of a device).
+ */
+struct SequenceStats {
+    uint64_t received = 0;
+    uint64_t lost = 0;
+    uint64_t late = 0;
+    uint64_t duplicates = 0;
+    uint64_t restarts = 0;
+
+    void add(const SequenceTracker& tracker) {
+        received += tracker.received();
+        lost += tracker.lost();
+        late += tracker.late();
+        duplicates += tracker.duplicates();
+        restarts += tracker.restarts();
+    }
+
+    void add(const SequenceStats& other) {
+        received += other.received;
+        lost += other.lost;
+        late += other.late;
+        duplicates += other.duplicates;
+        restarts += other.restarts;
+    }
+
+    /**
+     * @return Lost samples as a fraction of the samples the sketches sent, 0 before any arrived.
+     */
+    double loss_ratio() const {
+        uint64_t sent = received + lost;
+        return sent > 0 ? static_cast<double>(lost) / static_cast<double>(sent) : 0.0;
+    }
+};
+
+#endif // SEQUENCE_TRACKER_H
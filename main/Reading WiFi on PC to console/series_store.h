@@ -0,0 +1,530 @@
+#ifndef SERIES_STORE_H
+#define SERIES_STORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "metrics.h"
+
+/**
+ * One sample read back from a SeriesStore.
+ */
+struct SeriesPoint {
+    int64_t time_ms;  // Milliseconds since the Unix epoch
+    double value;
+};
+
+/**
+ * Recent samples of every sensor, kept in memory for queries without reading
+ * the log back. Samples are compressed as in Facebook's Gorilla time-series
+ * database, which fits the sensors well: they are sampled at a steady rate and
+ * change slowly.
+ *
+ *   time   first sample of a chunk: 64 bits; then the delta-of-delta from the
+ *          previous sample, in ms:  0 -> '0'
+ *                                   [-63, 64]     -> '10'   + 7 bits
+ *                                   [-255, 256]   -> '110'  + 9 bits
+ *                                   [-2047, 2048] -> '1110' + 12 bits
+ *                                   otherwise     -> '1111' + 32 bits
+ *   value  first sample: 64 bits of the double; then the XOR with the previous
+ *          value: 0 -> '0'; inside the previous one's meaningful bits -> '10' +
+ *          those bits; otherwise '11' + 5 bits of leading zeros + 6 bits of
+ *          length - 1 + the meaningful bits
+ *
+ * A steady 10 Hz reading that has not changed costs 2 bits.
+ *
+ * Each series is a list of fixed-size chunks, oldest first, and has a single
+ * writer (the parser thread that owns its device). Appends are lock-free: the
+ * writer stores the bits, then publishes the sample count with release order.
+ * Reads are lock-free too. A reader decodes the published samples of each
+ * chunk and checks the chunk's version afterwards (a seqlock). Chunks are also
+ * numbered within their series, so following a link into a chunk that was
+ * recycled meanwhile is noticed too. Either case makes the read start over.
+ *
+ * Chunks come from a pool sized by the memory budget and are allocated on
+ * first use. When the pool is used up, or a chunk's newest sample is older
+ * than the retention, the oldest closed chunk is recycled. Only taking a new
+ * chunk is serialised, by a mutex the readers never touch. A chunk holds
+ * about 15 000 samples of a steady sensor and a few hundred of a noisy one.
+ */
+class SeriesStore {
+public:
+    static const size_t CHUNK_BYTES = 4096;          // Pool granularity, header included
+    static const uint32_t NONE = UINT32_MAX;         // No chunk
+
+    struct Options {
+        size_t memory_bytes = size_t(64) << 20;      // Chunk pool budget; 0 keeps nothing
+        int64_t retention_ms = 24LL * 3600 * 1000;   // Chunks wholly older than this are recycled first
+    };
+
+    /**
+     * @param series Number of series; ids run from 0 to series - 1.
+     */
+    SeriesStore(size_t series, const Options& options)
+        : retention_ms_(options.retention_ms), series_(series),
+          max_chunks_(options.memory_bytes / sizeof(Chunk)), chunks_(new std::atomic<Chunk*>[max_chunks_]()),
+          allocated_(0) {
+        for (auto& s : series_) {
+            s.reset(new Series());
+        }
+    }
+
+    ~SeriesStore() {
+        for (size_t i = 0; i < allocated_; ++i) {
+            delete chunks_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    SeriesStore(const SeriesStore&) = delete;
+    SeriesStore& operator=(const SeriesStore&) = delete;
+
+    size_t series() const {
+        return series_.size();
+    }
+
+    /**
+     * Writer of the series: appends one sample. Samples should come in time
+     * order; a late one is stored where it arrived.
+     * @return false if the sample was dropped (the budget leaves no chunk to recycle).
+     */
+    bool append(size_t series, int64_t time_ms, double value) {
+        Series& s = *series_[series];
+        Writer& w = s.writer;
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        int64_t delta = time_ms - w.previous_ms;
+        int64_t dod = delta - w.previous_delta;
+        if (w.chunk == NONE || w.position + MAX_SAMPLE_BITS > Chunk::WORDS * 64 || dod < INT32_MIN ||
+            dod > INT32_MAX) {
+            if (!open_chunk(series, time_ms)) {
+                s.dropped.add();
+                return false;
+            }
+            put(w, static_cast<uint64_t>(time_ms), 64);
+            put(w, bits, 64);
+            w.previous_delta = 0;
+        } else {
+            put_dod(w, dod);
+            put_xor(w, bits ^ w.previous_bits);
+            w.previous_delta = delta;
+        }
+        w.previous_ms = time_ms;
+        w.previous_bits = bits;
+
+        Chunk& c = chunk(w.chunk);
+        if ((w.position & 63) != 0) {
+            c.words[w.position >> 6].store(w.word, std::memory_order_relaxed); // The partial last word
+        }
+        if (time_ms < c.min_ms.load(std::memory_order_relaxed)) {
+            c.min_ms.store(time_ms, std::memory_order_relaxed);
+        }
+        if (time_ms > c.max_ms.load(std::memory_order_relaxed)) {
+            c.max_ms.store(time_ms, std::memory_order_relaxed);
+        }
+        c.count.store(c.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        s.samples.add();
+        return true;
+    }
+
+    /**
+     * Any thread: appends the samples of a series from from_ms to to_ms (both
+     * included) to out, in stored order.
+     * @return Number of samples added.
+     */
+    size_t read(size_t series, int64_t from_ms, int64_t to_ms, std::vector<SeriesPoint>& out) const {
+        const size_t start = out.size();
+        const Series& s = *series_[series];
+        std::vector<SeriesPoint> scratch;
+        for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+            out.resize(start);
+            bool consistent = true;
+            uint32_t id = s.oldest.load(std::memory_order_acquire);
+            uint32_t ordinal = 0;
+            for (bool first = true; id != NONE; first = false) {
+                const Chunk& c = chunk(id);
+                const uint32_t version = c.version.load(std::memory_order_acquire);
+                // Still the chunk the link pointed at: the oldest one, or the one after the previous
+                const bool linked = first ? s.oldest.load(std::memory_order_acquire) == id
+                                          : c.ordinal.load(std::memory_order_relaxed) == ordinal + 1;
+                ordinal = c.ordinal.load(std::memory_order_relaxed);
+                const uint32_t count = c.count.load(std::memory_order_acquire);
+                const uint32_t next = c.next.load(std::memory_order_acquire);
+                const bool overlaps = c.max_ms.load(std::memory_order_relaxed) >= from_ms &&
+                                      c.min_ms.load(std::memory_order_relaxed) <= to_ms;
+                const bool ours = linked && c.series.load(std::memory_order_relaxed) == series;
+                scratch.clear();
+                if (ours && overlaps && (version & 1) == 0) {
+                    decode(c, count, scratch);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if ((version & 1) != 0 || !ours || c.version.load(std::memory_order_relaxed) != version) {
+                    consistent = false; // Recycled under us: everything older is gone too
+                    break;
+                }
+                for (const SeriesPoint& p : scratch) {
+                    if (p.time_ms >= from_ms && p.time_ms <= to_ms) {
+                        out.push_back(p);
+                    }
+                }
+                id = next;
+            }
+            if (consistent) {
+                break;
+            }
+            read_retries_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return out.size() - start;
+    }
+
+    /**
+     * @return Samples appended to a series since the start (including evicted ones).
+     */
+    uint64_t samples(size_t series) const {
+        return series_[series]->samples.value();
+    }
+
+    /**
+     * @return Samples a series dropped for lack of a chunk.
+     */
+    uint64_t dropped(size_t series) const {
+        return series_[series]->dropped.value();
+    }
+
+    /**
+     * @return Bytes of chunks allocated so far (the pool never shrinks).
+     */
+    size_t memory_bytes() const {
+        return allocated_count_.load(std::memory_order_relaxed) * sizeof(Chunk);
+    }
+
+    /**
+     * @return Chunks recycled to make room or by the retention.
+     */
+    uint64_t evicted_chunks() const {
+        return evicted_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return Reads that found a chunk recycled under them and started over.
+     */
+    uint64_t read_retries() const {
+        return read_retries_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Worst case per sample: '1111' + 32 bits of time, '11' + 5 + 6 + 64 bits of value
+    static const size_t MAX_SAMPLE_BITS = 4 + 32 + 2 + 5 + 6 + 64;
+    static const int MAX_READ_ATTEMPTS = 8;
+
+    struct Chunk {
+        static const size_t HEADER_BYTES = 64;
+        static const size_t WORDS = (CHUNK_BYTES - HEADER_BYTES) / 8;
+
+        std::atomic<uint32_t> version{0};   // Odd while the chunk is being handed to a series
+        std::atomic<uint32_t> count{0};     // Samples published
+        std::atomic<uint32_t> next{NONE};   // Newer chunk of the same series
+        std::atomic<uint32_t> series{NONE};
+        std::atomic<uint32_t> ordinal{0};   // Chunks the series had taken before this one
+        std::atomic<int64_t> min_ms{0};
+        std::atomic<int64_t> max_ms{0};
+        char padding[HEADER_BYTES - 40];
+        std::atomic<uint64_t> words[WORDS]; // Bit stream, most significant bit first
+    };
+    static_assert(sizeof(Chunk) == CHUNK_BYTES, "chunk header layout");
+
+    struct Writer {                         // Encoder state, writer thread only
+        uint32_t chunk = NONE;
+        size_t position = 0;                // Bits written to the chunk
+        uint64_t word = 0;                  // Word holding bit position, as stored
+        int64_t previous_ms = 0;
+        int64_t previous_delta = 0;
+        uint64_t previous_bits = 0;
+        int leading = -1;                   // Meaningful bits of the previous XOR; -1 before the first
+        int trailing = 0;
+    };
+
+    struct alignas(64) Series {
+        std::atomic<uint32_t> oldest{NONE}; // Changed under allocation_mutex_ only
+        std::atomic<uint32_t> newest{NONE}; // The chunk being written
+        uint32_t opened = 0;                // Chunks taken so far, under allocation_mutex_
+        Counter samples;
+        Counter dropped;
+        Writer writer;
+    };
+
+    Chunk& chunk(uint32_t id) const {
+        return *chunks_[id].load(std::memory_order_acquire);
+    }
+
+    /**
+     * Takes a chunk for a series: a never used one while the budget allows,
+     * else the oldest closed chunk of any series.
+     */
+    bool open_chunk(size_t series, int64_t time_ms) {
+        Series& s = *series_[series];
+        std::lock_guard<std::mutex> lock(allocation_mutex_);
+        uint32_t id = NONE;
+        // Chunks past the retention go first, then never used ones, then the oldest in use
+        if (!order_.empty() && is_closed(order_.front()) &&
+            chunk(order_.front()).max_ms.load(std::memory_order_relaxed) < time_ms - retention_ms_) {
+            id = evict_front();
+        } else if (allocated_ < max_chunks_) {
+            id = static_cast<uint32_t>(allocated_++);
+            chunks_[id].store(new Chunk(), std::memory_order_release);
+            allocated_count_.store(allocated_, std::memory_order_relaxed);
+        } else {
+            for (size_t tries = order_.size(); tries > 0 && id == NONE; --tries) {
+                if (is_closed(order_.front())) {
+                    id = evict_front();
+                } else {
+                    order_.push_back(order_.front()); // Another series is still writing it
+                    order_.pop_front();
+                }
+            }
+        }
+        if (id == NONE) {
+            return false;
+        }
+        Chunk& c = chunk(id);
+        const uint32_t version = c.version.load(std::memory_order_relaxed);
+        c.version.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        c.count.store(0, std::memory_order_relaxed);
+        c.next.store(NONE, std::memory_order_relaxed);
+        c.series.store(static_cast<uint32_t>(series), std::memory_order_relaxed);
+        c.ordinal.store(s.opened++, std::memory_order_relaxed);
+        c.min_ms.store(time_ms, std::memory_order_relaxed);
+        c.max_ms.store(time_ms, std::memory_order_relaxed);
+        c.version.store(version + 2, std::memory_order_release);
+
+        const uint32_t previous = s.newest.load(std::memory_order_relaxed);
+        if (previous != NONE) {
+            chunk(previous).next.store(id, std::memory_order_release);
+        } else {
+            s.oldest.store(id, std::memory_order_release);
+        }
+        s.newest.store(id, std::memory_order_relaxed);
+        order_.push_back(id);
+
+        Writer& w = s.writer;
+        w.chunk = id;
+        w.position = 0;
+        w.word = 0;
+        w.leading = -1;
+        return true;
+    }
+
+    bool is_closed(uint32_t id) const {
+        return series_[chunk(id).series.load(std::memory_order_relaxed)]->newest.load(std::memory_order_relaxed) != id;
+    }
+
+    /**
+     * Unlinks the chunk at the front of order_ from its series (where it is the oldest).
+     */
+    uint32_t evict_front() {
+        const uint32_t id = order_.front();
+        order_.pop_front();
+        Chunk& c = chunk(id);
+        series_[c.series.load(std::memory_order_relaxed)]->oldest.store(c.next.load(std::memory_order_relaxed),
+                                                                         std::memory_order_release);
+        evicted_.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    /**
+     * Appends the low n bits of value (1 <= n <= 64).
+     */
+    void put(Writer& w, uint64_t value, int n) {
+        Chunk& c = chunk(w.chunk);
+        const int used = static_cast<int>(w.position & 63);
+        const int free = 64 - used;
+        if (n < 64) {
+            value &= (uint64_t(1) << n) - 1;
+        }
+        if (n < free) {
+            w.word |= value << (free - n);
+        } else {
+            w.word |= n == free ? value : value >> (n - free);
+            c.words[w.position >> 6].store(w.word, std::memory_order_relaxed);
+            w.word = n == free ? 0 : value << (64 - (n - free));
+        }
+        w.position += static_cast<size_t>(n);
+    }
+
+    void put_dod(Writer& w, int64_t dod) {
+        if (dod == 0) {
+            put(w, 0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            put(w, 0x2, 2);
+            put(w, static_cast<uint64_t>(dod + 63), 7);
+        } else if (dod >= -255 && dod <= 256) {
+            put(w, 0x6, 3);
+            put(w, static_cast<uint64_t>(dod + 255), 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            put(w, 0xE, 4);
+            put(w, static_cast<uint64_t>(dod + 2047), 12);
+        } else {
+            put(w, 0xF, 4);
+            put(w, static_cast<uint32_t>(static_cast<int32_t>(dod)), 32);
+        }
+    }
+
+    void put_xor(Writer& w, uint64_t x) {
+        if (x == 0) {
+            put(w, 0, 1);
+            return;
+        }
+        int leading = count_leading_zeros(x);
+        int trailing = count_trailing_zeros(x);
+        if (leading > 31) {
+            leading = 31;
+        }
+        if (w.leading >= 0 && leading >= w.leading && trailing >= w.trailing) {
+            put(w, 0x2, 2);
+            put(w, x >> w.trailing, 64 - w.leading - w.trailing);
+            return;
+        }
+        const int length = 64 - leading - trailing;
+        put(w, 0x3, 2);
+        put(w, static_cast<uint64_t>(leading), 5);
+        put(w, static_cast<uint64_t>(length - 1), 6);
+        put(w, x >> trailing, length);
+        w.leading = leading;
+        w.trailing = trailing;
+    }
+
+    /**
+     * Reads a chunk's bit stream; words past the published samples may be stale.
+     * Reads past the end (a chunk recycled while it was decoded) return zeros.
+     */
+    class BitReader {
+    public:
+        explicit BitReader(const Chunk& chunk) : words_(chunk.words), position_(0) {}
+
+        /**
+         * @return The next n bits (1 <= n <= 64).
+         */
+        uint64_t get(int n) {
+            const size_t index = position_ >> 6;
+            const int offset = static_cast<int>(position_ & 63);
+            position_ += static_cast<size_t>(n);
+            if (position_ > Chunk::WORDS * 64) {
+                return 0;
+            }
+            uint64_t bits = words_[index].load(std::memory_order_relaxed) << offset;
+            if (offset + n > 64) {
+                bits |= words_[index + 1].load(std::memory_order_relaxed) >> (64 - offset);
+            }
+            return bits >> (64 - n);
+        }
+
+        /**
+         * @return Number of 1 bits before the first 0, reading at most max bits.
+         */
+        int ones(int max) {
+            int n = 0;
+            while (n < max && get(1)) {
+                ++n;
+            }
+            return n;
+        }
+
+    private:
+        const std::atomic<uint64_t>* words_;
+        size_t position_;
+    };
+
+    static void decode(const Chunk& c, uint32_t count, std::vector<SeriesPoint>& out) {
+        if (count == 0) {
+            return;
+        }
+        BitReader in(c);
+        int64_t time_ms = static_cast<int64_t>(in.get(64));
+        uint64_t bits = in.get(64);
+        int64_t delta = 0;
+        int leading = 0, trailing = 0;
+        out.reserve(out.size() + count);
+        out.push_back({time_ms, to_double(bits)});
+        for (uint32_t i = 1; i < count; ++i) {
+            int64_t dod;
+            switch (in.ones(4)) {
+            case 0:
+                dod = 0;
+                break;
+            case 1:
+                dod = static_cast<int64_t>(in.get(7)) - 63;
+                break;
+            case 2:
+                dod = static_cast<int64_t>(in.get(9)) - 255;
+                break;
+            case 3:
+                dod = static_cast<int64_t>(in.get(12)) - 2047;
+                break;
+            default:
+                dod = static_cast<int32_t>(static_cast<uint32_t>(in.get(32)));
+                break;
+            }
+            delta += dod;
+            time_ms += delta;
+            if (in.get(1)) {
+                if (in.get(1)) {
+                    leading = static_cast<int>(in.get(5));
+                    trailing = 64 - leading - (static_cast<int>(in.get(6)) + 1);
+                }
+                bits ^= in.get(64 - leading - trailing) << trailing;
+            }
+            out.push_back({time_ms, to_double(bits)});
+        }
+    }
+
+    static double to_double(uint64_t bits) {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    static int count_leading_zeros(uint64_t x) {
+#if defined(__GNUC__)
+        return __builtin_clzll(x);
+#else
+        int n = 0;
+        while (!(x & (uint64_t(1) << 63))) {
+            x <<= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    static int count_trailing_zeros(uint64_t x) {
+#if defined(__GNUC__)
+        return __builtin_ctzll(x);
+#else
+        int n = 0;
+        while (!(x & 1)) {
+            x >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    const int64_t retention_ms_;
+    std::vector<std::unique_ptr<Series>> series_;
+    const size_t max_chunks_;
+    std::unique_ptr<std::atomic<Chunk*>[]> chunks_; // Pool slots, filled on first use
+    std::mutex allocation_mutex_;
+    size_t allocated_;                              // Under allocation_mutex_
+    std::deque<uint32_t> order_;                    // Chunks in use, in the order they were taken
+    std::atomic<size_t> allocated_count_{0};
+    std::atomic<uint64_t> evicted_{0};
+    mutable std::atomic<uint64_t> read_retries_{0};
+};
+
+#endif // SERIES_STORE_H
@@ -0,0 +1,393 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "metrics.h"
+
+/**
+ * Bounded lock-free single-producer/single-consumer ring.
+ *
+ * One thread writes, one thread reads, and neither takes a lock. Indexes only
+ * grow and are masked into a power-of-two slot array. Each side keeps a cached
+ * copy of the other side's index, so the shared cache lines are only touched
+ * when the ring looks full or empty.
+ *
+ * The producer can fill a slot in place (write_slot() + publish()), which lets the
+ * serial reader read straight into the ring. Rings built with overwrite enabled
+ * also let the producer discard the oldest element when full; the consumer then
+ * claims each element with a compare-exchange after copying it and retries if
+ * the producer got there first, which is why T must be trivially copyable.
+ */
+template <typename T>
+class SpscRing {
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRing elements are copied with plain stores");
+
+public:
+    /**
+     * @param capacity Minimum number of elements; rounded up to a power of two.
+     * @param overwrite Allow discard_oldest() (costs one compare-exchange per pop).
+     */
+    explicit SpscRing(size_t capacity, bool overwrite = false)
+        : slots_(round_up(capacity)), mask_(slots_.size() - 1), overwrite_(overwrite),
+          head_(0), cached_tail_(0), tail_(0), cached_head_(0) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t capacity() const {
+        return slots_.size();
+    }
+
+    /**
+     * @return Elements queued; exact only on a side whose partner is idle.
+     */
+    size_t size() const {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        return head_.load(std::memory_order_acquire) - tail;
+    }
+
+    // Producer side
+
+    /**
+     * @return The next free slot to fill, or nullptr if the ring is full.
+     */
+    T* write_slot() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ >= slots_.size()) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ >= slots_.size()) {
+                return nullptr;
+            }
+        }
+        return &slots_[head & mask_];
+    }
+
+    /**
+     * Hands the slot returned by write_slot() to the consumer.
+     */
+    void publish() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @return false if the ring is full.
+     */
+    bool try_push(const T& item) {
+        T* slot = write_slot();
+        if (!slot) {
+            return false;
+        }
+        *slot = item;
+        publish();
+        return true;
+    }
+
+    /**
+     * Drops the oldest element of a full ring to make room. Overwrite rings only.
+     * @return true if an element was dropped here (false if the consumer took it first).
+     */
+    bool discard_oldest() {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        if (!overwrite_ || head_.load(std::memory_order_relaxed) - tail < slots_.size()) {
+            return false;
+        }
+        if (tail_.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel)) {
+            cached_tail_ = tail + 1;
+            return true;
+        }
+        return false;
+    }
+
+    // Consumer side
+
+    /**
+     * Copies out and removes the oldest element.
+     * @return false if the ring is empty.
+     */
+    bool try_pop(T& out) {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        while (true) {
+            if (static_cast<std::ptrdiff_t>(cached_head_ - tail) <= 0) {
+                cached_head_ = head_.load(std::memory_order_acquire);
+                if (static_cast<std::ptrdiff_t>(cached_head_ - tail) <= 0) {
+                    return false;
+                }
+            }
+            out = slots_[tail & mask_];
+            if (!overwrite_) {
+                tail_.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+            // A failed exchange means the producer discarded this element; out may be torn
+            if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @return The oldest element without removing it, or nullptr if empty.
+     *         Not available on overwrite rings.
+     */
+    const T* front() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (overwrite_) {
+            return nullptr;
+        }
+        if (cached_head_ == tail) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (cached_head_ == tail) {
+                return nullptr;
+            }
+        }
+        return &slots_[tail & mask_];
+    }
+
+    /**
+     * Removes the element returned by front().
+     */
+    void pop_front() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    static size_t round_up(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    std::vector<T> slots_;
+    const size_t mask_;
+    const bool overwrite_;
+    alignas(64) std::atomic<size_t> head_;  // Written by the producer
+    size_t cached_tail_;                    // Producer's last view of tail_
+    alignas(64) std::atomic<size_t> tail_;  // Written by the consumer (and discard_oldest())
+    size_t cached_head_;                    // Consumer's last view of head_
+};
+
+/**
+ * Lets a consumer sleep while its ring is empty without a lock per push: the
+ * producer only takes the mutex when the consumer has said it is about to wait.
+ */
+class Doorbell {
+public:
+    Doorbell() : waiting_(false), rung_(false) {}
+
+    /**
+     * Wakes the consumer if it is waiting. Call after publishing.
+     */
+    void ring() {
+        ring_if([] { return true; });
+    }
+
+    /**
+     * Wakes the consumer if it is waiting and should_wake() holds.
+     */
+    template <typename Pred>
+    void ring_if(Pred should_wake) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_relaxed) && should_wake()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rung_ = true;
+            wake_.notify_one();
+        }
+    }
+
+    /**
+     * Waits until ready() holds, ring() is called or the timeout passes.
+     * @param ready Checked after announcing the wait, so a concurrent publish is not missed.
+     */
+    template <typename Ready>
+    void wait(std::chrono::milliseconds timeout, Ready ready) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) {
+            wake_.wait_for(lock, timeout, [this] { return rung_; });
+        }
+        rung_ = false;
+        waiting_.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> waiting_;
+    bool rung_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+};
+
+/**
+ * What a sink queue does when its consumer falls behind.
+ */
+enum class OverflowPolicy {
+    BLOCK,        // The producer waits for room (the serial read thread never feeds a sink directly)
+    DROP_OLDEST,  // The newest element replaces the oldest queued one
+    SAMPLE        // Past 3/4 full, keep one element in sample_every; drop new elements when full
+};
+
+/**
+ * @param text "block", "drop-oldest" or "sample".
+ * @param policy Receives the policy.
+ * @return false if text names no policy.
+ */
+inline bool parse_overflow_policy(const std::string& text, OverflowPolicy& policy) {
+    if (text == "block") {
+        policy = OverflowPolicy::BLOCK;
+    } else if (text == "drop-oldest") {
+        policy = OverflowPolicy::DROP_OLDEST;
+    } else if (text == "sample") {
+        policy = OverflowPolicy::SAMPLE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Bounded queue in front of one sink: an SpscRing, the sink's overflow policy
+ * and a Doorbell for the sink thread. Elements are built in place with
+ * offer_with() to avoid copying large records twice. A sink fed by several
+ * producer threads gives each its own channel and lets them share one Doorbell.
+ */
+template <typename T>
+class SinkChannel {
+public:
+    /**
+     * @param capacity Queue size in elements (rounded up to a power of two).
+     * @param policy Overflow policy.
+     * @param wake_threshold Wake a waiting consumer once this many elements are queued.
+     * @param sample_every Elements kept per element offered under pressure with SAMPLE.
+     * @param doorbell Doorbell shared with the sink's other channels, or nullptr for a private one.
+     */
+    SinkChannel(size_t capacity, OverflowPolicy policy, size_t wake_threshold = 1, unsigned sample_every = 8,
+                Doorbell* doorbell = nullptr)
+        : ring_(capacity, policy == OverflowPolicy::DROP_OLDEST), policy_(policy),
+          wake_threshold_(wake_threshold > 0 ? wake_threshold : 1), sample_every_(sample_every > 0 ? sample_every : 1),
+          offered_(0), closed_(false), ready_(doorbell ? *doorbell : own_doorbell_) {}
+
+    SinkChannel(const SinkChannel&) = delete;
+    SinkChannel& operator=(const SinkChannel&) = delete;
+
+    /**
+     * Queues an element built by fill(T&) according to the overflow policy.
+     * Producer thread only.
+     * @return false if this or an older element was dropped.
+     */
+    template <typename Fill>
+    bool offer_with(Fill fill) {
+        bool kept = true;
+        T* slot = ring_.write_slot();
+        if (!slot) {
+            switch (policy_) {
+            case OverflowPolicy::BLOCK:
+                for (unsigned spins = 0; !slot && !closed_.load(std::memory_order_relaxed); ++spins) {
+                    if (spins < 64) {
+                        std::this_thread::yield();
+                    } else {
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    }
+                    slot = ring_.write_slot();
+                }
+                break;
+            case OverflowPolicy::DROP_OLDEST:
+                while (!slot) {
+                    if (ring_.discard_oldest()) {
+                        dropped_.add();
+                        kept = false;
+                    }
+                    slot = ring_.write_slot();
+                }
+                break;
+            case OverflowPolicy::SAMPLE:
+                break;
+            }
+        } else if (policy_ == OverflowPolicy::SAMPLE && ring_.size() >= ring_.capacity() / 4 * 3 &&
+                   ++offered_ % sample_every_ != 0) {
+            slot = nullptr;
+        }
+        if (!slot) {
+            dropped_.add();
+            return false;
+        }
+        fill(*slot);
+        ring_.publish();
+        ready_.ring_if([this] { return wake_threshold_ == 1 || ring_.size() >= wake_threshold_; });
+        return kept;
+    }
+
+    bool offer(const T& item) {
+        return offer_with([&item](T& slot) { slot = item; });
+    }
+
+    /**
+     * Consumer thread only.
+     * @return false if nothing is queued.
+     */
+    bool pop(T& out) {
+        return ring_.try_pop(out);
+    }
+
+    /**
+     * Consumer: sleeps until wake_threshold elements are queued, close() or the timeout.
+     * Channels sharing a Doorbell are waited on through the Doorbell instead.
+     */
+    void wait(std::chrono::milliseconds timeout) {
+        ready_.wait(timeout, [this] { return ready(); });
+    }
+
+    /**
+     * Tells the consumer no more elements will come and releases a blocked producer.
+     */
+    void close() {
+        closed_.store(true, std::memory_order_relaxed);
+        ready_.ring();
+    }
+
+    bool closed() const {
+        return closed_.load(std::memory_order_relaxed);
+    }
+
+    size_t size() const {
+        return ring_.size();
+    }
+
+    /**
+     * @return true once closed or wake_threshold elements are queued.
+     */
+    bool ready() const {
+        return closed_.load(std::memory_order_relaxed) || ring_.size() >= wake_threshold_;
+    }
+
+    /**
+     * @return Elements dropped by the overflow policy.
+     */
+    uint64_t dropped() const {
+        return dropped_.value();
+    }
+
+private:
+    SpscRing<T> ring_;
+    const OverflowPolicy policy_;
+    const size_t wake_threshold_;
+    const unsigned sample_every_;
+    unsigned offered_;             // Producer: elements offered under pressure, for SAMPLE
+    Counter dropped_;              // Producer
+    std::atomic<bool> closed_;
+    Doorbell own_doorbell_;
+    Doorbell& ready_;              // own_doorbell_ or the sink's shared one
+};
+
+#endif // SPSC_RING_H
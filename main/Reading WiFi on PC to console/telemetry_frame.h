@@ -0,0 +1,349 @@
+#ifndef TELEMETRY_FRAME_H
+#define TELEMETRY_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary telemetry frames from the sketches to the PC reader, as a compact
+ * alternative to the text lines (Sensor handler prints about 70 bytes per
+ * sample; the same sample is 15 bytes as a frame). Shared by the sketches
+ * (plain C++ for avr-gcc) and the reader.
+ *
+ *   frame   = COBS(payload) 0x00        COBS removes every 0x00 from the payload,
+ *                                       so 0x00 only ever ends a frame
+ *   payload = header seq time value... crc
+ *   header  1 byte: bits 7-6 kind (TelemetryKind), bits 5-0 sensor id
+ *   seq     1 byte: per-sensor sample counter, wraps at 256
+ *   time    3 bytes little endian: device millis() modulo 2^24 (wraps every 4.66 h)
+ *   value   2 bytes little endian int16 per slot of the kind's layout: fixed point
+ *           with the slot's decimals, or TELEMETRY_DISCONNECTED / TELEMETRY_ABSENT
+ *   crc     2 bytes little endian: CRC-16/CCITT-FALSE of header .. last value
+ *
+ * Three values take 13 payload bytes, 15 on the wire. There is no version
+ * field: a future layout must use a different CRC initial value, so that
+ * readers of this one count its frames as corrupt instead of misreading them.
+ */
+
+static const uint8_t TELEMETRY_MAX_VALUES = 3;
+static const size_t TELEMETRY_HEADER_SIZE = 5;                                                    // header, seq, time
+static const size_t TELEMETRY_MAX_PAYLOAD = TELEMETRY_HEADER_SIZE + 2 * TELEMETRY_MAX_VALUES + 2; // 13
+static const size_t TELEMETRY_MAX_FRAME = TELEMETRY_MAX_PAYLOAD + 2; // COBS code byte and delimiter: 15
+static const int16_t TELEMETRY_DISCONNECTED = -32768; // The sketch reported the sensor as not connected
+static const int16_t TELEMETRY_ABSENT = -32767;       // The sketch has no reading for this slot
+static const uint16_t TELEMETRY_CRC_INIT = 0xFFFF;
+
+/**
+ * Which sketch layout a frame carries; the values match LineFormat, so a frame
+ * decodes to the same SensorLine as the text line it replaces.
+ */
+enum TelemetryKind : uint8_t {
+    TELEMETRY_LEGACY = 0,   // Raw ADC gas, temp, s3
+    TELEMETRY_JSON = 1,     // Sensor Stream: temperature, humidity, light
+    TELEMETRY_HANDLER = 2,  // Sensor handler: gas PPM, temperature C, soil moisture %
+    TELEMETRY_DHT = 3       // humidity: humidity %, temperature C
+};
+
+/**
+ * Value slots of one kind.
+ */
+struct TelemetryLayout {
+    uint8_t count;                          // Values in a frame of this kind
+    uint8_t field[TELEMETRY_MAX_VALUES];    // SensorField index of each value
+    uint8_t decimals[TELEMETRY_MAX_VALUES]; // Fixed-point decimals of each value (0..2)
+};
+
+inline const TelemetryLayout& telemetry_layout(uint8_t kind) {
+    static const TelemetryLayout LAYOUTS[4] = {
+        {3, {0, 1, 2}, {0, 0, 0}}, // LEGACY: gas, temp, s3 ADC counts
+        {3, {1, 3, 4}, {2, 2, 0}}, // JSON: temp, humidity, light
+        {3, {0, 1, 5}, {1, 2, 2}}, // HANDLER: gas (up to 3276.7 PPM), temp, soil
+        {2, {3, 1, 0}, {2, 2, 0}}  // DHT: humidity, temp
+    };
+    return LAYOUTS[kind & 3];
+}
+
+/**
+ * CRC-16/CCITT-FALSE (polynomial 0x1021), a nibble at a time: a 32-byte table
+ * is small enough for the sketches and four times faster than bitwise.
+ */
+inline uint16_t telemetry_crc16(const uint8_t* data, size_t length, uint16_t crc = TELEMETRY_CRC_INIT) {
+    static const uint16_t NIBBLE[16] = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+                                        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+    for (size_t i = 0; i < length; ++i) {
+        crc = static_cast<uint16_t>((crc << 4) ^ NIBBLE[(crc >> 12) ^ (data[i] >> 4)]);
+        crc = static_cast<uint16_t>((crc << 4) ^ NIBBLE[(crc >> 12) ^ (data[i] & 0x0F)]);
+    }
+    return crc;
+}
+
+/**
+ * COBS-encodes data; out needs length + length / 254 + 1 bytes. The 0x00
+ * delimiter is not written.
+ * @return Encoded length.
+ */
+inline size_t cobs_encode(const uint8_t* data, size_t length, uint8_t* out) {
+    size_t code_at = 0;
+    size_t o = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] == 0) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+            continue;
+        }
+        out[o++] = data[i];
+        if (++code == 0xFF) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+        }
+    }
+    out[code_at] = code;
+    return o;
+}
+
+/**
+ * Reverses cobs_encode().
+ * @param data Encoded bytes without the delimiter.
+ * @return Decoded length, or 0 if data is not valid COBS or does not fit in capacity.
+ */
+inline size_t cobs_decode(const uint8_t* data, size_t length, uint8_t* out, size_t capacity) {
+    size_t o = 0;
+    size_t i = 0;
+    while (i < length) {
+        uint8_t code = data[i++];
+        if (code == 0 || i + code - 1 > length) {
+            return 0;
+        }
+        for (uint8_t k = 1; k < code; ++k) {
+            if (data[i] == 0 || o == capacity) {
+                return 0;
+            }
+            out[o++] = data[i++];
+        }
+        if (code != 0xFF && i < length) {
+            if (o == capacity) {
+                return 0;
+            }
+            out[o++] = 0;
+        }
+    }
+    return o;
+}
+
+/**
+ * Builds frames for one sensor: set the values of a sample, then finish() it.
+ * Keeps the sequence counter; needs no heap and about 10 bytes of RAM.
+ */
+class TelemetryEncoder {
+public:
+    /**
+     * @param kind TelemetryKind of every frame.
+     * @param sensor_id 0..63, tells sensors sharing a link apart.
+     */
+    TelemetryEncoder(uint8_t kind, uint8_t sensor_id)
+        : header_(static_cast<uint8_t>((kind & 3) << 6 | (sensor_id & 0x3F))), seq_(0) {
+        clear();
+    }
+
+    /**
+     * Sets a slot to a reading, rounded to the slot's decimals and clamped to the int16 range.
+     */
+    void set(uint8_t slot, float value) {
+        if (slot >= TELEMETRY_MAX_VALUES) {
+            return;
+        }
+        static const float SCALE[3] = {1.0f, 10.0f, 100.0f};
+        float scaled = value * SCALE[telemetry_layout(header_ >> 6).decimals[slot]];
+        scaled += scaled < 0 ? -0.5f : 0.5f;
+        if (scaled > 32767.0f) {
+            scaled = 32767.0f;
+        } else if (scaled < -32766.0f) {
+            scaled = -32766.0f;
+        }
+        values_[slot] = static_cast<int16_t>(scaled);
+    }
+
+    /**
+     * Marks a slot as a sensor the sketch found disconnected.
+     */
+    void set_disconnected(uint8_t slot) {
+        if (slot < TELEMETRY_MAX_VALUES) {
+            values_[slot] = TELEMETRY_DISCONNECTED;
+        }
+    }
+
+    /**
+     * Encodes the sample, advances the sequence number and clears the slots.
+     * @param time_ms Device time of the sample, normally millis().
+     * @param out At least TELEMETRY_MAX_FRAME bytes.
+     * @return Bytes to send, including the 0x00 delimiter.
+     */
+    size_t finish(uint32_t time_ms, uint8_t* out) {
+        uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+        size_t n = 0;
+        payload[n++] = header_;
+        payload[n++] = seq_++;
+        payload[n++] = static_cast<uint8_t>(time_ms);
+        payload[n++] = static_cast<uint8_t>(time_ms >> 8);
+        payload[n++] = static_cast<uint8_t>(time_ms >> 16);
+        for (uint8_t slot = 0; slot < telemetry_layout(header_ >> 6).count; ++slot) {
+            uint16_t value = static_cast<uint16_t>(values_[slot]);
+            payload[n++] = static_cast<uint8_t>(value);
+            payload[n++] = static_cast<uint8_t>(value >> 8);
+        }
+        uint16_t crc = telemetry_crc16(payload, n);
+        payload[n++] = static_cast<uint8_t>(crc);
+        payload[n++] = static_cast<uint8_t>(crc >> 8);
+        size_t length = cobs_encode(payload, n, out);
+        out[length++] = 0;
+        clear();
+        return length;
+    }
+
+    /**
+     * @return Sequence number of the next frame.
+     */
+    uint8_t next_seq() const {
+        return seq_;
+    }
+
+    uint8_t kind() const {
+        return header_ >> 6;
+    }
+
+private:
+    void clear() {
+        for (uint8_t slot = 0; slot < TELEMETRY_MAX_VALUES; ++slot) {
+            values_[slot] = TELEMETRY_ABSENT;
+        }
+    }
+
+    uint8_t header_;
+    uint8_t seq_;
+    int16_t values_[TELEMETRY_MAX_VALUES];
+};
+
+/**
+ * One decoded frame.
+ */
+struct TelemetryFrame {
+    uint8_t kind;                        // TelemetryKind
+    uint8_t sensor_id;
+    uint8_t seq;
+    uint32_t time_ms;                    // Device millis() modulo 2^24
+    uint8_t count;                       // Values, from the kind's layout
+    int16_t value[TELEMETRY_MAX_VALUES]; // Fixed point, TELEMETRY_DISCONNECTED or TELEMETRY_ABSENT
+};
+
+/**
+ * Why a frame was rejected.
+ */
+enum TelemetryStatus : uint8_t {
+    TELEMETRY_OK,
+    TELEMETRY_BAD_COBS,     // Not valid COBS, or longer than any frame
+    TELEMETRY_BAD_CRC,      // Bytes changed on the way
+    TELEMETRY_BAD_LENGTH    // CRC matched but the size does not fit the kind
+};
+
+/**
+ * Decodes and checks one frame.
+ * @param data Bytes between two 0x00 delimiters.
+ */
+inline TelemetryStatus decode_telemetry_frame(const uint8_t* data, size_t length, TelemetryFrame& frame) {
+    uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+    size_t n = length <= TELEMETRY_MAX_PAYLOAD + 1 ? cobs_decode(data, length, payload, sizeof(payload)) : 0;
+    if (n < TELEMETRY_HEADER_SIZE + 2) {
+        return TELEMETRY_BAD_COBS;
+    }
+    uint16_t crc = static_cast<uint16_t>(payload[n - 2] | payload[n - 1] << 8);
+    if (telemetry_crc16(payload, n - 2) != crc) {
+        return TELEMETRY_BAD_CRC;
+    }
+    frame.kind = payload[0] >> 6;
+    frame.sensor_id = payload[0] & 0x3F;
+    frame.seq = payload[1];
+    frame.time_ms = static_cast<uint32_t>(payload[2]) | static_cast<uint32_t>(payload[3]) << 8 |
+                    static_cast<uint32_t>(payload[4]) << 16;
+    frame.count = telemetry_layout(frame.kind).count;
+    if (n != TELEMETRY_HEADER_SIZE + 2 * frame.count + 2) {
+        return TELEMETRY_BAD_LENGTH;
+    }
+    for (uint8_t slot = 0; slot < frame.count; ++slot) {
+        frame.value[slot] = static_cast<int16_t>(payload[TELEMETRY_HEADER_SIZE + 2 * slot] |
+                                                 payload[TELEMETRY_HEADER_SIZE + 2 * slot + 1] << 8);
+    }
+    return TELEMETRY_OK;
+}
+
+inline const char* telemetry_status_name(TelemetryStatus status) {
+    switch (status) {
+    case TELEMETRY_OK:
+        return "ok";
+    case TELEMETRY_BAD_COBS:
+        return "bad framing";
+    case TELEMETRY_BAD_CRC:
+        return "bad CRC";
+    default:
+        return "bad length";
+    }
+}
+
+#ifndef ARDUINO
+#include "sensor_parser.h"
+
+static_assert(static_cast<int>(LineFormat::LEGACY) == TELEMETRY_LEGACY && static_cast<int>(LineFormat::JSON) == TELEMETRY_JSON &&
+                  static_cast<int>(LineFormat::HANDLER) == TELEMETRY_HANDLER && static_cast<int>(LineFormat::DHT) == TELEMETRY_DHT,
+              "TelemetryKind values are LineFormat values");
+
+/**
+ * Fills out as parse_sensor_line() would for the text line the frame replaces.
+ */
+inline void telemetry_to_sensor_line(const TelemetryFrame& frame, SensorLine& out) {
+    static const double SCALE[3] = {1.0, 10.0, 100.0};
+    const TelemetryLayout& layout = telemetry_layout(frame.kind);
+    out.format = static_cast<LineFormat>(frame.kind);
+    out.fields = 0;
+    out.errors = 0;
+    out.device_error = false;
+    out.device_warning = false;
+    out.seq_bits = 8;
+    out.seq = frame.seq;
+    out.time_bits = 24;
+    out.device_ms = frame.time_ms;
+    out.sensor_id = frame.sensor_id;
+    for (uint8_t slot = 0; slot < frame.count; ++slot) {
+        uint8_t field = layout.field[slot];
+        if (frame.value[slot] == TELEMETRY_DISCONNECTED) {
+            out.errors |= static_cast<uint8_t>(1 << field);
+        } else if (frame.value[slot] != TELEMETRY_ABSENT) {
+            out.fields |= static_cast<uint8_t>(1 << field);
+            out.value[field] = frame.value[slot] / SCALE[layout.decimals[slot]];
+        }
+    }
+}
+
+/**
+ * Sets the encoder's slots from a parsed line (for the simulator and benchmarks).
+ * @return false if the line is not of the encoder's kind.
+ */
+inline bool telemetry_set_line(TelemetryEncoder& encoder, const SensorLine& line) {
+    if (static_cast<int>(line.format) != encoder.kind()) {
+        return false;
+    }
+    const TelemetryLayout& layout = telemetry_layout(static_cast<uint8_t>(line.format));
+    for (uint8_t slot = 0; slot < layout.count; ++slot) {
+        SensorField field = static_cast<SensorField>(layout.field[slot]);
+        if (line.has(field)) {
+            encoder.set(slot, static_cast<float>(line.value[field]));
+        } else if ((line.errors >> field) & 1) {
+            encoder.set_disconnected(slot);
+        }
+    }
+    return true;
+}
+#endif
+
+#endif // TELEMETRY_FRAME_H
@@ -0,0 +1,128 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+/**
+ * Fills a struct tm with local time without touching the shared std::localtime buffer.
+ * @return false if the time cannot be represented.
+ */
+inline bool to_local_tm(std::time_t seconds, std::tm& out) {
+#ifdef _WIN32
+    return localtime_s(&out, &seconds) == 0;
+#else
+    return localtime_r(&seconds, &out) != nullptr;
+#endif
+}
+
+/**
+ * @return Current wall-clock time in milliseconds since the Unix epoch.
+ */
+inline int64_t wall_clock_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Formats "YYYY-MM-DD HH:MM:SS.mmm" local timestamps into caller buffers.
+ *
+ * The local date, hour and minute are computed with localtime_r() once per minute
+ * and cached; seconds and milliseconds are patched in as digits. Time zone offsets
+ * are whole minutes, so a cached minute prefix is valid for all 60 seconds in it.
+ * One instance per thread: the cache is not synchronised.
+ */
+class TimestampClock {
+public:
+    static const size_t LENGTH = 23;           // Characters in a formatted timestamp
+    static const size_t BUFFER_SIZE = LENGTH + 1;
+
+    TimestampClock() : cached_minute_(INT64_MIN), cache_valid_(false) {
+        std::memset(prefix_, 0, sizeof(prefix_));
+    }
+
+    /**
+     * Formats a given instant.
+     * @param time_ms Milliseconds since the Unix epoch.
+     * @param out Buffer of at least BUFFER_SIZE bytes; receives a NUL-terminated string.
+     * @return Number of characters written (LENGTH), or 0 if the time is invalid
+     *         ("Invalid time" is written instead).
+     */
+    size_t format(int64_t time_ms, char* out) {
+        int64_t minute = floor_div(time_ms, 60000);
+        if (minute != cached_minute_) {
+            refresh(minute);
+        }
+        if (!cache_valid_) {
+            std::memcpy(out, "Invalid time", sizeof("Invalid time"));
+            return 0;
+        }
+        int millis_in_minute = static_cast<int>(time_ms - minute * 60000);
+        int seconds = millis_in_minute / 1000;
+        int millis = millis_in_minute % 1000;
+        std::memcpy(out, prefix_, PREFIX_LENGTH);
+        out[17] = static_cast<char>('0' + seconds / 10);
+        out[18] = static_cast<char>('0' + seconds % 10);
+        out[19] = '.';
+        out[20] = static_cast<char>('0' + millis / 100);
+        out[21] = static_cast<char>('0' + millis / 10 % 10);
+        out[22] = static_cast<char>('0' + millis % 10);
+        out[23] = '\0';
+        return LENGTH;
+    }
+
+    /**
+     * Formats the current time.
+     * @param out Buffer of at least BUFFER_SIZE bytes.
+     * @param time_ms If not null, receives the instant that was formatted.
+     * @return As format().
+     */
+    size_t now(char* out, int64_t* time_ms = nullptr) {
+        int64_t current = wall_clock_ms();
+        if (time_ms) {
+            *time_ms = current;
+        }
+        return format(current, out);
+    }
+
+private:
+    static const size_t PREFIX_LENGTH = 17; // "YYYY-MM-DD HH:MM:"
+
+    static int64_t floor_div(int64_t value, int64_t divisor) {
+        int64_t quotient = value / divisor;
+        return (value % divisor < 0) ? quotient - 1 : quotient;
+    }
+
+    void refresh(int64_t minute) {
+        cached_minute_ = minute;
+        std::tm tm;
+        char text[32];
+        cache_valid_ = to_local_tm(static_cast<std::time_t>(minute * 60), tm) &&
+                       std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:", &tm) == PREFIX_LENGTH;
+        if (cache_valid_) {
+            std::memcpy(prefix_, text, PREFIX_LENGTH);
+        }
+    }
+
+    int64_t cached_minute_;
+    bool cache_valid_;
+    char prefix_[PREFIX_LENGTH + 1];
+};
+
+/**
+ * Gets current timestamp as string for logging (cold paths; the ingest path
+ * formats into its own buffer with TimestampClock).
+ * @return Formatted timestamp (e.g., "2025-06-04 13:00:00.123") or "Invalid time" on failure.
+ */
+inline std::string getTimestamp() {
+    thread_local TimestampClock clock;
+    char buf[TimestampClock::BUFFER_SIZE];
+    clock.now(buf);
+    return buf;
+}
+
+#endif // TIMESTAMP_H
@@ -1,5 +1,7 @@
 #include "sensor_utils.h"
 
+unsigned long sampleSeq = 0; // Numbers the readings sent, so the PC reader can count lost ones
+
 void setup() {
   delay(1000);
   Serial.begin(9600);
@@ -44,6 +46,10 @@ void loop() {
         }
         status &= Serial.print("\"temp\":");
         status &= Serial.print(temperature, DECIMALS);
+        status &= Serial.print(",\"seq\":");
+        status &= Serial.print(sampleSeq++);
+        status &= Serial.print(",\"ms\":");  // When sampling started, so the PC can time the reading
+        status &= Serial.print(currentMillis);
         status &= Serial.println("}");
 
         if (!status) {
@@ -13,6 +13,8 @@ const float MAX_TEMP = 80.0;
 const float MIN_HUM  = 0.0;
 const float MAX_HUM  = 100.0;
 
+unsigned long sampleSeq = 0; // Numbers the readings sent, so the PC reader can count lost ones
+
 void setup() {
   Serial.begin(9600);
   dht.begin();
@@ -46,6 +48,10 @@ void loop() {
 
     Serial.print("Temperature: ");
     Serial.print(temperature);
-    Serial.println(" °C");
+    Serial.print(" °C | Seq: ");
+    Serial.print(sampleSeq++);
+    Serial.print(" | Time: ");  // millis() of the reading, so the PC can time it
+    Serial.print(currentMillis);
+    Serial.println(" ms");
   }
 }
\ No newline at end of file